@@ -8,10 +8,12 @@
 #include "util/asio.h"
 #include "bucket/Bucket.h"
 #include "bucket/BucketApplicator.h"
+#include "bucket/BucketIndex.h"
 #include "bucket/BucketList.h"
 #include "bucket/BucketManager.h"
 #include "bucket/BucketOutputIterator.h"
 #include "bucket/LedgerCmp.h"
+#include "bucket/MergeCheckpoint.h"
 #include "bucket/MergeKey.h"
 #include "crypto/Hex.h"
 #include "crypto/Random.h"
@@ -20,11 +22,14 @@
 #include "lib/util/format.h"
 #include "main/Application.h"
 #include "medida/timer.h"
+#include "util/BlockCompressedFile.h"
 #include "util/Fs.h"
 #include "util/Logging.h"
+#include "util/MappedFile.h"
 #include "util/TmpDir.h"
 #include "util/XDRStream.h"
 #include "xdrpp/message.h"
+#include <algorithm>
 #include <cassert>
 #include <future>
 
@@ -39,7 +44,9 @@ Bucket::Bucket(std::string const& filename, Hash const& hash)
     {
         CLOG(TRACE, "Bucket")
             << "Bucket::Bucket() created, file exists : " << mFilename;
-        mSize = fs::size(filename);
+        mCompressed = blockcompression::isCompressed(filename);
+        mSize = mCompressed ? blockcompression::getStreamSize(filename)
+                            : fs::size(filename);
     }
 }
 
@@ -47,6 +54,10 @@ Bucket::Bucket()
 {
 }
 
+Bucket::~Bucket()
+{
+}
+
 Hash const&
 Bucket::getHash() const
 {
@@ -65,6 +76,12 @@ Bucket::getSize() const
     return mSize;
 }
 
+bool
+Bucket::isCompressed() const
+{
+    return mCompressed;
+}
+
 bool
 Bucket::containsBucketIdentity(BucketEntry const& id) const
 {
@@ -81,6 +98,144 @@ Bucket::containsBucketIdentity(BucketEntry const& id) const
     return false;
 }
 
+void
+Bucket::loadIndex() const
+{
+    // Called with mIndexMutex held
+    if (mIndex)
+    {
+        return;
+    }
+    assert(!mFilename.empty());
+
+    auto indexFilename = BucketIndex::getFilename(mFilename);
+    std::unique_ptr<BucketIndex> index;
+    if (fs::exists(indexFilename))
+    {
+        try
+        {
+            index = BucketIndex::load(indexFilename);
+        }
+        catch (std::exception const& e)
+        {
+            CLOG(WARNING, "Bucket") << "Indexing bucket " << mFilename
+                                    << " again: " << e.what();
+        }
+    }
+    if (!index)
+    {
+        CLOG(DEBUG, "Bucket") << "Indexing bucket " << mFilename;
+        index = BucketIndex::build(mFilename);
+        try
+        {
+            index->save(indexFilename);
+        }
+        catch (std::exception const& e)
+        {
+            // The index is kept in memory, and built again next time
+            CLOG(WARNING, "Bucket") << "Unable to save bucket index "
+                                    << indexFilename << ": " << e.what();
+            std::remove(indexFilename.c_str());
+        }
+    }
+
+    if (mCompressed)
+    {
+        auto compressedFile = std::make_unique<BlockCompressedFile>();
+        compressedFile->open(mFilename);
+        mCompressedFile = std::move(compressedFile);
+    }
+    else
+    {
+        auto mappedFile = std::make_unique<MappedFile>();
+        mappedFile->open(mFilename);
+        mMappedFile = std::move(mappedFile);
+    }
+    mIndex = std::move(index);
+}
+
+BucketIndex const&
+Bucket::getIndex() const
+{
+    std::lock_guard<std::mutex> lock(mIndexMutex);
+    loadIndex();
+    return *mIndex;
+}
+
+bool
+Bucket::getBucketEntry(LedgerKey const& key, BucketEntry& entry) const
+{
+    if (mFilename.empty())
+    {
+        return false;
+    }
+
+    auto const& index = getIndex();
+    size_t pos, end;
+    if (!index.mayContain(key) || !index.findPage(key, pos, end))
+    {
+        return false;
+    }
+
+    // The entries of the page are decoded in place, or from its blocks for
+    // a compressed bucket, until one is not before key. The mappings live as
+    // long as the bucket.
+    end = std::min(end, mSize);
+    char const* page;
+    std::vector<char> pageBuf;
+    if (mCompressed)
+    {
+        pageBuf.resize(end - pos);
+        mCompressedFile->read(pos, pageBuf.size(), pageBuf.data());
+        page = pageBuf.data();
+    }
+    else
+    {
+        page = mMappedFile->data() + pos;
+    }
+
+    LedgerEntryIdCmp cmp;
+    size_t size = end - pos;
+    pos = 0;
+    while (size - pos >= 4)
+    {
+        auto p = reinterpret_cast<uint8_t const*>(page + pos);
+        uint32_t sz = (static_cast<uint32_t>(p[0] & 0x7f) << 24) |
+                      (static_cast<uint32_t>(p[1]) << 16) |
+                      (static_cast<uint32_t>(p[2]) << 8) |
+                      static_cast<uint32_t>(p[3]);
+        if (size - pos - 4 < sz)
+        {
+            throw xdr::xdr_runtime_error("malformed XDR file");
+        }
+        xdr::xdr_get g(page + pos + 4, page + pos + 4 + sz);
+        xdr::xdr_argpack_archive(g, entry);
+        pos += 4 + sz;
+
+        if (entry.type() == METAENTRY)
+        {
+            continue;
+        }
+        bool before;
+        bool after;
+        if (entry.type() == DEADENTRY)
+        {
+            before = cmp(entry.deadEntry(), key);
+            after = cmp(key, entry.deadEntry());
+        }
+        else
+        {
+            before = cmp(entry.liveEntry().data, key);
+            after = cmp(key, entry.liveEntry().data);
+        }
+        if (!before)
+        {
+            return !after;
+        }
+    }
+    return false;
+}
+
 void
 Bucket::apply(Application& app) const
 {
@@ -153,7 +308,8 @@ Bucket::fresh(BucketManager& bucketManager, uint32_t protocolVersion,
 
     MergeCounters mc;
     BucketOutputIterator out(bucketManager.getTmpDir(), true, meta, mc,
-                             doFsync);
+                             doFsync, /*isSegment=*/false,
+                             bucketManager.getBucketCompressionLevel());
     for (auto const& e : entries)
     {
         out.put(e);
@@ -584,23 +740,208 @@ mergeCasesWithEqualKeys(MergeCounters& mc, BucketInputIterator& oi,
     ++ni;
 }
 
+// mergeRange merges the inputs until they are exhausted or, if maxBytes is
+// not 0, until at least maxBytes are written to out, between two keys
+static void
+mergeRange(MergeCounters& mc, BucketInputIterator& oi,
+           BucketInputIterator& ni, BucketOutputIterator& out,
+           std::vector<BucketInputIterator>& shadowIterators,
+           uint32_t protocolVersion, bool keepShadowedLifecycleEntries,
+           size_t maxBytes = 0)
+{
+    BucketEntryIdCmp cmp;
+    while ((oi || ni) && (maxBytes == 0 || out.getBytesPut() < maxBytes))
+    {
+        if (!mergeCasesWithDefaultAcceptance(cmp, mc, oi, ni, out,
+                                             shadowIterators, protocolVersion,
+                                             keepShadowedLifecycleEntries))
+        {
+            mergeCasesWithEqualKeys(mc, oi, ni, out, shadowIterators,
+                                    protocolVersion,
+                                    keepShadowedLifecycleEntries);
+        }
+    }
+}
+
+namespace
+{
+// An entry of a bucket file, and the offset at which it starts
+struct BucketSample
+{
+    size_t offset;
+    BucketEntry entry;
+};
+
+// Where a range of keys starts: its first key, and the offset in each input
+// of the merge (old, new then shadows) of an entry before it
+struct MergeRangeStart
+{
+    BucketEntry key;
+    std::vector<size_t> offsets;
+};
+
+struct MergeRangeOutput
+{
+    MergeCounters mc;
+    std::vector<std::unique_ptr<BucketOutputIterator>> segments;
+};
+
+// Ranges are split on samples of the inputs, which are taken every
+// size / (ranges * MERGE_SAMPLES_PER_RANGE) bytes
+size_t const MERGE_SAMPLES_PER_RANGE = 16;
+
+// sampleBucket returns about count entries of bucket, evenly spaced in its
+// file. Only the sampled entries are decoded.
+std::vector<BucketSample>
+sampleBucket(std::shared_ptr<Bucket> const& bucket, size_t count)
+{
+    std::vector<BucketSample> samples;
+    if (bucket->getFilename().empty())
+    {
+        return samples;
+    }
+
+    XDRInputMappedStream in;
+    in.open(bucket->getFilename());
+    size_t stride = std::max<size_t>(in.size() / count, 1);
+    size_t next = 0;
+    BucketEntry entry;
+    for (;;)
+    {
+        size_t offset = in.pos();
+        if (offset < next)
+        {
+            if (!in.skipOne())
+            {
+                break;
+            }
+        }
+        else if (!in.readOne(entry))
+        {
+            break;
+        }
+        else if (entry.type() != METAENTRY)
+        {
+            samples.emplace_back(BucketSample{offset, entry});
+            next = offset + stride;
+        }
+    }
+    return samples;
+}
+
+// getMergeRangeStarts splits the keys of a merge into up to `ranges` ranges
+// of about the same size in the largest input, and returns where each range
+// but the first starts.
+std::vector<MergeRangeStart>
+getMergeRangeStarts(std::vector<std::shared_ptr<Bucket>> const& inputs,
+                    size_t ranges)
+{
+    std::vector<std::vector<BucketSample>> samples;
+    for (auto const& input : inputs)
+    {
+        samples.emplace_back(
+            sampleBucket(input, ranges * MERGE_SAMPLES_PER_RANGE));
+    }
+    auto const& largest =
+        inputs[0]->getSize() >= inputs[1]->getSize() ? samples[0] : samples[1];
+
+    BucketEntryIdCmp cmp;
+    std::vector<MergeRangeStart> starts;
+    for (size_t i = 1; i < ranges; ++i)
+    {
+        size_t index = i * largest.size() / ranges;
+        if (index == 0 ||
+            (!starts.empty() && !cmp(starts.back().key, largest[index].entry)))
+        {
+            continue;
+        }
+        auto const& key = largest[index].entry;
+
+        MergeRangeStart start{key, {}};
+        for (auto const& inputSamples : samples)
+        {
+            // The last sample before key, or the first entry of the input
+            auto it = std::lower_bound(
+                inputSamples.begin(), inputSamples.end(), key,
+                [&cmp](BucketSample const& sample, BucketEntry const& k) {
+                    return cmp(sample.entry, k);
+                });
+            if (it != inputSamples.begin())
+            {
+                --it;
+            }
+            start.offsets.emplace_back(it == inputSamples.end() ? 0
+                                                                : it->offset);
+        }
+        starts.emplace_back(std::move(start));
+    }
+    return starts;
+}
+
+// positionIterator moves it to the first entry of the range starting at key
+// in its bucket, given the offset of an entry before it (0 for the first
+// entry, where it already is)
+void
+positionIterator(BucketInputIterator& it, size_t offset,
+                 BucketEntry const& key)
+{
+    if (offset != 0)
+    {
+        it.seek(offset);
+    }
+    BucketEntryIdCmp cmp;
+    while (it && cmp(*it, key))
+    {
+        ++it;
+    }
+}
+
+// seekIterator moves it, an iterator of bucket, to the first entry of bucket
+// not before key, locating it with the index of bucket
+void
+seekIterator(BucketInputIterator& it, std::shared_ptr<Bucket> const& bucket,
+             BucketEntry const& key)
+{
+    size_t offset = 0, end;
+    if (it)
+    {
+        bucket->getIndex().findPage(key.type() == DEADENTRY
+                                        ? key.deadEntry()
+                                        : LedgerEntryKey(key.liveEntry()),
+                                    offset, end);
+    }
+    positionIterator(it, offset, key);
+}
+}
+
 std::shared_ptr<Bucket>
 Bucket::merge(BucketManager& bucketManager, uint32_t maxProtocolVersion,
               std::shared_ptr<Bucket> const& oldBucket,
               std::shared_ptr<Bucket> const& newBucket,
               std::vector<std::shared_ptr<Bucket>> const& shadows,
-              bool keepDeadEntries, bool countMergeEvents, bool doFsync)
+              bool keepDeadEntries, bool countMergeEvents, bool doFsync,
+              size_t ranges, IOThrottle* throttle)
 {
     // This is the key operation in the scheme: merging two (read-only)
     // buckets together into a new 3rd bucket, while calculating its hash,
     // in a single pass.
+    //
+    // Large merges can be split into ranges of keys, each merged by its own
+    // thread into a segment of the output. The segments are then appended in
+    // order to the output, which hashes them, so the bucket is the same as
+    // that of a single pass.
+    //
+    // Merges of large inputs are also checkpointed: each range, the first one
+    // included, is merged into segments that are kept with a MergeCheckpoint,
+    // so that a merge of the same inputs after a restart only merges what is
+    // left of each range.
 
     assert(oldBucket);
     assert(newBucket);
 
     MergeCounters mc;
-    BucketInputIterator oi(oldBucket);
-    BucketInputIterator ni(newBucket);
+    BucketInputIterator oi(oldBucket, throttle);
+    BucketInputIterator ni(newBucket, throttle);
     std::vector<BucketInputIterator> shadowIterators(shadows.begin(),
                                                      shadows.end());
 
@@ -614,26 +955,169 @@ Bucket::merge(BucketManager& bucketManager, uint32_t maxProtocolVersion,
     BucketMetadata meta;
     meta.ledgerVersion = protocolVersion;
     BucketOutputIterator out(bucketManager.getTmpDir(), keepDeadEntries, meta,
-                             mc, doFsync);
+                             mc, doFsync, /*isSegment=*/false,
+                             bucketManager.getBucketCompressionLevel(),
+                             throttle);
+    MergeKey mk{maxProtocolVersion, keepDeadEntries, oldBucket, newBucket,
+                shadows};
 
-    BucketEntryIdCmp cmp;
-    while (oi || ni)
+    std::vector<std::shared_ptr<Bucket>> inputs{oldBucket, newBucket};
+    inputs.insert(inputs.end(), shadows.begin(), shadows.end());
+    std::vector<MergeRangeStart> starts;
+    if (ranges > 1)
     {
-        if (!mergeCasesWithDefaultAcceptance(cmp, mc, oi, ni, out,
-                                             shadowIterators, protocolVersion,
-                                             keepShadowedLifecycleEntries))
+        starts = getMergeRangeStarts(inputs, ranges);
+    }
+
+    size_t checkpointBytes = bucketManager.getMergeCheckpointBytes();
+    bool checkpoint =
+        checkpointBytes != 0 &&
+        oldBucket->getSize() + newBucket->getSize() >= checkpointBytes;
+    auto const& checkpointDir = bucketManager.getMergeCheckpointDir();
+    auto getCheckpoint = [&](size_t i) {
+        return std::make_unique<MergeCheckpoint>(
+            checkpointDir, mk, starts.size() + 1, i, doFsync);
+    };
+
+    // mergeRangeSegments merges range i, which ends where range i + 1
+    // starts, into segments
+    auto& tmpDir = bucketManager.getTmpDir();
+    auto mergeRangeSegments = [&](size_t i) {
+        auto const* start = i > 0 ? &starts[i - 1] : nullptr;
+        auto const* end = i < starts.size() ? &starts[i] : nullptr;
+        auto res = std::make_unique<MergeRangeOutput>();
+
+        BucketInputIterator rangeOi(oldBucket, throttle);
+        BucketInputIterator rangeNi(newBucket, throttle);
+        std::vector<BucketInputIterator> rangeShadows(shadows.begin(),
+                                                      shadows.end());
+        if (end)
         {
-            mergeCasesWithEqualKeys(mc, oi, ni, out, shadowIterators,
-                                    protocolVersion,
-                                    keepShadowedLifecycleEntries);
+            rangeOi.setEnd(end->key);
+            rangeNi.setEnd(end->key);
+        }
+
+        std::unique_ptr<MergeCheckpoint> cp;
+        if (checkpoint)
+        {
+            cp = getCheckpoint(i);
+            cp->load();
+            for (size_t j = 0; j < cp->getSegments(); ++j)
+            {
+                res->segments.emplace_back(
+                    std::make_unique<BucketOutputIterator>(
+                        cp->getSegmentFilename(j), res->mc));
+            }
+            if (cp->isDone())
+            {
+                return res;
+            }
+        }
+        if (cp && cp->getSegments() > 0)
+        {
+            CLOG(DEBUG, "Bucket")
+                << "Resuming merge " << mk << " in range " << i << " after "
+                << cp->getSegments() << " segments";
+            auto const& key = cp->getResumeKey();
+            seekIterator(rangeOi, oldBucket, key);
+            seekIterator(rangeNi, newBucket, key);
+            for (size_t j = 0; j < rangeShadows.size(); ++j)
+            {
+                seekIterator(rangeShadows[j], shadows[j], key);
+            }
+        }
+        else if (start)
+        {
+            positionIterator(rangeOi, start->offsets[0], start->key);
+            positionIterator(rangeNi, start->offsets[1], start->key);
+            for (size_t j = 0; j < rangeShadows.size(); ++j)
+            {
+                positionIterator(rangeShadows[j], start->offsets[j + 2],
+                                 start->key);
+            }
+        }
+
+        BucketEntryIdCmp cmp;
+        do
+        {
+            auto segment = std::make_unique<BucketOutputIterator>(
+                tmpDir, keepDeadEntries, meta, res->mc, doFsync && cp,
+                /*isSegment=*/true, /*compressionLevel=*/0, throttle);
+            mergeRange(res->mc, rangeOi, rangeNi, *segment, rangeShadows,
+                       protocolVersion, keepShadowedLifecycleEntries,
+                       cp ? checkpointBytes : 0);
+            if (cp)
+            {
+                // The next segment starts at the least key left
+                segment->closeSegment(
+                    cp->getSegmentFilename(cp->getSegments()), checkpointDir,
+                    doFsync);
+                if (!rangeOi && !rangeNi)
+                {
+                    cp->addSegment(nullptr);
+                }
+                else if (!rangeNi || (rangeOi && cmp(*rangeOi, *rangeNi)))
+                {
+                    cp->addSegment(&*rangeOi);
+                }
+                else
+                {
+                    cp->addSegment(&*rangeNi);
+                }
+            }
+            res->segments.emplace_back(std::move(segment));
+        } while (rangeOi || rangeNi);
+        return res;
+    };
+
+    // Each range but the first is merged by a thread of its own
+    std::vector<std::future<std::unique_ptr<MergeRangeOutput>>> rangeOutputs;
+    for (size_t i = 1; i <= starts.size(); ++i)
+    {
+        rangeOutputs.emplace_back(
+            std::async(std::launch::async, mergeRangeSegments, i));
+    }
+
+    std::unique_ptr<MergeRangeOutput> first;
+    if (checkpoint)
+    {
+        first = mergeRangeSegments(0);
+    }
+    else
+    {
+        if (!starts.empty())
+        {
+            oi.setEnd(starts.front().key);
+            ni.setEnd(starts.front().key);
         }
+        mergeRange(mc, oi, ni, out, shadowIterators, protocolVersion,
+                   keepShadowedLifecycleEntries);
     }
+
+    auto appendRange = [&](MergeRangeOutput& res, size_t i) {
+        for (auto& segment : res.segments)
+        {
+            out.appendSegment(*segment);
+        }
+        mc += res.mc;
+        if (checkpoint)
+        {
+            getCheckpoint(i)->remove();
+        }
+    };
+    if (first)
+    {
+        appendRange(*first, 0);
+    }
+    for (size_t i = 0; i < rangeOutputs.size(); ++i)
+    {
+        appendRange(*rangeOutputs[i].get(), i + 1);
+    }
+
     if (countMergeEvents)
     {
         bucketManager.incrMergeCounters(mc);
     }
-    MergeKey mk{maxProtocolVersion, keepDeadEntries, oldBucket, newBucket,
-                shadows};
     return out.getBucket(bucketManager, &mk);
 }
 
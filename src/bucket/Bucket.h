@@ -9,6 +9,8 @@
 #include "overlay/StellarXDR.h"
 #include "util/NonCopyable.h"
 #include "util/XDRStream.h"
+#include <memory>
+#include <mutex>
 #include <string>
 
 namespace stellar
@@ -26,9 +28,13 @@ namespace stellar
  */
 
 class Application;
+class BlockCompressedFile;
+class BucketIndex;
 class BucketManager;
 class BucketList;
 class Database;
+class IOThrottle;
+class MappedFile;
 
 class Bucket : public std::enable_shared_from_this<Bucket>,
                public NonMovableOrCopyable
@@ -37,6 +43,18 @@ class Bucket : public std::enable_shared_from_this<Bucket>,
     std::string const mFilename;
     Hash const mHash;
     size_t mSize{0};
+    bool mCompressed{false};
+
+    // The index of the bucket and a mapping of its file, to look up keys.
+    // They are loaded on first use and never change after, which does not
+    // change the bucket itself. Only one of the mappings is used, depending
+    // on whether the file is compressed.
+    mutable std::mutex mIndexMutex;
+    mutable std::unique_ptr<BucketIndex const> mIndex;
+    mutable std::unique_ptr<MappedFile> mMappedFile;
+    mutable std::unique_ptr<BlockCompressedFile> mCompressedFile;
+
+    void loadIndex() const;
 
   public:
     // Create an empty bucket. The empty bucket has hash '000000...' and its
@@ -48,14 +66,33 @@ class Bucket : public std::enable_shared_from_this<Bucket>,
     // needs to ensure that.
     Bucket(std::string const& filename, Hash const& hash);
 
+    ~Bucket();
+
     Hash const& getHash() const;
     std::string const& getFilename() const;
+
+    // The size of the XDR stream of the bucket, which is the size of its
+    // file unless the file is compressed
     size_t getSize() const;
 
+    // Whether the file of the bucket is block-compressed (see
+    // BlockCompressedFile). Compressed and plain bucket files hold the same
+    // entries and have the same hash.
+    bool isCompressed() const;
+
     // Returns true if a BucketEntry that is key-wise identical to the given
     // BucketEntry exists in the bucket. For testing.
     bool containsBucketIdentity(BucketEntry const& id) const;
 
+    // Returns the index of the bucket (see BucketIndex), reading it from its
+    // file or building it if needed. Must not be called on the empty bucket.
+    BucketIndex const& getIndex() const;
+
+    // Looks up the entry of key through the index of the bucket: returns true
+    // and sets entry to the LIVEENTRY, INITENTRY or DEADENTRY of key if the
+    // bucket holds one, and false otherwise. Can be called from any thread.
+    bool getBucketEntry(LedgerKey const& key, BucketEntry& entry) const;
+
     // At version 11, we added support for INITENTRY and METAENTRY. Before this
     // we were only supporting LIVEENTRY and DEADENTRY.
     static constexpr uint32_t
@@ -98,12 +135,18 @@ class Bucket : public std::enable_shared_from_this<Bucket>,
     // `maxProtocolVersion` bounds this (for error checking) and should usually
     // be the protocol of the ledger header at which the merge is starting. An
     // exception will be thrown if any provided bucket versions exceed it.
+    //
+    // If `ranges` is more than 1, the keys are split into up to that many
+    // ranges that are merged in parallel, producing the same bucket. If
+    // `throttle` is not null, the inputs are read and the output written at
+    // the rate it allows.
     static std::shared_ptr<Bucket>
     merge(BucketManager& bucketManager, uint32_t maxProtocolVersion,
           std::shared_ptr<Bucket> const& oldBucket,
           std::shared_ptr<Bucket> const& newBucket,
           std::vector<std::shared_ptr<Bucket>> const& shadows,
-          bool keepDeadEntries, bool countMergeEvents, bool doFsync);
+          bool keepDeadEntries, bool countMergeEvents, bool doFsync,
+          size_t ranges = 1, IOThrottle* throttle = nullptr);
 
     static uint32_t getBucketVersion(std::shared_ptr<Bucket> const& bucket);
 };
@@ -5,6 +5,9 @@
 #include "util/asio.h"
 #include "bucket/BucketApplicator.h"
 #include "bucket/Bucket.h"
+#include "bucket/BucketIndex.h"
+#include "bucket/LedgerCmp.h"
+#include "database/Database.h"
 #include "ledger/LedgerTxn.h"
 #include "ledger/LedgerTxnEntry.h"
 #include "lib/util/format.h"
@@ -12,20 +15,60 @@
 #include "util/Logging.h"
 #include "util/types.h"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <future>
+#include <limits>
+#include <mutex>
+
 namespace stellar
 {
 
+namespace
+{
+// Each thread of a parallel apply gets about this many ranges of keys, so
+// that a thread that is done with its ranges can take those of the others
+size_t const RANGES_PER_THREAD = 4;
+
+// The least key of type
+LedgerKey
+firstKeyOfType(LedgerEntryType type)
+{
+    LedgerKey key(type);
+    if (type == OFFER)
+    {
+        key.offer().offerID = std::numeric_limits<int64>::min();
+    }
+    return key;
+}
+}
+
 BucketApplicator::BucketApplicator(Application& app,
                                    uint32_t maxProtocolVersion,
                                    std::shared_ptr<const Bucket> bucket)
-    : mApp(app), mMaxProtocolVersion(maxProtocolVersion), mBucketIter(bucket)
+    : BucketApplicator(app, maxProtocolVersion,
+                       std::vector<std::shared_ptr<Bucket const>>{bucket})
 {
-    auto protocolVersion = mBucketIter.getMetadata().ledgerVersion;
-    if (protocolVersion > mMaxProtocolVersion)
+}
+
+BucketApplicator::BucketApplicator(
+    Application& app, uint32_t maxProtocolVersion,
+    std::vector<std::shared_ptr<Bucket const>> const& buckets,
+    LedgerKey const* begin, LedgerKey const* end)
+    : mApp(app)
+    , mMaxProtocolVersion(maxProtocolVersion)
+    , mBucketIter(buckets, begin, end)
+{
+    for (size_t i = 0; i < buckets.size(); ++i)
     {
-        throw std::runtime_error(fmt::format(
-            "bucket protocol version {} exceeds maxProtocolVersion {}",
-            protocolVersion, mMaxProtocolVersion));
+        auto protocolVersion = mBucketIter.getMetadata(i).ledgerVersion;
+        if (protocolVersion > mMaxProtocolVersion)
+        {
+            throw std::runtime_error(fmt::format(
+                "bucket protocol version {} exceeds maxProtocolVersion {}",
+                protocolVersion, mMaxProtocolVersion));
+        }
     }
 }
 
@@ -52,7 +95,8 @@ BucketApplicator::advance(BucketApplicator::Counters& counters)
     size_t count = 0;
 
     LedgerTxn ltx(mApp.getLedgerTxnRoot(), false);
-    for (; mBucketIter; ++mBucketIter)
+    for (; mBucketIter && count < LEDGER_ENTRY_BATCH_COMMIT_SIZE;
+         ++mBucketIter, ++count)
     {
         BucketEntry const& e = *mBucketIter;
         Bucket::checkProtocolLegality(e, mMaxProtocolVersion);
@@ -70,11 +114,6 @@ BucketApplicator::advance(BucketApplicator::Counters& counters)
             }
             ltx.eraseWithoutLoading(e.deadEntry());
         }
-
-        if ((++count > LEDGER_ENTRY_BATCH_COMMIT_SIZE))
-        {
-            break;
-        }
     }
     ltx.commit();
 
@@ -82,6 +121,147 @@ BucketApplicator::advance(BucketApplicator::Counters& counters)
     return count;
 }
 
+size_t
+BucketApplicator::advance(BucketApplicator::Counters& counters,
+                          LedgerTxnRoot& root, soci::session& session)
+{
+    std::vector<BucketEntry> entries;
+    for (; mBucketIter && entries.size() < LEDGER_ENTRY_BATCH_COMMIT_SIZE;
+         ++mBucketIter)
+    {
+        BucketEntry const& e = *mBucketIter;
+        Bucket::checkProtocolLegality(e, mMaxProtocolVersion);
+        if (e.type() != LIVEENTRY && e.type() != INITENTRY &&
+            e.type() != DEADENTRY)
+        {
+            throw std::runtime_error(
+                "Malformed bucket: unexpected non-INIT/LIVE/DEAD entry.");
+        }
+        counters.mark(e);
+        entries.emplace_back(e);
+    }
+    root.writeBucketEntries(entries, session);
+
+    mCount += entries.size();
+    return entries.size();
+}
+
+std::vector<LedgerKey>
+BucketApplicator::getRangeStarts(
+    std::vector<std::shared_ptr<Bucket const>> const& buckets, size_t ranges)
+{
+    std::vector<LedgerKey> starts;
+    auto const& types = xdr::xdr_traits<LedgerEntryType>::enum_values();
+    for (auto type : types)
+    {
+        auto let = static_cast<LedgerEntryType>(type);
+        if (let != ACCOUNT)
+        {
+            starts.emplace_back(firstKeyOfType(let));
+        }
+    }
+
+    std::shared_ptr<Bucket const> largest;
+    for (auto const& bucket : buckets)
+    {
+        if (!bucket->getFilename().empty() &&
+            (!largest || bucket->getSize() > largest->getSize()))
+        {
+            largest = bucket;
+        }
+    }
+    if (largest)
+    {
+        auto const& index = largest->getIndex();
+        for (size_t i = 1; i < ranges; ++i)
+        {
+            size_t page = i * index.getPageCount() / ranges;
+            if (page > 0)
+            {
+                starts.emplace_back(index.getPageKey(page));
+            }
+        }
+    }
+
+    LedgerEntryIdCmp cmp;
+    std::sort(starts.begin(), starts.end(), cmp);
+    starts.erase(std::unique(starts.begin(), starts.end(),
+                             [&cmp](LedgerKey const& a, LedgerKey const& b) {
+                                 return !cmp(a, b);
+                             }),
+                 starts.end());
+    return starts;
+}
+
+void
+BucketApplicator::applyInParallel(
+    Application& app, LedgerTxnRoot& root, uint32_t maxProtocolVersion,
+    std::vector<std::shared_ptr<Bucket const>> const& buckets, size_t threads,
+    Counters& counters)
+{
+    auto starts = getRangeStarts(buckets, threads * RANGES_PER_THREAD);
+    size_t ranges = starts.size() + 1;
+    auto& pool = app.getDatabase().getPool();
+    CLOG(INFO, "Bucket") << "Applying " << buckets.size() << " buckets in "
+                         << ranges << " ranges on " << threads << " threads";
+
+    std::atomic<size_t> nextRange{0};
+    std::mutex countersMutex;
+    auto applyRanges = [&]() {
+        Counters threadCounters(std::chrono::system_clock::now());
+        try
+        {
+            soci::session session(pool);
+            for (size_t i = nextRange++; i < ranges; i = nextRange++)
+            {
+                auto begin = i > 0 ? &starts[i - 1] : nullptr;
+                auto end = i < starts.size() ? &starts[i] : nullptr;
+                BucketApplicator applicator(app, maxProtocolVersion, buckets,
+                                            begin, end);
+                while (applicator)
+                {
+                    applicator.advance(threadCounters, root, session);
+                }
+            }
+        }
+        catch (...)
+        {
+            // Leave no range to the other threads
+            nextRange = ranges;
+            throw;
+        }
+        std::lock_guard<std::mutex> lock(countersMutex);
+        counters += threadCounters;
+    };
+
+    std::vector<std::future<void>> workers;
+    for (size_t i = 0; i < std::min(threads, ranges); ++i)
+    {
+        workers.emplace_back(std::async(std::launch::async, applyRanges));
+    }
+    // Every thread is waited for before rethrowing, since they use the
+    // locals of this function
+    std::exception_ptr error;
+    for (auto& worker : workers)
+    {
+        try
+        {
+            worker.get();
+        }
+        catch (...)
+        {
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
 BucketApplicator::Counters::Counters(VirtualClock::time_point now)
 {
     reset(now);
@@ -101,6 +281,20 @@ BucketApplicator::Counters::reset(VirtualClock::time_point now)
     mDataDelete = 0;
 }
 
+BucketApplicator::Counters&
+BucketApplicator::Counters::operator+=(Counters const& other)
+{
+    mAccountUpsert += other.mAccountUpsert;
+    mAccountDelete += other.mAccountDelete;
+    mTrustLineUpsert += other.mTrustLineUpsert;
+    mTrustLineDelete += other.mTrustLineDelete;
+    mOfferUpsert += other.mOfferUpsert;
+    mOfferDelete += other.mOfferDelete;
+    mDataUpsert += other.mDataUpsert;
+    mDataDelete += other.mDataDelete;
+    return *this;
+}
+
 void
 BucketApplicator::Counters::getRates(VirtualClock::time_point now,
                                      uint64_t& au_sec, uint64_t& ad_sec,
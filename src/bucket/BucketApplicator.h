@@ -5,25 +5,38 @@
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
 #include "bucket/Bucket.h"
-#include "bucket/BucketInputIterator.h"
+#include "bucket/MergedBucketIterator.h"
 #include "util/Timer.h"
 #include "util/XDRStream.h"
 #include <memory>
+#include <vector>
+
+namespace soci
+{
+class session;
+}
 
 namespace stellar
 {
 
 class Application;
+class LedgerTxnRoot;
 
 // Class that represents a single apply-bucket-to-database operation in
 // progress. Used during history catchup to split up the task of applying
 // bucket into scheduler-friendly, bite-sized pieces.
+//
+// Several buckets can be applied at once, in which case each key is written
+// once, with its entry in the newest bucket that holds it, rather than once
+// per bucket (see MergedBucketIterator). They can also be applied in
+// parallel, by threads that each apply a range of keys through a database
+// session of their own (see applyInParallel).
 
 class BucketApplicator
 {
     Application& mApp;
     uint32_t mMaxProtocolVersion;
-    BucketInputIterator mBucketIter;
+    MergedBucketIterator mBucketIter;
     size_t mCount{0};
 
   public:
@@ -51,6 +64,8 @@ class BucketApplicator
         Counters(VirtualClock::time_point now);
         void reset(VirtualClock::time_point now);
         void mark(BucketEntry const& e);
+        // Adds the counts of other, which started at the same time or later
+        Counters& operator+=(Counters const& other);
         void logInfo(std::string const& bucketName, uint32_t level,
                      VirtualClock::time_point now);
         void logDebug(std::string const& bucketName, uint32_t level,
@@ -59,10 +74,45 @@ class BucketApplicator
 
     BucketApplicator(Application& app, uint32_t maxProtocolVersion,
                      std::shared_ptr<const Bucket> bucket);
+
+    // Applies buckets, ordered from the newest to the oldest, from the first
+    // key not less than *begin to the last key less than *end, where a null
+    // bound does not limit the keys
+    BucketApplicator(Application& app, uint32_t maxProtocolVersion,
+                     std::vector<std::shared_ptr<Bucket const>> const& buckets,
+                     LedgerKey const* begin = nullptr,
+                     LedgerKey const* end = nullptr);
+
     operator bool() const;
+
+    // advance applies a batch of entries through a LedgerTxn on the
+    // LedgerTxnRoot of the application
     size_t advance(Counters& counters);
 
+    // advance applies a batch of entries through session, with
+    // LedgerTxnRoot::writeBucketEntries
+    size_t advance(Counters& counters, LedgerTxnRoot& root,
+                   soci::session& session);
+
     size_t pos();
     size_t size() const;
+
+    // getRangeStarts splits the keys of buckets into ranges that can be
+    // applied in parallel, and returns where each range but the first starts.
+    // Every LedgerEntryType gets ranges of its own, and the keys are split in
+    // up to `ranges` ranges of about the same size in the largest bucket.
+    static std::vector<LedgerKey> getRangeStarts(
+        std::vector<std::shared_ptr<Bucket const>> const& buckets,
+        size_t ranges);
+
+    // applyInParallel applies buckets, ordered from the newest to the
+    // oldest, on `threads` threads, each of which applies ranges of keys
+    // through a session from the connection pool of the database. It blocks
+    // until they are all applied, and rethrows the first error of a thread.
+    // The requirements of LedgerTxnRoot::writeBucketEntries apply.
+    static void applyInParallel(
+        Application& app, LedgerTxnRoot& root, uint32_t maxProtocolVersion,
+        std::vector<std::shared_ptr<Bucket const>> const& buckets,
+        size_t threads, Counters& counters);
 };
 }
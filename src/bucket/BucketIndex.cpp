@@ -0,0 +1,228 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "bucket/BucketIndex.h"
+#include "bucket/LedgerCmp.h"
+#include "crypto/Random.h"
+#include "crypto/XDRHasher.h"
+#include "util/XDRStream.h"
+#include "util/siphash.h"
+#include "util/types.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace stellar
+{
+
+namespace
+{
+uint32_t const INDEX_VERSION = 1;
+
+// A Bloom filter with 10 bits and 7 hashes per key has about 1% of false
+// positives
+size_t const BLOOM_BITS_PER_KEY = 10;
+uint32_t const BLOOM_HASHES = 7;
+
+struct KeyHasher : XDRHasher<KeyHasher>
+{
+    SipHash24 state;
+    explicit KeyHasher(Hash const& key) : state(key.data())
+    {
+    }
+    void
+    hashBytes(unsigned char const* bytes, size_t len)
+    {
+        state.update(bytes, len);
+    }
+};
+
+LedgerKey
+getBucketEntryKey(BucketEntry const& entry)
+{
+    return entry.type() == DEADENTRY ? entry.deadEntry()
+                                     : LedgerEntryKey(entry.liveEntry());
+}
+
+// The bits of the Bloom filter set for a key are derived from its hash by
+// double hashing
+template <typename F>
+void
+forEachBloomBit(uint64_t hash, uint32_t hashes, size_t bits, F f)
+{
+    uint64_t h1 = hash & 0xffffffff;
+    uint64_t h2 = (hash >> 32) | 1;
+    for (uint32_t i = 0; i < hashes; ++i)
+    {
+        f((h1 + i * h2) % bits);
+    }
+}
+}
+
+Hash const&
+BucketIndex::getProcessHashKey()
+{
+    static Hash const key = []() {
+        Hash k;
+        auto bytes = randomBytes(k.size());
+        std::copy(bytes.begin(), bytes.end(), k.begin());
+        return k;
+    }();
+    return key;
+}
+
+uint64_t
+BucketIndex::hashKey(Hash const& hashKey, LedgerKey const& key)
+{
+    KeyHasher hasher(hashKey);
+    xdr::archive(hasher, key);
+    hasher.flush();
+    return hasher.state.digest();
+}
+
+std::string
+BucketIndex::getFilename(std::string const& bucketFilename)
+{
+    return bucketFilename + ".index";
+}
+
+std::unique_ptr<BucketIndex>
+BucketIndex::build(std::string const& bucketFilename)
+{
+    Builder builder;
+    XDRInputMappedStream in;
+    in.open(bucketFilename);
+    BucketEntry entry;
+    for (size_t offset = in.pos(); in.readOne(entry); offset = in.pos())
+    {
+        builder.add(entry, offset);
+    }
+    return builder.finish();
+}
+
+std::unique_ptr<BucketIndex>
+BucketIndex::load(std::string const& filename)
+{
+    auto index = std::make_unique<BucketIndex>();
+    XDRInputFileStream in;
+    in.open(filename);
+    uint32_t version = 0;
+    if (!in.readOne(version) || version != INDEX_VERSION ||
+        !in.readOne(index->mHashKey) || !in.readOne(index->mBloomHashes) ||
+        !in.readOne(index->mBloomBits) || !in.readOne(index->mPageOffsets))
+    {
+        throw std::runtime_error("Unable to read bucket index " + filename);
+    }
+    index->mPageKeys.resize(index->mPageOffsets.size());
+    for (auto& key : index->mPageKeys)
+    {
+        if (!in.readOne(key))
+        {
+            throw std::runtime_error("Truncated bucket index " + filename);
+        }
+    }
+    return index;
+}
+
+void
+BucketIndex::save(std::string const& filename) const
+{
+    XDROutputFileStream out(/*fsyncOnClose=*/false);
+    out.open(filename);
+    out.writeOne(INDEX_VERSION);
+    out.writeOne(mHashKey);
+    out.writeOne(mBloomHashes);
+    out.writeOne(mBloomBits);
+    out.writeOne(mPageOffsets);
+    for (auto const& key : mPageKeys)
+    {
+        out.writeOne(key);
+    }
+    out.close();
+}
+
+bool
+BucketIndex::mayContain(LedgerKey const& key) const
+{
+    if (mBloomBits.empty())
+    {
+        return false;
+    }
+    auto const& bits = mBloomBits;
+    bool res = true;
+    forEachBloomBit(hashKey(mHashKey, key), mBloomHashes, bits.size() * 64,
+                    [&](uint64_t bit) {
+                        res = res && ((bits[bit / 64] >> (bit % 64)) & 1);
+                    });
+    return res;
+}
+
+bool
+BucketIndex::findPage(LedgerKey const& key, size_t& begin, size_t& end) const
+{
+    // The page of key is the last one starting at or before it
+    auto next = std::upper_bound(mPageKeys.begin(), mPageKeys.end(), key,
+                                 LedgerEntryIdCmp{});
+    if (next == mPageKeys.begin())
+    {
+        return false;
+    }
+    size_t page = next - mPageKeys.begin() - 1;
+    begin = mPageOffsets[page];
+    end = page + 1 < mPageOffsets.size() ? mPageOffsets[page + 1]
+                                         : std::numeric_limits<size_t>::max();
+    return true;
+}
+
+void
+BucketIndex::Builder::add(BucketEntry const& entry, uint64_t offset)
+{
+    if (entry.type() == METAENTRY)
+    {
+        return;
+    }
+    auto key = getBucketEntryKey(entry);
+    mHashes.emplace_back(hashKey(getProcessHashKey(), key));
+    if (mPageOffsets.empty() || offset >= mPageOffsets.back() + PAGE_SIZE)
+    {
+        mPageOffsets.emplace_back(offset);
+        mPageKeys.emplace_back(std::move(key));
+    }
+}
+
+void
+BucketIndex::Builder::append(Builder&& other, uint64_t base)
+{
+    mHashes.insert(mHashes.end(), other.mHashes.begin(), other.mHashes.end());
+    for (auto offset : other.mPageOffsets)
+    {
+        mPageOffsets.emplace_back(base + offset);
+    }
+    std::move(other.mPageKeys.begin(), other.mPageKeys.end(),
+              std::back_inserter(mPageKeys));
+    other = Builder();
+}
+
+std::unique_ptr<BucketIndex>
+BucketIndex::Builder::finish()
+{
+    auto index = std::make_unique<BucketIndex>();
+    index->mHashKey = getProcessHashKey();
+    index->mBloomHashes = BLOOM_HASHES;
+    size_t words = (mHashes.size() * BLOOM_BITS_PER_KEY + 63) / 64;
+    index->mBloomBits.resize(std::max<size_t>(words, 1));
+    auto& bits = index->mBloomBits;
+    for (auto hash : mHashes)
+    {
+        forEachBloomBit(hash, BLOOM_HASHES, bits.size() * 64,
+                        [&](uint64_t bit) {
+                            bits[bit / 64] |= uint64_t(1) << (bit % 64);
+                        });
+    }
+    index->mPageOffsets.assign(mPageOffsets.begin(), mPageOffsets.end());
+    index->mPageKeys = std::move(mPageKeys);
+    *this = Builder();
+    return index;
+}
+}
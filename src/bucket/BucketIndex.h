@@ -0,0 +1,101 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "overlay/StellarXDR.h"
+#include "util/NonCopyable.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace stellar
+{
+
+// BucketIndex finds the entry of a key in a bucket without scanning it. It
+// holds a sparse index of the bucket, the first key of every page of about
+// PAGE_SIZE bytes and the offset of the page, so that finding a key means
+// decoding the entries of a single page, and a Bloom filter of the keys of the
+// bucket, so that most buckets that do not hold a key are not read at all.
+//
+// The index of a bucket is built while the bucket is written and saved next
+// to it, in a file named by getFilename, which is a cache: a bucket whose
+// index file is missing or unreadable is indexed again by scanning it. The
+// Bloom filter hashes keys with a random key, chosen once per process and
+// saved with the index, so that keys cannot be crafted to defeat it.
+class BucketIndex : public NonMovableOrCopyable
+{
+  public:
+    static size_t const PAGE_SIZE = 16 * 1024;
+
+    class Builder;
+
+  private:
+    Hash mHashKey;
+    uint32_t mBloomHashes{0};
+    xdr::xvector<uint64_t> mBloomBits;
+    xdr::xvector<uint64_t> mPageOffsets;
+    std::vector<LedgerKey> mPageKeys;
+
+    static Hash const& getProcessHashKey();
+    static uint64_t hashKey(Hash const& hashKey, LedgerKey const& key);
+
+  public:
+    BucketIndex() = default;
+
+    static std::string getFilename(std::string const& bucketFilename);
+
+    // build indexes the bucket in bucketFilename by scanning it
+    static std::unique_ptr<BucketIndex>
+    build(std::string const& bucketFilename);
+
+    // load reads an index saved by save, and throws if it is not readable
+    static std::unique_ptr<BucketIndex> load(std::string const& filename);
+
+    // save writes the index to filename. It is not synced to disk.
+    void save(std::string const& filename) const;
+
+    // mayContain is false if the bucket does not hold key, and true if it
+    // probably does
+    bool mayContain(LedgerKey const& key) const;
+
+    // findPage returns false if no page can hold key, and the offsets of the
+    // page that holds key if it is in the bucket otherwise. end is the
+    // largest size_t for the last page.
+    bool findPage(LedgerKey const& key, size_t& begin, size_t& end) const;
+
+    size_t
+    getPageCount() const
+    {
+        return mPageOffsets.size();
+    }
+
+    // The first key of page
+    LedgerKey const&
+    getPageKey(size_t page) const
+    {
+        return mPageKeys.at(page);
+    }
+};
+
+// BucketIndex::Builder indexes the entries of a bucket while they are
+// written, in order, with their offsets in the bucket
+class BucketIndex::Builder
+{
+    // The hashes of all the keys, for the Bloom filter
+    std::vector<uint64_t> mHashes;
+    std::vector<uint64_t> mPageOffsets;
+    std::vector<LedgerKey> mPageKeys;
+
+  public:
+    void add(BucketEntry const& entry, uint64_t offset);
+
+    // append adds the entries indexed by other, whose offsets are relative
+    // to base, after the entries added so far
+    void append(Builder&& other, uint64_t base);
+
+    std::unique_ptr<BucketIndex> finish();
+};
+}
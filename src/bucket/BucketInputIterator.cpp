@@ -42,6 +42,10 @@ BucketInputIterator::loadEntry()
             {
                 Bucket::checkProtocolLegality(mEntry, mMetadata.ledgerVersion);
             }
+            if (mEnd && !BucketEntryIdCmp{}(mEntry, *mEnd))
+            {
+                mEntryPtr = nullptr;
+            }
         }
     }
     else
@@ -84,7 +88,8 @@ BucketInputIterator::getMetadata() const
     return mMetadata;
 }
 
-BucketInputIterator::BucketInputIterator(std::shared_ptr<Bucket const> bucket)
+BucketInputIterator::BucketInputIterator(std::shared_ptr<Bucket const> bucket,
+                                         IOThrottle* throttle)
     : mBucket(bucket), mEntryPtr(nullptr), mSeenMetadata(false)
 {
     // In absence of metadata, we treat every bucket as though it is from ledger
@@ -98,6 +103,7 @@ BucketInputIterator::BucketInputIterator(std::shared_ptr<Bucket const> bucket)
     {
         CLOG(TRACE, "Bucket") << "BucketInputIterator opening file to read: "
                               << mBucket->getFilename();
+        mIn.setThrottle(throttle);
         mIn.open(mBucket->getFilename());
         loadEntry();
     }
@@ -110,7 +116,7 @@ BucketInputIterator::~BucketInputIterator()
 
 BucketInputIterator& BucketInputIterator::operator++()
 {
-    if (mIn)
+    if (mIn && mEntryPtr)
     {
         loadEntry();
     }
@@ -120,4 +126,22 @@ BucketInputIterator& BucketInputIterator::operator++()
     }
     return *this;
 }
+
+void
+BucketInputIterator::seek(size_t offset)
+{
+    assert(!mBucket->getFilename().empty());
+    mIn.seek(offset);
+    loadEntry();
+}
+
+void
+BucketInputIterator::setEnd(BucketEntry const& end)
+{
+    mEnd = std::make_unique<BucketEntry>(end);
+    if (mEntryPtr && !BucketEntryIdCmp{}(*mEntryPtr, *mEnd))
+    {
+        mEntryPtr = nullptr;
+    }
+}
 }
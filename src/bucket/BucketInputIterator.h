@@ -14,6 +14,7 @@ namespace stellar
 {
 
 class Bucket;
+class IOThrottle;
 
 // Helper class that reads through the entries in a bucket.
 class BucketInputIterator
@@ -24,11 +25,12 @@ class BucketInputIterator
     // pointer. If
     // non-null, it points to mEntry.
     BucketEntry const* mEntryPtr{nullptr};
-    XDRInputFileStream mIn;
+    XDRInputMappedStream mIn;
     BucketEntry mEntry;
     bool mSeenMetadata{false};
     bool mSeenOtherEntries{false};
     BucketMetadata mMetadata;
+    std::unique_ptr<BucketEntry> mEnd;
     void loadEntry();
 
   public:
@@ -46,12 +48,22 @@ class BucketInputIterator
 
     BucketEntry const& operator*();
 
-    BucketInputIterator(std::shared_ptr<Bucket const> bucket);
+    // If throttle is not null, the bytes read are acquired from it
+    BucketInputIterator(std::shared_ptr<Bucket const> bucket,
+                        IOThrottle* throttle = nullptr);
 
     ~BucketInputIterator();
 
     BucketInputIterator& operator++();
 
+    // seek moves the iterator to the entry starting at offset in the bucket
+    // file, which must not be the METAENTRY.
+    void seek(size_t offset);
+
+    // setEnd makes the iterator end before the first entry that is not less
+    // than end, so that it only reads a range of keys of the bucket.
+    void setEnd(BucketEntry const& end);
+
     size_t pos();
     size_t size() const;
 };
@@ -6,15 +6,18 @@
 #include "bucket/Bucket.h"
 #include "bucket/BucketManager.h"
 #include "bucket/LedgerCmp.h"
+#include "bucket/MergeScheduler.h"
 #include "crypto/Hex.h"
 #include "crypto/Random.h"
 #include "crypto/SHA.h"
 #include "main/Application.h"
+#include "util/IOThrottle.h"
 #include "util/Logging.h"
 #include "util/XDRStream.h"
 #include "util/format.h"
 #include "util/types.h"
 #include <cassert>
+#include <chrono>
 
 namespace stellar
 {
@@ -160,7 +163,8 @@ BucketLevel::prepare(Application& app, uint32_t currLedger,
             ? std::vector<std::shared_ptr<Bucket>>()
             : shadows;
     mNextCurr = FutureBucket(app, curr, snap, shadowsBasedOnProtocol,
-                             currLedgerProtocol, countMergeEvents, mLevel);
+                             currLedgerProtocol, countMergeEvents, mLevel,
+                             currLedger);
     assert(mNextCurr.isMerging());
 }
 
@@ -364,6 +368,28 @@ BucketList::getHash() const
     return hsh->finish();
 }
 
+std::shared_ptr<LedgerEntry>
+BucketList::getLedgerEntry(LedgerKey const& key) const
+{
+    // The first entry of key found from the newest bucket is the current one
+    BucketEntry entry;
+    for (auto const& lev : mLevels)
+    {
+        for (auto const& b : {lev.getCurr(), lev.getSnap()})
+        {
+            if (b->getBucketEntry(key, entry))
+            {
+                if (entry.type() == DEADENTRY)
+                {
+                    return nullptr;
+                }
+                return std::make_shared<LedgerEntry>(entry.liveEntry());
+            }
+        }
+    }
+    return nullptr;
+}
+
 // levelShouldSpill is the set of boundaries at which each level should spill,
 // it's not-entirely obvious which numbers these are by inspection, so we list
 // the first 3 values it's true on each level here for reference:
@@ -434,6 +460,27 @@ BucketList::futuresAllResolved() const
         [](BucketLevel const& bl) { return !bl.getNext().isMerging(); });
 }
 
+void
+BucketList::commitLevel(Application& app, uint32_t i)
+{
+    auto& next = mLevels[i].getNext();
+    if (!next.isMerging() || next.mergeComplete())
+    {
+        mLevels[i].commit();
+        return;
+    }
+    // The ledger close waits for the merge, which must not be throttled or
+    // wait behind other merges
+    auto start = std::chrono::steady_clock::now();
+    app.getBucketManager().getMergeScheduler().promote(i);
+    {
+        IOThrottle::Urgent urgent(app.getBucketManager().getIOThrottle());
+        mLevels[i].commit();
+    }
+    app.getBucketManager().getMergeScheduler().mergeWasLate(
+        i, std::chrono::steady_clock::now() - start);
+}
+
 void
 BucketList::addBatch(Application& app, uint32_t currLedger,
                      uint32_t currLedgerProtocol,
@@ -529,7 +576,7 @@ BucketList::addBatch(Application& app, uint32_t currLedger,
             //           << " element snap from level " << i-1
             //           << " to level " << i;
 
-            mLevels[i].commit();
+            commitLevel(app, i);
             mLevels[i].prepare(app, currLedger, currLedgerProtocol, snap,
                                shadows, /*countMergeEvents=*/true);
         }
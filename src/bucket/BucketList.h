@@ -350,6 +350,9 @@ class BucketList
     static uint32_t mask(uint32_t v, uint32_t m);
     std::vector<BucketLevel> mLevels;
 
+    // Commits level `i`, recording its merge as late if it is not done yet.
+    void commitLevel(Application& app, uint32_t i);
+
   public:
     // Number of bucket levels in the bucketlist. Every bucketlist in the system
     // will have this many levels and it effectively gets wired-in to the
@@ -400,6 +403,12 @@ class BucketList
     // of the concatenation of the hashes of the `curr` and `snap` buckets.
     Hash getHash() const;
 
+    // Return the current state of the entry of `key`, or nullptr if it does
+    // not exist, by looking it up in the buckets from the newest to the
+    // oldest. Only the committed `curr` and `snap` buckets of each level are
+    // read, not the merges in progress.
+    std::shared_ptr<LedgerEntry> getLedgerEntry(LedgerKey const& key) const;
+
     // Restart any merges that might be running on background worker threads,
     // merging buckets between levels. This needs to be called after forcing a
     // BucketList to adopt a new state, either at application restart or when
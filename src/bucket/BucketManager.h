@@ -21,6 +21,8 @@ class TmpDirManager;
 struct LedgerHeader;
 struct MergeKey;
 struct HistoryArchiveState;
+class MergeScheduler;
+class IOThrottle;
 
 // A fine-grained merge-operation-counter structure for tracking various
 // events during merges. These are not medida counters becasue we do not
@@ -105,6 +107,24 @@ class BucketManager : NonMovableOrCopyable
 
     virtual medida::Timer& getMergeTimer() = 0;
 
+    // The zstd level that new bucket files are compressed at, or 0 if they
+    // are not compressed (see BUCKET_COMPRESSION_LEVEL).
+    virtual int getBucketCompressionLevel() = 0;
+
+    // The directory where merges keep their checkpoints (see MergeCheckpoint)
+    // and the number of bytes of output between two checkpoints of a range of
+    // a merge, or 0 if merges are not checkpointed (see
+    // BUCKET_MERGE_CHECKPOINT_SIZE).
+    virtual std::string const& getMergeCheckpointDir() = 0;
+    virtual size_t getMergeCheckpointBytes() = 0;
+
+    // The scheduler that runs the merges of the bucket list
+    virtual MergeScheduler& getMergeScheduler() = 0;
+
+    // The throttle of background bucket I/O (see BUCKET_IO_RATE_LIMIT). Can be
+    // used from any thread.
+    virtual IOThrottle& getIOThrottle() = 0;
+
     // Reading and writing the merge counters is done in bulk, and takes a lock
     // briefly; this can be done from any thread.
     virtual MergeCounters readMergeCounters() = 0;
@@ -157,6 +177,10 @@ class BucketManager : NonMovableOrCopyable
     // independently keep them alive.
     virtual void forgetUnreferencedBuckets() = 0;
 
+    // Record the state stored in the database for the last closed ledger,
+    // whose buckets are retained until the next one is stored.
+    virtual void setLastClosedLedgerHAS(HistoryArchiveState const& has) = 0;
+
     // Feed a new batch of entries to the bucket list. This interface expects to
     // be given separate init (created) and live (updated) entry vectors. The
     // `currLedger` and `currProtocolVersion` values should be taken from the
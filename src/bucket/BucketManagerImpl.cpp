@@ -4,7 +4,9 @@
 
 #include "bucket/BucketManagerImpl.h"
 #include "bucket/Bucket.h"
+#include "bucket/BucketIndex.h"
 #include "bucket/BucketList.h"
+#include "bucket/MergeCheckpoint.h"
 #include "crypto/Hex.h"
 #include "history/HistoryManager.h"
 #include "ledger/LedgerManager.h"
@@ -15,8 +17,10 @@
 #include "util/LogSlowExecution.h"
 #include "util/Logging.h"
 #include "util/TmpDir.h"
+#include "util/XDRStream.h"
 #include "util/format.h"
 #include "util/types.h"
+#include <algorithm>
 #include <fstream>
 #include <map>
 #include <regex>
@@ -71,6 +75,14 @@ BucketManagerImpl::initialize()
 
     mLockedBucketDir = std::make_unique<std::string>(d);
     mTmpDirManager = std::make_unique<TmpDirManager>(d + "/tmp");
+
+    mMergeCheckpointDir = d + "/merges";
+    if (!fs::exists(mMergeCheckpointDir) && !fs::mkpath(mMergeCheckpointDir))
+    {
+        throw std::runtime_error("Unable to create merge directory: " +
+                                 mMergeCheckpointDir);
+    }
+    loadMergeRecords();
 }
 
 void
@@ -85,6 +97,8 @@ BucketManagerImpl::dropAll()
         fs::deltree(d);
     }
 
+    // The records of finished merges went with the buckets
+    mFinishedMerges = BucketMergeMap();
     initialize();
 }
 
@@ -105,11 +119,15 @@ BucketManagerImpl::BucketManagerImpl(Application& app)
     , mBucketSnapMerge(app.getMetrics().NewTimer({"bucket", "snap", "merge"}))
     , mSharedBucketsSize(
           app.getMetrics().NewCounter({"bucket", "memory", "shared"}))
+    , mMergeScheduler(app)
+    , mIOThrottle(app.getMetrics(),
+                  uint64_t(app.getConfig().BUCKET_IO_RATE_LIMIT) * 1024 * 1024)
 
 {
 }
 
 const std::string BucketManagerImpl::kLockFilename = "stellar-core.lock";
+const std::string BucketManagerImpl::kMergesFilename = "merges.xdr";
 
 namespace
 {
@@ -122,10 +140,16 @@ bucketBasename(std::string const& bucketHexHash)
 bool
 isBucketFile(std::string const& name)
 {
-    static std::regex re("^bucket-[a-z0-9]{64}\\.xdr(\\.gz)?$");
+    static std::regex re("^bucket-[a-z0-9]{64}\\.xdr(\\.gz|\\.index)?$");
     return std::regex_match(name, re);
 };
 
+bool
+isMergeCheckpointFile(std::string const& name)
+{
+    return !MergeCheckpoint::getMergeIDOfFile(name).empty();
+}
+
 uint256
 extractFromFilename(std::string const& name)
 {
@@ -196,6 +220,36 @@ BucketManagerImpl::getMergeTimer()
     return mBucketSnapMerge;
 }
 
+int
+BucketManagerImpl::getBucketCompressionLevel()
+{
+    return mApp.getConfig().BUCKET_COMPRESSION_LEVEL;
+}
+
+std::string const&
+BucketManagerImpl::getMergeCheckpointDir()
+{
+    return mMergeCheckpointDir;
+}
+
+size_t
+BucketManagerImpl::getMergeCheckpointBytes()
+{
+    return size_t(mApp.getConfig().BUCKET_MERGE_CHECKPOINT_SIZE) * 1024 * 1024;
+}
+
+MergeScheduler&
+BucketManagerImpl::getMergeScheduler()
+{
+    return mMergeScheduler;
+}
+
+IOThrottle&
+BucketManagerImpl::getIOThrottle()
+{
+    return mIOThrottle;
+}
+
 MergeCounters
 BucketManagerImpl::readMergeCounters()
 {
@@ -337,6 +391,7 @@ BucketManagerImpl::adoptFileAsBucket(std::string const& filename,
         {
             auto timer = LogSlowExecution("Delete redundant bucket");
             std::remove(filename.c_str());
+            std::remove(BucketIndex::getFilename(filename).c_str());
         }
     }
     else
@@ -358,10 +413,21 @@ BucketManagerImpl::adoptFileAsBucket(std::string const& filename,
             }
         }
 
+        // The index of the bucket, if any, does not need to be durable: a
+        // missing index is built again
+        auto indexName = BucketIndex::getFilename(filename);
+        if (fs::exists(indexName) &&
+            rename(indexName.c_str(),
+                   BucketIndex::getFilename(canonicalName).c_str()) != 0)
+        {
+            std::remove(indexName.c_str());
+        }
+
         b = std::make_shared<Bucket>(canonicalName, hash);
         {
             mSharedBuckets.emplace(hash, b);
             mSharedBucketsSize.set_count(mSharedBuckets.size());
+            mUnreferencedBuckets.emplace(hash);
         }
     }
     assert(b);
@@ -370,10 +436,108 @@ BucketManagerImpl::adoptFileAsBucket(std::string const& filename,
         // Second half of the mergeKey record-keeping, above: if we successfully
         // adopted (no throw), then (weakly) record the preimage of the hash.
         mFinishedMerges.recordMerge(*mergeKey, hash);
+        appendMergeRecord(*mergeKey, hash);
     }
     return b;
 }
 
+namespace
+{
+// Records of kMergesFilename: a MergeKey, then its output
+uint32_t const MERGE_RECORD_VERSION = 1;
+
+// The file is rewritten once it holds this many more records than twice the
+// merges that are still known
+size_t const MERGE_RECORDS_SLACK = 64;
+
+void
+writeMergeRecord(XDROutputFileStream& out, MergeKey const& key,
+                 Hash const& output)
+{
+    out.writeOne(MERGE_RECORD_VERSION);
+    out.writeOne(key.mMaxProtocolVersion);
+    out.writeOne(key.mKeepDeadEntries);
+    out.writeOne(key.mInputCurrBucket);
+    out.writeOne(key.mInputSnapBucket);
+    out.writeOne(xdr::xvector<Hash>(key.mInputShadowBuckets.begin(),
+                                    key.mInputShadowBuckets.end()));
+    out.writeOne(output);
+}
+}
+
+void
+BucketManagerImpl::loadMergeRecords()
+{
+    // Merges whose output is gone, and a last record cut short by a crash,
+    // are dropped as the file is rewritten
+    std::string filename = getBucketDir() + "/" + kMergesFilename;
+    if (fs::exists(filename))
+    {
+        try
+        {
+            XDRInputFileStream in;
+            in.open(filename);
+            uint32_t recordVersion, maxProtocolVersion;
+            bool keepDeadEntries;
+            Hash curr, snap, output;
+            xdr::xvector<Hash> shadows;
+            while (in.readOne(recordVersion) &&
+                   recordVersion == MERGE_RECORD_VERSION &&
+                   in.readOne(maxProtocolVersion) &&
+                   in.readOne(keepDeadEntries) && in.readOne(curr) &&
+                   in.readOne(snap) && in.readOne(shadows) &&
+                   in.readOne(output))
+            {
+                if (fs::exists(bucketFilename(output)))
+                {
+                    MergeKey key(
+                        maxProtocolVersion, keepDeadEntries, curr, snap,
+                        std::vector<Hash>(shadows.begin(), shadows.end()));
+                    mFinishedMerges.recordMerge(key, output);
+                }
+            }
+        }
+        catch (std::exception const& e)
+        {
+            CLOG(WARNING, "Bucket") << "Stopped reading finished merges from "
+                                    << filename << ": " << e.what();
+        }
+    }
+    rewriteMergeRecords();
+    CLOG(DEBUG, "Bucket") << "Loaded " << mMergeRecords << " finished merges";
+}
+
+void
+BucketManagerImpl::appendMergeRecord(MergeKey const& key, Hash const& output)
+{
+    std::string filename = getBucketDir() + "/" + kMergesFilename;
+    XDROutputFileStream out(!mApp.getConfig().DISABLE_XDR_FSYNC);
+    out.openAt(filename, fs::size(filename));
+    writeMergeRecord(out, key, output);
+    out.close();
+    ++mMergeRecords;
+}
+
+void
+BucketManagerImpl::rewriteMergeRecords()
+{
+    std::string filename = getBucketDir() + "/" + kMergesFilename;
+    std::string tmpFilename = filename + ".tmp";
+    XDROutputFileStream out(!mApp.getConfig().DISABLE_XDR_FSYNC);
+    out.open(tmpFilename);
+    for (auto const& merge : mFinishedMerges.getAllMerges())
+    {
+        writeMergeRecord(out, merge.first, merge.second);
+    }
+    out.close();
+    if (!renameBucket(tmpFilename, filename))
+    {
+        throw std::runtime_error("Unable to write finished merges to " +
+                                 filename);
+    }
+    mMergeRecords = mFinishedMerges.getAllMerges().size();
+}
+
 std::shared_ptr<Bucket>
 BucketManagerImpl::getBucketByHash(uint256 const& hash)
 {
@@ -399,6 +563,7 @@ BucketManagerImpl::getBucketByHash(uint256 const& hash)
         auto p = std::make_shared<Bucket>(canonicalName, hash);
         mSharedBuckets.emplace(hash, p);
         mSharedBucketsSize.set_count(mSharedBuckets.size());
+        mUnreferencedBuckets.emplace(hash);
         return p;
     }
     return std::shared_ptr<Bucket>();
@@ -516,19 +681,137 @@ BucketManagerImpl::getReferencedBuckets() const
             if (rit.second)
             {
                 CLOG(TRACE, "Bucket") << h << " referenced by publish queue";
-
-                // Project referenced bucket `rhash` -- which might be a merge
-                // input captured before a merge finished -- through our weak
-                // map of merge input/output relationships, to find any outputs
-                // we'll want to retain in order to resynthesize the merge in
-                // the future, rather than re-run it.
-                mFinishedMerges.getOutputsUsingInput(rhash, referenced);
             }
+
+            // Project referenced bucket `rhash` -- which might be a merge
+            // input captured before a merge finished -- through our weak map
+            // of merge input/output relationships, to find any outputs we'll
+            // want to retain in order to resynthesize the merge in the future,
+            // rather than re-run it. This is done even if `rhash` is also
+            // referenced by the bucket list, as isReferencedByPublishQueue
+            // does.
+            mFinishedMerges.getOutputsUsingInput(rhash, referenced);
         }
     }
     return referenced;
 }
 
+void
+BucketManagerImpl::retainBuckets(std::vector<Hash> const& buckets)
+{
+    for (auto const& h : buckets)
+    {
+        ++mBucketReferences[h];
+    }
+}
+
+void
+BucketManagerImpl::releaseBuckets(std::vector<Hash> const& buckets)
+{
+    for (auto const& h : buckets)
+    {
+        auto i = mBucketReferences.find(h);
+        assert(i != mBucketReferences.end() && i->second > 0);
+        if (--i->second == 0)
+        {
+            mBucketReferences.erase(i);
+            mUnreferencedBuckets.emplace(h);
+        }
+    }
+}
+
+void
+BucketManagerImpl::setLastClosedLedgerHAS(HistoryArchiveState const& has)
+{
+    std::lock_guard<std::recursive_mutex> lock(mBucketMutex);
+    std::vector<Hash> buckets;
+    for (auto const& h : has.allBuckets())
+    {
+        buckets.emplace_back(hexToBin256(h));
+    }
+    retainBuckets(buckets);
+    releaseBuckets(mCountedLastClosedLedger);
+    mCountedLastClosedLedger = std::move(buckets);
+    mLastClosedLedgerCounted = true;
+}
+
+void
+BucketManagerImpl::countBucketListReferences()
+{
+    if (!mLastClosedLedgerCounted)
+    {
+        // No ledger was stored since startup: count the one stored before
+        setLastClosedLedgerHAS(
+            mApp.getLedgerManager().getLastClosedLedgerHAS());
+    }
+
+    // The levels change at every ledger close, when merges are started and
+    // resolved, and when a state is assumed, so rather than tracking each of
+    // these, each level is compared with the buckets it was counted with
+    mCountedLevels.resize(BucketList::kNumLevels);
+    for (uint32_t i = 0; i < BucketList::kNumLevels; ++i)
+    {
+        auto const& level = mBucketList.getLevel(i);
+        std::vector<Hash> buckets{level.getCurr()->getHash(),
+                                  level.getSnap()->getHash()};
+        for (auto const& h : level.getNext().getHashes())
+        {
+            buckets.emplace_back(hexToBin256(h));
+        }
+        if (buckets != mCountedLevels[i])
+        {
+            retainBuckets(buckets);
+            releaseBuckets(mCountedLevels[i]);
+            mCountedLevels[i] = std::move(buckets);
+        }
+    }
+}
+
+bool
+BucketManagerImpl::isReferencedByPublishQueue(Hash const& hash) const
+{
+    // As in getReferencedBuckets, the outputs of the known merges of a
+    // bucket of the publish queue are retained along with it
+    auto& hm = mApp.getHistoryManager();
+    if (hm.isBucketReferencedByPublishQueue(binToHex(hash)))
+    {
+        return true;
+    }
+    std::set<Hash> inputs;
+    mFinishedMerges.getInputsOfMergesProducing(hash, inputs);
+    return std::any_of(inputs.begin(), inputs.end(), [&](Hash const& input) {
+        return hm.isBucketReferencedByPublishQueue(binToHex(input));
+    });
+}
+
+void
+BucketManagerImpl::checkBucketReferences() const
+{
+    auto referenced = getReferencedBuckets();
+    for (auto const& p : mSharedBuckets)
+    {
+        bool counted =
+            mBucketReferences.find(p.first) != mBucketReferences.end() ||
+            isReferencedByPublishQueue(p.first);
+        bool scanned = referenced.find(p.first) != referenced.end();
+        if (counted != scanned)
+        {
+            throw std::runtime_error(fmt::format(
+                "Bucket {} is {}referenced by its reference counts but {}"
+                "referenced by a full scan",
+                binToHex(p.first), counted ? "" : "not ",
+                scanned ? "" : "not "));
+        }
+        if (!counted && mUnreferencedBuckets.find(p.first) ==
+                            mUnreferencedBuckets.end())
+        {
+            throw std::runtime_error(
+                fmt::format("Unreferenced bucket {} is not collectable",
+                            binToHex(p.first)));
+        }
+    }
+}
+
 void
 BucketManagerImpl::cleanupStaleFiles()
 {
@@ -555,6 +838,24 @@ BucketManagerImpl::cleanupStaleFiles()
             // called again
             auto fullName = getBucketDir() + "/" + f;
             std::remove(fullName.c_str());
+            mFinishedMerges.forgetAllMergesProducing(hash);
+        }
+    }
+
+    // Checkpoints of merges that were not restarted will not be resumed
+    std::set<std::string> liveMerges;
+    for (auto const& f : mLiveFutures)
+    {
+        liveMerges.emplace(MergeCheckpoint::getMergeID(f.first));
+    }
+    for (auto f :
+         fs::findfiles(getMergeCheckpointDir(), isMergeCheckpointFile))
+    {
+        if (liveMerges.find(MergeCheckpoint::getMergeIDOfFile(f)) ==
+            liveMerges.end())
+        {
+            auto fullName = getMergeCheckpointDir() + "/" + f;
+            std::remove(fullName.c_str());
         }
     }
 }
@@ -563,14 +864,23 @@ void
 BucketManagerImpl::forgetUnreferencedBuckets()
 {
     std::lock_guard<std::recursive_mutex> lock(mBucketMutex);
-    auto referenced = getReferencedBuckets();
+    countBucketListReferences();
+    if (mApp.getConfig().CHECK_BUCKET_REFERENCES)
+    {
+        checkBucketReferences();
+    }
 
-    for (auto i = mSharedBuckets.begin(); i != mSharedBuckets.end();)
+    for (auto i = mUnreferencedBuckets.begin();
+         i != mUnreferencedBuckets.end();)
     {
-        // Standard says map iterators other than the one you're erasing remain
-        // valid.
-        auto j = i;
-        ++i;
+        auto j = mSharedBuckets.find(*i);
+        if (j == mSharedBuckets.end() ||
+            mBucketReferences.find(*i) != mBucketReferences.end())
+        {
+            // Dropped already, or referenced again since it was released
+            i = mUnreferencedBuckets.erase(i);
+            continue;
+        }
 
         // Only drop buckets if the bucketlist has forgotten them _and_
         // no other in-progress structures (worker threads, shadow lists)
@@ -582,8 +892,8 @@ BucketManagerImpl::forgetUnreferencedBuckets()
         // we're the first and last to know about it. Otherwise buckets might
         // race on deleting the underlying file from one another.
 
-        if (referenced.find(j->first) == referenced.end() &&
-            j->second.use_count() == 1)
+        if (j->second.use_count() == 1 &&
+            !isReferencedByPublishQueue(j->first))
         {
             auto filename = j->second->getFilename();
             CLOG(TRACE, "Bucket")
@@ -595,6 +905,7 @@ BucketManagerImpl::forgetUnreferencedBuckets()
                 std::remove(filename.c_str());
                 auto gzfilename = filename + ".gz";
                 std::remove(gzfilename.c_str());
+                std::remove(BucketIndex::getFilename(filename).c_str());
             }
 
             // Dropping this bucket means we'll no longer be able to
@@ -617,16 +928,28 @@ BucketManagerImpl::forgetUnreferencedBuckets()
                 {
                     CLOG(WARNING, "Bucket")
                         << "Unexpected live future for unreferenced bucket: "
-                        << binToHex(i->first);
+                        << binToHex(j->first);
                     mLiveFutures.erase(f);
                 }
             }
 
             // All done, delete the bucket from the shared map.
             mSharedBuckets.erase(j);
+            i = mUnreferencedBuckets.erase(i);
+        }
+        else
+        {
+            // Still used, maybe not at the next pass
+            ++i;
         }
     }
     mSharedBucketsSize.set_count(mSharedBuckets.size());
+
+    if (mMergeRecords > 2 * mFinishedMerges.getAllMerges().size() +
+                            MERGE_RECORDS_SLACK)
+    {
+        rewriteMergeRecords();
+    }
 }
 
 void
@@ -3,13 +3,16 @@
 #include "bucket/BucketList.h"
 #include "bucket/BucketManager.h"
 #include "bucket/BucketMergeMap.h"
+#include "bucket/MergeScheduler.h"
 #include "overlay/StellarXDR.h"
+#include "util/IOThrottle.h"
 
 #include <map>
 #include <memory>
 #include <mutex>
 #include <set>
 #include <string>
+#include <vector>
 
 // Copyright 2015 Stellar Development Foundation and contributors. Licensed
 // under the Apache License, Version 2.0. See the COPYING file at the root
@@ -47,6 +50,8 @@ class BucketManagerImpl : public BucketManager
     medida::Timer& mBucketSnapMerge;
     medida::Counter& mSharedBucketsSize;
     MergeCounters mMergeCounters;
+    MergeScheduler mMergeScheduler;
+    IOThrottle mIOThrottle;
 
     // Records bucket-merges that are currently _live_ in some FutureBucket, in
     // the sense of either running, or finished (with or without the
@@ -63,6 +68,43 @@ class BucketManagerImpl : public BucketManager
     // alive. Needs to be queried and updated on mSharedBuckets GC events.
     BucketMergeMap mFinishedMerges;
 
+    // The finished merges are also appended to kMergesFilename, in the bucket
+    // directory, and loaded back on startup, so that a merge that finished
+    // before a restart is not run again. The file is rewritten without the
+    // forgotten merges once they make up most of its mMergeRecords records.
+    static std::string const kMergesFilename;
+    size_t mMergeRecords{0};
+    std::string mMergeCheckpointDir;
+
+    void loadMergeRecords();
+    void appendMergeRecord(MergeKey const& key, Hash const& output);
+    void rewriteMergeRecords();
+
+    // Buckets are garbage collected by counting their references rather than
+    // by scanning everything that can reference them. mBucketReferences
+    // counts, for each bucket, the levels of the BucketList (their curr, snap
+    // and the buckets of their next) and the last closed ledger state that
+    // hold it. A level is counted again, when a GC pass finds that it holds
+    // other buckets than mCountedLevels, and the last closed ledger when it
+    // is stored. The publish queue counts its own references (see
+    // PublishQueueBuckets).
+    //
+    // mUnreferencedBuckets holds the buckets of mSharedBuckets that may be
+    // dropped: those adopted or loaded with no count, or whose count fell to
+    // zero. A GC pass only looks at these, and keeps the ones that are still
+    // used elsewhere for the next pass.
+    std::map<Hash, uint32_t> mBucketReferences;
+    std::vector<std::vector<Hash>> mCountedLevels;
+    std::vector<Hash> mCountedLastClosedLedger;
+    bool mLastClosedLedgerCounted{false};
+    std::set<Hash> mUnreferencedBuckets;
+
+    void retainBuckets(std::vector<Hash> const& buckets);
+    void releaseBuckets(std::vector<Hash> const& buckets);
+    void countBucketListReferences();
+    bool isReferencedByPublishQueue(Hash const& hash) const;
+    void checkBucketReferences() const;
+
     std::set<Hash> getReferencedBuckets() const;
     void cleanupStaleFiles();
     void cleanDir();
@@ -88,6 +130,11 @@ class BucketManagerImpl : public BucketManager
     std::string const& getBucketDir() override;
     BucketList& getBucketList() override;
     medida::Timer& getMergeTimer() override;
+    int getBucketCompressionLevel() override;
+    std::string const& getMergeCheckpointDir() override;
+    size_t getMergeCheckpointBytes() override;
+    MergeScheduler& getMergeScheduler() override;
+    IOThrottle& getIOThrottle() override;
     MergeCounters readMergeCounters() override;
     void incrMergeCounters(MergeCounters const&) override;
     TmpDirManager& getTmpDirManager() override;
@@ -106,6 +153,7 @@ class BucketManagerImpl : public BucketManager
 #endif
 
     void forgetUnreferencedBuckets() override;
+    void setLastClosedLedgerHAS(HistoryArchiveState const& has) override;
     void addBatch(Application& app, uint32_t currLedger,
                   uint32_t currLedgerProtocol,
                   std::vector<LedgerEntry> const& initEntries,
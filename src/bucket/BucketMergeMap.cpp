@@ -124,4 +124,16 @@ BucketMergeMap::getOutputsUsingInput(Hash const& input,
             << hexAbbrev(input);
     }
 }
+
+void
+BucketMergeMap::getInputsOfMergesProducing(Hash const& output,
+                                           std::set<Hash>& inputs) const
+{
+    auto pair = mOutputToMergeKey.equal_range(output);
+    for (auto i = pair.first; i != pair.second; ++i)
+    {
+        auto hashes = getMergeKeyHashes(i->second);
+        inputs.insert(hashes.begin(), hashes.end());
+    }
+}
 }
@@ -45,5 +45,13 @@ class BucketMergeMap
     std::unordered_set<MergeKey> forgetAllMergesProducing(Hash const& output);
     bool findMergeFor(MergeKey const& input, Hash& output);
     void getOutputsUsingInput(Hash const& input, std::set<Hash>& outputs) const;
+    void getInputsOfMergesProducing(Hash const& output,
+                                    std::set<Hash>& inputs) const;
+
+    std::unordered_map<MergeKey, Hash> const&
+    getAllMerges() const
+    {
+        return mMergeKeyToOutput;
+    }
 };
 }
@@ -6,6 +6,8 @@
 #include "bucket/Bucket.h"
 #include "bucket/BucketManager.h"
 #include "crypto/Random.h"
+#include "util/Fs.h"
+#include "util/MappedFile.h"
 
 namespace stellar
 {
@@ -35,22 +37,28 @@ randomBucketName(std::string const& tmpDir)
 BucketOutputIterator::BucketOutputIterator(std::string const& tmpDir,
                                            bool keepDeadEntries,
                                            BucketMetadata const& meta,
-                                           MergeCounters& mc, bool doFsync)
+                                           MergeCounters& mc, bool doFsync,
+                                           bool isSegment, int compressionLevel,
+                                           IOThrottle* throttle)
     : mFilename(randomBucketName(tmpDir))
     , mOut(doFsync)
     , mBuf(nullptr)
-    , mHasher(SHA256::create())
+    , mHasher(isSegment ? nullptr : SHA256::create())
     , mKeepDeadEntries(keepDeadEntries)
     , mMeta(meta)
+    , mIsSegment(isSegment)
     , mMergeCounters(mc)
 {
     CLOG(TRACE, "Bucket") << "BucketOutputIterator opening file to write: "
                           << mFilename;
     // Will throw if unable to open the file
-    mOut.open(mFilename);
+    assert(!isSegment || compressionLevel == 0);
+    mOut.setThrottle(throttle);
+    mOut.open(mFilename, mHasher.get(), compressionLevel);
 
-    if (meta.ledgerVersion >=
-        Bucket::FIRST_PROTOCOL_SUPPORTING_INITENTRY_AND_METAENTRY)
+    if (!isSegment &&
+        meta.ledgerVersion >=
+            Bucket::FIRST_PROTOCOL_SUPPORTING_INITENTRY_AND_METAENTRY)
     {
         BucketEntry bme;
         bme.type(METAENTRY);
@@ -60,6 +68,26 @@ BucketOutputIterator::BucketOutputIterator(std::string const& tmpDir,
     }
 }
 
+BucketOutputIterator::BucketOutputIterator(std::string const& segmentFilename,
+                                           MergeCounters& mc)
+    : mFilename(segmentFilename)
+    , mOut(/*fsyncOnClose=*/false)
+    , mBuf(nullptr)
+    , mIsSegment(true)
+    , mMergeCounters(mc)
+{
+    // The index of the segment is built again from its entries
+    XDRInputMappedStream in;
+    in.open(mFilename);
+    BucketEntry entry;
+    for (size_t offset = in.pos(); in.readOne(entry); offset = in.pos())
+    {
+        mIndexBuilder.add(entry, offset);
+        ++mObjectsPut;
+    }
+    mBytesPut = in.size();
+}
+
 void
 BucketOutputIterator::put(BucketEntry const& e)
 {
@@ -91,8 +119,7 @@ BucketOutputIterator::put(BucketEntry const& e)
         if (mCmp(*mBuf, e))
         {
             ++mMergeCounters.mOutputIteratorActualWrites;
-            mOut.writeOne(*mBuf, mHasher.get(), &mBytesPut);
-            mObjectsPut++;
+            writeEntry(*mBuf);
         }
     }
     else
@@ -105,16 +132,76 @@ BucketOutputIterator::put(BucketEntry const& e)
     *mBuf = e;
 }
 
-std::shared_ptr<Bucket>
-BucketOutputIterator::getBucket(BucketManager& bucketManager,
-                                MergeKey* mergeKey)
+void
+BucketOutputIterator::writeEntry(BucketEntry const& e)
+{
+    mIndexBuilder.add(e, mBytesPut);
+    mOut.writeOne(e, &mBytesPut);
+    mObjectsPut++;
+}
+
+void
+BucketOutputIterator::flushBuffer()
 {
     if (mBuf)
     {
-        mOut.writeOne(*mBuf, mHasher.get(), &mBytesPut);
-        mObjectsPut++;
+        writeEntry(*mBuf);
         mBuf.reset();
     }
+}
+
+void
+BucketOutputIterator::closeSegment(std::string const& filename,
+                                   std::string const& dir, bool doFsync)
+{
+    assert(mIsSegment);
+    flushBuffer();
+    mOut.close();
+    bool renamed = doFsync ? fs::durableRename(mFilename, filename, dir)
+                           : rename(mFilename.c_str(), filename.c_str()) == 0;
+    if (!renamed)
+    {
+        throw std::runtime_error("Unable to move bucket segment " + mFilename +
+                                 " to " + filename);
+    }
+    mFilename = filename;
+}
+
+void
+BucketOutputIterator::appendSegment(BucketOutputIterator& segment)
+{
+    assert(!mIsSegment);
+    assert(segment.mIsSegment);
+    flushBuffer();
+    segment.flushBuffer();
+    if (segment.mOut.isOpen())
+    {
+        segment.mOut.close();
+    }
+
+    // The segment holds whole records, which are copied and hashed as is
+    MappedFile in;
+    in.open(segment.mFilename);
+    if (in.size() != segment.mBytesPut)
+    {
+        throw std::runtime_error("Unable to read bucket segment " +
+                                 segment.mFilename);
+    }
+    in.adviseSequential();
+    mOut.writeBytes(in.data(), in.size());
+    in.close();
+    mIndexBuilder.append(std::move(segment.mIndexBuilder), mBytesPut);
+    mObjectsPut += segment.mObjectsPut;
+    mBytesPut += segment.mBytesPut;
+    std::remove(segment.mFilename.c_str());
+}
+
+std::shared_ptr<Bucket>
+BucketOutputIterator::getBucket(BucketManager& bucketManager,
+                                MergeKey* mergeKey)
+{
+    assert(!mIsSegment);
+    flushBuffer();
 
     mOut.close();
     if (mObjectsPut == 0 || mBytesPut == 0)
@@ -125,6 +212,9 @@ BucketOutputIterator::getBucket(BucketManager& bucketManager,
         std::remove(mFilename.c_str());
         return std::make_shared<Bucket>();
     }
+
+    // The index is adopted along with the bucket
+    mIndexBuilder.finish()->save(BucketIndex::getFilename(mFilename));
     return bucketManager.adoptFileAsBucket(mFilename, mHasher->finish(),
                                            mObjectsPut, mBytesPut, mergeKey);
 }
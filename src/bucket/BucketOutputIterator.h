@@ -4,6 +4,7 @@
 // under the Apache License, Version 2.0. See the COPYING file at the root
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
+#include "bucket/BucketIndex.h"
 #include "bucket/BucketManager.h"
 #include "bucket/LedgerCmp.h"
 #include "util/XDRStream.h"
@@ -24,7 +25,7 @@ class BucketOutputIterator
 {
   protected:
     std::string mFilename;
-    XDROutputFileStream mOut;
+    XDRAsyncOutputFileStream mOut;
     BucketEntryIdCmp mCmp;
     std::unique_ptr<BucketEntry> mBuf;
     std::unique_ptr<SHA256> mHasher;
@@ -33,7 +34,12 @@ class BucketOutputIterator
     bool mKeepDeadEntries{true};
     BucketMetadata mMeta;
     bool mPutMeta{false};
+    bool const mIsSegment;
     MergeCounters& mMergeCounters;
+    BucketIndex::Builder mIndexBuilder;
+
+    void writeEntry(BucketEntry const& e);
+    void flushBuffer();
 
   public:
     // BucketOutputIterators must _always_ be constructed with BucketMetadata,
@@ -43,12 +49,44 @@ class BucketOutputIterator
     // version new enough that it should _write_ the metadata to the stream in
     // the form of a METAENTRY; but that's not a thing the caller gets to decide
     // (or forget to do), it's handled automatically.
+    //
+    // An iterator constructed with isSegment writes a segment of a bucket
+    // instead: the entries of a range of keys, which are not hashed and are
+    // appended to the iterator writing the bucket with appendSegment. It never
+    // writes a METAENTRY.
+    //
+    // If compressionLevel is not 0, the bucket file is block-compressed at
+    // that level (see BlockCompressedFile). Segments are never compressed.
+    // If throttle is not null, the bytes written are acquired from it.
     BucketOutputIterator(std::string const& tmpDir, bool keepDeadEntries,
                          BucketMetadata const& meta, MergeCounters& mc,
-                         bool doFsync);
+                         bool doFsync, bool isSegment = false,
+                         int compressionLevel = 0,
+                         IOThrottle* throttle = nullptr);
+
+    // Opens the segment that an earlier iterator wrote and moved to
+    // segmentFilename with closeSegment, so that it can be appended again
+    BucketOutputIterator(std::string const& segmentFilename, MergeCounters& mc);
 
     void put(BucketEntry const& e);
 
+    // The number of bytes written so far, without the buffered entry
+    size_t
+    getBytesPut() const
+    {
+        return mBytesPut;
+    }
+
+    // closeSegment writes what is left of a segment and moves it to filename,
+    // in dir, durably if doFsync. It can still be appended afterwards.
+    void closeSegment(std::string const& filename, std::string const& dir,
+                      bool doFsync);
+
+    // appendSegment appends the entries of segment, which must follow the
+    // entries put so far, as if they had been put in this iterator, and
+    // deletes the segment file.
+    void appendSegment(BucketOutputIterator& segment);
+
     std::shared_ptr<Bucket> getBucket(BucketManager& bucketManager,
                                       MergeKey* mergeKey = nullptr);
 };
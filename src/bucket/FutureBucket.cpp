@@ -12,15 +12,19 @@
 #include "bucket/BucketManager.h"
 #include "bucket/FutureBucket.h"
 #include "bucket/MergeKey.h"
+#include "bucket/MergeScheduler.h"
 #include "crypto/Hex.h"
+#include "ledger/LedgerManager.h"
 #include "main/Application.h"
 #include "main/ErrorMessages.h"
+#include "util/IOThrottle.h"
 #include "util/LogSlowExecution.h"
 #include "util/Logging.h"
 #include "util/format.h"
 
 #include "medida/metrics_registry.h"
 
+#include <algorithm>
 #include <chrono>
 
 namespace stellar
@@ -31,7 +35,7 @@ FutureBucket::FutureBucket(Application& app,
                            std::shared_ptr<Bucket> const& snap,
                            std::vector<std::shared_ptr<Bucket>> const& shadows,
                            uint32_t maxProtocolVersion, bool countMergeEvents,
-                           uint32_t level)
+                           uint32_t level, uint32_t currLedger)
     : mState(FB_LIVE_INPUTS)
     , mInputCurrBucket(curr)
     , mInputSnapBucket(snap)
@@ -57,7 +61,8 @@ FutureBucket::FutureBucket(Application& app,
     {
         mInputShadowBucketHashes.push_back(binToHex(b->getHash()));
     }
-    startMerge(app, maxProtocolVersion, countMergeEvents, level);
+    startMerge(app, maxProtocolVersion, countMergeEvents, level,
+               MergeScheduler::getDeadline(currLedger, level));
 }
 
 void
@@ -283,9 +288,24 @@ getAvailableTimeForMerge(Application& app, uint32_t level)
     return closeTime;
 }
 
+// Merges are split in ranges of at least this many bytes of input, below
+// which starting threads costs more than they save
+static size_t const MIN_MERGE_RANGE_BYTES = 64 * 1024 * 1024;
+
+static size_t
+getMergeRanges(Application& app, std::shared_ptr<Bucket> const& curr,
+               std::shared_ptr<Bucket> const& snap)
+{
+    size_t maxRanges =
+        (curr->getSize() + snap->getSize()) / MIN_MERGE_RANGE_BYTES;
+    return std::max<size_t>(
+        std::min<size_t>(app.getConfig().BUCKET_MERGE_THREADS, maxRanges), 1);
+}
+
 void
 FutureBucket::startMerge(Application& app, uint32_t maxProtocolVersion,
-                         bool countMergeEvents, uint32_t level)
+                         bool countMergeEvents, uint32_t level,
+                         uint32_t deadline)
 {
     // NB: startMerge starts with FutureBucket in a half-valid state; the inputs
     // are live but the merge is not yet running. So you can't call checkState()
@@ -329,10 +349,12 @@ FutureBucket::startMerge(Application& app, uint32_t maxProtocolVersion,
         checkState();
         return;
     }
+    // Merges into level 0 are committed right away, and never throttled
+    IOThrottle* throttle = level > 0 ? &bm.getIOThrottle() : nullptr;
     using task_t = std::packaged_task<std::shared_ptr<Bucket>()>;
     std::shared_ptr<task_t> task = std::make_shared<task_t>(
         [curr, snap, &bm, shadows, maxProtocolVersion, countMergeEvents, level,
-         &timer, &app]() mutable {
+         &timer, &app, throttle]() mutable {
             auto timeScope = timer.TimeScope();
             CLOG(TRACE, "Bucket")
                 << "Worker merging curr=" << hexAbbrev(curr->getHash())
@@ -343,7 +365,8 @@ FutureBucket::startMerge(Application& app, uint32_t maxProtocolVersion,
                 auto res = Bucket::merge(
                     bm, maxProtocolVersion, curr, snap, shadows,
                     BucketList::keepDeadEntries(level), countMergeEvents,
-                    !app.getConfig().DISABLE_XDR_FSYNC);
+                    !app.getConfig().DISABLE_XDR_FSYNC,
+                    getMergeRanges(app, curr, snap), throttle);
 
                 CLOG(TRACE, "Bucket")
                     << "Worker finished merging curr="
@@ -373,8 +396,8 @@ FutureBucket::startMerge(Application& app, uint32_t maxProtocolVersion,
 
     mOutputBucket = task->get_future().share();
     bm.putMergeFuture(mk, mOutputBucket);
-    app.postOnBackgroundThread(bind(&task_t::operator(), task),
-                               "FutureBucket: merge");
+    bm.getMergeScheduler().schedule(bind(&task_t::operator(), task), level,
+                                    deadline);
     checkState();
 }
 
@@ -406,7 +429,10 @@ FutureBucket::makeLive(Application& app, uint32_t maxProtocolVersion,
             mInputShadowBuckets.push_back(b);
         }
         mState = FB_LIVE_INPUTS;
-        startMerge(app, maxProtocolVersion, /*countMergeEvents=*/true, level);
+        uint32_t currLedger =
+            app.getLedgerManager().getLastClosedLedgerNum() + 1;
+        startMerge(app, maxProtocolVersion, /*countMergeEvents=*/true, level,
+                   MergeScheduler::getDeadline(currLedger, level));
         assert(isLive());
     }
 }
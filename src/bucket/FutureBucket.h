@@ -74,7 +74,7 @@ class FutureBucket
     void checkHashesMatch() const;
     void checkState() const;
     void startMerge(Application& app, uint32_t maxProtocolVersion,
-                    bool countMergeEvents, uint32_t level);
+                    bool countMergeEvents, uint32_t level, uint32_t deadline);
 
     void clearInputs();
     void clearOutput();
@@ -85,7 +85,7 @@ class FutureBucket
                  std::shared_ptr<Bucket> const& snap,
                  std::vector<std::shared_ptr<Bucket>> const& shadows,
                  uint32_t maxProtocolVersion, bool countMergeEvents,
-                 uint32_t level);
+                 uint32_t level, uint32_t currLedger);
 
     FutureBucket() = default;
     FutureBucket(FutureBucket const& other) = default;
@@ -119,7 +119,9 @@ class FutureBucket
     // Precondition: isLive(); waits-for and resolves to merged bucket.
     std::shared_ptr<Bucket> resolve();
 
-    // Precondition: !isLive(); transitions from FB_HASH_FOO to FB_LIVE_FOO
+    // Precondition: !isLive(); transitions from FB_HASH_FOO to FB_LIVE_FOO.
+    // A merge restarted here is scheduled as if it was started at the ledger
+    // after the last closed one.
     void makeLive(Application& app, uint32_t maxProtocolVersion,
                   uint32_t level);
 
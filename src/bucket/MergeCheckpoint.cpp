@@ -0,0 +1,157 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "bucket/MergeCheckpoint.h"
+#include "crypto/Hex.h"
+#include "crypto/SHA.h"
+#include "util/Fs.h"
+#include "util/Logging.h"
+#include "util/XDRStream.h"
+
+#include <cstdio>
+#include <regex>
+#include <sstream>
+
+namespace stellar
+{
+
+namespace
+{
+uint32_t const CHECKPOINT_VERSION = 1;
+}
+
+MergeCheckpoint::MergeCheckpoint(std::string const& dir, MergeKey const& key,
+                                 size_t ranges, size_t range, bool doFsync)
+    : mDir(dir)
+    , mBasename(dir + "/merge-" + getMergeID(key) + "-" +
+                std::to_string(ranges) + "-" + std::to_string(range))
+    , mDoFsync(doFsync)
+{
+}
+
+std::string
+MergeCheckpoint::getMergeID(MergeKey const& key)
+{
+    std::ostringstream oss;
+    oss << key.mMaxProtocolVersion << ',' << key.mKeepDeadEntries << ','
+        << binToHex(key.mInputCurrBucket) << ','
+        << binToHex(key.mInputSnapBucket);
+    for (auto const& h : key.mInputShadowBuckets)
+    {
+        oss << ',' << binToHex(h);
+    }
+    return binToHex(sha256(oss.str()));
+}
+
+std::string
+MergeCheckpoint::getMergeIDOfFile(std::string const& name)
+{
+    static std::regex re("^merge-([a-z0-9]{64})-.*$");
+    std::smatch match;
+    if (!std::regex_match(name, match, re))
+    {
+        return std::string();
+    }
+    return match[1];
+}
+
+std::string
+MergeCheckpoint::getFilename() const
+{
+    return mBasename + ".checkpoint";
+}
+
+std::string
+MergeCheckpoint::getSegmentFilename(size_t segment) const
+{
+    return mBasename + "-" + std::to_string(segment) + ".xdr";
+}
+
+bool
+MergeCheckpoint::load()
+{
+    mSegments = 0;
+    mDone = false;
+    auto filename = getFilename();
+    if (!fs::exists(filename))
+    {
+        return false;
+    }
+
+    // A checkpoint that cannot be used is ignored: the range is merged again
+    uint32_t version = 0, segments = 0;
+    bool done = false;
+    bool read = false;
+    try
+    {
+        XDRInputFileStream in;
+        in.open(filename);
+        read = in.readOne(version) && version == CHECKPOINT_VERSION &&
+               in.readOne(segments) && in.readOne(done) &&
+               (done || in.readOne(mResumeKey));
+    }
+    catch (std::exception const&)
+    {
+    }
+    if (!read)
+    {
+        CLOG(WARNING, "Bucket") << "Ignoring unreadable merge checkpoint "
+                                << filename;
+        return false;
+    }
+    for (uint32_t i = 0; i < segments; ++i)
+    {
+        if (!fs::exists(getSegmentFilename(i)))
+        {
+            CLOG(WARNING, "Bucket") << "Ignoring merge checkpoint " << filename
+                                    << " with missing segments";
+            return false;
+        }
+    }
+    mSegments = segments;
+    mDone = done;
+    return true;
+}
+
+void
+MergeCheckpoint::addSegment(BucketEntry const* resumeKey)
+{
+    ++mSegments;
+    mDone = resumeKey == nullptr;
+    if (resumeKey)
+    {
+        mResumeKey = *resumeKey;
+    }
+
+    // The checkpoint is replaced at once, so that a crash leaves either the
+    // new one or the old one, which ignores the new segment
+    auto filename = getFilename();
+    auto tmpFilename = filename + ".tmp";
+    XDROutputFileStream out(mDoFsync);
+    out.open(tmpFilename);
+    out.writeOne(CHECKPOINT_VERSION);
+    out.writeOne(static_cast<uint32_t>(mSegments));
+    out.writeOne(mDone);
+    if (!mDone)
+    {
+        out.writeOne(mResumeKey);
+    }
+    out.close();
+
+    bool renamed = mDoFsync ? fs::durableRename(tmpFilename, filename, mDir)
+                            : rename(tmpFilename.c_str(),
+                                     filename.c_str()) == 0;
+    if (!renamed)
+    {
+        throw std::runtime_error("Unable to save merge checkpoint " +
+                                 filename);
+    }
+}
+
+void
+MergeCheckpoint::remove()
+{
+    std::remove(getFilename().c_str());
+}
+}
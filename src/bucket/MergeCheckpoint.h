@@ -0,0 +1,80 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "bucket/MergeKey.h"
+#include "overlay/StellarXDR.h"
+
+#include <string>
+
+namespace stellar
+{
+
+// MergeCheckpoint records the progress of a range of keys of a merge, so that
+// a merge interrupted by a restart resumes where it stopped instead of
+// starting over.
+//
+// The range is merged into segments (see BucketOutputIterator) that are cut
+// between two keys once they hold enough bytes. Each finished segment is
+// moved to the checkpoint directory, then the checkpoint is saved: the number
+// of segments, and the key the next one starts at or that the range is done.
+// A merge of the same inputs, split in the same ranges, loads it, reuses the
+// segments and resumes from that key. The files of a range are deleted once
+// its segments are appended to the merged bucket.
+class MergeCheckpoint
+{
+    std::string const mDir;
+    std::string const mBasename;
+    bool const mDoFsync;
+    size_t mSegments{0};
+    bool mDone{false};
+    BucketEntry mResumeKey;
+
+    std::string getFilename() const;
+
+  public:
+    MergeCheckpoint(std::string const& dir, MergeKey const& key, size_t ranges,
+                    size_t range, bool doFsync);
+
+    // getMergeID names the merge of key in the files of its checkpoints
+    static std::string getMergeID(MergeKey const& key);
+
+    // getMergeIDOfFile returns the ID of the merge that the file name in a
+    // checkpoint directory belongs to, or an empty string
+    static std::string getMergeIDOfFile(std::string const& name);
+
+    // load reads the checkpoint saved by an earlier merge of the range, if
+    // any, and returns whether there was one whose segments all exist
+    bool load();
+
+    // addSegment records that the segment getSegmentFilename(getSegments())
+    // is written, and that the next one starts at resumeKey, or that the
+    // range is done if resumeKey is null, and saves the checkpoint
+    void addSegment(BucketEntry const* resumeKey);
+
+    // remove deletes the checkpoint, but not its segments
+    void remove();
+
+    std::string getSegmentFilename(size_t segment) const;
+
+    size_t
+    getSegments() const
+    {
+        return mSegments;
+    }
+
+    bool
+    isDone() const
+    {
+        return mDone;
+    }
+
+    BucketEntry const&
+    getResumeKey() const
+    {
+        return mResumeKey;
+    }
+};
+}
@@ -0,0 +1,195 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "bucket/MergeScheduler.h"
+#include "bucket/BucketList.h"
+#include "main/Application.h"
+#include "main/Config.h"
+#include "util/Logging.h"
+
+#include "medida/counter.h"
+#include "medida/meter.h"
+#include "medida/metrics_registry.h"
+#include "medida/timer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <tuple>
+
+namespace stellar
+{
+
+MergeScheduler::MergeScheduler(Application& app)
+    : mApp(app)
+    , mMaxDeepMerges(app.getConfig().MAX_CONCURRENT_DEEP_MERGES)
+    , mQueuedMerges(
+          app.getMetrics().NewCounter({"bucket", "merge-scheduler", "queued"}))
+    , mRunningMerges(
+          app.getMetrics().NewCounter({"bucket", "merge-scheduler", "running"}))
+    , mQueueDelay(app.getMetrics().NewTimer(
+          {"bucket", "merge-scheduler", "queue-delay"}))
+    , mLateMerges(app.getMetrics().NewMeter(
+          {"bucket", "merge-scheduler", "late"}, "merge"))
+{
+}
+
+uint32_t
+MergeScheduler::getDeadline(uint32_t currLedger, uint32_t level)
+{
+    // Level 0 is committed as soon as it is prepared; deeper levels are
+    // committed at the next spill of the level above
+    if (level == 0)
+    {
+        return currLedger;
+    }
+    uint64_t half = BucketList::levelHalf(level - 1);
+    uint64_t deadline = currLedger / half * half + half;
+    return static_cast<uint32_t>(std::min<uint64_t>(
+        deadline, std::numeric_limits<uint32_t>::max()));
+}
+
+bool
+MergeScheduler::isDeep(uint32_t level)
+{
+    return level >= DEEP_MERGE_LEVEL;
+}
+
+void
+MergeScheduler::schedule(std::function<void()> merge, uint32_t level,
+                         uint32_t deadline)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQueue.emplace_back(Merge{deadline, level, mNextSeq++,
+                                  std::chrono::steady_clock::now(),
+                                  std::move(merge)});
+        mQueuedMerges.inc();
+    }
+    post();
+}
+
+void
+MergeScheduler::post()
+{
+    mApp.postOnBackgroundThread([this]() { runNext(); },
+                                "MergeScheduler: merge");
+}
+
+void
+MergeScheduler::runNext()
+{
+    Merge merge;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        // Every posted run takes one merge from the queue, so there is one
+        // here, but it may be a deep merge that has to wait
+        bool deepAllowed = mRunningDeepMerges < mMaxDeepMerges;
+        auto next = mQueue.end();
+        for (auto it = mQueue.begin(); it != mQueue.end(); ++it)
+        {
+            if (!deepAllowed && isDeep(it->level) && !it->promoted)
+            {
+                continue;
+            }
+            if (next == mQueue.end() ||
+                std::make_tuple(!it->promoted, it->deadline, it->level,
+                                it->seq) <
+                    std::make_tuple(!next->promoted, next->deadline,
+                                    next->level, next->seq))
+            {
+                next = it;
+            }
+        }
+        if (next == mQueue.end())
+        {
+            assert(!mQueue.empty());
+            ++mDeferredRuns;
+            return;
+        }
+        merge = std::move(*next);
+        mQueue.erase(next);
+        if (isDeep(merge.level))
+        {
+            ++mRunningDeepMerges;
+        }
+        mQueuedMerges.dec();
+        mRunningMerges.inc();
+    }
+
+    mQueueDelay.Update(std::chrono::steady_clock::now() - merge.queued);
+    CLOG(TRACE, "Bucket") << "Running merge into level " << merge.level
+                          << " due at ledger " << merge.deadline;
+    // The merge is a packaged task, which keeps its exceptions in its future
+    merge.run();
+
+    bool postDeferred = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRunningMerges.dec();
+        if (isDeep(merge.level))
+        {
+            --mRunningDeepMerges;
+            if (mDeferredRuns > 0)
+            {
+                --mDeferredRuns;
+                postDeferred = true;
+            }
+        }
+    }
+    if (postDeferred)
+    {
+        post();
+    }
+}
+
+void
+MergeScheduler::promote(uint32_t level)
+{
+    bool postDeferred = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        bool found = false;
+        for (auto& merge : mQueue)
+        {
+            if (merge.level == level && !merge.promoted)
+            {
+                merge.promoted = true;
+                found = true;
+            }
+        }
+        // If it is a deep merge over the limit, the run that was posted for it
+        // may have been left for a deep merge to finish
+        if (found && mDeferredRuns > 0)
+        {
+            --mDeferredRuns;
+            postDeferred = true;
+        }
+    }
+    if (postDeferred)
+    {
+        post();
+    }
+}
+
+void
+MergeScheduler::mergeWasLate(uint32_t level, std::chrono::nanoseconds wait)
+{
+    mLateMerges.Mark();
+    auto& lateness = mApp.getMetrics().NewTimer(
+        {"bucket", "merge-lateness", "level-" + std::to_string(level)});
+    lateness.Update(wait);
+    CLOG(DEBUG, "Perf")
+        << "Merge into level " << level << " was not done when needed, waited "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(wait).count()
+        << "ms";
+}
+
+size_t
+MergeScheduler::getQueueSize()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mQueue.size();
+}
+}
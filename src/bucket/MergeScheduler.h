@@ -0,0 +1,97 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/NonCopyable.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace medida
+{
+class Counter;
+class Meter;
+class Timer;
+}
+
+namespace stellar
+{
+
+class Application;
+
+// MergeScheduler runs the merges of the bucket list on the background
+// threads, most urgent first. The deadline of a merge is the ledger at which
+// its level spills and its output is needed: a merge that is not done by then
+// blocks the ledger close. Merges are posted to the background threads with
+// everything else, but when a thread picks one up it runs the queued merge
+// with the earliest deadline, so that a merge that must be done in a few
+// ledgers does not wait behind one that has hours to finish.
+//
+// Merges into levels from DEEP_MERGE_LEVEL down are long and, once split in
+// ranges, use several threads each, so at most MAX_CONCURRENT_DEEP_MERGES of
+// them run at once; the others wait for one to finish. A merge that the
+// ledger close is waiting for is promoted: it runs before every other merge,
+// regardless of that limit.
+class MergeScheduler : public NonMovableOrCopyable
+{
+  public:
+    static uint32_t const DEEP_MERGE_LEVEL = 6;
+
+  private:
+    struct Merge
+    {
+        uint32_t deadline;
+        uint32_t level;
+        uint64_t seq;
+        std::chrono::steady_clock::time_point queued;
+        std::function<void()> run;
+        bool promoted{false};
+    };
+
+    Application& mApp;
+    uint32_t const mMaxDeepMerges;
+
+    std::mutex mMutex;
+    std::vector<Merge> mQueue;
+    uint64_t mNextSeq{0};
+    uint32_t mRunningDeepMerges{0};
+    // Threads that found only deep merges in the queue while the deep merges
+    // were all running, and left them for the next deep merge to finish
+    uint32_t mDeferredRuns{0};
+
+    medida::Counter& mQueuedMerges;
+    medida::Counter& mRunningMerges;
+    medida::Timer& mQueueDelay;
+    medida::Meter& mLateMerges;
+
+    static bool isDeep(uint32_t level);
+    void post();
+    void runNext();
+
+  public:
+    explicit MergeScheduler(Application& app);
+
+    // getDeadline returns the ledger at which a merge into level, running
+    // at currLedger, is needed
+    static uint32_t getDeadline(uint32_t currLedger, uint32_t level);
+
+    // schedule queues merge, which will run on a background thread
+    void schedule(std::function<void()> merge, uint32_t level,
+                  uint32_t deadline);
+
+    // promote is called before waiting for the merge into level, so that it
+    // runs as soon as a background thread is free if it is still queued
+    void promote(uint32_t level);
+
+    // mergeWasLate records that the merge into level was not done when it was
+    // needed, and blocked the ledger close for wait
+    void mergeWasLate(uint32_t level, std::chrono::nanoseconds wait);
+
+    size_t getQueueSize();
+};
+}
@@ -0,0 +1,128 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "bucket/MergedBucketIterator.h"
+#include "bucket/Bucket.h"
+#include "bucket/BucketIndex.h"
+#include "bucket/LedgerCmp.h"
+
+namespace stellar
+{
+
+namespace
+{
+BucketEntry
+keyEntry(LedgerKey const& key)
+{
+    BucketEntry entry(DEADENTRY);
+    entry.deadEntry() = key;
+    return entry;
+}
+}
+
+MergedBucketIterator::MergedBucketIterator(
+    std::vector<std::shared_ptr<Bucket const>> const& buckets,
+    LedgerKey const* begin, LedgerKey const* end)
+{
+    BucketEntryIdCmp cmp;
+    for (auto const& bucket : buckets)
+    {
+        auto it = std::make_unique<BucketInputIterator>(bucket);
+        if (end)
+        {
+            it->setEnd(keyEntry(*end));
+        }
+        if (begin && *it)
+        {
+            // The page of begin is the last one that starts at or before it
+            size_t pageBegin, pageEnd;
+            if (bucket->getIndex().findPage(*begin, pageBegin, pageEnd))
+            {
+                it->seek(pageBegin);
+            }
+            auto beginEntry = keyEntry(*begin);
+            while (*it && cmp(**it, beginEntry))
+            {
+                ++(*it);
+            }
+        }
+        mIters.emplace_back(std::move(it));
+    }
+    findCurrent();
+}
+
+void
+MergedBucketIterator::findCurrent()
+{
+    // The current entry is the least key, from the newest bucket that holds
+    // it
+    BucketEntryIdCmp cmp;
+    mCurrent = mIters.size();
+    for (size_t i = 0; i < mIters.size(); ++i)
+    {
+        auto& it = *mIters[i];
+        if (it && (mCurrent == mIters.size() || cmp(*it, **mIters[mCurrent])))
+        {
+            mCurrent = i;
+        }
+    }
+}
+
+MergedBucketIterator::operator bool() const
+{
+    return mCurrent < mIters.size();
+}
+
+BucketEntry const& MergedBucketIterator::operator*()
+{
+    return **mIters[mCurrent];
+}
+
+MergedBucketIterator& MergedBucketIterator::operator++()
+{
+    // Every other iterator at the current key is at an entry it shadows,
+    // since no iterator is at a lesser key
+    BucketEntryIdCmp cmp;
+    auto const& current = **mIters[mCurrent];
+    for (size_t i = 0; i < mIters.size(); ++i)
+    {
+        auto& it = *mIters[i];
+        if (i != mCurrent && it && !cmp(current, *it))
+        {
+            ++it;
+        }
+    }
+    ++(*mIters[mCurrent]);
+    findCurrent();
+    return *this;
+}
+
+BucketMetadata const&
+MergedBucketIterator::getMetadata(size_t bucketIndex) const
+{
+    return mIters.at(bucketIndex)->getMetadata();
+}
+
+size_t
+MergedBucketIterator::pos()
+{
+    size_t res = 0;
+    for (auto& it : mIters)
+    {
+        res += it->pos();
+    }
+    return res;
+}
+
+size_t
+MergedBucketIterator::size() const
+{
+    size_t res = 0;
+    for (auto const& it : mIters)
+    {
+        res += it->size();
+    }
+    return res;
+}
+}
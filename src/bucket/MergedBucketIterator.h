@@ -0,0 +1,59 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "bucket/BucketInputIterator.h"
+#include "util/NonCopyable.h"
+
+#include <memory>
+#include <vector>
+
+namespace stellar
+{
+
+class Bucket;
+
+// MergedBucketIterator reads several buckets, ordered from the newest to the
+// oldest, as if they were merged with newest-wins semantics: it returns every
+// key once, in order, with its entry in the newest bucket that holds it, and
+// skips the entries that this one shadows in older buckets.
+//
+// It can be limited to a range of keys, which is located in each bucket
+// through the index of the bucket rather than by scanning it.
+class MergedBucketIterator : public NonMovableOrCopyable
+{
+    std::vector<std::unique_ptr<BucketInputIterator>> mIters;
+    // The iterator of the current entry, or mIters.size() at the end
+    size_t mCurrent;
+
+    void findCurrent();
+
+  public:
+    // Iterates from the first key not less than *begin, if begin is not
+    // null, and stops before the first key not less than *end, if end is not
+    // null
+    MergedBucketIterator(
+        std::vector<std::shared_ptr<Bucket const>> const& buckets,
+        LedgerKey const* begin = nullptr, LedgerKey const* end = nullptr);
+
+    operator bool() const;
+    BucketEntry const& operator*();
+    MergedBucketIterator& operator++();
+
+    // getBucketIndex returns the index, in the buckets this was constructed
+    // with, of the bucket of the current entry
+    size_t
+    getBucketIndex() const
+    {
+        return mCurrent;
+    }
+
+    BucketMetadata const& getMetadata(size_t bucketIndex) const;
+
+    // The number of bytes read and to read in all the buckets
+    size_t pos();
+    size_t size() const;
+};
+}
@@ -172,6 +172,102 @@ TEST_CASE("bucket list", "[bucket][bucketlist]")
     }
 }
 
+TEST_CASE("bucket list entry lookups", "[bucket][bucketlist][bucketindex]")
+{
+    VirtualClock clock;
+    Config const& cfg = getTestConfig();
+    for_versions_with_differing_bucket_logic(cfg, [&](Config const& cfg) {
+        Application::pointer app = createTestApplication(clock, cfg);
+        BucketList bl;
+        std::map<LedgerKey, LedgerEntry, LedgerEntryIdCmp> current;
+        std::vector<LedgerKey> deleted;
+
+        auto checkEntry = [&](LedgerKey const& key) {
+            auto entry = bl.getLedgerEntry(key);
+            auto i = current.find(key);
+            if (i == current.end())
+            {
+                REQUIRE(!entry);
+            }
+            else
+            {
+                REQUIRE(entry);
+                REQUIRE(*entry == i->second);
+            }
+        };
+
+        for (uint32_t ledger = 1; ledger < 200; ++ledger)
+        {
+            app->getClock().crank(false);
+            std::vector<LedgerEntry> initEntries;
+            std::vector<LedgerEntry> liveEntries;
+            std::vector<LedgerKey> deadEntries;
+            std::set<LedgerKey, LedgerEntryIdCmp> created;
+            for (auto& e : LedgerTestUtils::generateValidLedgerEntries(5))
+            {
+                auto key = LedgerEntryKey(e);
+                if (current.find(key) == current.end() &&
+                    std::find(deleted.begin(), deleted.end(), key) ==
+                        deleted.end() &&
+                    created.insert(key).second)
+                {
+                    e.lastModifiedLedgerSeq = ledger;
+                    initEntries.emplace_back(e);
+                }
+            }
+            // Update and delete some of the entries of earlier ledgers
+            for (auto i = current.begin();
+                 i != current.end() && liveEntries.size() + deadEntries.size() <
+                                           initEntries.size();
+                 ++i)
+            {
+                if (rand_flip())
+                {
+                    i->second.lastModifiedLedgerSeq = ledger;
+                    liveEntries.emplace_back(i->second);
+                }
+                else if (rand_flip())
+                {
+                    deadEntries.emplace_back(i->first);
+                }
+            }
+            for (auto const& e : initEntries)
+            {
+                current.emplace(LedgerEntryKey(e), e);
+            }
+            for (auto const& key : deadEntries)
+            {
+                current.erase(key);
+                deleted.emplace_back(key);
+            }
+            bl.addBatch(*app, ledger, getAppLedgerVersion(app), initEntries,
+                        liveEntries, deadEntries);
+
+            for (auto const& e : liveEntries)
+            {
+                checkEntry(LedgerEntryKey(e));
+            }
+            for (auto const& key : deadEntries)
+            {
+                checkEntry(key);
+            }
+        }
+
+        for (auto const& kv : current)
+        {
+            checkEntry(kv.first);
+        }
+        for (auto const& key : deleted)
+        {
+            checkEntry(key);
+        }
+        for (auto const& e : LedgerTestUtils::generateValidLedgerEntries(20))
+        {
+            checkEntry(LedgerEntryKey(e));
+        }
+    });
+}
+
 TEST_CASE("bucket list shadowing pre/post proto 12", "[bucket][bucketlist]")
 {
     VirtualClock clock;
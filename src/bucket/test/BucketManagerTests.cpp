@@ -14,7 +14,11 @@
 #include "bucket/BucketInputIterator.h"
 #include "bucket/BucketManager.h"
 #include "bucket/BucketManagerImpl.h"
+#include "bucket/BucketOutputIterator.h"
 #include "bucket/BucketTests.h"
+#include "bucket/MergeCheckpoint.h"
+#include "bucket/MergeScheduler.h"
+#include "history/HistoryArchive.h"
 #include "history/HistoryArchiveManager.h"
 #include "ledger/LedgerTxn.h"
 #include "ledger/test/LedgerTestUtils.h"
@@ -22,12 +26,14 @@
 #include "main/Application.h"
 #include "main/Config.h"
 #include "main/ExternalQueue.h"
+#include "main/PersistentState.h"
 #include "test/TestUtils.h"
 #include "test/test.h"
 #include "util/Math.h"
 #include "util/Timer.h"
 
 #include <cstdio>
+#include <future>
 
 using namespace stellar;
 using namespace BucketTests;
@@ -341,6 +347,45 @@ TEST_CASE("bucketmanager ownership", "[bucket][bucketmanager]")
     });
 }
 
+TEST_CASE("bucketmanager retains buckets of last closed ledger",
+          "[bucket][bucketmanager]")
+{
+    VirtualClock clock;
+    Config const& cfg = getTestConfig();
+    Application::pointer app = createTestApplication(clock, cfg);
+    BucketManager& bm = app->getBucketManager();
+    BucketList& bl = bm.getBucketList();
+
+    // As LedgerManager does when it stores a ledger
+    auto storeLastClosedLedgerHAS = [&]() {
+        HistoryArchiveState has(1, bl);
+        app->getPersistentState().setState(
+            PersistentState::kHistoryArchiveState, has.toString());
+        bm.setLastClosedLedgerHAS(has);
+    };
+
+    std::vector<LedgerEntry> live(
+        LedgerTestUtils::generateValidLedgerEntries(10));
+    std::vector<LedgerKey> dead{};
+    bl.addBatch(*app, 1, getAppLedgerVersion(app), {}, live, dead);
+    clearFutures(app, bl);
+    storeLastClosedLedgerHAS();
+    std::string filename = bl.getLevel(0).getCurr()->getFilename();
+
+    // Replaced in the bucket list, the bucket is still referenced by the last
+    // closed ledger
+    live[0] = LedgerTestUtils::generateValidLedgerEntry(10);
+    bl.addBatch(*app, 1, getAppLedgerVersion(app), {}, live, dead);
+    clearFutures(app, bl);
+    bm.forgetUnreferencedBuckets();
+    CHECK(fs::exists(filename));
+
+    // Until the next one is stored
+    storeLastClosedLedgerHAS();
+    bm.forgetUnreferencedBuckets();
+    CHECK(!fs::exists(filename));
+}
+
 TEST_CASE("bucketmanager missing buckets fail", "[bucket][bucketmanager]")
 {
     Config cfg(getTestConfig(0, Config::TESTDB_ON_DISK_SQLITE));
@@ -587,6 +632,114 @@ TEST_CASE("bucketmanager reattach HAS from publish queue to finished merge",
     }
 }
 
+TEST_CASE("bucketmanager reattach to merge finished before restart",
+          "[bucket][bucketmanager]")
+{
+    Config cfg(getTestConfig(0, Config::TESTDB_ON_DISK_SQLITE));
+    std::unique_ptr<MergeKey> mk;
+    Hash output;
+    {
+        VirtualClock clock;
+        Application::pointer app = createTestApplication(clock, cfg);
+        BucketManager& bm = app->getBucketManager();
+        auto vers = getAppLedgerVersion(app);
+        auto b1 = Bucket::fresh(
+            bm, vers, {}, LedgerTestUtils::generateValidLedgerEntries(10), {},
+            /*countMergeEvents=*/true, /*doFsync=*/true);
+        auto b2 = Bucket::fresh(
+            bm, vers, {}, LedgerTestUtils::generateValidLedgerEntries(10), {},
+            /*countMergeEvents=*/true, /*doFsync=*/true);
+        auto merged = Bucket::merge(bm, vers, b1, b2, {},
+                                    /*keepDeadEntries=*/true,
+                                    /*countMergeEvents=*/true,
+                                    /*doFsync=*/true);
+        mk = std::make_unique<MergeKey>(
+            vers, true, b1, b2, std::vector<std::shared_ptr<Bucket>>{});
+        output = merged->getHash();
+    }
+
+    VirtualClock clock;
+    Application::pointer app =
+        createTestApplication(clock, cfg, /*newDB=*/false);
+    BucketManager& bm = app->getBucketManager();
+    auto future = bm.getMergeFuture(*mk);
+    REQUIRE(future.valid());
+    REQUIRE(future.get()->getHash() == output);
+    REQUIRE(bm.readMergeCounters().mFinishedMergeReattachments == 1);
+}
+
+TEST_CASE("bucket merge resumes from its checkpoints",
+          "[bucket][bucketmanager]")
+{
+    VirtualClock clock;
+    Config cfg0(getTestConfig(0));
+    cfg0.BUCKET_MERGE_CHECKPOINT_SIZE = 0;
+    Config cfg1(getTestConfig(1));
+    cfg1.BUCKET_MERGE_CHECKPOINT_SIZE = 1;
+    Application::pointer app0 = createTestApplication(clock, cfg0);
+    Application::pointer app1 = createTestApplication(clock, cfg1);
+    BucketManager& bm = app1->getBucketManager();
+    auto vers = getAppLedgerVersion(app1);
+
+    auto live1 = LedgerTestUtils::generateValidLedgerEntries(5000);
+    auto live2 = LedgerTestUtils::generateValidLedgerEntries(5000);
+    auto merge = [&](Application& app, size_t ranges) {
+        auto& appBm = app.getBucketManager();
+        auto b1 = Bucket::fresh(appBm, vers, {}, live1, {},
+                                /*countMergeEvents=*/false,
+                                /*doFsync=*/false);
+        auto b2 = Bucket::fresh(appBm, vers, {}, live2, {},
+                                /*countMergeEvents=*/false,
+                                /*doFsync=*/false);
+        REQUIRE(b1->getSize() + b2->getSize() >= 1024 * 1024);
+        return Bucket::merge(appBm, vers, b1, b2, {},
+                             /*keepDeadEntries=*/true,
+                             /*countMergeEvents=*/true, /*doFsync=*/false,
+                             ranges);
+    };
+
+    // Checkpoints do not change the merged bucket
+    auto expected = merge(*app0, 1);
+    REQUIRE(merge(*app1, 1)->getHash() == expected->getHash());
+    REQUIRE(merge(*app1, 4)->getHash() == expected->getHash());
+
+    // Checkpoint half of the merge, as if it was stopped by a restart
+    std::vector<BucketEntry> entries;
+    for (BucketInputIterator in(expected); in; ++in)
+    {
+        entries.emplace_back(*in);
+    }
+    size_t half = entries.size() / 2;
+    MergeCounters mc;
+    BucketMetadata meta;
+    meta.ledgerVersion = vers;
+    BucketOutputIterator segment(bm.getTmpDir(), /*keepDeadEntries=*/true,
+                                 meta, mc, /*doFsync=*/false,
+                                 /*isSegment=*/true);
+    for (size_t i = 0; i < half; ++i)
+    {
+        segment.put(entries[i]);
+    }
+    auto b1 = Bucket::fresh(bm, vers, {}, live1, {}, false, false);
+    auto b2 = Bucket::fresh(bm, vers, {}, live2, {}, false, false);
+    MergeCheckpoint checkpoint(
+        bm.getMergeCheckpointDir(),
+        MergeKey(vers, true, b1, b2, std::vector<std::shared_ptr<Bucket>>{}),
+        1, 0, /*doFsync=*/false);
+    segment.closeSegment(checkpoint.getSegmentFilename(0),
+                         bm.getMergeCheckpointDir(), /*doFsync=*/false);
+    checkpoint.addSegment(&entries[half]);
+
+    // The merge only puts what is left, and deletes the checkpoint
+    auto puts = bm.readMergeCounters().mOutputIteratorBufferUpdates;
+    REQUIRE(merge(*app1, 1)->getHash() == expected->getHash());
+    puts = bm.readMergeCounters().mOutputIteratorBufferUpdates - puts;
+    REQUIRE(puts >= entries.size() - half);
+    REQUIRE(puts <= entries.size() - half + 1);
+    REQUIRE(!checkpoint.load());
+    REQUIRE(!fs::exists(checkpoint.getSegmentFilename(0)));
+}
+
 // Running one of these tests involves comparing three timelines with different
 // application lifecycles for identical outcomes.
 //
@@ -1271,6 +1424,125 @@ class StopAndRestartBucketMergesTest
     }
 };
 
+TEST_CASE("merge deadlines are the next spills", "[bucket][bucketmanager]")
+{
+    for (uint32_t level = 1; level < 6; ++level)
+    {
+        uint32_t prepared = 0;
+        for (uint32_t ledger = 1; ledger < 5000; ++ledger)
+        {
+            if (!BucketList::levelShouldSpill(ledger, level - 1))
+            {
+                continue;
+            }
+            if (prepared != 0)
+            {
+                REQUIRE(MergeScheduler::getDeadline(prepared, level) ==
+                        ledger);
+                REQUIRE(MergeScheduler::getDeadline(ledger - 1, level) ==
+                        ledger);
+            }
+            prepared = ledger;
+        }
+    }
+    REQUIRE(MergeScheduler::getDeadline(17, 0) == 17);
+}
+
+TEST_CASE("merge scheduler runs the most urgent merges first",
+          "[bucket][bucketmanager]")
+{
+    VirtualClock clock;
+    Config cfg(getTestConfig());
+    cfg.WORKER_THREADS = 1;
+    Application::pointer app = createTestApplication(clock, cfg);
+    auto& scheduler = app->getBucketManager().getMergeScheduler();
+
+    // Hold the only worker thread while the merges are queued
+    std::promise<void> gate;
+    auto gateFuture = gate.get_future().share();
+    app->postOnBackgroundThread([gateFuture]() { gateFuture.wait(); },
+                                "test: gate");
+
+    std::mutex mutex;
+    std::vector<std::string> order;
+    auto merge = [&](std::string name) {
+        return [&mutex, &order, name]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.emplace_back(name);
+        };
+    };
+    std::promise<void> done;
+    scheduler.schedule(merge("late"), 3, 100);
+    scheduler.schedule(merge("soon-level-2"), 2, 10);
+    scheduler.schedule(merge("soon-level-1"), 1, 10);
+    scheduler.schedule(merge("deep"), MergeScheduler::DEEP_MERGE_LEVEL, 50);
+    scheduler.schedule([&done]() { done.set_value(); }, 4, 1000);
+    REQUIRE(scheduler.getQueueSize() == 5);
+
+    gate.set_value();
+    REQUIRE(done.get_future().wait_for(std::chrono::seconds(10)) ==
+            std::future_status::ready);
+    REQUIRE(order == std::vector<std::string>{"soon-level-1", "soon-level-2",
+                                              "deep", "late"});
+    REQUIRE(scheduler.getQueueSize() == 0);
+}
+
+TEST_CASE("merge scheduler limits concurrent deep merges",
+          "[bucket][bucketmanager]")
+{
+    VirtualClock clock;
+    Config cfg(getTestConfig());
+    cfg.WORKER_THREADS = 3;
+    cfg.MAX_CONCURRENT_DEEP_MERGES = 1;
+    Application::pointer app = createTestApplication(clock, cfg);
+    auto& scheduler = app->getBucketManager().getMergeScheduler();
+    auto deep = MergeScheduler::DEEP_MERGE_LEVEL;
+    auto wait = [](std::future<void>& f) {
+        return f.wait_for(std::chrono::seconds(10)) ==
+               std::future_status::ready;
+    };
+
+    std::promise<void> firstStarted, releaseFirst, secondRan, shallowRan;
+    auto release = releaseFirst.get_future().share();
+    scheduler.schedule(
+        [&firstStarted, release]() {
+            firstStarted.set_value();
+            release.wait();
+        },
+        deep, 10);
+    auto first = firstStarted.get_future();
+    REQUIRE(wait(first));
+
+    scheduler.schedule([&secondRan]() { secondRan.set_value(); }, deep + 1,
+                       20);
+    scheduler.schedule([&shallowRan]() { shallowRan.set_value(); }, 2, 30);
+
+    // The shallow merge runs, the second deep one waits for the first
+    auto shallow = shallowRan.get_future();
+    REQUIRE(wait(shallow));
+    auto second = secondRan.get_future();
+    REQUIRE(second.wait_for(std::chrono::milliseconds(100)) ==
+            std::future_status::timeout);
+    REQUIRE(scheduler.getQueueSize() == 1);
+
+    SECTION("the second deep merge waits for the first")
+    {
+        releaseFirst.set_value();
+        REQUIRE(wait(second));
+    }
+
+    SECTION("a promoted deep merge does not wait for the first")
+    {
+        // The ledger close waits for the second deep merge, which runs while
+        // the first one still holds the only deep merge slot
+        scheduler.promote(deep + 1);
+        bool ran = wait(second);
+        releaseFirst.set_value();
+        REQUIRE(ran);
+    }
+    REQUIRE(scheduler.getQueueSize() == 0);
+}
+
 TEST_CASE("bucket persistence over app restart with initentry",
           "[bucket][bucketmanager][bp-initentry][!hide]")
 {
@@ -13,7 +13,10 @@
 #include "util/asio.h"
 #include "bucket/BucketTests.h"
 #include "bucket/Bucket.h"
+#include "bucket/BucketApplicator.h"
+#include "bucket/BucketIndex.h"
 #include "bucket/BucketInputIterator.h"
+#include "bucket/MergedBucketIterator.h"
 #include "ledger/LedgerTxn.h"
 #include "ledger/test/LedgerTestUtils.h"
 #include "lib/catch.hpp"
@@ -137,17 +140,23 @@ TEST_CASE("file backed buckets", "[bucket][bucketbench]")
             for (auto& e : dead)
                 e = deadGen(3);
             {
+                auto b2 = Bucket::fresh(app->getBucketManager(),
+                                        getAppLedgerVersion(app), {}, live,
+                                        dead, /*countMergeEvents=*/true,
+                                        /*doFsync=*/true);
+                auto start = std::chrono::steady_clock::now();
                 b1 = Bucket::merge(app->getBucketManager(),
                                    app->getConfig().LEDGER_PROTOCOL_VERSION, b1,
-                                   Bucket::fresh(app->getBucketManager(),
-                                                 getAppLedgerVersion(app), {},
-                                                 live, dead,
-                                                 /*countMergeEvents=*/true,
-                                                 /*doFsync=*/true),
-                                   /*shadows=*/{},
+                                   b2, /*shadows=*/{},
                                    /*keepDeadEntries=*/true,
                                    /*countMergeEvents=*/true,
                                    /*doFsync=*/true);
+                CLOG(DEBUG, "Bucket")
+                    << "Merged in "
+                    << std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count()
+                    << "us";
             }
         }
         CLOG(DEBUG, "Bucket")
@@ -278,6 +287,89 @@ TEST_CASE("merging bucket entries", "[bucket]")
     });
 }
 
+TEST_CASE("merging bucket entries in ranges", "[bucket][bucketrange]")
+{
+    VirtualClock clock;
+    Config const& cfg = getTestConfig();
+    for_versions_with_differing_bucket_logic(cfg, [&](Config const& cfg) {
+        Application::pointer app = createTestApplication(clock, cfg);
+        auto& bm = app->getBucketManager();
+        auto vers = getAppLedgerVersion(app);
+
+        std::vector<LedgerEntry> oldLive(2000);
+        for (auto& e : oldLive)
+        {
+            e = LedgerTestUtils::generateValidLedgerEntry(5);
+        }
+        std::vector<LedgerEntry> newLive;
+        std::vector<LedgerKey> newDead;
+        std::vector<LedgerEntry> shadowLive;
+        for (auto const& e : oldLive)
+        {
+            switch (rand_uniform(0, 3))
+            {
+            case 0:
+                newLive.emplace_back(
+                    LedgerTestUtils::generateValidLedgerEntry(5));
+                break;
+            case 1:
+                newDead.emplace_back(LedgerEntryKey(e));
+                break;
+            case 2:
+                shadowLive.emplace_back(e);
+                break;
+            default:
+                break;
+            }
+        }
+
+        auto bOld = Bucket::fresh(bm, vers, {}, oldLive, {},
+                                  /*countMergeEvents=*/true,
+                                  /*doFsync=*/false);
+        auto bNew = Bucket::fresh(bm, vers, {}, newLive, newDead,
+                                  /*countMergeEvents=*/true,
+                                  /*doFsync=*/false);
+        std::vector<std::shared_ptr<Bucket>> shadows;
+        if (vers < Bucket::FIRST_PROTOCOL_SHADOWS_REMOVED)
+        {
+            shadows.emplace_back(Bucket::fresh(bm, vers, {}, shadowLive, {},
+                                               /*countMergeEvents=*/true,
+                                               /*doFsync=*/false));
+        }
+
+        auto merge = [&](size_t ranges, bool keepDeadEntries) {
+            return Bucket::merge(bm, vers, bOld, bNew, shadows,
+                                 keepDeadEntries,
+                                 /*countMergeEvents=*/true,
+                                 /*doFsync=*/false, ranges);
+        };
+        for (bool keepDeadEntries : {true, false})
+        {
+            auto serial = merge(1, keepDeadEntries);
+            for (size_t ranges : {2, 5, 64, 1000})
+            {
+                auto merged = merge(ranges, keepDeadEntries);
+                REQUIRE(merged->getHash() == serial->getHash());
+                REQUIRE(countEntries(merged) == countEntries(serial));
+            }
+        }
+
+        SECTION("with an empty input")
+        {
+            auto empty = std::make_shared<Bucket>();
+            auto serial = Bucket::merge(bm, vers, bOld, empty, {},
+                                        /*keepDeadEntries=*/true,
+                                        /*countMergeEvents=*/true,
+                                        /*doFsync=*/false);
+            auto merged = Bucket::merge(bm, vers, empty, bOld, {},
+                                        /*keepDeadEntries=*/true,
+                                        /*countMergeEvents=*/true,
+                                        /*doFsync=*/false, 4);
+            REQUIRE(merged->getHash() == serial->getHash());
+        }
+    });
+}
+
 static LedgerEntry
 generateAccount()
 {
@@ -328,6 +420,131 @@ generateDifferentAccount(std::vector<LedgerEntry> const& others)
     }
 }
 
+TEST_CASE("bucket index lookups", "[bucket][bucketindex]")
+{
+    VirtualClock clock;
+    Config const& cfg = getTestConfig();
+    Application::pointer app = createTestApplication(clock, cfg);
+    auto& bm = app->getBucketManager();
+    auto vers = getAppLedgerVersion(app);
+
+    std::set<LedgerKey, LedgerEntryIdCmp> keys;
+    auto generateKey = [&]() {
+        for (;;)
+        {
+            auto e = LedgerTestUtils::generateValidLedgerEntry(5);
+            if (keys.insert(LedgerEntryKey(e)).second)
+            {
+                return e;
+            }
+        }
+    };
+    std::vector<LedgerEntry> live(5000);
+    std::generate(live.begin(), live.end(), generateKey);
+    std::vector<LedgerKey> dead(500);
+    std::generate(dead.begin(), dead.end(),
+                  [&]() { return LedgerEntryKey(generateKey()); });
+
+    auto checkLookups = [&](std::shared_ptr<Bucket> const& b,
+                            size_t deletedLive) {
+        BucketEntry e;
+        for (size_t i = 0; i < live.size(); ++i)
+        {
+            auto key = LedgerEntryKey(live[i]);
+            REQUIRE(b->getBucketEntry(key, e));
+            if (i < deletedLive)
+            {
+                REQUIRE(e.type() == DEADENTRY);
+                REQUIRE(e.deadEntry() == key);
+            }
+            else
+            {
+                REQUIRE(e.type() == LIVEENTRY);
+                REQUIRE(e.liveEntry() == live[i]);
+            }
+        }
+        for (auto const& key : dead)
+        {
+            REQUIRE(b->getBucketEntry(key, e));
+            REQUIRE(e.type() == DEADENTRY);
+            REQUIRE(e.deadEntry() == key);
+        }
+
+        // Keys that are not in the bucket are not found, and most of them
+        // are not even read
+        size_t falsePositives = 0;
+        for (size_t i = 0; i < 1000; ++i)
+        {
+            auto key = LedgerEntryKey(generateKey());
+            REQUIRE(!b->getBucketEntry(key, e));
+            if (b->getIndex().mayContain(key))
+            {
+                ++falsePositives;
+            }
+        }
+        REQUIRE(falsePositives < 50);
+    };
+
+    auto b = Bucket::fresh(bm, vers, {}, live, dead,
+                           /*countMergeEvents=*/true, /*doFsync=*/false);
+    auto indexFilename = BucketIndex::getFilename(b->getFilename());
+    REQUIRE(fs::exists(indexFilename));
+
+    SECTION("index built while writing")
+    {
+        REQUIRE(b->getIndex().getPageCount() > 1);
+        checkLookups(b, 0);
+    }
+
+    SECTION("index read from its file")
+    {
+        auto copy = std::make_shared<Bucket>(b->getFilename(), b->getHash());
+        checkLookups(copy, 0);
+        REQUIRE(copy->getIndex().getPageCount() ==
+                b->getIndex().getPageCount());
+    }
+
+    SECTION("index built again when missing or unreadable")
+    {
+        std::remove(indexFilename.c_str());
+        auto copy = std::make_shared<Bucket>(b->getFilename(), b->getHash());
+        checkLookups(copy, 0);
+        REQUIRE(fs::exists(indexFilename));
+
+        {
+            std::ofstream out(indexFilename, std::ofstream::binary);
+            out << "not an index";
+        }
+        copy = std::make_shared<Bucket>(b->getFilename(), b->getHash());
+        checkLookups(copy, 0);
+    }
+
+    SECTION("index of a bucket merged in ranges")
+    {
+        std::vector<LedgerKey> deleted;
+        for (size_t i = 0; i < 1000; ++i)
+        {
+            deleted.emplace_back(LedgerEntryKey(live[i]));
+        }
+        auto bNew = Bucket::fresh(bm, vers, {}, {}, deleted,
+                                  /*countMergeEvents=*/true,
+                                  /*doFsync=*/false);
+        auto merged = Bucket::merge(bm, vers, b, bNew, /*shadows=*/{},
+                                    /*keepDeadEntries=*/true,
+                                    /*countMergeEvents=*/true,
+                                    /*doFsync=*/false, /*ranges=*/4);
+        REQUIRE(fs::exists(BucketIndex::getFilename(merged->getFilename())));
+        checkLookups(merged, deleted.size());
+    }
+
+    SECTION("empty bucket")
+    {
+        BucketEntry e;
+        REQUIRE(!std::make_shared<Bucket>()->getBucketEntry(
+            LedgerEntryKey(live.front()), e));
+    }
+}
+
 TEST_CASE("merges proceed old-style despite newer shadows",
           "[bucket][bucketmaxprotocol]")
 {
@@ -930,6 +1147,180 @@ TEST_CASE("bucket apply", "[bucket]")
     });
 }
 
+// generateBucketsToApply returns buckets, from the newest to the oldest, each
+// of which updates or deletes some of the entries of the older ones, and sets
+// newest to the newest entry of every key
+static std::vector<std::shared_ptr<Bucket const>>
+generateBucketsToApply(Application& app, std::vector<BucketEntry>& newest)
+{
+    auto& bm = app.getBucketManager();
+    auto vers = getAppLedgerVersion(app);
+    std::vector<std::shared_ptr<Bucket const>> buckets;
+    std::map<LedgerKey, BucketEntry, LedgerEntryIdCmp> newestByKey;
+    std::vector<LedgerEntry> entries;
+    std::unordered_set<LedgerKey> keys;
+    for (uint32_t ledger = 2; ledger < 6; ++ledger)
+    {
+        std::vector<LedgerEntry> live;
+        std::vector<LedgerKey> dead;
+        for (auto const& e : entries)
+        {
+            switch (rand_uniform(0, 3))
+            {
+            case 0:
+                live.emplace_back(e);
+                live.back().lastModifiedLedgerSeq = ledger;
+                break;
+            case 1:
+                dead.emplace_back(LedgerEntryKey(e));
+                break;
+            default:
+                break;
+            }
+        }
+        size_t updated = live.size();
+        for (size_t i = 0; i < 1000; ++i)
+        {
+            auto e = LedgerTestUtils::generateValidLedgerEntry(5);
+            if (keys.insert(LedgerEntryKey(e)).second)
+            {
+                e.lastModifiedLedgerSeq = ledger;
+                live.emplace_back(e);
+            }
+        }
+        entries.insert(entries.end(), live.begin() + updated, live.end());
+
+        for (auto const& e : live)
+        {
+            BucketEntry be(LIVEENTRY);
+            be.liveEntry() = e;
+            newestByKey[LedgerEntryKey(e)] = be;
+        }
+        for (auto const& k : dead)
+        {
+            BucketEntry be(DEADENTRY);
+            be.deadEntry() = k;
+            newestByKey[k] = be;
+        }
+        buckets.insert(buckets.begin(),
+                       Bucket::fresh(bm, vers, {}, live, dead,
+                                     /*countMergeEvents=*/true,
+                                     /*doFsync=*/false));
+    }
+
+    newest.clear();
+    for (auto const& kv : newestByKey)
+    {
+        newest.emplace_back(kv.second);
+    }
+    return buckets;
+}
+
+TEST_CASE("merged bucket iterator keeps the newest entries",
+          "[bucket][bucketapply]")
+{
+    VirtualClock clock;
+    Config const& cfg = getTestConfig();
+    Application::pointer app = createTestApplication(clock, cfg);
+
+    std::vector<BucketEntry> newest;
+    auto buckets = generateBucketsToApply(*app, newest);
+    // An empty bucket holds no key
+    buckets.insert(buckets.begin() + 1, std::make_shared<Bucket>());
+
+    std::vector<BucketEntry> merged;
+    for (MergedBucketIterator it(buckets); it; ++it)
+    {
+        merged.emplace_back(*it);
+    }
+    REQUIRE(merged == newest);
+
+    SECTION("in ranges")
+    {
+        for (size_t ranges : {1, 2, 16, 1000})
+        {
+            auto starts = BucketApplicator::getRangeStarts(buckets, ranges);
+            // Every type but the first starts a range
+            REQUIRE(starts.size() >= 3);
+
+            std::vector<BucketEntry> ranged;
+            for (size_t i = 0; i <= starts.size(); ++i)
+            {
+                auto begin = i > 0 ? &starts[i - 1] : nullptr;
+                auto end = i < starts.size() ? &starts[i] : nullptr;
+                for (MergedBucketIterator it(buckets, begin, end); it; ++it)
+                {
+                    ranged.emplace_back(*it);
+                }
+            }
+            REQUIRE(ranged == newest);
+        }
+    }
+}
+
+TEST_CASE("bucket apply writes the newest entries", "[bucket][bucketapply]")
+{
+    auto check = [](Application& app, std::vector<BucketEntry> const& newest) {
+        LedgerTxn ltx(app.getLedgerTxnRoot());
+        for (auto const& e : newest)
+        {
+            if (e.type() == DEADENTRY)
+            {
+                REQUIRE(!ltx.loadWithoutRecord(e.deadEntry()));
+            }
+            else
+            {
+                auto entry =
+                    ltx.loadWithoutRecord(LedgerEntryKey(e.liveEntry()));
+                REQUIRE(entry);
+                REQUIRE(entry.current() == e.liveEntry());
+            }
+        }
+    };
+
+    SECTION("on the main thread")
+    {
+        VirtualClock clock;
+        Application::pointer app =
+            createTestApplication(clock, getTestConfig());
+        app->start();
+
+        std::vector<BucketEntry> newest;
+        auto buckets = generateBucketsToApply(*app, newest);
+        BucketApplicator::Counters counters(clock.now());
+        BucketApplicator applicator(*app, getAppLedgerVersion(app), buckets);
+        size_t applied = 0;
+        while (applicator)
+        {
+            applied += applicator.advance(counters);
+        }
+        REQUIRE(applied == newest.size());
+        check(*app, newest);
+    }
+#ifdef USE_POSTGRES
+    SECTION("in parallel")
+    {
+        VirtualClock clock;
+        Application::pointer app = createTestApplication(
+            clock, getTestConfig(0, Config::TESTDB_POSTGRESQL));
+        app->start();
+
+        std::vector<BucketEntry> newest;
+        auto buckets = generateBucketsToApply(*app, newest);
+        auto& root = dynamic_cast<LedgerTxnRoot&>(app->getLedgerTxnRoot());
+        root.deleteObjectsModifiedOnOrAfterLedger(2);
+        BucketApplicator::Counters counters(clock.now());
+        root.beginBucketApply();
+        BucketApplicator::applyInParallel(*app, root, getAppLedgerVersion(app),
+                                          buckets, 4, counters);
+        // Nothing can read, and cache, entries until the apply is over
+        REQUIRE_THROWS_AS(LedgerTxn(root), std::runtime_error);
+        root.endBucketApply();
+        check(*app, newest);
+    }
+#endif
+}
+
 TEST_CASE("bucket apply bench", "[bucketbench][!hide]")
 {
     auto runtest = [](Config::TestDbMode mode) {
@@ -10,12 +10,14 @@
 #include "catchup/CatchupManager.h"
 #include "crypto/Hex.h"
 #include "crypto/SecretKey.h"
+#include "database/Database.h"
 #include "history/HistoryArchive.h"
 #include "historywork/Progress.h"
 #include "invariant/InvariantManager.h"
 #include "ledger/LedgerTxn.h"
 #include "main/Application.h"
 #include "util/format.h"
+#include <algorithm>
 #include <medida/meter.h>
 #include <medida/metrics_registry.h>
 
@@ -30,9 +32,6 @@ ApplyBucketsWork::ApplyBucketsWork(
     : BasicWork(app, "apply-buckets", BasicWork::RETRY_NEVER)
     , mBuckets(buckets)
     , mApplyState(applyState)
-    , mApplying(false)
-    , mTotalSize(0)
-    , mLevel(BucketList::kNumLevels - 1)
     , mMaxProtocolVersion(maxProtocolVersion)
     , mBucketApplyStart(app.getMetrics().NewMeter(
           {"history", "bucket-apply", "start"}, "event"))
@@ -62,98 +61,180 @@ ApplyBucketsWork::getBucket(std::string const& hash)
     return b;
 }
 
+std::vector<std::shared_ptr<Bucket const>>
+ApplyBucketsWork::getBuckets(size_t count) const
+{
+    std::vector<std::shared_ptr<Bucket const>> buckets;
+    for (size_t i = 0; i < count; ++i)
+    {
+        buckets.emplace_back(mBucketsToApply[i].bucket);
+    }
+    return buckets;
+}
+
 void
 ApplyBucketsWork::onReset()
 {
     CLOG(INFO, "History") << "Applying buckets";
 
+    mStarted = false;
     mTotalBuckets = 0;
-    mAppliedBuckets = 0;
     mAppliedEntries = 0;
-    mTotalSize = 0;
-    mAppliedSize = 0;
     mLastAppliedSizeMb = 0;
-    mLastPos = 0;
-
-    if (!isAborting())
-    {
-        auto addBucket = [this](std::shared_ptr<Bucket const> const& bucket) {
-            if (bucket->getSize() > 0)
-            {
-                mTotalBuckets++;
-                mTotalSize += bucket->getSize();
-            }
-        };
-
-        for (auto const& hsb : mApplyState.currentBuckets)
-        {
-            addBucket(getBucket(hsb.snap));
-            addBucket(getBucket(hsb.curr));
-        }
-    }
-
-    mLevel = BucketList::kNumLevels - 1;
-    mApplying = false;
 
     mDelayTimer.reset();
-    mSnapBucket.reset();
-    mCurrBucket.reset();
-    mSnapApplicator.reset();
-    mCurrApplicator.reset();
+    mBucketsToApply.clear();
+    mApplicator.reset();
+    mParallelApplyFailed = false;
+    mCheckedBuckets = 0;
 }
 
 void
-ApplyBucketsWork::startLevel()
+ApplyBucketsWork::startApply()
 {
-    assert(isLevelComplete());
+    // The deepest level that differs from the bucket list is applied, and so
+    // is every newer bucket, after the entries they replace are deleted
+    for (uint32_t i = BucketList::kNumLevels; i-- > 0;)
+    {
+        auto& level = getBucketLevel(i);
+        HistoryStateBucket const& hsb = mApplyState.currentBuckets.at(i);
 
-    CLOG(DEBUG, "History") << "ApplyBuckets : starting level " << mLevel;
-    auto& level = getBucketLevel(mLevel);
-    HistoryStateBucket const& i = mApplyState.currentBuckets.at(mLevel);
+        bool applying = !mBucketsToApply.empty();
+        bool applySnap = (hsb.snap != binToHex(level.getSnap()->getHash()));
+        bool applyCurr = (hsb.curr != binToHex(level.getCurr()->getHash()));
+        if (!applying && (applySnap || applyCurr))
+        {
+            uint32_t oldestLedger =
+                applySnap ? BucketList::oldestLedgerInSnap(
+                                mApplyState.currentLedger, i)
+                          : BucketList::oldestLedgerInCurr(
+                                mApplyState.currentLedger, i);
+            auto& lsRoot = mApp.getLedgerTxnRoot();
+            lsRoot.deleteObjectsModifiedOnOrAfterLedger(oldestLedger);
+        }
 
-    bool applySnap = (i.snap != binToHex(level.getSnap()->getHash()));
-    bool applyCurr = (i.curr != binToHex(level.getCurr()->getHash()));
-    if (!mApplying && (applySnap || applyCurr))
+        if (applying || applySnap)
+        {
+            CLOG(DEBUG, "History") << "ApplyBuckets : applying level[" << i
+                                   << "].snap = " << hsb.snap;
+            mBucketsToApply.emplace_back(
+                BucketToApply{getBucket(hsb.snap), i, false});
+            mBucketApplyStart.Mark();
+        }
+        if (applying || applySnap || applyCurr)
+        {
+            CLOG(DEBUG, "History") << "ApplyBuckets : applying level[" << i
+                                   << "].curr = " << hsb.curr;
+            mBucketsToApply.emplace_back(
+                BucketToApply{getBucket(hsb.curr), i, true});
+            mBucketApplyStart.Mark();
+        }
+    }
+    std::reverse(mBucketsToApply.begin(), mBucketsToApply.end());
+    for (auto const& b : mBucketsToApply)
     {
-        uint32_t oldestLedger = applySnap
-                                    ? BucketList::oldestLedgerInSnap(
-                                          mApplyState.currentLedger, mLevel)
-                                    : BucketList::oldestLedgerInCurr(
-                                          mApplyState.currentLedger, mLevel);
-        auto& lsRoot = mApp.getLedgerTxnRoot();
-        lsRoot.deleteObjectsModifiedOnOrAfterLedger(oldestLedger);
+        if (b.bucket->getSize() > 0)
+        {
+            ++mTotalBuckets;
+        }
+    }
+    if (mBucketsToApply.empty())
+    {
+        return;
     }
 
-    if (mApplying || applySnap)
+    // SQLite allows a single writer, so buckets are only applied in parallel
+    // on other databases
+    auto root = dynamic_cast<LedgerTxnRoot*>(&mApp.getLedgerTxnRoot());
+    auto threads = mApp.getConfig().BUCKET_APPLY_THREADS;
+    if (root && threads > 1 && !mApp.getDatabase().isSqlite())
     {
-        mSnapBucket = getBucket(i.snap);
-        mSnapApplicator = std::make_unique<BucketApplicator>(
-            mApp, mMaxProtocolVersion, mSnapBucket);
-        CLOG(DEBUG, "History") << "ApplyBuckets : starting level[" << mLevel
-                               << "].snap = " << i.snap;
-        mApplying = true;
-        mBucketApplyStart.Mark();
+        spawnParallelApply(*root, threads);
     }
-    if (mApplying || applyCurr)
+    else
     {
-        mCurrBucket = getBucket(i.curr);
-        mCurrApplicator = std::make_unique<BucketApplicator>(
-            mApp, mMaxProtocolVersion, mCurrBucket);
-        CLOG(DEBUG, "History") << "ApplyBuckets : starting level[" << mLevel
-                               << "].curr = " << i.curr;
-        mApplying = true;
-        mBucketApplyStart.Mark();
+        mApplicator = std::make_unique<BucketApplicator>(
+            mApp, mMaxProtocolVersion, getBuckets(mBucketsToApply.size()));
     }
 }
 
+void
+ApplyBucketsWork::spawnParallelApply(LedgerTxnRoot& root, size_t threads)
+{
+    // The connection pool is created on the main thread
+    mApp.getDatabase().getPool();
+    root.beginBucketApply();
+    mApplyingInParallel = true;
+
+    Application& app = mApp;
+    auto buckets = getBuckets(mBucketsToApply.size());
+    auto maxProtocolVersion = mMaxProtocolVersion;
+    uint32_t level = mBucketsToApply.back().level;
+    std::weak_ptr<ApplyBucketsWork> weak(
+        std::static_pointer_cast<ApplyBucketsWork>(shared_from_this()));
+    app.postOnBackgroundThread(
+        [&app, &root, buckets, maxProtocolVersion, threads, level, weak]() {
+            bool failed = false;
+            try
+            {
+                BucketApplicator::Counters counters(
+                    std::chrono::system_clock::now());
+                BucketApplicator::applyInParallel(app, root,
+                                                  maxProtocolVersion, buckets,
+                                                  threads, counters);
+                counters.logInfo("merged", level,
+                                 std::chrono::system_clock::now());
+            }
+            catch (std::exception const& e)
+            {
+                CLOG(ERROR, "History")
+                    << "Unable to apply buckets: " << e.what();
+                failed = true;
+            }
+
+            // BasicWork's state is not thread-safe, so the work is woken up
+            // on the main thread, where the root can be read again
+            app.postOnMainThread(
+                [&root, weak, failed]() {
+                    root.endBucketApply();
+                    auto self = weak.lock();
+                    if (self)
+                    {
+                        self->mApplyingInParallel = false;
+                        self->mParallelApplyFailed = failed;
+                        self->wakeUp();
+                    }
+                },
+                "ApplyBuckets: parallel apply done");
+        },
+        "ApplyBuckets: parallel apply");
+}
+
+void
+ApplyBucketsWork::checkNextBucket()
+{
+    // The newer buckets replaced the entries of the bucket they hold
+    auto const& b = mBucketsToApply[mCheckedBuckets];
+    mApp.getInvariantManager().checkOnBucketApply(
+        b.bucket, mApplyState.currentLedger, b.level, b.isCurr,
+        getBuckets(mCheckedBuckets));
+    ++mCheckedBuckets;
+    mBucketApplySuccess.Mark();
+}
+
 BasicWork::State
 ApplyBucketsWork::onRun()
 {
-    if (mLevel == BucketList::kNumLevels - 1 &&
-        !mApplyState.containsValidBuckets(mApp))
+    if (!mStarted)
     {
-        CLOG(ERROR, "History") << "Malformed HAS: unable to apply buckets";
-        return State::WORK_FAILURE;
+        if (!mApplyState.containsValidBuckets(mApp))
+        {
+            CLOG(ERROR, "History") << "Malformed HAS: unable to apply buckets";
+            return State::WORK_FAILURE;
+        }
+        mStarted = true;
+        startApply();
+        return mApplyingInParallel ? State::WORK_WAITING : State::WORK_RUNNING;
     }
 
     if (mResolveMerges && mDelayTimer)
@@ -185,50 +266,32 @@ ApplyBucketsWork::onRun()
         }
     }
 
-    // Check if we're at the beginning of the new level
-    if (isLevelComplete())
+    if (mApplyingInParallel)
     {
-        startLevel();
+        return State::WORK_WAITING;
     }
-
-    // The structure of these if statements is motivated by the following:
-    // 1. mCurrApplicator should never be advanced if mSnapApplicator is
-    //    not false. Otherwise it is possible for curr to modify the
-    //    database when the invariants for snap are checked.
-    // 2. There is no reason to advance mSnapApplicator or mCurrApplicator
-    //    if there is nothing to be applied.
-    if (mSnapApplicator)
+    if (mParallelApplyFailed)
     {
-        if (*mSnapApplicator)
-        {
-            advance("snap", *mSnapApplicator);
-            return State::WORK_RUNNING;
-        }
-        mApp.getInvariantManager().checkOnBucketApply(
-            mSnapBucket, mApplyState.currentLedger, mLevel, false);
-        mSnapApplicator.reset();
-        mSnapBucket.reset();
-        mBucketApplySuccess.Mark();
+        return State::WORK_FAILURE;
     }
-    if (mCurrApplicator)
+
+    if (mApplicator)
     {
-        if (*mCurrApplicator)
+        if (*mApplicator)
         {
-            advance("curr", *mCurrApplicator);
+            advance();
             return State::WORK_RUNNING;
         }
-        mApp.getInvariantManager().checkOnBucketApply(
-            mCurrBucket, mApplyState.currentLedger, mLevel, true);
-        mCurrApplicator.reset();
-        mCurrBucket.reset();
-        mBucketApplySuccess.Mark();
+        mCounters.logInfo("merged", mBucketsToApply.back().level,
+                          mApp.getClock().now());
+        mApplicator.reset();
     }
 
-    if (mLevel != 0)
+    // Invariants are checked one bucket at a time, as they read the whole
+    // bucket and the entries of the database
+    if (mCheckedBuckets < mBucketsToApply.size())
     {
-        --mLevel;
-        CLOG(DEBUG, "History")
-            << "ApplyBuckets : starting next level: " << mLevel;
+        checkNextBucket();
         return State::WORK_RUNNING;
     }
 
@@ -245,54 +308,27 @@ ApplyBucketsWork::onRun()
 }
 
 void
-ApplyBucketsWork::advance(std::string const& bucketName,
-                          BucketApplicator& applicator)
+ApplyBucketsWork::advance()
 {
-    assert(applicator);
-    assert(mTotalSize != 0);
-    auto sz = applicator.advance(mCounters);
-    mAppliedEntries += sz;
-    mCounters.logDebug(bucketName, mLevel, mApp.getClock().now());
-
-    auto log = false;
-    if (applicator)
-    {
-        mAppliedSize += (applicator.pos() - mLastPos);
-        mLastPos = applicator.pos();
-    }
-    else
+    assert(mApplicator && *mApplicator);
+    mAppliedEntries += mApplicator->advance(mCounters);
+    mCounters.logDebug("merged", mBucketsToApply.back().level,
+                       mApp.getClock().now());
+
+    auto appliedSize = mApplicator->pos();
+    auto totalSize = mApplicator->size();
+    auto appliedSizeMb = appliedSize / 1024 / 1024;
+    if (appliedSizeMb > mLastAppliedSizeMb || !*mApplicator)
     {
-        mAppliedSize += (applicator.size() - mLastPos);
-        mAppliedBuckets++;
-        mLastPos = 0;
-        log = true;
-        mCounters.logInfo(bucketName, mLevel, mApp.getClock().now());
-        mCounters.reset(mApp.getClock().now());
-    }
-
-    auto appliedSizeMb = mAppliedSize / 1024 / 1024;
-    if (appliedSizeMb > mLastAppliedSizeMb)
-    {
-        log = true;
         mLastAppliedSizeMb = appliedSizeMb;
-    }
-
-    if (log)
-    {
         CLOG(INFO, "Bucket")
             << "Bucket-apply: " << mAppliedEntries << " entries in "
-            << formatSize(mAppliedSize) << "/" << formatSize(mTotalSize)
-            << " in " << mAppliedBuckets << "/" << mTotalBuckets << " files ("
-            << (100 * mAppliedSize / mTotalSize) << "%)";
+            << formatSize(appliedSize) << "/" << formatSize(totalSize)
+            << " of " << mTotalBuckets << " files ("
+            << (totalSize ? 100 * appliedSize / totalSize : 100) << "%)";
     }
 }
 
-bool
-ApplyBucketsWork::isLevelComplete()
-{
-    return !(mApplying) || !(mSnapApplicator || mCurrApplicator);
-}
-
 void
 ApplyBucketsWork::onFailureRaise()
 {
@@ -18,28 +18,39 @@ namespace stellar
 class BucketLevel;
 class BucketList;
 class Bucket;
+class LedgerTxnRoot;
 struct HistoryArchiveState;
 struct LedgerHeaderHistoryEntry;
 
 class ApplyBucketsWork : public BasicWork
 {
+    // A bucket to apply, with where it is in the bucket list
+    struct BucketToApply
+    {
+        std::shared_ptr<Bucket const> bucket;
+        uint32_t level;
+        bool isCurr;
+    };
+
     std::map<std::string, std::shared_ptr<Bucket>> const& mBuckets;
     HistoryArchiveState const& mApplyState;
 
-    bool mApplying{false};
+    bool mStarted{false};
     size_t mTotalBuckets{0};
-    size_t mAppliedBuckets{0};
     size_t mAppliedEntries{0};
-    size_t mTotalSize{0};
-    size_t mAppliedSize{0};
     size_t mLastAppliedSizeMb{0};
-    size_t mLastPos{0};
-    uint32_t mLevel{0};
     uint32_t mMaxProtocolVersion{0};
-    std::shared_ptr<Bucket const> mSnapBucket;
-    std::shared_ptr<Bucket const> mCurrBucket;
-    std::unique_ptr<BucketApplicator> mSnapApplicator;
-    std::unique_ptr<BucketApplicator> mCurrApplicator;
+
+    // The buckets are applied at once, from the newest to the oldest, so that
+    // each entry is written once (see BucketApplicator). They are applied
+    // either by mApplicator on the main thread, or in parallel on other
+    // threads, while mApplyingInParallel is set. Their invariants are checked
+    // once they are all applied, mCheckedBuckets of them so far.
+    std::vector<BucketToApply> mBucketsToApply;
+    std::unique_ptr<BucketApplicator> mApplicator;
+    bool mApplyingInParallel{false};
+    bool mParallelApplyFailed{false};
+    size_t mCheckedBuckets{0};
 
     medida::Meter& mBucketApplyStart;
     medida::Meter& mBucketApplySuccess;
@@ -65,11 +76,13 @@ class ApplyBucketsWork : public BasicWork
     bool const mResolveMerges;
     std::unique_ptr<VirtualTimer> mDelayTimer;
 
-    void advance(std::string const& name, BucketApplicator& applicator);
+    void advance();
     std::shared_ptr<Bucket const> getBucket(std::string const& bucketHash);
     BucketLevel& getBucketLevel(uint32_t level);
-    void startLevel();
-    bool isLevelComplete();
+    std::vector<std::shared_ptr<Bucket const>> getBuckets(size_t count) const;
+    void startApply();
+    void spawnParallelApply(LedgerTxnRoot& root, size_t threads);
+    void checkNextBucket();
 
   public:
     ApplyBucketsWork(
@@ -85,7 +98,8 @@ class ApplyBucketsWork : public BasicWork
     bool
     onAbort() override
     {
-        return true;
+        // The threads applying buckets cannot be interrupted
+        return !mApplyingInParallel;
     };
     void onFailureRaise() override;
     void onFailureRetry() override;
@@ -6,9 +6,11 @@
 #include "crypto/Hex.h"
 #include "database/DatabaseConnectionString.h"
 #include "database/DatabaseTypeSpecificOperation.h"
+#include "database/HistoryPartitions.h"
 #include "main/Application.h"
 #include "main/Config.h"
 #include "overlay/StellarXDR.h"
+#include "util/Decoder.h"
 #include "util/GlobalChecks.h"
 #include "util/Logging.h"
 #include "util/Timer.h"
@@ -57,7 +59,7 @@ bool Database::gDriversRegistered = false;
 
 // smallest schema version supported
 static unsigned long const MIN_SCHEMA_VERSION = 9;
-static unsigned long const SCHEMA_VERSION = 10;
+static unsigned long const SCHEMA_VERSION = 12;
 
 // These should always match our compiled version precisely, since we are
 // using a bundled version to get access to carray(). But in case someone
@@ -119,6 +121,91 @@ Database::registerDrivers()
     }
 }
 
+// decode(text, format) and encode(blob, 'hex') are builtin on PostgreSQL. The
+// SQLite versions below let the ledger entry tables use the same SQL to write
+// and read their binary columns (see Database::getBinaryType); decode also
+// accepts 'base64', which is used when converting those tables to binary.
+static std::string
+sqliteFormat(sqlite_api::sqlite3_value* format)
+{
+    auto text = sqlite_api::sqlite3_value_text(format);
+    return text ? reinterpret_cast<char const*>(text) : "";
+}
+
+static void
+sqliteDecode(sqlite_api::sqlite3_context* ctx, int argc,
+             sqlite_api::sqlite3_value** argv)
+{
+    using namespace sqlite_api;
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
+    {
+        sqlite3_result_null(ctx);
+        return;
+    }
+
+    auto text = reinterpret_cast<char const*>(sqlite3_value_text(argv[0]));
+    std::string encoded(text, sqlite3_value_bytes(argv[0]));
+    std::vector<uint8_t> bin;
+    auto format = sqliteFormat(argv[1]);
+    if (format == "hex")
+    {
+        try
+        {
+            if (encoded.size() % 2 != 0)
+            {
+                throw std::runtime_error("odd number of hex digits");
+            }
+            bin = hexToBin(encoded);
+        }
+        catch (std::exception&)
+        {
+            sqlite3_result_error(ctx, "decode: invalid hex", -1);
+            return;
+        }
+    }
+    else if (format == "base64")
+    {
+        decoder::decode_b64(encoded, bin);
+    }
+    else
+    {
+        sqlite3_result_error(ctx, "decode: unsupported format", -1);
+        return;
+    }
+
+    if (bin.empty())
+    {
+        sqlite3_result_zeroblob(ctx, 0);
+    }
+    else
+    {
+        sqlite3_result_blob(ctx, bin.data(), static_cast<int>(bin.size()),
+                            SQLITE_TRANSIENT);
+    }
+}
+
+static void
+sqliteEncode(sqlite_api::sqlite3_context* ctx, int argc,
+             sqlite_api::sqlite3_value** argv)
+{
+    using namespace sqlite_api;
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
+    {
+        sqlite3_result_null(ctx);
+        return;
+    }
+    if (sqliteFormat(argv[1]) != "hex")
+    {
+        sqlite3_result_error(ctx, "encode: unsupported format", -1);
+        return;
+    }
+
+    auto data = static_cast<uint8_t const*>(sqlite3_value_blob(argv[0]));
+    auto hex = binToHex(ByteSlice(data, sqlite3_value_bytes(argv[0])));
+    sqlite3_result_text(ctx, hex.c_str(), static_cast<int>(hex.size()),
+                        SQLITE_TRANSIENT);
+}
+
 // Helper class that confirms that we're running on a new-enough version
 // of each database type and tweaks some per-backend settings.
 class DatabaseConfigureSessionOp : public DatabaseTypeSpecificOperation<void>
@@ -145,6 +232,18 @@ class DatabaseConfigureSessionOp : public DatabaseTypeSpecificOperation<void>
 
         // Register the sqlite carray() extension we use for bulk operations.
         sqlite3_carray_init(sq->conn_, nullptr, nullptr);
+
+        // Register the hex conversions of the binary columns.
+        int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+        if (sqlite_api::sqlite3_create_function(sq->conn_, "decode", 2, flags,
+                                                nullptr, sqliteDecode, nullptr,
+                                                nullptr) != SQLITE_OK ||
+            sqlite_api::sqlite3_create_function(sq->conn_, "encode", 2, flags,
+                                                nullptr, sqliteEncode, nullptr,
+                                                nullptr) != SQLITE_OK)
+        {
+            throw std::runtime_error("Could not register SQLite functions");
+        }
     }
 #ifdef USE_POSTGRES
     void
@@ -181,6 +280,11 @@ Database::Database(Application& app)
     mSession.open(app.getConfig().DATABASE.value);
     DatabaseConfigureSessionOp op(mSession);
     doDatabaseTypeSpecificOperation(op);
+    mHistoryPartitions = std::make_unique<HistoryPartitions>(*this);
+}
+
+Database::~Database()
+{
 }
 
 void
@@ -195,6 +299,18 @@ Database::applySchemaUpgrade(unsigned long vers)
         // add tracking table information
         mApp.getHerderPersistence().createQuorumTrackingTable(mSession);
         break;
+    case 11:
+        // binary keys and XDR columns in the ledger entry tables. The tables
+        // are converted even with in-memory ledger state, which does not
+        // write them, since they are rebuilt and used when the node restarts
+        // without it.
+        LedgerTxnRoot::upgradeToBinaryKeys(*this);
+        break;
+    case 12:
+        // offers are iterated in seller order by getOffersBySellerRange
+        mSession << "CREATE INDEX offersbyseller ON offers "
+                    "(sellerid, offerid)";
+        break;
     default:
         throw std::runtime_error("Unknown DB schema version");
     }
@@ -230,6 +346,16 @@ Database::upgradeToCurrentSchema()
     }
     CLOG(INFO, "Database") << "DB schema is in current version";
     assert(vers == SCHEMA_VERSION);
+
+    mHistoryPartitions->load(
+        mApp.getConfig().HISTORY_PARTITION_CHECKPOINTS *
+        mApp.getHistoryManager().getCheckpointFrequency());
+}
+
+HistoryPartitions&
+Database::getHistoryPartitions()
+{
+    return *mHistoryPartitions;
 }
 
 void
@@ -269,7 +395,10 @@ Database::getAppSchemaVersion()
 medida::TimerContext
 Database::getInsertTimer(std::string const& entityName)
 {
-    mEntityTypes.insert(entityName);
+    {
+        std::lock_guard<std::mutex> lock(mEntityTypesMutex);
+        mEntityTypes.insert(entityName);
+    }
     mQueryMeter.Mark();
     return mApp.getMetrics()
         .NewTimer({"database", "insert", entityName})
@@ -279,7 +408,10 @@ Database::getInsertTimer(std::string const& entityName)
 medida::TimerContext
 Database::getSelectTimer(std::string const& entityName)
 {
-    mEntityTypes.insert(entityName);
+    {
+        std::lock_guard<std::mutex> lock(mEntityTypesMutex);
+        mEntityTypes.insert(entityName);
+    }
     mQueryMeter.Mark();
     return mApp.getMetrics()
         .NewTimer({"database", "select", entityName})
@@ -289,7 +421,10 @@ Database::getSelectTimer(std::string const& entityName)
 medida::TimerContext
 Database::getDeleteTimer(std::string const& entityName)
 {
-    mEntityTypes.insert(entityName);
+    {
+        std::lock_guard<std::mutex> lock(mEntityTypesMutex);
+        mEntityTypes.insert(entityName);
+    }
     mQueryMeter.Mark();
     return mApp.getMetrics()
         .NewTimer({"database", "delete", entityName})
@@ -299,7 +434,10 @@ Database::getDeleteTimer(std::string const& entityName)
 medida::TimerContext
 Database::getUpdateTimer(std::string const& entityName)
 {
-    mEntityTypes.insert(entityName);
+    {
+        std::lock_guard<std::mutex> lock(mEntityTypesMutex);
+        mEntityTypes.insert(entityName);
+    }
     mQueryMeter.Mark();
     return mApp.getMetrics()
         .NewTimer({"database", "update", entityName})
@@ -309,7 +447,10 @@ Database::getUpdateTimer(std::string const& entityName)
 medida::TimerContext
 Database::getUpsertTimer(std::string const& entityName)
 {
-    mEntityTypes.insert(entityName);
+    {
+        std::lock_guard<std::mutex> lock(mEntityTypesMutex);
+        mEntityTypes.insert(entityName);
+    }
     mQueryMeter.Mark();
     return mApp.getMetrics()
         .NewTimer({"database", "upsert", entityName})
@@ -335,12 +476,24 @@ Database::isSqlite() const
            std::string::npos;
 }
 
+std::string
+Database::getBinaryType() const
+{
+    return isSqlite() ? "BLOB" : "BYTEA";
+}
+
 bool
 Database::canUsePool() const
 {
     return !(mApp.getConfig().DATABASE.value == ("sqlite3://:memory:"));
 }
 
+size_t
+Database::getBulkUpsertCopyThreshold() const
+{
+    return mApp.getConfig().BULK_UPSERT_COPY_THRESHOLD;
+}
+
 void
 Database::clearPreparedStatementCache()
 {
@@ -363,6 +516,7 @@ Database::initialize()
 
     // only time this section should be modified is when
     // consolidating changes found in applySchemaUpgrade here
+    mHistoryPartitions->dropAll();
     Upgrades::dropAll(*this);
     mApp.getLedgerTxnRoot().dropAccounts();
     mApp.getLedgerTxnRoot().dropOffers();
@@ -477,6 +631,21 @@ Database::getPreparedStatement(std::string const& query)
     return sc;
 }
 
+StatementContext
+Database::getPreparedStatement(std::string const& query,
+                               soci::session& session)
+{
+    if (&session == &mSession)
+    {
+        return getPreparedStatement(query);
+    }
+    auto p = std::make_shared<soci::statement>(session);
+    p->alloc();
+    p->prepare(query);
+    StatementContext sc(p);
+    return sc;
+}
+
 std::shared_ptr<SQLLogContext>
 Database::captureAndLogSQL(std::string contextName)
 {
@@ -494,6 +663,7 @@ Database::totalQueryTime() const
 {
     std::vector<std::string> qtypes = {"insert", "delete", "select", "update"};
     std::chrono::nanoseconds nsq(0);
+    std::lock_guard<std::mutex> lock(mEntityTypesMutex);
     for (auto const& q : qtypes)
     {
         for (auto const& e : mEntityTypes)
@@ -9,6 +9,7 @@
 #include "overlay/StellarXDR.h"
 #include "util/NonCopyable.h"
 #include "util/Timer.h"
+#include <mutex>
 #include <set>
 #include <soci.h>
 #include <string>
@@ -24,6 +25,8 @@ namespace stellar {
 
   class SQLLogContext;
 
+  class HistoryPartitions;
+
 /**
  * Helper class for borrowing a SOCI prepared statement handle into a local
  * scope and cleaning it up once done with it. Returned by
@@ -83,13 +86,16 @@ namespace stellar {
     medida::Meter &mQueryMeter;
     soci::session mSession;
     std::unique_ptr<soci::connection_pool> mPool;
+    std::unique_ptr<HistoryPartitions> mHistoryPartitions;
 
     std::map<std::string, std::shared_ptr<soci::statement>> mStatements;
     medida::Counter &mStatementsSize;
 
     // Helpers for maintaining the total query time and calculating
-    // idle percentage.
+    // idle percentage. mEntityTypes is guarded by mEntityTypesMutex as the
+    // timers below may also be acquired by threads using pool sessions.
     std::set<std::string> mEntityTypes;
+    mutable std::mutex mEntityTypesMutex;
     std::chrono::nanoseconds mExcludedQueryTime;
     std::chrono::nanoseconds mExcludedTotalTime;
     std::chrono::nanoseconds mLastIdleQueryTime;
@@ -106,6 +112,8 @@ namespace stellar {
     // if there is a connection error, this will throw.
     Database(Application &app);
 
+    ~Database();
+
     // Return a crude meter of total queries to the db, for use in
     // overlay/LoadManager.
     medida::Meter &getQueryMeter();
@@ -136,6 +144,13 @@ namespace stellar {
     // when the statement context is destroyed.
     StatementContext getPreparedStatement(std::string const &query);
 
+    // Return a helper object that borrows a prepared statement handle for the
+    // provided query on the provided session. If session is not the main
+    // session the handle is not cached, so this can safely be called from a
+    // thread that owns a session borrowed from the connection pool.
+    StatementContext getPreparedStatement(std::string const &query,
+                                          soci::session &session);
+
     // Purge all cached prepared statements, closing their handles with the
     // database.
     void clearPreparedStatementCache();
@@ -161,14 +176,29 @@ namespace stellar {
     // Return true if the Database target is SQLite, otherwise false.
     bool isSqlite() const;
 
+    // Return the SQL type of binary columns: BLOB on SQLite, BYTEA on
+    // PostgreSQL. Binary values are exchanged as hex strings, converted
+    // with decode(:v, 'hex') and encode(column, 'hex') on both backends.
+    std::string getBinaryType() const;
+
     // Call `op` back with the specific database backend subtype in use.
     template<typename T>
     T doDatabaseTypeSpecificOperation(DatabaseTypeSpecificOperation<T> &op);
 
+    // Call `op` back with the backend of the provided session, which may be
+    // a session borrowed from the connection pool.
+    template<typename T>
+    T doDatabaseTypeSpecificOperation(DatabaseTypeSpecificOperation<T> &op,
+                                      soci::session &session);
+
     // Return true if a connection pool is available for worker threads
     // to read from the database through, otherwise false.
     bool canUsePool() const;
 
+    // Return the number of rows from which bulk upserts on postgresql should
+    // use COPY (see PostgresBinaryCopy) rather than array binding.
+    size_t getBulkUpsertCopyThreshold() const;
+
     // Drop and recreate all tables in the database target. This is called
     // by the new-db command on stellar-core.
     void initialize();
@@ -182,9 +212,13 @@ namespace stellar {
     // Get current schema version of running application.
     unsigned long getAppSchemaVersion();
 
-    // Check schema version and apply any upgrades if necessary.
+    // Check schema version and apply any upgrades if necessary, then
+    // partition the history tables if HISTORY_PARTITION_CHECKPOINTS is set.
     void upgradeToCurrentSchema();
 
+    // Access the partitions of the history tables.
+    HistoryPartitions &getHistoryPartitions();
+
     // Access the underlying SOCI session object
     soci::session &getSession();
 
@@ -196,7 +230,14 @@ namespace stellar {
   template<typename T>
   T
   Database::doDatabaseTypeSpecificOperation(DatabaseTypeSpecificOperation<T> &op) {
-    auto b = mSession.get_backend();
+    return doDatabaseTypeSpecificOperation(op, mSession);
+  }
+
+  template<typename T>
+  T
+  Database::doDatabaseTypeSpecificOperation(DatabaseTypeSpecificOperation<T> &op,
+                                            soci::session &session) {
+    auto b = session.get_backend();
     if (auto sq = dynamic_cast<soci::sqlite3_session_backend *>(b)) {
       return op.doSqliteSpecificOperation(sq);
 #ifdef USE_POSTGRES
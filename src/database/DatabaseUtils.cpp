@@ -3,15 +3,37 @@
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
 #include "DatabaseUtils.h"
+#include "database/HistoryPartitions.h"
+
+#include <algorithm>
 
 namespace stellar
 {
 namespace DatabaseUtils
 {
 void
-deleteOldEntriesHelper(soci::session& sess, uint32_t ledgerSeq, uint32_t count,
+deleteOldEntriesHelper(Database& db, uint32_t ledgerSeq, uint32_t count,
                        std::string const& tableName,
                        std::string const& ledgerSeqColumn)
+{
+    auto& partitions = db.getHistoryPartitions();
+    if (partitions.isPartitioned() &&
+        std::find(HistoryPartitions::TABLES.begin(),
+                  HistoryPartitions::TABLES.end(),
+                  tableName) != HistoryPartitions::TABLES.end())
+    {
+        partitions.deleteOldEntries(tableName, ledgerSeq, count);
+    }
+    else
+    {
+        deleteOldRows(db.getSession(), ledgerSeq, count, tableName,
+                      ledgerSeqColumn);
+    }
+}
+
+void
+deleteOldRows(soci::session& sess, uint32_t ledgerSeq, uint32_t count,
+              std::string const& tableName, std::string const& ledgerSeqColumn)
 {
     uint32_t curMin = 0;
     soci::indicator gotMin;
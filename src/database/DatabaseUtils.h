@@ -10,8 +10,17 @@ namespace stellar
 {
 namespace DatabaseUtils
 {
-void deleteOldEntriesHelper(soci::session& sess, uint32_t ledgerSeq,
-                            uint32_t count, std::string const& tableName,
+// deleteOldEntriesHelper deletes the rows of tableName up to ledgerSeq, at
+// most count ledgers from the oldest one, or drops its partitions if it is
+// partitioned (see HistoryPartitions)
+void deleteOldEntriesHelper(Database& db, uint32_t ledgerSeq, uint32_t count,
+                            std::string const& tableName,
                             std::string const& ledgerSeqColumn);
+
+// deleteOldRows deletes the rows of tableName like deleteOldEntriesHelper,
+// whether it is partitioned or not
+void deleteOldRows(soci::session& sess, uint32_t ledgerSeq, uint32_t count,
+                   std::string const& tableName,
+                   std::string const& ledgerSeqColumn);
 }
 }
@@ -0,0 +1,356 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "database/HistoryPartitions.h"
+#include "database/Database.h"
+#include "database/DatabaseUtils.h"
+#include "util/Fs.h"
+#include "util/Logging.h"
+
+#include <algorithm>
+#include <limits>
+#include <regex>
+
+namespace stellar
+{
+
+std::vector<std::string> const HistoryPartitions::TABLES = {
+    "txhistory", "txfeehistory", "scphistory", "upgradehistory"};
+
+// primary keys and indexes of partitioned tables need postgresql 11
+static int const MIN_PARTITIONING_POSTGRESQL_VERSION = 110000;
+
+HistoryPartitions::HistoryPartitions(Database& db) : mDatabase(db)
+{
+}
+
+std::string
+HistoryPartitions::getPartitionName(std::string const& table, uint32_t first,
+                                    uint32_t end)
+{
+    return table + "_p" + fs::hexStr(first) + "_" + fs::hexStr(end);
+}
+
+bool
+HistoryPartitions::isPartitionedInDatabase(std::string const& table)
+{
+    auto& sess = mDatabase.getSession();
+    std::string kind;
+    if (mDatabase.isSqlite())
+    {
+        sess << "SELECT type FROM sqlite_master WHERE name = :t",
+            soci::into(kind), soci::use(table);
+        return sess.got_data() && kind == "view";
+    }
+    sess << "SELECT CAST(relkind AS TEXT) FROM pg_class "
+            "WHERE relname = :t AND pg_table_is_visible(oid)",
+        soci::into(kind), soci::use(table);
+    return sess.got_data() && kind == "p";
+}
+
+std::vector<HistoryPartitions::Partition>
+HistoryPartitions::findPartitions(std::string const& table)
+{
+    std::string query =
+        mDatabase.isSqlite()
+            ? "SELECT name FROM sqlite_master WHERE type = 'table'"
+            : "SELECT c.relname FROM pg_inherits i "
+              "JOIN pg_class c ON c.oid = i.inhrelid "
+              "WHERE pg_table_is_visible(c.oid)";
+    std::regex const re(table + "_p([0-9a-f]{8})_([0-9a-f]{8})");
+
+    std::vector<Partition> partitions;
+    std::string name;
+    auto& sess = mDatabase.getSession();
+    soci::statement st = (sess.prepare << query, soci::into(name));
+    st.execute(true);
+    while (st.got_data())
+    {
+        std::smatch m;
+        if (std::regex_match(name, m, re))
+        {
+            auto first = std::stoul(m[1].str(), nullptr, 16);
+            auto end = std::stoul(m[2].str(), nullptr, 16);
+            partitions.emplace_back(Partition{static_cast<uint32_t>(first),
+                                              static_cast<uint32_t>(end),
+                                              name});
+        }
+        st.fetch();
+    }
+    std::sort(partitions.begin(), partitions.end(),
+              [](Partition const& lhs, Partition const& rhs) {
+                  return lhs.first < rhs.first;
+              });
+    return partitions;
+}
+
+void
+HistoryPartitions::load(uint32_t partitionSize)
+{
+    mPartitionSize = partitionSize;
+    mPartitions.clear();
+    if (!isPartitionedInDatabase(TABLES.front()))
+    {
+        if (partitionSize == 0)
+        {
+            return;
+        }
+        partitionTables();
+    }
+    else if (partitionSize == 0)
+    {
+        throw std::runtime_error(
+            "History tables are partitioned, HISTORY_PARTITION_CHECKPOINTS "
+            "must be set (or the database rebuilt with new-db)");
+    }
+
+    for (auto const& table : TABLES)
+    {
+        auto partitions = findPartitions(table);
+        if (partitions.empty())
+        {
+            throw std::runtime_error("No partition found for history table " +
+                                     table);
+        }
+        mPartitions[table] = std::move(partitions);
+    }
+}
+
+void
+HistoryPartitions::partitionTables()
+{
+    auto& sess = mDatabase.getSession();
+    if (!mDatabase.isSqlite())
+    {
+        std::string version;
+        sess << "SHOW server_version_num", soci::into(version);
+        if (std::stoi(version) < MIN_PARTITIONING_POSTGRESQL_VERSION)
+        {
+            throw std::runtime_error(
+                "HISTORY_PARTITION_CHECKPOINTS needs postgresql 11 or later");
+        }
+    }
+
+    // The rows already in the tables go to their first partition
+    uint32_t last = 0;
+    for (auto const& table : TABLES)
+    {
+        uint32_t maxSeq = 0;
+        soci::indicator gotMax;
+        sess << "SELECT MAX(ledgerseq) FROM " << table,
+            soci::into(maxSeq, gotMax);
+        if (gotMax == soci::i_ok)
+        {
+            last = std::max(last, maxSeq);
+        }
+    }
+    uint32_t end = (last / mPartitionSize + 1) * mPartitionSize;
+
+    CLOG(INFO, "Database") << "Partitioning history tables by "
+                           << mPartitionSize << " ledgers";
+    mDatabase.clearPreparedStatementCache();
+    soci::transaction tx(sess);
+    for (auto const& table : TABLES)
+    {
+        auto name = getPartitionName(table, 0, end);
+        sess << "ALTER TABLE " << table << " RENAME TO " << name;
+        if (mDatabase.isSqlite())
+        {
+            createView(table, {Partition{0, end, name}});
+        }
+        else
+        {
+            sess << "CREATE TABLE " << table << " (LIKE " << name
+                 << " INCLUDING ALL) PARTITION BY RANGE (ledgerseq)";
+            sess << "ALTER TABLE " << table << " ATTACH PARTITION " << name
+                 << " FOR VALUES FROM (0) TO (" << end << ")";
+        }
+    }
+    tx.commit();
+}
+
+void
+HistoryPartitions::createPartition(std::string const& table,
+                                   std::vector<Partition>& partitions,
+                                   uint32_t ledgerSeq)
+{
+    // The partition of ledgerSeq, clipped to the partitions around it
+    uint64_t first = ledgerSeq / mPartitionSize * uint64_t(mPartitionSize);
+    uint64_t end = std::min<uint64_t>(first + mPartitionSize,
+                                      std::numeric_limits<uint32_t>::max());
+    auto next = std::upper_bound(
+        partitions.begin(), partitions.end(), ledgerSeq,
+        [](uint32_t seq, Partition const& p) { return seq < p.first; });
+    if (next != partitions.end())
+    {
+        end = std::min<uint64_t>(end, next->first);
+    }
+    if (next != partitions.begin())
+    {
+        first = std::max<uint64_t>(first, std::prev(next)->end);
+    }
+
+    Partition partition{static_cast<uint32_t>(first),
+                        static_cast<uint32_t>(end), ""};
+    partition.name = getPartitionName(table, partition.first, partition.end);
+    auto& sess = mDatabase.getSession();
+    if (mDatabase.isSqlite())
+    {
+        // The columns and keys are those of the other partitions
+        std::string sql;
+        sess << "SELECT sql FROM sqlite_master "
+                "WHERE type = 'table' AND name = :n",
+            soci::into(sql), soci::use(partitions.front().name);
+        auto columns = sql.find('(');
+        if (!sess.got_data() || columns == std::string::npos)
+        {
+            throw std::runtime_error("Unable to read the schema of " +
+                                     partitions.front().name);
+        }
+        sess << "CREATE TABLE " << partition.name << " " << sql.substr(columns);
+        sess << "CREATE INDEX " << partition.name << "_byseq ON "
+             << partition.name << " (ledgerseq)";
+    }
+    else
+    {
+        sess << "CREATE TABLE " << partition.name << " PARTITION OF " << table
+             << " FOR VALUES FROM (" << partition.first << ") TO ("
+             << partition.end << ")";
+    }
+    CLOG(DEBUG, "Database") << "Created history partition " << partition.name;
+    partitions.insert(next, partition);
+}
+
+void
+HistoryPartitions::dropPartition(Partition const& partition)
+{
+    CLOG(DEBUG, "Database") << "Dropping history partition " << partition.name;
+    mDatabase.getSession() << "DROP TABLE " << partition.name;
+}
+
+void
+HistoryPartitions::createView(std::string const& table,
+                              std::vector<Partition> const& partitions)
+{
+    std::string sql = "CREATE VIEW " + table + " AS ";
+    for (auto const& partition : partitions)
+    {
+        if (&partition != &partitions.front())
+        {
+            sql += " UNION ALL ";
+        }
+        sql += "SELECT * FROM " + partition.name;
+    }
+    auto& sess = mDatabase.getSession();
+    sess << "DROP VIEW IF EXISTS " << table;
+    sess << sql;
+}
+
+void
+HistoryPartitions::prepare(uint32_t ledgerSeq)
+{
+    auto contains = [ledgerSeq](Partition const& p) {
+        return p.first <= ledgerSeq && ledgerSeq < p.end;
+    };
+    auto missing = [&](PartitionMap::value_type const& kv) {
+        return std::none_of(kv.second.begin(), kv.second.end(), contains);
+    };
+    if (std::none_of(mPartitions.begin(), mPartitions.end(), missing))
+    {
+        return;
+    }
+
+    // The partitions are only known to exist once they are committed
+    auto partitions = mPartitions;
+    mDatabase.clearPreparedStatementCache();
+    soci::transaction tx(mDatabase.getSession());
+    for (auto& kv : partitions)
+    {
+        if (missing(kv))
+        {
+            createPartition(kv.first, kv.second, ledgerSeq);
+            if (mDatabase.isSqlite())
+            {
+                createView(kv.first, kv.second);
+            }
+        }
+    }
+    tx.commit();
+    mPartitions = std::move(partitions);
+}
+
+std::string
+HistoryPartitions::getTable(std::string const& table, uint32_t ledgerSeq) const
+{
+    if (!mDatabase.isSqlite() || !isPartitioned())
+    {
+        return table;
+    }
+
+    auto const& partitions = mPartitions.at(table);
+    auto next = std::upper_bound(
+        partitions.begin(), partitions.end(), ledgerSeq,
+        [](uint32_t seq, Partition const& p) { return seq < p.first; });
+    if (next == partitions.begin() || std::prev(next)->end <= ledgerSeq)
+    {
+        throw std::runtime_error("No partition of " + table + " for ledger " +
+                                 std::to_string(ledgerSeq));
+    }
+    return std::prev(next)->name;
+}
+
+void
+HistoryPartitions::deleteOldEntries(std::string const& table,
+                                    uint32_t ledgerSeq, uint32_t count)
+{
+    // Dropping a partition costs the same whatever it holds, so count only
+    // limits the rows deleted from a table that was partitioned. The last
+    // partition is kept, as the view needs at least one table.
+    auto& partitions = mPartitions.at(table);
+    bool dropped = false;
+    while (partitions.size() > 1 && partitions.front().end - 1 <= ledgerSeq)
+    {
+        if (!dropped)
+        {
+            mDatabase.clearPreparedStatementCache();
+        }
+        dropPartition(partitions.front());
+        partitions.erase(partitions.begin());
+        dropped = true;
+    }
+    if (dropped && mDatabase.isSqlite())
+    {
+        createView(table, partitions);
+    }
+
+    auto const& first = partitions.front();
+    if (first.first == 0)
+    {
+        DatabaseUtils::deleteOldRows(mDatabase.getSession(), ledgerSeq, count,
+                                     first.name, "ledgerseq");
+    }
+}
+
+void
+HistoryPartitions::dropAll()
+{
+    auto& sess = mDatabase.getSession();
+    for (auto const& table : TABLES)
+    {
+        if (!isPartitionedInDatabase(table))
+        {
+            continue;
+        }
+        if (mDatabase.isSqlite())
+        {
+            sess << "DROP VIEW " << table;
+        }
+        for (auto const& partition : findPartitions(table))
+        {
+            dropPartition(partition);
+        }
+    }
+    mPartitions.clear();
+}
+}
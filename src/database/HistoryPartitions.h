@@ -0,0 +1,111 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/NonCopyable.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace stellar
+{
+
+class Database;
+
+// HistoryPartitions splits the tables holding the history of closed ledgers
+// (txhistory, txfeehistory, scphistory and upgradehistory) into ranges of
+// ledgers, so that trimming history drops whole ranges instead of deleting
+// rows, which bloats postgresql tables and stalls sqlite writes.
+//
+// On postgresql, each table is range partitioned on ledgerseq, so rows are
+// still written to and read from the table itself. Sqlite has no
+// partitioning: each range is a table of its own and the history table is
+// replaced by a view over them, so rows are written to the table returned by
+// getTable and read through the view. The ranges are tables of the main
+// database rather than attached databases, as commits are not atomic across
+// attached databases in WAL mode.
+//
+// Partitions are named <table>_p<first>_<end> and hold the ledgers from
+// first up to end (excluded), in hex. Partitioning a table turns it into the
+// first partition, which ends at the first partition boundary after the
+// ledgers that it holds and is still trimmed by deleting rows until it can be
+// dropped. The boundaries are multiples of the partition size, a number of
+// checkpoints, so that the ledgers of a checkpoint are in one partition, and
+// partitions are only created for ledgers that are written, so catching up
+// to a recent ledger does not create the partitions of the ledgers before.
+// Partitions are dropped once all of their ledgers can be trimmed, so up to
+// one partition more of history than requested is kept.
+//
+// Partitioning cannot be undone other than by new-db. The partitions are
+// created and dropped from the main thread, outside of any transaction for
+// prepare. getTable can be called from any thread on postgresql.
+class HistoryPartitions : public NonMovableOrCopyable
+{
+    struct Partition
+    {
+        uint32_t first;
+        uint32_t end;
+        std::string name;
+    };
+    typedef std::map<std::string, std::vector<Partition>> PartitionMap;
+
+    Database& mDatabase;
+    uint32_t mPartitionSize{0};
+
+    // The partitions of each table, by ledger. Empty if the tables are not
+    // partitioned.
+    PartitionMap mPartitions;
+
+    static std::string getPartitionName(std::string const& table,
+                                        uint32_t first, uint32_t end);
+
+    bool isPartitionedInDatabase(std::string const& table);
+    std::vector<Partition> findPartitions(std::string const& table);
+
+    void partitionTables();
+    void createPartition(std::string const& table,
+                         std::vector<Partition>& partitions,
+                         uint32_t ledgerSeq);
+    void dropPartition(Partition const& partition);
+    void createView(std::string const& table,
+                    std::vector<Partition> const& partitions);
+
+  public:
+    // The tables that are partitioned, which all have a ledgerseq column
+    static std::vector<std::string> const TABLES;
+
+    explicit HistoryPartitions(Database& db);
+
+    // load finds the partitions of the tables after partitioning them, if
+    // they are not and partitionSize (in ledgers) is not 0. Throws if the
+    // tables are partitioned and partitionSize is 0.
+    void load(uint32_t partitionSize);
+
+    bool
+    isPartitioned() const
+    {
+        return !mPartitions.empty();
+    }
+
+    // prepare creates the partitions that the rows of ledgerSeq are written
+    // to, if they do not exist yet
+    void prepare(uint32_t ledgerSeq);
+
+    // getTable returns the table that the rows of table for ledgerSeq must be
+    // written to. Throws if their partition does not exist.
+    std::string getTable(std::string const& table, uint32_t ledgerSeq) const;
+
+    // deleteOldEntries trims the ledgers up to ledgerSeq from table like
+    // DatabaseUtils::deleteOldEntriesHelper, by dropping partitions
+    void deleteOldEntries(std::string const& table, uint32_t ledgerSeq,
+                          uint32_t count);
+
+    // dropAll drops the partitions and views of the tables, leaving them to
+    // be created again (see Database::initialize)
+    void dropAll();
+};
+}
@@ -0,0 +1,162 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#ifdef USE_POSTGRES
+#include "database/PostgresBinaryCopy.h"
+#include "crypto/Hex.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace stellar
+{
+
+// The binary COPY format starts with an 11 byte signature followed by a 32
+// bit flags field and a 32 bit header extension length, both zero.
+static char const COPY_SIGNATURE[] = "PGCOPY\n\377\r\n";
+static size_t const COPY_SIGNATURE_SIZE = 11;
+
+template <typename T>
+static void
+appendBigEndian(std::string& out, T value)
+{
+    for (size_t i = sizeof(T); i > 0; --i)
+    {
+        out.push_back(static_cast<char>((value >> (8 * (i - 1))) & 0xff));
+    }
+}
+
+PostgresBinaryCopy::PostgresBinaryCopy(size_t fieldsPerRow)
+    : mFieldsPerRow(fieldsPerRow), mFieldsInRow(fieldsPerRow), mRows(0)
+{
+    mData.append(COPY_SIGNATURE, COPY_SIGNATURE_SIZE);
+    appendBigEndian<uint32_t>(mData, 0);
+    appendBigEndian<uint32_t>(mData, 0);
+}
+
+void
+PostgresBinaryCopy::startRow()
+{
+    if (mFieldsInRow != mFieldsPerRow)
+    {
+        throw std::logic_error("previous COPY row is incomplete");
+    }
+    appendBigEndian<uint16_t>(mData, static_cast<uint16_t>(mFieldsPerRow));
+    mFieldsInRow = 0;
+    ++mRows;
+}
+
+void
+PostgresBinaryCopy::appendField(char const* data, int32_t len)
+{
+    if (mFieldsInRow == mFieldsPerRow)
+    {
+        throw std::logic_error("too many fields in COPY row");
+    }
+    appendBigEndian<uint32_t>(mData, static_cast<uint32_t>(len));
+    if (len > 0)
+    {
+        mData.append(data, len);
+    }
+    ++mFieldsInRow;
+}
+
+void
+PostgresBinaryCopy::appendNull()
+{
+    appendField(nullptr, -1);
+}
+
+void
+PostgresBinaryCopy::append(int32_t value)
+{
+    std::string buf;
+    appendBigEndian<uint32_t>(buf, static_cast<uint32_t>(value));
+    appendField(buf.data(), static_cast<int32_t>(buf.size()));
+}
+
+void
+PostgresBinaryCopy::append(int64_t value)
+{
+    std::string buf;
+    appendBigEndian<uint64_t>(buf, static_cast<uint64_t>(value));
+    appendField(buf.data(), static_cast<int32_t>(buf.size()));
+}
+
+void
+PostgresBinaryCopy::append(double value)
+{
+    static_assert(sizeof(double) == sizeof(uint64_t),
+                  "double must be 64 bits to be sent as float8");
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    std::string buf;
+    appendBigEndian<uint64_t>(buf, bits);
+    appendField(buf.data(), static_cast<int32_t>(buf.size()));
+}
+
+void
+PostgresBinaryCopy::append(std::string const& value)
+{
+    appendField(value.data(), static_cast<int32_t>(value.size()));
+}
+
+void
+PostgresBinaryCopy::appendHex(std::string const& hex)
+{
+    auto bin = hexToBin(hex);
+    appendField(reinterpret_cast<char const*>(bin.data()),
+                static_cast<int32_t>(bin.size()));
+}
+
+void
+PostgresBinaryCopy::copyInto(PGconn* conn, std::string const& table,
+                             std::string const& columns) const
+{
+    if (mFieldsInRow != mFieldsPerRow)
+    {
+        throw std::logic_error("last COPY row is incomplete");
+    }
+
+    std::string sql = "COPY " + table + " (" + columns +
+                      ") FROM STDIN WITH (FORMAT binary)";
+    PGresult* res = PQexec(conn, sql.c_str());
+    bool started = PQresultStatus(res) == PGRES_COPY_IN;
+    PQclear(res);
+    if (!started)
+    {
+        throw std::runtime_error(std::string("Could not start COPY: ") +
+                                 PQerrorMessage(conn));
+    }
+
+    // The trailer is a field count of -1
+    std::string trailer;
+    appendBigEndian<uint16_t>(trailer, 0xffff);
+    bool sent =
+        PQputCopyData(conn, mData.data(), static_cast<int>(mData.size())) ==
+            1 &&
+        PQputCopyData(conn, trailer.data(), static_cast<int>(trailer.size())) ==
+            1;
+    bool ended = PQputCopyEnd(conn, sent ? nullptr : "send failed") == 1;
+
+    // Always drain the results so the connection is usable afterwards
+    std::string error;
+    while ((res = PQgetResult(conn)) != nullptr)
+    {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK && error.empty())
+        {
+            error = PQresultErrorMessage(res);
+        }
+        PQclear(res);
+    }
+
+    if (!sent || !ended || !error.empty())
+    {
+        throw std::runtime_error("Could not COPY data in SQL: " +
+                                 (error.empty() ? std::string(PQerrorMessage(
+                                                      conn))
+                                                : error));
+    }
+}
+}
+#endif
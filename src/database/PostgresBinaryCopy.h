@@ -0,0 +1,84 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#ifdef USE_POSTGRES
+#include <cstdint>
+#include <libpq-fe.h>
+#include <soci.h>
+#include <string>
+
+namespace stellar
+{
+
+// PostgresBinaryCopy accumulates rows in the binary format of the postgresql
+// COPY command and streams them into a table, which avoids both parsing SQL
+// text and marshaling arrays for large numbers of rows. Every row must have
+// exactly as many fields as the constructor was given, and each field must be
+// appended with the C++ type matching the type of its column: int32_t for INT,
+// int64_t for BIGINT, double for DOUBLE PRECISION and std::string for TEXT
+// and VARCHAR. BYTEA fields are appended with appendHex, which takes the hex
+// strings used to bind binary columns elsewhere and copies the raw bytes.
+class PostgresBinaryCopy
+{
+    std::string mData;
+    size_t const mFieldsPerRow;
+    size_t mFieldsInRow;
+    size_t mRows;
+
+    void appendField(char const* data, int32_t len);
+
+  public:
+    explicit PostgresBinaryCopy(size_t fieldsPerRow);
+
+    void startRow();
+
+    void appendNull();
+    void append(int32_t value);
+    void append(int64_t value);
+    void append(double value);
+    void append(std::string const& value);
+    void appendHex(std::string const& hex);
+
+    template <typename T>
+    void
+    append(T const& value, soci::indicator ind)
+    {
+        if (ind == soci::i_null)
+        {
+            appendNull();
+        }
+        else
+        {
+            append(value);
+        }
+    }
+
+    void
+    appendHex(std::string const& hex, soci::indicator ind)
+    {
+        if (ind == soci::i_null)
+        {
+            appendNull();
+        }
+        else
+        {
+            appendHex(hex);
+        }
+    }
+
+    size_t
+    rows() const
+    {
+        return mRows;
+    }
+
+    // copyInto runs "COPY table (columns) FROM STDIN" on conn and streams
+    // every row. Throws if the server rejects any of them.
+    void copyInto(PGconn* conn, std::string const& table,
+                  std::string const& columns) const;
+};
+}
+#endif
@@ -5,6 +5,9 @@
 #include "util/asio.h"
 #include "crypto/Hex.h"
 #include "database/Database.h"
+#include "database/DatabaseUtils.h"
+#include "database/HistoryPartitions.h"
+#include "history/HistoryManager.h"
 #include "lib/catch.hpp"
 #include "main/Application.h"
 #include "main/Config.h"
@@ -337,3 +340,77 @@ TEST_CASE("schema test", "[db]")
     auto av = db.getAppSchemaVersion();
     REQUIRE(dbv == av);
 }
+
+TEST_CASE("history partitions", "[db][historypartitions]")
+{
+    Config cfg = getTestConfig(0, Config::TESTDB_IN_MEMORY_SQLITE);
+    cfg.HISTORY_PARTITION_CHECKPOINTS = 2;
+
+    VirtualClock clock;
+    Application::pointer app = createTestApplication(clock, cfg);
+    app->start();
+
+    auto& db = app->getDatabase();
+    auto& partitions = db.getHistoryPartitions();
+    auto& sess = db.getSession();
+    uint32_t size = 2 * app->getHistoryManager().getCheckpointFrequency();
+    REQUIRE(partitions.isPartitioned());
+
+    auto insert = [&](uint32_t ledgerSeq) {
+        partitions.prepare(ledgerSeq);
+        auto table = partitions.getTable("upgradehistory", ledgerSeq);
+        sess << "INSERT INTO " << table
+             << " (ledgerseq, upgradeindex, upgrade, changes) "
+                "VALUES (:l, 0, '', '')",
+            soci::use(ledgerSeq);
+    };
+    auto count = [&]() {
+        int n = 0;
+        sess << "SELECT COUNT(*) FROM upgradehistory", soci::into(n);
+        return n;
+    };
+
+    // the ledgers of the genesis database are in the first partition
+    for (uint32_t ledgerSeq = 2; ledgerSeq < size * 4; ledgerSeq += 3)
+    {
+        insert(ledgerSeq);
+    }
+    REQUIRE(count() == static_cast<int>((size * 4 - 2 + 2) / 3));
+    REQUIRE(partitions.getTable("upgradehistory", size * 2 + 1) !=
+            partitions.getTable("upgradehistory", size * 2 - 1));
+    REQUIRE_THROWS(partitions.getTable("upgradehistory", size * 4));
+
+    SECTION("partitions are only created for ledgers that are written")
+    {
+        insert(size * 10 + 1);
+        REQUIRE_THROWS(partitions.getTable("upgradehistory", size * 9));
+        REQUIRE(partitions.getTable("upgradehistory", size * 10) ==
+                partitions.getTable("upgradehistory", size * 11 - 1));
+    }
+
+    SECTION("trimming history drops the partitions that it covers")
+    {
+        auto rows = [&](uint32_t first, uint32_t end) {
+            int n = 0;
+            sess << "SELECT COUNT(*) FROM upgradehistory "
+                    "WHERE ledgerseq >= :f AND ledgerseq < :e",
+                soci::into(n), soci::use(first), soci::use(end);
+            return n;
+        };
+        auto kept = rows(size, size * 4);
+
+        // the second partition holds ledgers after the trimmed ones, so it
+        // is kept whole
+        DatabaseUtils::deleteOldEntriesHelper(db, size * 2 - 2, 1,
+                                              "upgradehistory", "ledgerseq");
+        REQUIRE_THROWS(partitions.getTable("upgradehistory", size - 1));
+        REQUIRE(rows(0, size) == 0);
+        REQUIRE(rows(size, size * 4) == kept);
+
+        DatabaseUtils::deleteOldEntriesHelper(db, size * 4, 1,
+                                              "upgradehistory", "ledgerseq");
+        REQUIRE(partitions.getTable("upgradehistory", size * 3) ==
+                partitions.getTable("upgradehistory", size * 4 - 1));
+        REQUIRE(count() == rows(size * 3, size * 4));
+    }
+}
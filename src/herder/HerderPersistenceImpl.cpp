@@ -6,12 +6,17 @@
 #include "crypto/Hex.h"
 #include "database/Database.h"
 #include "database/DatabaseUtils.h"
+#include "database/HistoryPartitions.h"
 #include "herder/Herder.h"
+#include "history/HistoryManager.h"
+#include "history/HistorySegmentStore.h"
 #include "main/Application.h"
 #include "scp/Slot.h"
 #include "util/Decoder.h"
 #include "util/XDRStream.h"
 
+#include <algorithm>
+#include <set>
 #include <soci.h>
 #include <xdrpp/marshal.h>
 
@@ -45,52 +50,18 @@ HerderPersistenceImpl::saveSCPHistory(uint32_t seq,
     auto usedQSets = std::unordered_map<Hash, SCPQuorumSetPtr>{};
     auto& db = mApp.getDatabase();
 
+    db.getHistoryPartitions().prepare(seq);
     soci::transaction txscope(db.getSession());
 
+    auto segments = mApp.getHistoryManager().getSegmentStore();
+    if (segments && segments->isStoring(seq))
     {
-        auto prepClean = db.getPreparedStatement(
-            "DELETE FROM scphistory WHERE ledgerseq =:l");
-
-        auto& st = prepClean.statement();
-        st.exchange(soci::use(seq));
-        st.define_and_bind();
-        {
-            auto timer = db.getDeleteTimer("scphistory");
-            st.execute(true);
-        }
+        // The messages are appended to a history segment with the ledger
+        saveSCPHistoryToSegment(*segments, seq, envs, usedQSets);
     }
-    for (auto const& e : envs)
+    else
     {
-        auto const& qHash =
-            Slot::getCompanionQuorumSetHashFromStatement(e.statement);
-        usedQSets.insert(
-            std::make_pair(qHash, mApp.getHerder().getQSet(qHash)));
-
-        std::string nodeIDStrKey = KeyUtils::toStrKey(e.statement.nodeID);
-
-        auto envelopeBytes(xdr::xdr_to_opaque(e));
-
-        std::string envelopeEncoded;
-        envelopeEncoded = decoder::encode_b64(envelopeBytes);
-
-        auto prepEnv =
-            db.getPreparedStatement("INSERT INTO scphistory "
-                                    "(nodeid, ledgerseq, envelope) VALUES "
-                                    "(:n, :l, :e)");
-
-        auto& st = prepEnv.statement();
-        st.exchange(soci::use(nodeIDStrKey));
-        st.exchange(soci::use(seq));
-        st.exchange(soci::use(envelopeEncoded));
-        st.define_and_bind();
-        {
-            auto timer = db.getInsertTimer("scphistory");
-            st.execute(true);
-        }
-        if (st.get_affected_rows() != 1)
-        {
-            throw std::runtime_error("Could not update data in SQL");
-        }
+        saveSCPHistoryToDatabase(seq, envs, usedQSets);
     }
 
     // save quorum information
@@ -184,6 +155,101 @@ HerderPersistenceImpl::saveSCPHistory(uint32_t seq,
     txscope.commit();
 }
 
+void
+HerderPersistenceImpl::saveSCPHistoryToDatabase(
+    uint32_t seq, std::vector<SCPEnvelope> const& envs,
+    std::unordered_map<Hash, SCPQuorumSetPtr>& usedQSets)
+{
+    auto& db = mApp.getDatabase();
+    auto table = db.getHistoryPartitions().getTable("scphistory", seq);
+
+    {
+        auto prepClean = db.getPreparedStatement("DELETE FROM " + table +
+                                                 " WHERE ledgerseq =:l");
+
+        auto& st = prepClean.statement();
+        st.exchange(soci::use(seq));
+        st.define_and_bind();
+        {
+            auto timer = db.getDeleteTimer("scphistory");
+            st.execute(true);
+        }
+    }
+    for (auto const& e : envs)
+    {
+        auto const& qHash =
+            Slot::getCompanionQuorumSetHashFromStatement(e.statement);
+        usedQSets.insert(
+            std::make_pair(qHash, mApp.getHerder().getQSet(qHash)));
+
+        std::string nodeIDStrKey = KeyUtils::toStrKey(e.statement.nodeID);
+
+        auto envelopeBytes(xdr::xdr_to_opaque(e));
+
+        std::string envelopeEncoded;
+        envelopeEncoded = decoder::encode_b64(envelopeBytes);
+
+        auto prepEnv =
+            db.getPreparedStatement("INSERT INTO " + table +
+                                    " (nodeid, ledgerseq, envelope) VALUES "
+                                    "(:n, :l, :e)");
+
+        auto& st = prepEnv.statement();
+        st.exchange(soci::use(nodeIDStrKey));
+        st.exchange(soci::use(seq));
+        st.exchange(soci::use(envelopeEncoded));
+        st.define_and_bind();
+        {
+            auto timer = db.getInsertTimer("scphistory");
+            st.execute(true);
+        }
+        if (st.get_affected_rows() != 1)
+        {
+            throw std::runtime_error("Could not update data in SQL");
+        }
+    }
+}
+
+void
+HerderPersistenceImpl::saveSCPHistoryToSegment(
+    HistorySegmentStore& segments, uint32_t seq,
+    std::vector<SCPEnvelope> const& envs,
+    std::unordered_map<Hash, SCPQuorumSetPtr>& usedQSets)
+{
+    // Messages are sorted by node and each quorum set is included once, like
+    // copySCPHistoryToStream does
+    std::vector<std::pair<std::string, SCPEnvelope const*>> sorted;
+    for (auto const& e : envs)
+    {
+        sorted.emplace_back(KeyUtils::toStrKey(e.statement.nodeID), &e);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](auto const& lhs, auto const& rhs) {
+                         return lhs.first < rhs.first;
+                     });
+
+    SCPHistoryEntry hEntryV;
+    hEntryV.v(0);
+    auto& hEntry = hEntryV.v0();
+    hEntry.ledgerMessages.ledgerSeq = seq;
+    std::set<Hash> added;
+    for (auto const& p : sorted)
+    {
+        auto const& e = *p.second;
+        hEntry.ledgerMessages.messages.emplace_back(e);
+
+        auto const& qHash =
+            Slot::getCompanionQuorumSetHashFromStatement(e.statement);
+        auto qSet = mApp.getHerder().getQSet(qHash);
+        usedQSets.insert(std::make_pair(qHash, qSet));
+        if (qSet && added.insert(qHash).second)
+        {
+            hEntry.quorumSets.emplace_back(*qSet);
+        }
+    }
+    segments.setSCPHistory(hEntryV);
+}
+
 size_t
 HerderPersistence::copySCPHistoryToStream(Database& db, soci::session& sess,
                                           uint32_t ledgerSeq,
@@ -364,9 +430,9 @@ void
 HerderPersistence::deleteOldEntries(Database& db, uint32_t ledgerSeq,
                                     uint32_t count)
 {
-    DatabaseUtils::deleteOldEntriesHelper(db.getSession(), ledgerSeq, count,
-                                          "scphistory", "ledgerseq");
-    DatabaseUtils::deleteOldEntriesHelper(db.getSession(), ledgerSeq, count,
-                                          "scpquorums", "lastledgerseq");
+    DatabaseUtils::deleteOldEntriesHelper(db, ledgerSeq, count, "scphistory",
+                                          "ledgerseq");
+    DatabaseUtils::deleteOldEntriesHelper(db, ledgerSeq, count, "scpquorums",
+                                          "lastledgerseq");
 }
 }
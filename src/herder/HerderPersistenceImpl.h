@@ -5,10 +5,12 @@
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
 #include "herder/HerderPersistence.h"
+#include <unordered_map>
 
 namespace stellar
 {
 class Application;
+class HistorySegmentStore;
 
 class HerderPersistenceImpl : public HerderPersistence
 {
@@ -22,5 +24,14 @@ class HerderPersistenceImpl : public HerderPersistence
 
   private:
     Application& mApp;
+
+    // Both add the quorum sets of envs to usedQSets
+    void saveSCPHistoryToDatabase(
+        uint32_t seq, std::vector<SCPEnvelope> const& envs,
+        std::unordered_map<Hash, SCPQuorumSetPtr>& usedQSets);
+    void saveSCPHistoryToSegment(
+        HistorySegmentStore& segments, uint32_t seq,
+        std::vector<SCPEnvelope> const& envs,
+        std::unordered_map<Hash, SCPQuorumSetPtr>& usedQSets);
 };
 }
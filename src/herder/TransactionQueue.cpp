@@ -43,6 +43,14 @@ TransactionQueue::tryAdd(TransactionFramePtr tx)
         return TransactionQueue::AddResult::ADD_STATUS_DUPLICATE;
     }
 
+    // The ledger state cannot be read while buckets are applied in the
+    // background during catchup
+    auto root = dynamic_cast<LedgerTxnRoot*>(&mApp.getLedgerTxnRoot());
+    if (root && root->isApplyingBuckets())
+    {
+        return TransactionQueue::AddResult::ADD_STATUS_TRY_AGAIN_LATER;
+    }
+
     auto info = getAccountTransactionQueueInfo(tx->getSourceID());
     LedgerTxn ltx(mApp.getLedgerTxnRoot());
     if (!tx->checkValid(ltx, info.mMaxSeq))
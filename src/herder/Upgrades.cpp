@@ -5,6 +5,7 @@
 #include "herder/Upgrades.h"
 #include "database/Database.h"
 #include "database/DatabaseUtils.h"
+#include "database/HistoryPartitions.h"
 #include "ledger/LedgerTxn.h"
 #include "ledger/LedgerTxnEntry.h"
 #include "ledger/LedgerTxnHeader.h"
@@ -368,9 +369,11 @@ Upgrades::storeUpgradeHistory(Database& db, uint32_t ledgerSeq,
     xdr::opaque_vec<> upgradeChanges(xdr::xdr_to_opaque(changes));
     std::string upgradeChanges64 = decoder::encode_b64(upgradeChanges);
 
+    auto table =
+        db.getHistoryPartitions().getTable("upgradehistory", ledgerSeq);
     auto prep = db.getPreparedStatement(
-        "INSERT INTO upgradehistory "
-        "(ledgerseq, upgradeindex,  upgrade,  changes) VALUES "
+        "INSERT INTO " + table +
+        " (ledgerseq, upgradeindex,  upgrade,  changes) VALUES "
         "(:seq,      :upgradeindex, :upgrade, :changes)");
 
     auto& st = prep.statement();
@@ -393,7 +396,7 @@ Upgrades::storeUpgradeHistory(Database& db, uint32_t ledgerSeq,
 void
 Upgrades::deleteOldEntries(Database& db, uint32_t ledgerSeq, uint32_t count)
 {
-    DatabaseUtils::deleteOldEntriesHelper(db.getSession(), ledgerSeq, count,
+    DatabaseUtils::deleteOldEntriesHelper(db, ledgerSeq, count,
                                           "upgradehistory", "ledgerseq");
 }
 
@@ -583,148 +586,168 @@ updateOffer(
     return res;
 }
 
-// This function is used to bring offers and liabilities into a valid state.
-// For every account that has offers,
-//   1. Calculate total liabilities for each asset
-//   2. For every asset with excess buying liabilities according to (1), erase
-//      all offers buying that asset. For every asset with excess selling
-//      liabilities according to (1), erase all offers selling that asset.
-//   3. Update liabilities to reflect offers remaining in the book.
-// It is essential to note that the excess liabilities are determined only
-// using the initial result of step (1), so it does not matter what order the
-// offers are processed.
 static void
-prepareLiabilities(AbstractLedgerTxn& ltx, LedgerTxnHeader const& header)
+prepareAccountLiabilities(AbstractLedgerTxn& ltx, LedgerTxnHeader const& header,
+                          AccountID const& accountID,
+                          std::vector<LedgerTxnEntry>& offers,
+                          uint64_t& nChangedAccounts,
+                          uint64_t& nChangedTrustLines,
+                          std::map<UpdateOfferResult, uint64_t>& nUpdatedOffers)
 {
-    CLOG(INFO, "Ledger") << "Starting prepareLiabilities";
-
-    auto offersByAccount = ltx.loadAllOffers();
-
-    uint64_t nChangedAccounts = 0;
-    uint64_t nChangedTrustLines = 0;
-    std::map<UpdateOfferResult, uint64_t> nUpdatedOffers;
-    for (auto& accountOffers : offersByAccount)
-    {
-        // The purpose of std::unique_ptr here is to have a special value
-        // (nullptr) to indicate that an integer overflow would have occured.
-        // Overflow is possible here because existing offers were not
-        // constrainted to have int64_t liabilities. This must be carefully
-        // handled in what follows.
-        std::map<Asset, std::unique_ptr<int64_t>> initialBuyingLiabilities;
-        std::map<Asset, std::unique_ptr<int64_t>> initialSellingLiabilities;
-        for (auto const& offerEntry : accountOffers.second)
+    // The purpose of std::unique_ptr here is to have a special value
+    // (nullptr) to indicate that an integer overflow would have occured.
+    // Overflow is possible here because existing offers were not
+    // constrainted to have int64_t liabilities. This must be carefully
+    // handled in what follows.
+    std::map<Asset, std::unique_ptr<int64_t>> initialBuyingLiabilities;
+    std::map<Asset, std::unique_ptr<int64_t>> initialSellingLiabilities;
+    for (auto const& offerEntry : offers)
+    {
+        auto const& offer = offerEntry.current().data.offer();
+        addLiabilities(initialBuyingLiabilities, offer.sellerID, offer.buying,
+                       getOfferBuyingLiabilities(header, offerEntry));
+        addLiabilities(initialSellingLiabilities, offer.sellerID,
+                       offer.selling,
+                       getOfferSellingLiabilities(header, offerEntry));
+    }
+
+    auto accountEntry = stellar::loadAccount(ltx, accountID);
+    if (!accountEntry)
+    {
+        throw std::runtime_error("account does not exist");
+    }
+    auto const& acc = accountEntry.current().data.account();
+    AccountEntry const accountBefore = acc;
+
+    // balanceAboveReserve must exclude native selling liabilities, since
+    // these are in the process of being recalculated from scratch.
+    int64_t balance = acc.balance;
+    int64_t minBalance = getMinBalance(header, acc.numSubEntries);
+    int64_t balanceAboveReserve = balance - minBalance;
+
+    std::map<Asset, Liabilities> liabilities;
+    for (auto& offerEntry : offers)
+    {
+        auto offerID = offerEntry.current().data.offer().offerID;
+        auto res = updateOffer(offerEntry, balance, balanceAboveReserve,
+                               liabilities, initialBuyingLiabilities,
+                               initialSellingLiabilities, ltx, header);
+        if (res == UpdateOfferResult::AdjustedToZero ||
+            res == UpdateOfferResult::Erased)
         {
-            auto const& offer = offerEntry.current().data.offer();
-            addLiabilities(initialBuyingLiabilities, offer.sellerID,
-                           offer.buying,
-                           getOfferBuyingLiabilities(header, offerEntry));
-            addLiabilities(initialSellingLiabilities, offer.sellerID,
-                           offer.selling,
-                           getOfferSellingLiabilities(header, offerEntry));
+            stellar::addNumEntries(header, accountEntry, -1);
         }
 
-        auto accountEntry = stellar::loadAccount(ltx, accountOffers.first);
-        if (!accountEntry)
+        ++nUpdatedOffers[res];
+        if (res != UpdateOfferResult::Unchanged)
         {
-            throw std::runtime_error("account does not exist");
+            std::string message;
+            switch (res)
+            {
+            case UpdateOfferResult::Adjusted:
+                message = " was adjusted";
+                break;
+            case UpdateOfferResult::AdjustedToZero:
+                message = " was adjusted to zero";
+                break;
+            case UpdateOfferResult::Erased:
+                message = " was erased";
+                break;
+            default:
+                throw std::runtime_error("Unknown UpdateOfferResult");
+            }
+            CLOG(DEBUG, "Ledger") << "Offer with offerID=" << offerID << message;
         }
-        auto const& acc = accountEntry.current().data.account();
-        AccountEntry const accountBefore = acc;
-
-        // balanceAboveReserve must exclude native selling liabilities, since
-        // these are in the process of being recalculated from scratch.
-        int64_t balance = acc.balance;
-        int64_t minBalance = getMinBalance(header, acc.numSubEntries);
-        int64_t balanceAboveReserve = balance - minBalance;
+    }
 
-        std::map<Asset, Liabilities> liabilities;
-        for (auto& offerEntry : accountOffers.second)
+    for (auto const& assetLiabilities : liabilities)
+    {
+        Asset const& asset = assetLiabilities.first;
+        Liabilities const& liab = assetLiabilities.second;
+        if (asset.type() == ASSET_TYPE_NATIVE)
         {
-            auto offerID = offerEntry.current().data.offer().offerID;
-            auto res = updateOffer(offerEntry, balance, balanceAboveReserve,
-                                   liabilities, initialBuyingLiabilities,
-                                   initialSellingLiabilities, ltx, header);
-            if (res == UpdateOfferResult::AdjustedToZero ||
-                res == UpdateOfferResult::Erased)
+            int64_t deltaSelling =
+                liab.selling - getSellingLiabilities(header, accountEntry);
+            int64_t deltaBuying =
+                liab.buying - getBuyingLiabilities(header, accountEntry);
+            if (!addSellingLiabilities(header, accountEntry, deltaSelling))
             {
-                stellar::addNumEntries(header, accountEntry, -1);
+                throw std::runtime_error("invalid selling liabilities "
+                                         "during upgrade");
             }
-
-            ++nUpdatedOffers[res];
-            if (res != UpdateOfferResult::Unchanged)
+            if (!addBuyingLiabilities(header, accountEntry, deltaBuying))
             {
-                std::string message;
-                switch (res)
-                {
-                case UpdateOfferResult::Adjusted:
-                    message = " was adjusted";
-                    break;
-                case UpdateOfferResult::AdjustedToZero:
-                    message = " was adjusted to zero";
-                    break;
-                case UpdateOfferResult::Erased:
-                    message = " was erased";
-                    break;
-                default:
-                    throw std::runtime_error("Unknown UpdateOfferResult");
-                }
-                CLOG(DEBUG, "Ledger")
-                    << "Offer with offerID=" << offerID << message;
+                throw std::runtime_error("invalid buying liabilities "
+                                         "during upgrade");
             }
         }
-
-        for (auto const& assetLiabilities : liabilities)
+        else
         {
-            Asset const& asset = assetLiabilities.first;
-            Liabilities const& liab = assetLiabilities.second;
-            if (asset.type() == ASSET_TYPE_NATIVE)
+            auto trustEntry = stellar::loadTrustLine(ltx, accountID, asset);
+            int64_t deltaSelling =
+                liab.selling - trustEntry.getSellingLiabilities(header);
+            int64_t deltaBuying =
+                liab.buying - trustEntry.getBuyingLiabilities(header);
+            if (deltaSelling != 0 || deltaBuying != 0)
             {
-                int64_t deltaSelling =
-                    liab.selling - getSellingLiabilities(header, accountEntry);
-                int64_t deltaBuying =
-                    liab.buying - getBuyingLiabilities(header, accountEntry);
-                if (!addSellingLiabilities(header, accountEntry, deltaSelling))
-                {
-                    throw std::runtime_error("invalid selling liabilities "
-                                             "during upgrade");
-                }
-                if (!addBuyingLiabilities(header, accountEntry, deltaBuying))
-                {
-                    throw std::runtime_error("invalid buying liabilities "
-                                             "during upgrade");
-                }
+                ++nChangedTrustLines;
             }
-            else
+
+            if (!trustEntry.addSellingLiabilities(header, deltaSelling))
             {
-                auto trustEntry =
-                    stellar::loadTrustLine(ltx, accountOffers.first, asset);
-                int64_t deltaSelling =
-                    liab.selling - trustEntry.getSellingLiabilities(header);
-                int64_t deltaBuying =
-                    liab.buying - trustEntry.getBuyingLiabilities(header);
-                if (deltaSelling != 0 || deltaBuying != 0)
-                {
-                    ++nChangedTrustLines;
-                }
-
-                if (!trustEntry.addSellingLiabilities(header, deltaSelling))
-                {
-                    throw std::runtime_error("invalid selling liabilities "
-                                             "during upgrade");
-                }
-                if (!trustEntry.addBuyingLiabilities(header, deltaBuying))
-                {
-                    throw std::runtime_error("invalid buying liabilities "
-                                             "during upgrade");
-                }
+                throw std::runtime_error("invalid selling liabilities "
+                                         "during upgrade");
+            }
+            if (!trustEntry.addBuyingLiabilities(header, deltaBuying))
+            {
+                throw std::runtime_error("invalid buying liabilities "
+                                         "during upgrade");
             }
         }
+    }
+
+    if (!(acc == accountBefore))
+    {
+        ++nChangedAccounts;
+    }
+}
+
+// This function is used to bring offers and liabilities into a valid state.
+// For every account that has offers,
+//   1. Calculate total liabilities for each asset
+//   2. For every asset with excess buying liabilities according to (1), erase
+//      all offers buying that asset. For every asset with excess selling
+//      liabilities according to (1), erase all offers selling that asset.
+//   3. Update liabilities to reflect offers remaining in the book.
+// It is essential to note that the excess liabilities are determined only
+// using the initial result of step (1), so it does not matter what order the
+// offers are processed.
+static void
+prepareLiabilities(AbstractLedgerTxn& ltx, LedgerTxnHeader const& header)
+{
+    CLOG(INFO, "Ledger") << "Starting prepareLiabilities";
+
+    uint64_t nChangedAccounts = 0;
+    uint64_t nChangedTrustLines = 0;
+    std::map<UpdateOfferResult, uint64_t> nUpdatedOffers;
 
-        if (!(acc == accountBefore))
+    // Offers are loaded in batches of consecutive sellers, so that only one
+    // batch is materialized and active at a time rather than the whole order
+    // book
+    size_t const OFFER_BATCH_SIZE = 0x4000;
+    xdr::pointer<AccountID> lastSeller;
+    do
+    {
+        auto afterSeller = lastSeller;
+        auto offersByAccount = ltx.loadOffersBySellerRange(
+            afterSeller.get(), OFFER_BATCH_SIZE, lastSeller);
+        for (auto& accountOffers : offersByAccount)
         {
-            ++nChangedAccounts;
+            prepareAccountLiabilities(ltx, header, accountOffers.first,
+                                      accountOffers.second, nChangedAccounts,
+                                      nChangedTrustLines, nUpdatedOffers);
         }
-    }
+    } while (lastSeller);
 
     CLOG(INFO, "Ledger") << "prepareLiabilities completed with "
                          << nChangedAccounts << " accounts modified, "
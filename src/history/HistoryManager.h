@@ -179,6 +179,7 @@ class BucketList;
 class Config;
 class Database;
 class HistoryArchive;
+class HistorySegmentStore;
 struct StateSnapshot;
 
 class HistoryManager
@@ -271,6 +272,11 @@ class HistoryManager
     // queue.
     virtual std::vector<std::string> getBucketsReferencedByPublishQueue() = 0;
 
+    // Return whether a state in the persistent (DB) publish queue references
+    // the bucket with the given hex hash.
+    virtual bool
+    isBucketReferencedByPublishQueue(std::string const& bucket) = 0;
+
     // Return the full set of HistoryArchiveStates in the persistent (DB)
     // publish queue.
     virtual std::vector<HistoryArchiveState> getPublishQueueStates() = 0;
@@ -296,6 +302,11 @@ class HistoryManager
     // tmpdir.
     virtual std::string localFilename(std::string const& basename) = 0;
 
+    // Return the store of history segments, or nullptr if published history
+    // is only read from the database (HISTORY_SEGMENT_DIR_PATH is empty).
+    // Transactions are written to the database either way.
+    virtual HistorySegmentStore* getSegmentStore() = 0;
+
     // Return the number of checkpoints that have been enqueued for
     // publication. This may be less than the number "started", but every
     // enqueued checkpoint should eventually start.
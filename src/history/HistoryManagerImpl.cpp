@@ -22,6 +22,7 @@
 #include "historywork/ResolveSnapshotWork.h"
 #include "historywork/WriteSnapshotWork.h"
 #include "ledger/LedgerManager.h"
+#include "ledger/LedgerTxn.h"
 #include "lib/util/format.h"
 #include "main/Application.h"
 #include "main/Config.h"
@@ -74,6 +75,12 @@ HistoryManagerImpl::HistoryManagerImpl(Application& app)
     , mEnqueueToPublishTimer(
           app.getMetrics().NewTimer({"history", "publish", "time"}))
 {
+    auto const& dir = app.getConfig().HISTORY_SEGMENT_DIR_PATH;
+    if (!dir.empty())
+    {
+        mSegmentStore = std::make_unique<HistorySegmentStore>(
+            dir, getCheckpointFrequency(), !app.getConfig().DISABLE_XDR_FSYNC);
+    }
 }
 
 HistoryManagerImpl::~HistoryManagerImpl()
@@ -174,6 +181,12 @@ HistoryManagerImpl::localFilename(std::string const& basename)
     return this->getTmpDir() + "/" + basename;
 }
 
+HistorySegmentStore*
+HistoryManagerImpl::getSegmentStore()
+{
+    return mSegmentStore.get();
+}
+
 InferredQuorum
 HistoryManagerImpl::inferQuorum(uint32_t ledgerNum)
 {
@@ -287,6 +300,10 @@ HistoryManagerImpl::takeSnapshotAndPublish(HistoryArchiveState const& has)
     auto allBucketsFromHAS = has.allBuckets();
     auto ledgerSeq = has.currentLedger;
     CLOG(DEBUG, "History") << "Activating publish for ledger " << ledgerSeq;
+
+    // The transaction history of the checkpoint might still be waiting to be
+    // written, if ledgers are committed asynchronously
+    mApp.getLedgerTxnRoot().waitForDeferredWrites();
     auto snap = std::make_shared<StateSnapshot>(mApp, has);
 
     // Phase 1: resolve futures in snapshot
@@ -373,17 +390,22 @@ HistoryManagerImpl::loadBucketsReferencedByPublishQueue()
     return result;
 }
 
-std::vector<std::string>
-HistoryManagerImpl::getBucketsReferencedByPublishQueue()
+PublishQueueBuckets const&
+HistoryManagerImpl::getPublishQueueBuckets()
 {
     if (!mPublishQueueBucketsFilled)
     {
         mPublishQueueBuckets.setBuckets(loadBucketsReferencedByPublishQueue());
         mPublishQueueBucketsFilled = true;
     }
+    return mPublishQueueBuckets;
+}
 
+std::vector<std::string>
+HistoryManagerImpl::getBucketsReferencedByPublishQueue()
+{
     std::vector<std::string> buckets;
-    for (auto const& s : mPublishQueueBuckets.map())
+    for (auto const& s : getPublishQueueBuckets().map())
     {
         buckets.push_back(s.first);
     }
@@ -391,6 +413,13 @@ HistoryManagerImpl::getBucketsReferencedByPublishQueue()
     return buckets;
 }
 
+bool
+HistoryManagerImpl::isBucketReferencedByPublishQueue(std::string const& bucket)
+{
+    auto const& buckets = getPublishQueueBuckets().map();
+    return buckets.find(bucket) != buckets.end();
+}
+
 std::vector<std::string>
 HistoryManagerImpl::getMissingBucketsReferencedByPublishQueue()
 {
@@ -6,6 +6,7 @@
 
 #include "bucket/PublishQueueBuckets.h"
 #include "history/HistoryManager.h"
+#include "history/HistorySegmentStore.h"
 #include "util/TmpDir.h"
 #include "work/Work.h"
 #include <memory>
@@ -26,6 +27,7 @@ class HistoryManagerImpl : public HistoryManager
     Application& mApp;
     std::unique_ptr<TmpDir> mWorkDir;
     std::shared_ptr<BasicWork> mPublishWork;
+    std::unique_ptr<HistorySegmentStore> mSegmentStore;
 
     PublishQueueBuckets mPublishQueueBuckets;
     bool mPublishQueueBucketsFilled{false};
@@ -39,6 +41,7 @@ class HistoryManagerImpl : public HistoryManager
         mEnqueueTimes;
 
     PublishQueueBuckets::BucketCount loadBucketsReferencedByPublishQueue();
+    PublishQueueBuckets const& getPublishQueueBuckets();
 #ifdef BUILD_TESTS
     bool mPublicationEnabled{true};
 #endif
@@ -72,6 +75,7 @@ class HistoryManagerImpl : public HistoryManager
     getMissingBucketsReferencedByPublishQueue() override;
 
     std::vector<std::string> getBucketsReferencedByPublishQueue() override;
+    bool isBucketReferencedByPublishQueue(std::string const& bucket) override;
 
     std::vector<HistoryArchiveState> getPublishQueueStates() override;
 
@@ -85,6 +89,8 @@ class HistoryManagerImpl : public HistoryManager
 
     std::string localFilename(std::string const& basename) override;
 
+    HistorySegmentStore* getSegmentStore() override;
+
     uint64_t getPublishQueueCount() override;
     uint64_t getPublishSuccessCount() override;
     uint64_t getPublishFailureCount() override;
@@ -0,0 +1,424 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "history/HistorySegmentStore.h"
+#include "util/FileSystemException.h"
+#include "util/Fs.h"
+#include "util/Logging.h"
+#include "util/XDRStream.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <regex>
+
+namespace stellar
+{
+
+namespace
+{
+char const* const kStreamNames[HistorySegmentStore::STREAM_COUNT] = {
+    "ledger.xdr", "transactions.xdr", "results.xdr", "scp.xdr"};
+
+// Offsets are stored as big-endian 64-bit integers
+size_t const kOffsetSize = 8;
+
+bool
+isSegmentName(std::string const& name)
+{
+    static std::regex const re("^[a-f0-9]{8}$");
+    return std::regex_match(name, re);
+}
+
+FILE*
+openForWriting(std::string const& path)
+{
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out)
+    {
+        FileSystemException::failWithErrno(std::string("fopen(\"") + path +
+                                           "\") failed: ");
+    }
+    return out;
+}
+
+void
+writeBytes(FILE* out, std::string const& path, char const* data, size_t size)
+{
+    if (fwrite(data, 1, size, out) != size)
+    {
+        fclose(out);
+        FileSystemException::failWithErrno(
+            std::string("writing \"") + path + "\" failed: ");
+    }
+}
+
+void
+closeFile(FILE* out, std::string const& path, bool doFsync)
+{
+    if (fflush(out) != 0)
+    {
+        fclose(out);
+        FileSystemException::failWithErrno(
+            std::string("fflush(\"") + path + "\") failed: ");
+    }
+    if (doFsync)
+    {
+        fs::flushFileChanges(out);
+    }
+    if (fclose(out) != 0)
+    {
+        FileSystemException::failWithErrno(std::string("fclose(\"") + path +
+                                           "\") failed: ");
+    }
+}
+
+// copyFilePrefix writes the first size bytes of from to a new file to
+void
+copyFilePrefix(std::string const& from, std::string const& to, uint64_t size,
+               bool doFsync)
+{
+    std::ifstream in;
+    if (size != 0)
+    {
+        in.open(from, std::ifstream::binary);
+        if (!in)
+        {
+            FileSystemException::failWith(std::string("opening \"") + from +
+                                          "\" failed");
+        }
+    }
+
+    FILE* out = openForWriting(to);
+    std::vector<char> buf(64 * 1024);
+    while (size != 0)
+    {
+        auto n = static_cast<size_t>(std::min<uint64_t>(size, buf.size()));
+        if (!in.read(buf.data(), n))
+        {
+            fclose(out);
+            FileSystemException::failWith(std::string("reading \"") + from +
+                                          "\" failed");
+        }
+        writeBytes(out, to, buf.data(), n);
+        size -= n;
+    }
+    closeFile(out, to, doFsync);
+}
+}
+
+HistorySegmentStore::HistorySegmentStore(std::string const& dir,
+                                         uint32_t checkpointFrequency,
+                                         bool doFsync)
+    : mDir(dir), mCheckpointFrequency(checkpointFrequency), mDoFsync(doFsync)
+{
+    if (!fs::exists(mDir) && !fs::mkpath(mDir))
+    {
+        throw std::runtime_error("Unable to create history segment dir " +
+                                 mDir);
+    }
+    loadLastRun();
+}
+
+uint32_t
+HistorySegmentStore::firstLedgerInSegment(uint32_t ledgerSeq) const
+{
+    return ledgerSeq / mCheckpointFrequency * mCheckpointFrequency;
+}
+
+std::string
+HistorySegmentStore::segmentDir(uint32_t ledgerSeq) const
+{
+    uint32_t checkpoint =
+        firstLedgerInSegment(ledgerSeq) + mCheckpointFrequency - 1;
+    return mDir + "/" + fs::hexStr(checkpoint);
+}
+
+std::string
+HistorySegmentStore::streamPath(std::string const& dir, Stream stream) const
+{
+    return dir + "/" + kStreamNames[stream];
+}
+
+std::vector<HistorySegmentStore::Offsets>
+HistorySegmentStore::readIndex(std::string const& dir) const
+{
+    auto path = dir + "/index";
+    size_t const size = mCheckpointFrequency * STREAM_COUNT * kOffsetSize;
+    std::vector<unsigned char> buf(size);
+    std::ifstream in(path, std::ifstream::binary);
+    if (!in || !in.read(reinterpret_cast<char*>(buf.data()), size) ||
+        in.peek() != std::ifstream::traits_type::eof())
+    {
+        throw std::runtime_error("Invalid history segment index " + path);
+    }
+
+    std::vector<Offsets> index(mCheckpointFrequency);
+    auto p = buf.begin();
+    for (auto& offsets : index)
+    {
+        for (auto& offset : offsets)
+        {
+            offset = 0;
+            for (size_t i = 0; i < kOffsetSize; ++i)
+            {
+                offset = (offset << 8) | *p++;
+            }
+        }
+    }
+    return index;
+}
+
+void
+HistorySegmentStore::writeIndex(std::string const& dir,
+                                std::vector<Offsets> const& index) const
+{
+    std::vector<char> buf;
+    buf.reserve(index.size() * STREAM_COUNT * kOffsetSize);
+    for (auto const& offsets : index)
+    {
+        for (auto offset : offsets)
+        {
+            for (size_t i = kOffsetSize; i-- > 0;)
+            {
+                buf.push_back(static_cast<char>((offset >> (i * 8)) & 0xFF));
+            }
+        }
+    }
+
+    // The index is replaced by a rename, so it never describes data that was
+    // only partially written
+    auto tmp = dir + "/index.tmp";
+    FILE* out = openForWriting(tmp);
+    writeBytes(out, tmp, buf.data(), buf.size());
+    closeFile(out, tmp, mDoFsync);
+    if (mDoFsync)
+    {
+        fs::durableRename(tmp, dir + "/index", dir);
+    }
+    else if (std::rename(tmp.c_str(), (dir + "/index").c_str()) != 0)
+    {
+        FileSystemException::failWithErrno(std::string("rename(\"") + tmp +
+                                           "\") failed: ");
+    }
+}
+
+void
+HistorySegmentStore::loadLastRun()
+{
+    auto names = fs::findfiles(mDir, isSegmentName);
+    if (names.empty())
+    {
+        return;
+    }
+
+    // Names have a fixed width, so the last one is the latest segment
+    auto const& name = *std::max_element(names.begin(), names.end());
+    uint32_t first =
+        static_cast<uint32_t>(std::stoul(name, nullptr, 16)) + 1 -
+        mCheckpointFrequency;
+    std::vector<Offsets> index;
+    try
+    {
+        index = readIndex(mDir + "/" + name);
+    }
+    catch (std::exception& e)
+    {
+        CLOG(WARNING, "History") << e.what();
+        return;
+    }
+
+    uint32_t count = 0;
+    while (count < index.size() && index[count][LEDGER] != 0)
+    {
+        ++count;
+    }
+    if (count != 0)
+    {
+        mRunStart = first;
+        mLastLedger = first + count - 1;
+    }
+}
+
+bool
+HistorySegmentStore::isStoringLocked(uint32_t ledgerSeq) const
+{
+    return ledgerSeq % mCheckpointFrequency == 0 ||
+           (mLastLedger != 0 && ledgerSeq - 1 >= mRunStart &&
+            ledgerSeq - 1 <= mLastLedger);
+}
+
+bool
+HistorySegmentStore::isStoring(uint32_t ledgerSeq) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return isStoringLocked(ledgerSeq);
+}
+
+bool
+HistorySegmentStore::beginLedger(uint32_t ledgerSeq)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!isStoringLocked(ledgerSeq))
+    {
+        mRunStart = 0;
+        mLastLedger = 0;
+        return false;
+    }
+    if (mLastLedger == 0 || ledgerSeq - 1 < mRunStart ||
+        ledgerSeq - 1 > mLastLedger)
+    {
+        mRunStart = ledgerSeq;
+    }
+    mLastLedger = ledgerSeq;
+    return true;
+}
+
+void
+HistorySegmentStore::setSCPHistory(SCPHistoryEntry const& entry)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mPendingSCP[entry.v0().ledgerMessages.ledgerSeq] = entry;
+}
+
+optional<SCPHistoryEntry>
+HistorySegmentStore::takeSCPHistory(uint32_t ledgerSeq)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    optional<SCPHistoryEntry> res;
+    auto iter = mPendingSCP.find(ledgerSeq);
+    if (iter != mPendingSCP.end())
+    {
+        res = make_optional<SCPHistoryEntry>(iter->second);
+    }
+    mPendingSCP.erase(mPendingSCP.begin(),
+                      mPendingSCP.upper_bound(ledgerSeq));
+    return res;
+}
+
+void
+HistorySegmentStore::append(Ledger const& ledger)
+{
+    uint32_t ledgerSeq = ledger.header.header.ledgerSeq;
+    uint32_t slot = ledgerSeq - firstLedgerInSegment(ledgerSeq);
+    auto dir = segmentDir(ledgerSeq);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::vector<Offsets> index;
+    Offsets start{};
+    if (slot == 0)
+    {
+        if (!fs::exists(dir) && !fs::mkpath(dir))
+        {
+            throw std::runtime_error("Unable to create history segment " +
+                                     dir);
+        }
+        index.resize(mCheckpointFrequency);
+    }
+    else
+    {
+        index = readIndex(dir);
+        start = index[slot - 1];
+        if (start[LEDGER] == 0)
+        {
+            throw std::runtime_error("History segment " + dir +
+                                     " is missing ledger " +
+                                     std::to_string(ledgerSeq - 1));
+        }
+    }
+    std::fill(index.begin() + slot, index.end(), Offsets{});
+
+    Offsets end = start;
+    auto write = [&](Stream stream, auto const& value) {
+        XDROutputFileStream out(mDoFsync);
+        out.openAt(streamPath(dir, stream), start[stream]);
+        size_t bytes = 0;
+        out.writeOne(value, nullptr, &bytes);
+        out.close();
+        end[stream] += bytes;
+    };
+    write(LEDGER, ledger.header);
+    if (ledger.transactions)
+    {
+        write(TRANSACTIONS, *ledger.transactions);
+    }
+    if (ledger.results)
+    {
+        write(RESULTS, *ledger.results);
+    }
+    if (ledger.scp)
+    {
+        write(SCP, *ledger.scp);
+    }
+
+    index[slot] = end;
+    writeIndex(dir, index);
+}
+
+bool
+HistorySegmentStore::hasSegment(uint32_t ledgerSeq) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return fs::exists(segmentDir(ledgerSeq) + "/index");
+}
+
+bool
+HistorySegmentStore::copySegment(uint32_t lastLedger, Paths const& paths,
+                                 Offsets& sizes)
+{
+    auto dir = segmentDir(lastLedger);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!fs::exists(dir + "/index"))
+    {
+        return false;
+    }
+    auto index = readIndex(dir);
+    auto const& end = index[lastLedger - firstLedgerInSegment(lastLedger)];
+    if (end[LEDGER] == 0)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < STREAM_COUNT; ++i)
+    {
+        auto stream = static_cast<Stream>(i);
+        copyFilePrefix(streamPath(dir, stream), paths[i], end[i], mDoFsync);
+    }
+    sizes = end;
+    return true;
+}
+
+void
+HistorySegmentStore::deleteSegments(uint32_t ledgerSeq)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto const& name : fs::findfiles(mDir, isSegmentName))
+    {
+        if (std::stoul(name, nullptr, 16) <= ledgerSeq)
+        {
+            CLOG(DEBUG, "History") << "Deleting history segment " << name;
+            fs::deltree(mDir + "/" + name);
+        }
+    }
+}
+
+void
+HistorySegmentStore::clear()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (fs::exists(mDir))
+    {
+        fs::deltree(mDir);
+    }
+    if (!fs::mkpath(mDir))
+    {
+        throw std::runtime_error("Unable to create history segment dir " +
+                                 mDir);
+    }
+    mRunStart = 0;
+    mLastLedger = 0;
+    mPendingSCP.clear();
+}
+}
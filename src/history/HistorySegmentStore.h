@@ -0,0 +1,128 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/NonCopyable.h"
+#include "util/optional.h"
+#include "xdr/Stellar-ledger.h"
+
+#include <array>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace stellar
+{
+
+// HistorySegmentStore keeps the history of closed ledgers that is published
+// in files: one segment per checkpoint, which is a directory
+// named after the checkpoint holding one file per kind of history file of
+// the archives (ledger headers, transaction sets, transaction results and
+// SCP messages) and an index.
+//
+// The files use the framing of the archive files, so that publishing a
+// checkpoint copies them as they are. The index holds, for every ledger of
+// the checkpoint, the end offset of each file after that ledger, and is
+// replaced atomically after the files are flushed: a ledger is in the
+// segment if and only if it has an entry in the index. Appending a ledger
+// overwrites the files from the end of the previous ledger, so closing a
+// ledger again after a crash replaces what was stored for it and for the
+// ledgers after it. Trimming history deletes whole segments.
+//
+// A segment is only started at the first ledger of a checkpoint and only
+// grows by consecutive ledgers, so a segment that holds the last ledger of a
+// checkpoint holds all of it. Ledgers that are not stored in a segment (for
+// example after catchup, until the next checkpoint) are kept in the database.
+// Only SCP messages are kept out of the database for ledgers in a segment:
+// transactions are written to the txhistory and txfeehistory tables either
+// way, along with their meta and fee changes, which are not part of the
+// archives.
+//
+// All the methods can be called from any thread.
+class HistorySegmentStore : public NonMovableOrCopyable
+{
+  public:
+    enum Stream
+    {
+        LEDGER = 0,
+        TRANSACTIONS,
+        RESULTS,
+        SCP,
+        STREAM_COUNT
+    };
+    typedef std::array<uint64_t, STREAM_COUNT> Offsets;
+    typedef std::array<std::string, STREAM_COUNT> Paths;
+
+    struct Ledger
+    {
+        LedgerHeaderHistoryEntry header;
+        // Absent for ledgers without transactions, like in the archives
+        optional<TransactionHistoryEntry> transactions;
+        optional<TransactionHistoryResultEntry> results;
+        optional<SCPHistoryEntry> scp;
+    };
+
+  private:
+    std::string const mDir;
+    uint32_t const mCheckpointFrequency;
+    bool const mDoFsync;
+
+    mutable std::mutex mMutex;
+    // Ledgers mRunStart to mLastLedger are stored in segments (or about to
+    // be, the ledger close commits them asynchronously); both are 0 if the
+    // last ledger that was closed is not stored
+    uint32_t mRunStart{0};
+    uint32_t mLastLedger{0};
+    std::map<uint32_t, SCPHistoryEntry> mPendingSCP;
+
+    uint32_t firstLedgerInSegment(uint32_t ledgerSeq) const;
+    std::string segmentDir(uint32_t ledgerSeq) const;
+    std::string streamPath(std::string const& dir, Stream stream) const;
+    bool isStoringLocked(uint32_t ledgerSeq) const;
+
+    std::vector<Offsets> readIndex(std::string const& dir) const;
+    void writeIndex(std::string const& dir,
+                    std::vector<Offsets> const& index) const;
+
+    void loadLastRun();
+
+  public:
+    HistorySegmentStore(std::string const& dir, uint32_t checkpointFrequency,
+                        bool doFsync);
+
+    // isStoring returns whether ledgerSeq, the ledger after the last closed
+    // ledger, will be stored in a segment
+    bool isStoring(uint32_t ledgerSeq) const;
+
+    // beginLedger is called when ledgerSeq is closed, and returns whether it
+    // must be appended to a segment
+    bool beginLedger(uint32_t ledgerSeq);
+
+    // The SCP messages of a ledger are known before it is closed, so they are
+    // kept until the ledger is appended. takeSCPHistory returns those of
+    // ledgerSeq and forgets those of the ledgers up to ledgerSeq.
+    void setSCPHistory(SCPHistoryEntry const& entry);
+    optional<SCPHistoryEntry> takeSCPHistory(uint32_t ledgerSeq);
+
+    // append stores ledger at the end of its segment, replacing what was
+    // stored for that ledger and the following ones. Throws if the previous
+    // ledger is not in the segment.
+    void append(Ledger const& ledger);
+
+    bool hasSegment(uint32_t ledgerSeq) const;
+
+    // copySegment writes the files of the segment of lastLedger, up to
+    // lastLedger, to paths and sets sizes to their size. Returns false if the
+    // segment does not hold every ledger up to lastLedger.
+    bool copySegment(uint32_t lastLedger, Paths const& paths, Offsets& sizes);
+
+    // deleteSegments deletes the segments that only hold ledgers up to
+    // ledgerSeq
+    void deleteSegments(uint32_t ledgerSeq);
+
+    void clear();
+};
+}
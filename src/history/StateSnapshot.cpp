@@ -12,10 +12,12 @@
 #include "history/FileTransferInfo.h"
 #include "history/HistoryArchive.h"
 #include "history/HistoryManager.h"
+#include "history/HistorySegmentStore.h"
 #include "ledger/LedgerHeaderUtils.h"
 #include "main/Application.h"
 #include "main/Config.h"
 #include "transactions/TransactionFrame.h"
+#include "util/BlockCompressedFile.h"
 #include "util/Logging.h"
 #include "util/XDRStream.h"
 
@@ -49,6 +51,12 @@ StateSnapshot::StateSnapshot(Application& app, HistoryArchiveState const& state)
 bool
 StateSnapshot::writeHistoryBlocks() const
 {
+    auto segments = mApp.getHistoryManager().getSegmentStore();
+    if (segments && segments->hasSegment(mLocalState.currentLedger))
+    {
+        return writeHistoryBlocksFromSegment(*segments);
+    }
+
     std::unique_ptr<soci::session> snapSess(
         mApp.getDatabase().canUsePool()
             ? std::make_unique<soci::session>(mApp.getDatabase().getPool())
@@ -133,6 +141,40 @@ StateSnapshot::writeHistoryBlocks() const
     return true;
 }
 
+bool
+StateSnapshot::writeHistoryBlocksFromSegment(
+    HistorySegmentStore& segments) const
+{
+    // The segment files have the format of the history block files, so they
+    // are copied as they are
+    HistorySegmentStore::Paths paths{
+        {mLedgerSnapFile->localPath_nogz(),
+         mTransactionSnapFile->localPath_nogz(),
+         mTransactionResultSnapFile->localPath_nogz(),
+         mSCPHistorySnapFile->localPath_nogz()}};
+    HistorySegmentStore::Offsets sizes;
+    if (!segments.copySegment(mLocalState.currentLedger, paths, sizes))
+    {
+        CLOG(WARNING, "History")
+            << "History segment is missing ledgers up to "
+            << mLocalState.currentLedger << ", will retry";
+        return false;
+    }
+    CLOG(DEBUG, "History") << "Copied history segment of ledger "
+                           << mLocalState.currentLedger << " ("
+                           << sizes[HistorySegmentStore::LEDGER] << ", "
+                           << sizes[HistorySegmentStore::TRANSACTIONS] << ", "
+                           << sizes[HistorySegmentStore::RESULTS] << " and "
+                           << sizes[HistorySegmentStore::SCP] << " bytes)";
+
+    if (sizes[HistorySegmentStore::SCP] == 0)
+    {
+        // don't upload empty files
+        std::remove(mSCPHistorySnapFile->localPath_nogz().c_str());
+    }
+    return true;
+}
+
 std::vector<std::shared_ptr<FileTransferInfo>>
 StateSnapshot::differingHASFiles(HistoryArchiveState const& other)
 {
@@ -153,7 +195,23 @@ StateSnapshot::differingHASFiles(HistoryArchiveState const& other)
     {
         auto b = mApp.getBucketManager().getBucketByHash(hexToBin256(hash));
         assert(b);
-        addIfExists(std::make_shared<FileTransferInfo>(*b));
+        if (b->isCompressed())
+        {
+            // Archives hold plain buckets, so compressed ones are published
+            // from a decompressed copy in the snapshot directory
+            auto f = std::make_shared<FileTransferInfo>(
+                mSnapDir, HISTORY_FILE_TYPE_BUCKET, hash);
+            if (!fs::exists(f->localPath_nogz()))
+            {
+                blockcompression::decompressFile(b->getFilename(),
+                                                 f->localPath_nogz());
+            }
+            addIfExists(f);
+        }
+        else
+        {
+            addIfExists(std::make_shared<FileTransferInfo>(*b));
+        }
     }
 
     return files;
@@ -16,6 +16,7 @@ namespace stellar
 {
 
 class FileTransferInfo;
+class HistorySegmentStore;
 
 struct StateSnapshot : public std::enable_shared_from_this<StateSnapshot>
 {
@@ -29,6 +30,7 @@ struct StateSnapshot : public std::enable_shared_from_this<StateSnapshot>
 
     StateSnapshot(Application& app, HistoryArchiveState const& state);
     bool writeHistoryBlocks() const;
+    bool writeHistoryBlocksFromSegment(HistorySegmentStore& segments) const;
     std::vector<std::shared_ptr<FileTransferInfo>>
     differingHASFiles(HistoryArchiveState const& other);
 };
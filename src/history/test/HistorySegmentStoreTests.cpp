@@ -0,0 +1,204 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "crypto/Hex.h"
+#include "crypto/Random.h"
+#include "crypto/SHA.h"
+#include "history/HistorySegmentStore.h"
+#include "lib/catch.hpp"
+#include "util/TmpDir.h"
+#include "util/XDRStream.h"
+#include <string>
+#include <vector>
+
+using namespace stellar;
+
+namespace
+{
+HistorySegmentStore::Ledger
+makeLedger(uint32_t ledgerSeq, bool withTransactions)
+{
+    HistorySegmentStore::Ledger ledger;
+    ledger.header.header.ledgerSeq = ledgerSeq;
+    ledger.header.hash = sha256(std::to_string(ledgerSeq));
+    if (withTransactions)
+    {
+        ledger.transactions = make_optional<TransactionHistoryEntry>();
+        ledger.transactions->ledgerSeq = ledgerSeq;
+        ledger.results = make_optional<TransactionHistoryResultEntry>();
+        ledger.results->ledgerSeq = ledgerSeq;
+    }
+    return ledger;
+}
+
+// readLedgerSeqs returns the ledgerSeq of every entry of the file at path
+template <typename T, typename F>
+std::vector<uint32_t>
+readLedgerSeqs(std::string const& path, F getLedgerSeq)
+{
+    std::vector<uint32_t> res;
+    XDRInputFileStream in;
+    in.open(path);
+    T entry;
+    while (in.readOne(entry))
+    {
+        res.emplace_back(getLedgerSeq(entry));
+    }
+    return res;
+}
+}
+
+TEST_CASE("history segment store", "[history][segments]")
+{
+    TmpDirManager tdm(std::string("segmenttmp-") + binToHex(randomBytes(8)));
+    TmpDir td = tdm.tmpDir("segments");
+    TmpDir out = tdm.tmpDir("out");
+    std::string dir = td.getName() + "/store";
+    uint32_t const frequency = 8;
+    HistorySegmentStore store(dir, frequency, true);
+
+    HistorySegmentStore::Paths paths{
+        {out.getName() + "/ledger.xdr", out.getName() + "/transactions.xdr",
+         out.getName() + "/results.xdr", out.getName() + "/scp.xdr"}};
+    HistorySegmentStore::Offsets sizes;
+    auto copiedLedgers = [&]() {
+        return readLedgerSeqs<LedgerHeaderHistoryEntry>(
+            paths[HistorySegmentStore::LEDGER],
+            [](LedgerHeaderHistoryEntry const& e) {
+                return e.header.ledgerSeq;
+            });
+    };
+    auto copiedTransactions = [&]() {
+        return readLedgerSeqs<TransactionHistoryEntry>(
+            paths[HistorySegmentStore::TRANSACTIONS],
+            [](TransactionHistoryEntry const& e) { return e.ledgerSeq; });
+    };
+    auto copiedResults = [&]() {
+        return readLedgerSeqs<TransactionHistoryResultEntry>(
+            paths[HistorySegmentStore::RESULTS],
+            [](TransactionHistoryResultEntry const& e) {
+                return e.ledgerSeq;
+            });
+    };
+    auto appendLedgers = [&](uint32_t first, uint32_t last) {
+        for (uint32_t ledgerSeq = first; ledgerSeq <= last; ++ledgerSeq)
+        {
+            REQUIRE(store.beginLedger(ledgerSeq));
+            store.append(makeLedger(ledgerSeq, ledgerSeq % 2 == 0));
+        }
+    };
+
+    SECTION("segments start at the first ledger of a checkpoint")
+    {
+        REQUIRE(!store.isStoring(3));
+        REQUIRE(!store.beginLedger(3));
+        REQUIRE(!store.isStoring(4));
+        REQUIRE(store.isStoring(8));
+        REQUIRE(store.beginLedger(8));
+        REQUIRE(store.beginLedger(9));
+        REQUIRE(store.isStoring(10));
+
+        // after a gap, ledgers are not stored until the next checkpoint
+        REQUIRE(!store.beginLedger(12));
+        REQUIRE(!store.isStoring(13));
+        REQUIRE(store.beginLedger(16));
+        REQUIRE(store.isStoring(17));
+    }
+
+    SECTION("segments are copied up to a ledger")
+    {
+        appendLedgers(8, 12);
+        REQUIRE(store.hasSegment(9));
+        REQUIRE(!store.hasSegment(16));
+        REQUIRE(!store.copySegment(13, paths, sizes));
+        REQUIRE(!store.copySegment(16, paths, sizes));
+
+        REQUIRE(store.copySegment(12, paths, sizes));
+        REQUIRE(copiedLedgers() == std::vector<uint32_t>{8, 9, 10, 11, 12});
+        REQUIRE(copiedTransactions() == std::vector<uint32_t>{8, 10, 12});
+        REQUIRE(copiedResults() == std::vector<uint32_t>{8, 10, 12});
+        REQUIRE(sizes[HistorySegmentStore::SCP] == 0);
+
+        REQUIRE(store.copySegment(9, paths, sizes));
+        REQUIRE(copiedLedgers() == std::vector<uint32_t>{8, 9});
+        REQUIRE(copiedTransactions() == std::vector<uint32_t>{8});
+    }
+
+    SECTION("appending a ledger again replaces the following ledgers")
+    {
+        appendLedgers(8, 12);
+        REQUIRE(store.beginLedger(10));
+        store.append(makeLedger(10, false));
+        REQUIRE(!store.copySegment(11, paths, sizes));
+        REQUIRE(store.copySegment(10, paths, sizes));
+        REQUIRE(copiedLedgers() == std::vector<uint32_t>{8, 9, 10});
+        REQUIRE(copiedTransactions() == std::vector<uint32_t>{8});
+
+        appendLedgers(11, 15);
+        REQUIRE(store.copySegment(15, paths, sizes));
+        REQUIRE(copiedLedgers() ==
+                std::vector<uint32_t>{8, 9, 10, 11, 12, 13, 14, 15});
+        REQUIRE(copiedTransactions() == std::vector<uint32_t>{8, 12, 14});
+    }
+
+    SECTION("appending after a missing ledger throws")
+    {
+        appendLedgers(8, 9);
+        REQUIRE_THROWS_AS(store.append(makeLedger(11, false)),
+                          std::runtime_error);
+        REQUIRE_THROWS_AS(store.append(makeLedger(17, false)),
+                          std::runtime_error);
+    }
+
+    SECTION("SCP messages are appended with their ledger")
+    {
+        SCPHistoryEntry scp;
+        scp.v(0);
+        scp.v0().ledgerMessages.ledgerSeq = 8;
+        store.setSCPHistory(scp);
+        scp.v0().ledgerMessages.ledgerSeq = 9;
+        store.setSCPHistory(scp);
+
+        REQUIRE(!store.takeSCPHistory(7));
+        auto ledger = makeLedger(8, false);
+        ledger.scp = store.takeSCPHistory(8);
+        REQUIRE(ledger.scp);
+        REQUIRE(store.beginLedger(8));
+        store.append(ledger);
+        REQUIRE(!store.takeSCPHistory(8));
+
+        REQUIRE(store.copySegment(8, paths, sizes));
+        REQUIRE(sizes[HistorySegmentStore::SCP] != 0);
+        REQUIRE(readLedgerSeqs<SCPHistoryEntry>(
+                    paths[HistorySegmentStore::SCP],
+                    [](SCPHistoryEntry const& e) {
+                        return e.v0().ledgerMessages.ledgerSeq;
+                    }) == std::vector<uint32_t>{8});
+        REQUIRE(store.takeSCPHistory(9));
+    }
+
+    SECTION("the last run of ledgers is found again")
+    {
+        appendLedgers(8, 10);
+        HistorySegmentStore reopened(dir, frequency, true);
+        REQUIRE(reopened.isStoring(11));
+        REQUIRE(!reopened.isStoring(12));
+        REQUIRE(reopened.copySegment(10, paths, sizes));
+    }
+
+    SECTION("trimming deletes whole segments")
+    {
+        appendLedgers(8, 17);
+        store.deleteSegments(14);
+        REQUIRE(store.hasSegment(8));
+        store.deleteSegments(15);
+        REQUIRE(!store.hasSegment(8));
+        REQUIRE(store.copySegment(17, paths, sizes));
+        REQUIRE(copiedLedgers() == std::vector<uint32_t>{16, 17});
+
+        store.clear();
+        REQUIRE(!store.hasSegment(16));
+        REQUIRE(!store.isStoring(18));
+    }
+}
@@ -4,9 +4,12 @@
 
 #include "bucket/BucketManager.h"
 #include "catchup/test/CatchupWorkTests.h"
+#include "crypto/Random.h"
+#include "database/Database.h"
 #include "history/FileTransferInfo.h"
 #include "history/HistoryArchiveManager.h"
 #include "history/HistoryManager.h"
+#include "history/HistorySegmentStore.h"
 #include "history/test/HistoryTestsUtils.h"
 #include "historywork/GetHistoryArchiveStateWork.h"
 #include "historywork/GunzipFileWork.h"
@@ -320,6 +323,71 @@ TEST_CASE("History publish to multiple archives", "[history]")
     REQUIRE(catchupSimulation.catchupOffline(catchupApp, checkpointLedger));
 }
 
+namespace
+{
+// Keeps the history of the publishing application in history segments
+class SegmentStoreHistoryConfigurator : public TmpDirHistoryConfigurator
+{
+    TmpDirManager mSegmentTmp;
+    TmpDir mSegmentDir;
+
+  public:
+    SegmentStoreHistoryConfigurator()
+        : mSegmentTmp("segmenttmp-" + binToHex(randomBytes(8)))
+        , mSegmentDir(mSegmentTmp.tmpDir("segments"))
+    {
+    }
+
+    Config&
+    configure(Config& cfg, bool writable) const override
+    {
+        TmpDirHistoryConfigurator::configure(cfg, writable);
+        if (writable)
+        {
+            cfg.HISTORY_SEGMENT_DIR_PATH = mSegmentDir.getName();
+        }
+        return cfg;
+    }
+};
+}
+
+TEST_CASE("History publish from history segments", "[history][publish]")
+{
+    auto configurator = std::make_shared<SegmentStoreHistoryConfigurator>();
+    CatchupSimulation catchupSimulation{VirtualClock::VIRTUAL_TIME,
+                                        configurator};
+    auto& app = catchupSimulation.getApp();
+    auto segments = app.getHistoryManager().getSegmentStore();
+    REQUIRE(segments);
+
+    auto checkpointLedger = catchupSimulation.getLastCheckpointLedger(3);
+    catchupSimulation.ensureOfflineCatchupPossible(checkpointLedger);
+
+    // The first checkpoint starts with the genesis ledger, which is not
+    // closed, so it is published from the database and the next ones from
+    // segments
+    uint32_t freq = app.getHistoryManager().getCheckpointFrequency();
+    REQUIRE(!segments->hasSegment(1));
+    REQUIRE(segments->hasSegment(freq));
+    REQUIRE(segments->hasSegment(checkpointLedger));
+
+    // The transaction meta and fee changes of the ledgers in segments are
+    // still in the database
+    auto& sess = app.getDatabase().getSession();
+    int txCount = 0, feeCount = 0;
+    sess << "SELECT COUNT(*) FROM txhistory WHERE ledgerseq >= :s",
+        soci::into(txCount), soci::use(freq);
+    sess << "SELECT COUNT(*) FROM txfeehistory WHERE ledgerseq >= :s",
+        soci::into(feeCount), soci::use(freq);
+    REQUIRE(txCount > 0);
+    REQUIRE(feeCount == txCount);
+
+    auto catchupApp = catchupSimulation.createCatchupApplication(
+        std::numeric_limits<uint32_t>::max(), Config::TESTDB_IN_MEMORY_SQLITE,
+        "app");
+    REQUIRE(catchupSimulation.catchupOffline(catchupApp, checkpointLedger));
+}
+
 TEST_CASE("Publish works correctly post shadow removal", "[history]")
 {
     // Given a HAS, verify that appropriate levels have "next" cleared, while
@@ -146,9 +146,7 @@ BucketOutputIteratorForTesting::writeTmpTestBucket()
 
     // Finish writing and close the bucket file
     REQUIRE(mBuf);
-    mOut.writeOne(*mBuf, mHasher.get(), &mBytesPut);
-    mObjectsPut++;
-    mBuf.reset();
+    flushBuffer();
     mOut.close();
 
     return std::pair<std::string, uint256>(mFilename, mHasher->finish());
@@ -9,17 +9,23 @@
 #include "main/Application.h"
 #include "main/ErrorMessages.h"
 #include "util/Fs.h"
+#include "util/IOThrottle.h"
 #include "util/Logging.h"
+#include "util/MappedFile.h"
 #include "util/format.h"
 
 #include <medida/meter.h>
 #include <medida/metrics_registry.h>
 
-#include <fstream>
+#include <algorithm>
 
 namespace stellar
 {
 
+// Buckets are hashed in chunks of this size, each acquired from the bucket
+// I/O throttle
+static size_t const CHUNK_SIZE = 1024 * 1024;
+
 VerifyBucketWork::VerifyBucketWork(
     Application& app, std::map<std::string, std::shared_ptr<Bucket>>& buckets,
     std::string const& bucketFile, uint256 const& hash)
@@ -82,14 +88,25 @@ VerifyBucketWork::spawnVerifier()
                 CLOG(INFO, "History")
                     << fmt::format("Verifying bucket {}", binToHex(hash));
 
-                // ensure that the stream gets its own scope to avoid race with
+                // ensure that the file gets its own scope to avoid race with
                 // main thread
-                std::ifstream in(filename, std::ifstream::binary);
-                char buf[4096];
-                while (in)
+                try
+                {
+                    MappedFile in;
+                    in.open(filename);
+                    in.adviseSequential();
+                    auto& throttle = app.getBucketManager().getIOThrottle();
+                    for (size_t pos = 0; pos < in.size(); pos += CHUNK_SIZE)
+                    {
+                        size_t size = std::min(in.size() - pos, CHUNK_SIZE);
+                        throttle.acquire(size);
+                        hasher->add(ByteSlice(in.data() + pos, size));
+                    }
+                }
+                catch (std::exception const& e)
                 {
-                    in.read(buf, sizeof(buf));
-                    hasher->add(ByteSlice(buf, in.gcount()));
+                    CLOG(WARNING, "History") << "Unable to read " << filename
+                                             << ": " << e.what();
                 }
                 uint256 vHash = hasher->finish();
                 if (vHash == hash)
@@ -5,6 +5,7 @@
 #include "invariant/BucketListIsConsistentWithDatabase.h"
 #include "bucket/Bucket.h"
 #include "bucket/BucketInputIterator.h"
+#include "bucket/MergedBucketIterator.h"
 #include "crypto/Hex.h"
 #include "invariant/InvariantManager.h"
 #include "ledger/LedgerRange.h"
@@ -78,7 +79,8 @@ BucketListIsConsistentWithDatabase::getName() const
 std::string
 BucketListIsConsistentWithDatabase::checkOnBucketApply(
     std::shared_ptr<Bucket const> bucket, uint32_t oldestLedger,
-    uint32_t newestLedger)
+    uint32_t newestLedger,
+    std::vector<std::shared_ptr<Bucket const>> const& shadows)
 {
     uint64_t nAccounts = 0, nTrustLines = 0, nOffers = 0, nData = 0;
     {
@@ -86,6 +88,8 @@ BucketListIsConsistentWithDatabase::checkOnBucketApply(
 
         bool hasPreviousEntry = false;
         BucketEntry previousEntry;
+        // The shadows are read along with the bucket, in key order
+        MergedBucketIterator shadowIter(shadows);
         for (BucketInputIterator iter(bucket); iter; ++iter)
         {
             auto const& e = *iter;
@@ -119,7 +123,19 @@ BucketListIsConsistentWithDatabase::checkOnBucketApply(
                     s += xdr::xdr_to_string(e.liveEntry(), "live");
                     return s;
                 }
+            }
+
+            while (shadowIter && BucketEntryIdCmp{}(*shadowIter, e))
+            {
+                ++shadowIter;
+            }
+            if (shadowIter && !BucketEntryIdCmp{}(e, *shadowIter))
+            {
+                continue;
+            }
 
+            if (e.type() == LIVEENTRY || e.type() == INITENTRY)
+            {
                 switch (e.liveEntry().data.type())
                 {
                 case ACCOUNT:
@@ -24,6 +24,10 @@ class Application;
 // database, while the third condition shows that the database does not
 // contain any entry in the appropriate ledger range other than those in
 // the bucket.
+//
+// When newer buckets are applied along with the bucket, the entries of the
+// bucket whose keys are in one of them are not in the database, so only the
+// ordering and the ledger range of these entries are checked.
 class BucketListIsConsistentWithDatabase : public Invariant
 {
   public:
@@ -33,9 +37,10 @@ class BucketListIsConsistentWithDatabase : public Invariant
 
     virtual std::string getName() const override;
 
-    virtual std::string checkOnBucketApply(std::shared_ptr<Bucket const> bucket,
-                                           uint32_t oldestLedger,
-                                           uint32_t newestLedger) override;
+    virtual std::string checkOnBucketApply(
+        std::shared_ptr<Bucket const> bucket, uint32_t oldestLedger,
+        uint32_t newestLedger,
+        std::vector<std::shared_ptr<Bucket const>> const& shadows) override;
 
   private:
     Application& mApp;
@@ -6,6 +6,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace stellar
 {
@@ -39,9 +40,14 @@ class Invariant
         return mStrict;
     }
 
+    // checkOnBucketApply is called once bucket, which holds the entries
+    // modified from oldestLedger to newestLedger, has been applied along with
+    // the newer buckets in shadows, whose entries replaced those of bucket
     virtual std::string
-    checkOnBucketApply(std::shared_ptr<Bucket const> bucket,
-                       uint32_t oldestLedger, uint32_t newestLedger)
+    checkOnBucketApply(
+        std::shared_ptr<Bucket const> bucket, uint32_t oldestLedger,
+        uint32_t newestLedger,
+        std::vector<std::shared_ptr<Bucket const>> const& shadows)
     {
         return std::string{};
     }
@@ -41,9 +41,10 @@ class InvariantManagerImpl : public InvariantManager
                                        OperationResult const& opres,
                                        LedgerTxnDelta const& ltxDelta) override;
 
-    virtual void checkOnBucketApply(std::shared_ptr<Bucket const> bucket,
-                                    uint32_t ledger, uint32_t level,
-                                    bool isCurr) override;
+    virtual void checkOnBucketApply(
+        std::shared_ptr<Bucket const> bucket, uint32_t ledger, uint32_t level,
+        bool isCurr,
+        std::vector<std::shared_ptr<Bucket const>> const& shadows) override;
 
     virtual void
     registerInvariant(std::shared_ptr<Invariant> invariant) override;
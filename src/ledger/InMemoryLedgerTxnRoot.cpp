@@ -1,130 +1,465 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
 #include "ledger/InMemoryLedgerTxnRoot.h"
+#include "database/Database.h"
 #include "ledger/LedgerRange.h"
 #include "ledger/LedgerTxn.h"
+#include "util/GlobalChecks.h"
 #include "util/XDROperators.h"
 #include "util/types.h"
 #include "xdr/Stellar-ledger-entries.h"
-#include "xdrpp/marshal.h"
 #include <algorithm>
+#include <soci.h>
 
 namespace stellar
 {
 
-InMemoryLedgerTxnRoot::InMemoryLedgerTxnRoot()
-    : mHeader(std::make_unique<LedgerHeader>())
+InMemoryLedgerTxnRoot::InMemoryLedgerTxnRoot(Database& db)
+    : mDatabase(db), mHeader(std::make_unique<LedgerHeader>()), mChild(nullptr)
 {
 }
 
-void
-InMemoryLedgerTxnRoot::addChild(AbstractLedgerTxn& child)
+InMemoryLedgerTxnRoot::~InMemoryLedgerTxnRoot()
 {
 }
 
-void
-InMemoryLedgerTxnRoot::commitChild(EntryIterator iter,
-                                   LedgerTxnConsistency cons)
+InMemoryLedgerTxnRoot::EntryMap&
+InMemoryLedgerTxnRoot::getTable(LedgerEntryType let) const
 {
-    throw std::runtime_error("committing to stub InMemoryLedgerTxnRoot");
+    switch (let)
+    {
+    case ACCOUNT:
+        return mAccounts;
+    case TRUSTLINE:
+        return mTrustLines;
+    case OFFER:
+        return mOffers;
+    case DATA:
+        return mData;
+    default:
+        throw std::runtime_error("Unknown ledger entry type");
+    }
 }
 
 void
-InMemoryLedgerTxnRoot::rollbackChild()
+InMemoryLedgerTxnRoot::indexOffer(
+    std::shared_ptr<LedgerEntry const> const& entry) const
 {
+    auto const& oe = entry->data.offer();
+    double price = double(oe.price.n) / double(oe.price.d);
+    mOrderBooks[oe.buying][oe.selling][std::make_pair(price, oe.offerID)] =
+        entry;
+    mOffersBySeller[oe.sellerID].insert(oe.offerID);
 }
 
-std::unordered_map<LedgerKey, LedgerEntry>
-InMemoryLedgerTxnRoot::getAllOffers()
+void
+InMemoryLedgerTxnRoot::unindexOffer(LedgerEntry const& entry) const
 {
-    return std::unordered_map<LedgerKey, LedgerEntry>();
-}
+    auto const& oe = entry.data.offer();
+    double price = double(oe.price.n) / double(oe.price.d);
 
-std::shared_ptr<LedgerEntry const>
-InMemoryLedgerTxnRoot::getBestOffer(Asset const& buying, Asset const& selling)
-{
-    return nullptr;
+    auto booksIter = mOrderBooks.find(oe.buying);
+    if (booksIter != mOrderBooks.end())
+    {
+        auto bookIter = booksIter->second.find(oe.selling);
+        if (bookIter != booksIter->second.end())
+        {
+            bookIter->second.erase(std::make_pair(price, oe.offerID));
+            if (bookIter->second.empty())
+            {
+                booksIter->second.erase(bookIter);
+            }
+        }
+        if (booksIter->second.empty())
+        {
+            mOrderBooks.erase(booksIter);
+        }
+    }
+
+    auto sellerIter = mOffersBySeller.find(oe.sellerID);
+    if (sellerIter != mOffersBySeller.end())
+    {
+        sellerIter->second.erase(oe.offerID);
+        if (sellerIter->second.empty())
+        {
+            mOffersBySeller.erase(sellerIter);
+        }
+    }
 }
 
-std::shared_ptr<LedgerEntry const>
-InMemoryLedgerTxnRoot::getBestOffer(Asset const& buying, Asset const& selling,
-                                    OfferDescriptor const& worseThan)
+void
+InMemoryLedgerTxnRoot::insertEntry(
+    LedgerKey const& key, std::shared_ptr<LedgerEntry const> const& entry) const
 {
-    return nullptr;
+    auto& current = getTable(key.type())[key];
+    if (key.type() == OFFER)
+    {
+        if (current)
+        {
+            unindexOffer(*current);
+        }
+        indexOffer(entry);
+    }
+    else if (key.type() == ACCOUNT)
+    {
+        auto const& ae = entry->data.account();
+        mInflationVotes.updateAccount(ae.accountID, ae.inflationDest,
+                                      ae.balance);
+    }
+    current = entry;
 }
 
-std::unordered_map<LedgerKey, LedgerEntry>
-InMemoryLedgerTxnRoot::getOffersByAccountAndAsset(AccountID const& account,
-                                                  Asset const& asset)
+bool
+InMemoryLedgerTxnRoot::eraseEntry(LedgerKey const& key) const
 {
-    return std::unordered_map<LedgerKey, LedgerEntry>();
+    auto& table = getTable(key.type());
+    auto iter = table.find(key);
+    if (iter == table.end())
+    {
+        return false;
+    }
+    if (key.type() == OFFER)
+    {
+        unindexOffer(*iter->second);
+    }
+    else if (key.type() == ACCOUNT)
+    {
+        mInflationVotes.updateAccount(key.account().accountID, {}, 0);
+    }
+    table.erase(iter);
+    return true;
 }
 
-LedgerHeader const&
-InMemoryLedgerTxnRoot::getHeader() const
+void
+InMemoryLedgerTxnRoot::throwIfChild() const
 {
-    return *mHeader;
+    if (mChild)
+    {
+        throw std::runtime_error("InMemoryLedgerTxnRoot has child");
+    }
 }
 
-std::vector<InflationWinner>
-InMemoryLedgerTxnRoot::getInflationWinners(size_t maxWinners,
-                                           int64_t minBalance)
+void
+InMemoryLedgerTxnRoot::addChild(AbstractLedgerTxn& child)
 {
-    return std::vector<InflationWinner>();
+    if (mChild)
+    {
+        throw std::runtime_error("InMemoryLedgerTxnRoot already has child");
+    }
+    mTransaction = std::make_unique<soci::transaction>(mDatabase.getSession());
+    mChild = &child;
 }
 
-std::shared_ptr<LedgerEntry const>
-InMemoryLedgerTxnRoot::getNewestVersion(LedgerKey const& key) const
+void
+InMemoryLedgerTxnRoot::commitChild(EntryIterator iter,
+                                   LedgerTxnConsistency cons)
 {
-    return nullptr;
+    // Assignment of xdrpp objects does not have the strong exception safety
+    // guarantee, so use std::unique_ptr<...>::swap to achieve it
+    auto childHeader = std::make_unique<LedgerHeader>(mChild->getHeader());
+
+    try
+    {
+        for (; (bool)iter; ++iter)
+        {
+            if (iter.entryExists())
+            {
+                insertEntry(iter.key(),
+                            std::make_shared<LedgerEntry const>(iter.entry()));
+            }
+            else if (!eraseEntry(iter.key()) &&
+                     cons == LedgerTxnConsistency::EXACT)
+            {
+                throw std::runtime_error("Could not delete data");
+            }
+        }
+        for (auto const& write : mDeferredWrites)
+        {
+            write(mDatabase.getSession());
+        }
+        mTransaction->commit();
+    }
+    catch (std::exception& e)
+    {
+        printErrorAndAbort(
+            "fatal error during commit to InMemoryLedgerTxnRoot: ", e.what());
+    }
+    catch (...)
+    {
+        printErrorAndAbort(
+            "unknown fatal error during commit to InMemoryLedgerTxnRoot");
+    }
+
+    // std::unique_ptr<...>::reset and std::vector<...>::clear do not throw
+    mTransaction.reset();
+    mDeferredWrites.clear();
+
+    // std::unique_ptr<...>::swap does not throw
+    mHeader.swap(childHeader);
+    mChild = nullptr;
 }
 
 uint64_t
 InMemoryLedgerTxnRoot::countObjects(LedgerEntryType let) const
 {
-    return 0;
+    throwIfChild();
+    return getTable(let).size();
 }
 
 uint64_t
 InMemoryLedgerTxnRoot::countObjects(LedgerEntryType let,
-                                    LedgerRange const& ledgers) const
+                                   LedgerRange const& ledgers) const
 {
-    return 0;
+    throwIfChild();
+    auto const& table = getTable(let);
+    return std::count_if(table.begin(), table.end(), [&](auto const& kv) {
+        auto lastModified = kv.second->lastModifiedLedgerSeq;
+        return lastModified >= ledgers.mFirst && lastModified <= ledgers.mLast;
+    });
 }
 
 void
 InMemoryLedgerTxnRoot::deleteObjectsModifiedOnOrAfterLedger(
     uint32_t ledger) const
 {
+    throwIfChild();
+    for (auto let : {ACCOUNT, DATA, TRUSTLINE, OFFER})
+    {
+        auto& table = getTable(let);
+        for (auto iter = table.begin(); iter != table.end();)
+        {
+            if (iter->second->lastModifiedLedgerSeq >= ledger)
+            {
+                if (let == OFFER)
+                {
+                    unindexOffer(*iter->second);
+                }
+                else if (let == ACCOUNT)
+                {
+                    auto const& accountID = iter->first.account().accountID;
+                    mInflationVotes.updateAccount(accountID, {}, 0);
+                }
+                iter = table.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
 }
 
 void
 InMemoryLedgerTxnRoot::dropAccounts()
 {
+    throwIfChild();
+    mAccounts.clear();
+    mInflationVotes.clear();
 }
 
 void
 InMemoryLedgerTxnRoot::dropData()
 {
+    throwIfChild();
+    mData.clear();
 }
 
 void
 InMemoryLedgerTxnRoot::dropOffers()
 {
+    throwIfChild();
+    mOffers.clear();
+    mOrderBooks.clear();
+    mOffersBySeller.clear();
 }
 
 void
 InMemoryLedgerTxnRoot::dropTrustLines()
 {
+    throwIfChild();
+    mTrustLines.clear();
 }
 
-double
-InMemoryLedgerTxnRoot::getPrefetchHitRate() const
+#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+void
+InMemoryLedgerTxnRoot::resetForFuzzer()
 {
-    return 0.0;
+    // Nothing is cached, the tables are the ledger state
+}
+#endif // FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+
+std::unordered_map<LedgerKey, LedgerEntry>
+InMemoryLedgerTxnRoot::getAllOffers()
+{
+    std::unordered_map<LedgerKey, LedgerEntry> offers;
+    offers.reserve(mOffers.size());
+    for (auto const& kv : mOffers)
+    {
+        offers.emplace(kv.first, *kv.second);
+    }
+    return offers;
+}
+
+OfferBatch
+InMemoryLedgerTxnRoot::getOffersBySellerRange(AccountID const* afterSeller,
+                                              size_t maxOffers)
+{
+    OfferBatch batch;
+    auto sellerIter = afterSeller ? mOffersBySeller.upper_bound(*afterSeller)
+                                  : mOffersBySeller.begin();
+    LedgerKey key(OFFER);
+    for (; sellerIter != mOffersBySeller.end(); ++sellerIter)
+    {
+        if (batch.offers.size() >= std::max<size_t>(1, maxOffers))
+        {
+            batch.lastSeller.activate() = std::prev(sellerIter)->first;
+            break;
+        }
+
+        key.offer().sellerID = sellerIter->first;
+        for (auto offerID : sellerIter->second)
+        {
+            key.offer().offerID = offerID;
+            batch.offers.emplace(key, *mOffers.at(key));
+        }
+    }
+    return batch;
+}
+
+std::shared_ptr<LedgerEntry const>
+InMemoryLedgerTxnRoot::getBestOffer(Asset const& buying, Asset const& selling,
+                                    std::unordered_set<LedgerKey>& exclude)
+{
+    auto booksIter = mOrderBooks.find(buying);
+    if (booksIter == mOrderBooks.end())
+    {
+        return nullptr;
+    }
+    auto bookIter = booksIter->second.find(selling);
+    if (bookIter == booksIter->second.end())
+    {
+        return nullptr;
+    }
+
+    // Offers are visited in the order induced by isBetterOffer, so the first
+    // offer that is not excluded is the best offer
+    for (auto const& kv : bookIter->second)
+    {
+        if (exclude.find(LedgerEntryKey(*kv.second)) == exclude.end())
+        {
+            return kv.second;
+        }
+    }
+    return nullptr;
+}
+
+std::unordered_map<LedgerKey, LedgerEntry>
+InMemoryLedgerTxnRoot::getOffersByAccountAndAsset(AccountID const& account,
+                                                  Asset const& asset)
+{
+    std::unordered_map<LedgerKey, LedgerEntry> offers;
+    auto sellerIter = mOffersBySeller.find(account);
+    if (sellerIter == mOffersBySeller.end())
+    {
+        return offers;
+    }
+
+    LedgerKey key(OFFER);
+    key.offer().sellerID = account;
+    for (auto offerID : sellerIter->second)
+    {
+        key.offer().offerID = offerID;
+        auto const& entry = mOffers.at(key);
+        auto const& oe = entry->data.offer();
+        if (oe.buying == asset || oe.selling == asset)
+        {
+            offers.emplace(key, *entry);
+        }
+    }
+    return offers;
+}
+
+LedgerHeader const&
+InMemoryLedgerTxnRoot::getHeader() const
+{
+    return *mHeader;
+}
+
+std::vector<InflationWinner>
+InMemoryLedgerTxnRoot::getInflationWinners(size_t maxWinners,
+                                           int64_t minBalance)
+{
+    return mInflationVotes.getWinners(maxWinners, minBalance);
+}
+
+std::shared_ptr<LedgerEntry const>
+InMemoryLedgerTxnRoot::getNewestVersion(LedgerKey const& key) const
+{
+    auto const& table = getTable(key.type());
+    auto iter = table.find(key);
+    if (iter == table.end())
+    {
+        return nullptr;
+    }
+    return iter->second;
+}
+
+void
+InMemoryLedgerTxnRoot::rollbackChild()
+{
+    try
+    {
+        mTransaction->rollback();
+        mTransaction.reset();
+    }
+    catch (std::exception& e)
+    {
+        printErrorAndAbort(
+            "fatal error when rolling back child of InMemoryLedgerTxnRoot: ",
+            e.what());
+    }
+    catch (...)
+    {
+        printErrorAndAbort("unknown fatal error when rolling back child of "
+                           "InMemoryLedgerTxnRoot");
+    }
+
+    // std::vector<...>::clear does not throw
+    mDeferredWrites.clear();
+    mChild = nullptr;
 }
 
 uint32_t
 InMemoryLedgerTxnRoot::prefetch(std::unordered_set<LedgerKey> const& keys)
 {
+    // Every entry is already in memory
     return 0;
 }
+
+double
+InMemoryLedgerTxnRoot::getPrefetchHitRate() const
+{
+    return 0.0;
+}
+
+double
+InMemoryLedgerTxnRoot::getEntryCacheHitRate(LedgerEntryType let) const
+{
+    // There is no entry cache
+    return 0.0;
+}
+
+void
+InMemoryLedgerTxnRoot::deferWrite(DeferredWrite write)
+{
+    mDeferredWrites.emplace_back(std::move(write));
+}
+
+void
+InMemoryLedgerTxnRoot::waitForDeferredWrites() const
+{
+    // Deferred writes are done by commitChild
+}
 }
@@ -1,37 +1,118 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "ledger/InflationVoteTally.h"
 #include "ledger/LedgerTxn.h"
-#include "ledger/LedgerTxnImpl.h"
 #include "xdr/Stellar-ledger-entries.h"
 #include <map>
+#include <memory>
 #include <set>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
-// This is a stub helper class that pretends to implements a "root"
-// AbstractLedgerTxnParent like LedgerTxnRoot but returns empty/null values for
-// any query made of it, and throws if anyone ever tries to commit to it.
+namespace soci
+{
+class transaction;
+}
+
+// InMemoryLedgerTxnRoot is a "root" AbstractLedgerTxnParent like
+// LedgerTxnRoot, except that the committed ledger entries are held in memory
+// rather than in the accounts, trustlines, offers and accountdata tables. It is
+// used when MODE_USES_IN_MEMORY_LEDGER is set, in which case the entries are
+// loaded from the BucketList at startup (see LedgerManagerImpl).
 //
-// This is used to anchor a live-but-never-committed LedgerTxn when doing
-// strictly-in-memory fast history replay.
+// The database is still used for everything else written while closing a
+// ledger (ledger headers, transaction history, persistent state), so every
+// child opens a database transaction that is committed together with the
+// entries, just as with LedgerTxnRoot.
 
 namespace stellar
 {
 
+class Database;
+
 class InMemoryLedgerTxnRoot : public AbstractLedgerTxnParent
 {
+    typedef std::unordered_map<LedgerKey, std::shared_ptr<LedgerEntry const>>
+        EntryMap;
+
+    // Offers of an order book are sorted by price and then by offer ID, which
+    // is the order induced by isBetterOffer.
+    typedef std::map<std::pair<double, int64_t>,
+                     std::shared_ptr<LedgerEntry const>>
+        OrderBook;
+
+    Database& mDatabase;
     std::unique_ptr<LedgerHeader> mHeader;
+    AbstractLedgerTxn* mChild;
+    std::unique_ptr<soci::transaction> mTransaction;
+    std::vector<DeferredWrite> mDeferredWrites;
+
+    // The tables are mutable because deleteObjectsModifiedOnOrAfterLedger is
+    // const in AbstractLedgerTxnParent, as it does not modify LedgerTxnRoot
+    // itself but only the database behind it.
+    mutable EntryMap mAccounts;
+    mutable EntryMap mTrustLines;
+    mutable EntryMap mOffers;
+    mutable EntryMap mData;
+
+    // Indexes over mOffers, kept in sync by insertEntry and eraseEntry.
+    // Order books are keyed by buying asset and then by selling asset.
+    mutable std::unordered_map<Asset, std::unordered_map<Asset, OrderBook>>
+        mOrderBooks;
+    mutable std::map<AccountID, std::set<int64_t>> mOffersBySeller;
+
+    // Votes of mAccounts, also kept in sync by insertEntry and eraseEntry.
+    mutable InflationVoteTally mInflationVotes;
+
+    EntryMap& getTable(LedgerEntryType let) const;
+
+    void insertEntry(LedgerKey const& key,
+                     std::shared_ptr<LedgerEntry const> const& entry) const;
+    bool eraseEntry(LedgerKey const& key) const;
+
+    void indexOffer(std::shared_ptr<LedgerEntry const> const& entry) const;
+    void unindexOffer(LedgerEntry const& entry) const;
+
+    void throwIfChild() const;
 
   public:
-    InMemoryLedgerTxnRoot();
+    explicit InMemoryLedgerTxnRoot(Database& db);
+
+    virtual ~InMemoryLedgerTxnRoot();
+
     void addChild(AbstractLedgerTxn& child) override;
+
     void commitChild(EntryIterator iter, LedgerTxnConsistency cons) override;
-    void rollbackChild() override;
+
+    uint64_t countObjects(LedgerEntryType let) const override;
+    uint64_t countObjects(LedgerEntryType let,
+                          LedgerRange const& ledgers) const override;
+
+    void deleteObjectsModifiedOnOrAfterLedger(uint32_t ledger) const override;
+
+    void dropAccounts() override;
+    void dropData() override;
+    void dropOffers() override;
+    void dropTrustLines() override;
+
+#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+    void resetForFuzzer() override;
+#endif // FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 
     std::unordered_map<LedgerKey, LedgerEntry> getAllOffers() override;
-    std::shared_ptr<LedgerEntry const>
-    getBestOffer(Asset const& buying, Asset const& selling) override;
+
+    OfferBatch getOffersBySellerRange(AccountID const* afterSeller,
+                                      size_t maxOffers) override;
+
     std::shared_ptr<LedgerEntry const>
     getBestOffer(Asset const& buying, Asset const& selling,
-                 OfferDescriptor const& worseThan) override;
+                 std::unordered_set<LedgerKey>& exclude) override;
+
     std::unordered_map<LedgerKey, LedgerEntry>
     getOffersByAccountAndAsset(AccountID const& account,
                                Asset const& asset) override;
@@ -44,17 +125,13 @@ class InMemoryLedgerTxnRoot : public AbstractLedgerTxnParent
     std::shared_ptr<LedgerEntry const>
     getNewestVersion(LedgerKey const& key) const override;
 
-    uint64_t countObjects(LedgerEntryType let) const override;
-    uint64_t countObjects(LedgerEntryType let,
-                          LedgerRange const& ledgers) const override;
-
-    void deleteObjectsModifiedOnOrAfterLedger(uint32_t ledger) const override;
+    void rollbackChild() override;
 
-    void dropAccounts() override;
-    void dropData() override;
-    void dropOffers() override;
-    void dropTrustLines() override;
-    double getPrefetchHitRate() const override;
     uint32_t prefetch(std::unordered_set<LedgerKey> const& keys) override;
+    double getPrefetchHitRate() const override;
+    double getEntryCacheHitRate(LedgerEntryType let) const override;
+
+    void deferWrite(DeferredWrite write) override;
+    void waitForDeferredWrites() const override;
 };
 }
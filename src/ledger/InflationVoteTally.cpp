@@ -0,0 +1,100 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "ledger/InflationVoteTally.h"
+#include "crypto/KeyUtils.h"
+#include "util/XDROperators.h"
+
+namespace stellar
+{
+
+bool
+InflationVoteTally::Total::operator<(Total const& other) const
+{
+    if (votes != other.votes)
+    {
+        return votes > other.votes;
+    }
+    return strKey > other.strKey;
+}
+
+void
+InflationVoteTally::addVotes(AccountID const& destination, int64_t votes)
+{
+    Total total{0, {}, destination};
+    auto iter = mTotals.find(destination);
+    if (iter != mTotals.end())
+    {
+        total = *iter->second;
+        mRanking.erase(iter->second);
+    }
+    else
+    {
+        total.strKey = KeyUtils::toStrKey(destination);
+    }
+
+    total.votes += votes;
+    if (total.votes == 0)
+    {
+        // Every vote is positive, so no account votes for destination anymore
+        if (iter != mTotals.end())
+        {
+            mTotals.erase(iter);
+        }
+        return;
+    }
+    mTotals[destination] = mRanking.insert(total).first;
+}
+
+void
+InflationVoteTally::updateAccount(AccountID const& account,
+                                  xdr::pointer<AccountID> const& inflationDest,
+                                  int64_t balance)
+{
+    bool votes = inflationDest && balance >= MIN_VOTER_BALANCE;
+
+    auto iter = mVoters.find(account);
+    if (iter != mVoters.end())
+    {
+        auto& vote = iter->second;
+        if (votes && vote.destination == *inflationDest)
+        {
+            addVotes(vote.destination, balance - vote.balance);
+            vote.balance = balance;
+            return;
+        }
+        addVotes(vote.destination, -vote.balance);
+        mVoters.erase(iter);
+    }
+
+    if (votes)
+    {
+        addVotes(*inflationDest, balance);
+        mVoters.emplace(account, Vote{*inflationDest, balance});
+    }
+}
+
+std::vector<InflationWinner>
+InflationVoteTally::getWinners(size_t maxWinners, int64_t minVotes) const
+{
+    std::vector<InflationWinner> winners;
+    for (auto const& total : mRanking)
+    {
+        if (winners.size() >= maxWinners || total.votes < minVotes)
+        {
+            break;
+        }
+        winners.push_back({total.destination, total.votes});
+    }
+    return winners;
+}
+
+void
+InflationVoteTally::clear()
+{
+    mVoters.clear();
+    mRanking.clear();
+    mTotals.clear();
+}
+}
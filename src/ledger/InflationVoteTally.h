@@ -0,0 +1,79 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "crypto/SecretKey.h"
+#include "ledger/LedgerTxn.h"
+#include "util/NonCopyable.h"
+#include "xdr/Stellar-ledger-entries.h"
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace stellar
+{
+
+// InflationVoteTally maintains the inflation votes of a set of accounts, so
+// that the winners can be enumerated without visiting every account. The vote
+// of an account is its balance, counted for its inflation destination, if it
+// has one and its balance is at least MIN_VOTER_BALANCE. Destinations are kept
+// ordered by decreasing votes, with ties broken by inflation destination in
+// descending order of StrKey, which is the order in which inflation visits the
+// winners.
+//
+// The tally remembers the vote of every voting account, so the caller only has
+// to report the new state of each account that changes.
+class InflationVoteTally : public NonMovableOrCopyable
+{
+  public:
+    static int64_t const MIN_VOTER_BALANCE = 1000000000;
+
+  private:
+    struct Vote
+    {
+        AccountID destination;
+        int64_t balance;
+    };
+
+    struct Total
+    {
+        int64_t votes;
+        std::string strKey;
+        AccountID destination;
+
+        bool operator<(Total const& other) const;
+    };
+
+    std::unordered_map<AccountID, Vote> mVoters;
+    std::set<Total> mRanking;
+    std::unordered_map<AccountID, std::set<Total>::const_iterator> mTotals;
+
+    void addVotes(AccountID const& destination, int64_t votes);
+
+  public:
+    // updateAccount records the new inflation destination and balance of
+    // account. An erased account has no inflation destination. It has the
+    // basic exception safety guarantee. If it throws an exception, then the
+    // tally must be cleared before it is used again.
+    void updateAccount(AccountID const& account,
+                       xdr::pointer<AccountID> const& inflationDest,
+                       int64_t balance);
+
+    // getWinners returns, in order, at most maxWinners destinations that have
+    // at least minVotes votes. It is O(maxWinners).
+    std::vector<InflationWinner> getWinners(size_t maxWinners,
+                                            int64_t minVotes) const;
+
+    // clear does not throw
+    void clear();
+
+    size_t
+    countVoters() const
+    {
+        return mVoters.size();
+    }
+};
+}
@@ -0,0 +1,158 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "ledger/LedgerCloseStats.h"
+#include "crypto/Hex.h"
+#include "lib/json/json.h"
+#include "xdrpp/types.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace stellar
+{
+
+namespace
+{
+bool
+isSlower(LedgerCloseStats::Transaction const& lhs,
+         LedgerCloseStats::Transaction const& rhs)
+{
+    return lhs.duration > rhs.duration;
+}
+
+double
+toMilliseconds(std::chrono::nanoseconds duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+}
+
+LedgerCloseStats::LedgerCloseStats(size_t maxLedgers, size_t maxTransactions)
+    : mMaxLedgers(maxLedgers), mMaxTransactions(maxTransactions)
+{
+}
+
+char const*
+LedgerCloseStats::getPhaseName(Phase phase)
+{
+    switch (phase)
+    {
+    case VALIDATE:
+        return "validate";
+    case FEES:
+        return "fees";
+    case APPLY:
+        return "apply";
+    case UPGRADES:
+        return "upgrades";
+    case BUCKETS:
+        return "buckets";
+    case COMMIT:
+        return "commit";
+    case HISTORY:
+        return "history";
+    case GC:
+        return "gc";
+    default:
+        throw std::runtime_error("Unknown ledger close phase");
+    }
+}
+
+void
+LedgerCloseStats::beginLedger(uint32_t ledgerSeq)
+{
+    mLedgerSeq = ledgerSeq;
+    mTransactions.clear();
+}
+
+void
+LedgerCloseStats::addTransaction(Transaction const& tx)
+{
+    if (mMaxTransactions == 0)
+    {
+        return;
+    }
+    if (mTransactions.size() == mMaxTransactions)
+    {
+        if (!isSlower(tx, mTransactions.front()))
+        {
+            return;
+        }
+        std::pop_heap(mTransactions.begin(), mTransactions.end(), isSlower);
+        mTransactions.pop_back();
+    }
+    mTransactions.emplace_back(tx);
+    std::push_heap(mTransactions.begin(), mTransactions.end(), isSlower);
+}
+
+void
+LedgerCloseStats::endLedger(std::chrono::nanoseconds duration,
+                            PhaseTimes const& phases)
+{
+    if (mMaxLedgers == 0)
+    {
+        return;
+    }
+    if (mLedgers.size() == mMaxLedgers)
+    {
+        mLedgers.pop_back();
+    }
+
+    std::sort_heap(mTransactions.begin(), mTransactions.end(), isSlower);
+    mLedgers.emplace_front(
+        Ledger{mLedgerSeq, duration, phases, std::move(mTransactions)});
+    mTransactions.clear();
+}
+
+Json::Value
+LedgerCloseStats::getJson(size_t count, size_t limit) const
+{
+    Json::Value root;
+    auto& ledgers = root["ledgers"];
+    ledgers = Json::arrayValue;
+
+    count = std::min(count, mLedgers.size());
+    std::vector<std::pair<uint32_t, Transaction const*>> txs;
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto const& ledger = mLedgers[i];
+        Json::Value l;
+        l["ledger"] = ledger.ledgerSeq;
+        l["total_ms"] = toMilliseconds(ledger.duration);
+        for (size_t p = 0; p < PHASE_COUNT; ++p)
+        {
+            l["phases_ms"][getPhaseName(static_cast<Phase>(p))] =
+                toMilliseconds(ledger.phases[p]);
+        }
+        ledgers.append(l);
+
+        for (auto const& tx : ledger.slowest)
+        {
+            txs.emplace_back(ledger.ledgerSeq, &tx);
+        }
+    }
+
+    limit = std::min(limit, txs.size());
+    std::partial_sort(txs.begin(), txs.begin() + limit, txs.end(),
+                      [](auto const& lhs, auto const& rhs) {
+                          return isSlower(*lhs.second, *rhs.second);
+                      });
+    auto& slowest = root["slowest_transactions"];
+    slowest = Json::arrayValue;
+    for (size_t i = 0; i < limit; ++i)
+    {
+        auto const& tx = *txs[i].second;
+        Json::Value t;
+        t["ledger"] = txs[i].first;
+        t["hash"] = binToHex(tx.hash);
+        t["operations"] = static_cast<Json::UInt64>(tx.operations);
+        t["result"] =
+            xdr::xdr_traits<TransactionResultCode>::enum_name(tx.result);
+        t["ms"] = toMilliseconds(tx.duration);
+        slowest.append(t);
+    }
+    return root;
+}
+}
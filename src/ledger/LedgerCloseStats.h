@@ -0,0 +1,103 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "lib/json/json-forwards.h"
+#include "xdr/Stellar-transaction.h"
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <vector>
+
+namespace stellar
+{
+
+// LedgerCloseStats keeps, for the last ledgers that were closed, the time
+// spent in each phase of closeLedger and the slowest transactions, so that a
+// slow ledger close can be traced to what made it slow. It is reported by the
+// closetimes HTTP command.
+class LedgerCloseStats
+{
+  public:
+    enum Phase
+    {
+        // checking the transaction set and sorting it for apply
+        VALIDATE = 0,
+        // charging fees and sequence numbers
+        FEES,
+        // applying the transactions
+        APPLY,
+        // applying the upgrades
+        UPGRADES,
+        // adding the entries to the bucket list and storing the header
+        BUCKETS,
+        // committing the ledger to the database
+        COMMIT,
+        // queueing and publishing history checkpoints
+        HISTORY,
+        // forgetting the buckets that are no longer referenced
+        GC,
+        PHASE_COUNT
+    };
+    typedef std::array<std::chrono::nanoseconds, PHASE_COUNT> PhaseTimes;
+
+    struct Transaction
+    {
+        Hash hash;
+        size_t operations;
+        TransactionResultCode result;
+        std::chrono::nanoseconds duration;
+    };
+
+    struct Ledger
+    {
+        uint32_t ledgerSeq;
+        std::chrono::nanoseconds duration;
+        PhaseTimes phases;
+        // The slowest transactions of the ledger, slowest first
+        std::vector<Transaction> slowest;
+    };
+
+  private:
+    size_t const mMaxLedgers;
+    size_t const mMaxTransactions;
+
+    // The last ledgers that were closed, most recent first
+    std::deque<Ledger> mLedgers;
+
+    // The ledger being closed. mTransactions is kept as a heap with the
+    // fastest transaction on top, so it holds the slowest transactions seen
+    // so far.
+    uint32_t mLedgerSeq{0};
+    std::vector<Transaction> mTransactions;
+
+  public:
+    // LedgerCloseStats keeps the maxTransactions slowest transactions of each
+    // of the maxLedgers last ledgers
+    LedgerCloseStats(size_t maxLedgers, size_t maxTransactions);
+
+    static char const* getPhaseName(Phase phase);
+
+    // beginLedger starts recording ledgerSeq, addTransaction records one of
+    // its transactions and endLedger adds it to the last ledgers. A ledger
+    // that is begun again before it ends (because closing it threw) is
+    // forgotten.
+    void beginLedger(uint32_t ledgerSeq);
+    void addTransaction(Transaction const& tx);
+    void endLedger(std::chrono::nanoseconds duration,
+                   PhaseTimes const& phases);
+
+    std::deque<Ledger> const&
+    getLedgers() const
+    {
+        return mLedgers;
+    }
+
+    // getJson reports the phase times of the last count ledgers (most recent
+    // first) and the limit slowest transactions among them
+    Json::Value getJson(size_t count, size_t limit) const;
+};
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "ledger/LedgerHashUtils.h"
+#include "util/NonCopyable.h"
+#include "util/TinyLFUCache.h"
+#include "xdr/Stellar-ledger-entries.h"
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace stellar
+{
+
+// LedgerEntryCache is a TinyLFUCache keyed by LedgerKey that can be shared by
+// several threads. It is split into shards, selected by the hash of the key,
+// each with its own mutex and its own TinyLFUCache of maxSize / shards
+// entries, so threads that look up different keys rarely contend. Small
+// caches have a single shard, since every shard must be large enough for its
+// admission filter and segments to be meaningful.
+//
+// It counts hits and misses per LedgerEntryType.
+template <typename V> class LedgerEntryCache : public NonMovableOrCopyable
+{
+    static size_t const MIN_SHARD_SIZE = 1024;
+    static size_t const MAX_SHARDS = 16;
+    static size_t const ENTRY_TYPES = 4;
+
+    struct Shard
+    {
+        std::mutex mMutex;
+        TinyLFUCache<LedgerKey, V> mCache;
+
+        explicit Shard(size_t maxSize) : mCache(maxSize)
+        {
+        }
+    };
+
+    struct TypeCounters
+    {
+        std::atomic<uint64_t> mHits{0};
+        std::atomic<uint64_t> mMisses{0};
+    };
+
+    size_t const mMaxSize;
+    std::vector<std::unique_ptr<Shard>> mShards;
+    std::array<TypeCounters, ENTRY_TYPES> mTypeCounters;
+
+    static size_t
+    typeIndex(LedgerEntryType type)
+    {
+        switch (type)
+        {
+        case ACCOUNT:
+            return 0;
+        case TRUSTLINE:
+            return 1;
+        case OFFER:
+            return 2;
+        case DATA:
+            return 3;
+        default:
+            abort();
+        }
+    }
+
+    Shard&
+    getShard(LedgerKey const& key) const
+    {
+        // The low bits of the hash select the slot in the index of the shard,
+        // so the shard is selected by the high bits
+        uint64_t hash = std::hash<LedgerKey>()(key);
+        return *mShards[(hash >> 32) % mShards.size()];
+    }
+
+  public:
+    explicit LedgerEntryCache(size_t maxSize) : mMaxSize(maxSize)
+    {
+        size_t shards = maxSize / MIN_SHARD_SIZE;
+        shards = shards < 1 ? 1 : (shards > MAX_SHARDS ? MAX_SHARDS : shards);
+        for (size_t i = 0; i < shards; ++i)
+        {
+            // The first shards take the remainder of the division
+            size_t shardSize =
+                maxSize / shards + (i < maxSize % shards ? 1 : 0);
+            mShards.emplace_back(std::make_unique<Shard>(shardSize));
+        }
+    }
+
+    size_t
+    maxSize() const
+    {
+        return mMaxSize;
+    }
+
+    size_t
+    size() const
+    {
+        size_t res = 0;
+        for (auto const& shard : mShards)
+        {
+            std::lock_guard<std::mutex> lock(shard->mMutex);
+            res += shard->mCache.size();
+        }
+        return res;
+    }
+
+    // `get` records an access to key. If key is in the cache, it copies its
+    // value to value and returns true, otherwise it returns false. It has
+    // the strong exception safety guarantee.
+    bool
+    get(LedgerKey const& key, V& value)
+    {
+        auto& shard = getShard(key);
+        auto& counters = mTypeCounters[typeIndex(key.type())];
+        std::lock_guard<std::mutex> lock(shard.mMutex);
+        auto cached = shard.mCache.maybeGet(key);
+        if (!cached)
+        {
+            ++counters.mMisses;
+            return false;
+        }
+        ++counters.mHits;
+        value = *cached;
+        return true;
+    }
+
+    // `exists` does not record an access
+    bool
+    exists(LedgerKey const& key) const
+    {
+        auto& shard = getShard(key);
+        std::lock_guard<std::mutex> lock(shard.mMutex);
+        return shard.mCache.exists(key);
+    }
+
+    // `put`, `admit` and `update` are the same as for TinyLFUCache
+    void
+    put(LedgerKey const& key, V const& value)
+    {
+        auto& shard = getShard(key);
+        std::lock_guard<std::mutex> lock(shard.mMutex);
+        shard.mCache.put(key, value);
+    }
+
+    void
+    admit(LedgerKey const& key, V const& value)
+    {
+        auto& shard = getShard(key);
+        std::lock_guard<std::mutex> lock(shard.mMutex);
+        shard.mCache.admit(key, value);
+    }
+
+    bool
+    update(LedgerKey const& key, V const& value)
+    {
+        auto& shard = getShard(key);
+        std::lock_guard<std::mutex> lock(shard.mMutex);
+        return shard.mCache.update(key, value);
+    }
+
+    void
+    erase(LedgerKey const& key)
+    {
+        auto& shard = getShard(key);
+        std::lock_guard<std::mutex> lock(shard.mMutex);
+        shard.mCache.erase(key);
+    }
+
+    // `clear` does not throw, unless locking a mutex fails
+    void
+    clear()
+    {
+        for (auto& shard : mShards)
+        {
+            std::lock_guard<std::mutex> lock(shard->mMutex);
+            shard->mCache.clear();
+        }
+    }
+
+    uint64_t
+    getMisses() const
+    {
+        uint64_t res = 0;
+        for (auto const& counters : mTypeCounters)
+        {
+            res += counters.mMisses;
+        }
+        return res;
+    }
+
+    // getHitRate returns the fraction of the lookups of entries of the given
+    // type that hit, or 0 if there was no lookup
+    double
+    getHitRate(LedgerEntryType type) const
+    {
+        auto const& counters = mTypeCounters[typeIndex(type)];
+        uint64_t hits = counters.mHits;
+        uint64_t total = hits + counters.mMisses;
+        return total == 0 ? 0 : static_cast<double>(hits) / total;
+    }
+};
+}
@@ -6,68 +6,141 @@
 
 #include "crypto/ByteSliceHasher.h"
 #include "xdr/Stellar-ledger.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
 
-// implements a default hasher for "LedgerKey"
-namespace std
+namespace stellar
 {
-template <> class hash<stellar::LedgerKey>
+
+// StructuralHasher computes the hash of a LedgerKey or an Asset by writing
+// every field of the key into a small buffer and hashing it with
+// shortHash::computeHash. Unlike hashing a prefix of the key, it distinguishes
+// every pair of keys that differ in any byte, such as the trustlines of assets
+// that have the same issuer and whose codes share the first character. As
+// shortHash is keyed per process, it is safe for keys chosen by peers, which
+// cannot craft keys that collide in the LedgerTxn maps.
+class StructuralHasher
 {
+    // The largest key is a DATA key: its type, account ID, a name of up to
+    // 64 bytes and the length of the name
+    static size_t const MAX_SIZE = 128;
+
+    unsigned char mBuffer[MAX_SIZE];
+    size_t mSize{0};
+
   public:
-    size_t
-    operator()(stellar::LedgerKey const& lk) const
+    void
+    addWord(uint64_t word)
     {
-        size_t res;
-        switch (lk.type())
+        addBytes(reinterpret_cast<unsigned char const*>(&word), sizeof(word));
+    }
+
+    void
+    addBytes(unsigned char const* data, size_t size)
+    {
+        if (size > MAX_SIZE - mSize)
         {
-        case stellar::ACCOUNT:
-            res = stellar::shortHash::computeHash(
-                stellar::ByteSlice(lk.account().accountID.ed25519().data(), 8));
-            break;
-        case stellar::TRUSTLINE:
+            abort();
+        }
+        std::memcpy(mBuffer + mSize, data, size);
+        mSize += size;
+    }
+
+    void
+    addAccount(AccountID const& accountID)
+    {
+        addBytes(accountID.ed25519().data(), accountID.ed25519().size());
+    }
+
+    void
+    addAsset(Asset const& asset)
+    {
+        addWord(asset.type());
+        switch (asset.type())
         {
-            auto& tl = lk.trustLine();
-            res = stellar::shortHash::computeHash(
-                stellar::ByteSlice(tl.accountID.ed25519().data(), 8));
-            switch (lk.trustLine().asset.type())
-            {
-            case stellar::ASSET_TYPE_NATIVE:
-                break;
-            case stellar::ASSET_TYPE_CREDIT_ALPHANUM4:
-            {
-                auto& tl4 = tl.asset.alphaNum4();
-                res ^= stellar::shortHash::computeHash(
-                    stellar::ByteSlice(tl4.issuer.ed25519().data(), 8));
-                res ^= tl4.assetCode[0];
-                break;
-            }
-            case stellar::ASSET_TYPE_CREDIT_ALPHANUM12:
-            {
-                auto& tl12 = tl.asset.alphaNum12();
-                res ^= stellar::shortHash::computeHash(
-                    stellar::ByteSlice(tl12.issuer.ed25519().data(), 8));
-                res ^= tl12.assetCode[0];
-                break;
-            }
-            default:
-                abort();
-            }
+        case ASSET_TYPE_NATIVE:
+            break;
+        case ASSET_TYPE_CREDIT_ALPHANUM4:
+            addBytes(asset.alphaNum4().assetCode.data(),
+                     asset.alphaNum4().assetCode.size());
+            addAccount(asset.alphaNum4().issuer);
+            break;
+        case ASSET_TYPE_CREDIT_ALPHANUM12:
+            addBytes(asset.alphaNum12().assetCode.data(),
+                     asset.alphaNum12().assetCode.size());
+            addAccount(asset.alphaNum12().issuer);
             break;
+        default:
+            abort();
         }
-        case stellar::DATA:
-            res = stellar::shortHash::computeHash(
-                stellar::ByteSlice(lk.data().accountID.ed25519().data(), 8));
-            res ^= stellar::shortHash::computeHash(stellar::ByteSlice(
-                lk.data().dataName.data(), lk.data().dataName.size()));
+    }
+
+    void
+    addLedgerKey(LedgerKey const& key)
+    {
+        addWord(key.type());
+        switch (key.type())
+        {
+        case ACCOUNT:
+            addAccount(key.account().accountID);
             break;
-        case stellar::OFFER:
-            res = stellar::shortHash::computeHash(stellar::ByteSlice(
-                &lk.offer().offerID, sizeof(lk.offer().offerID)));
+        case TRUSTLINE:
+            addAccount(key.trustLine().accountID);
+            addAsset(key.trustLine().asset);
+            break;
+        case DATA:
+        {
+            auto const& name = key.data().dataName;
+            addAccount(key.data().accountID);
+            addBytes(reinterpret_cast<unsigned char const*>(name.data()),
+                     name.size());
+            // The length separates the name from the end of the key
+            addWord(name.size());
+            break;
+        }
+        case OFFER:
+            addAccount(key.offer().sellerID);
+            addWord(key.offer().offerID);
             break;
         default:
             abort();
         }
-        return res;
+    }
+
+    uint64_t
+    finish() const
+    {
+        return shortHash::computeHash(ByteSlice(mBuffer, mSize));
+    }
+};
+}
+
+// implements a default hasher for "LedgerKey" and "Asset"
+namespace std
+{
+template <> class hash<stellar::Asset>
+{
+  public:
+    size_t
+    operator()(stellar::Asset const& asset) const
+    {
+        stellar::StructuralHasher hasher;
+        hasher.addAsset(asset);
+        return static_cast<size_t>(hasher.finish());
+    }
+};
+
+template <> class hash<stellar::LedgerKey>
+{
+  public:
+    size_t
+    operator()(stellar::LedgerKey const& lk) const
+    {
+        stellar::StructuralHasher hasher;
+        hasher.addLedgerKey(lk);
+        return static_cast<size_t>(hasher.finish());
     }
 };
 }
@@ -158,8 +158,8 @@ loadBySequence(Database& db, soci::session& sess, uint32_t seq)
 void
 deleteOldEntries(Database& db, uint32_t ledgerSeq, uint32_t count)
 {
-    DatabaseUtils::deleteOldEntriesHelper(db.getSession(), ledgerSeq, count,
-                                          "ledgerheaders", "ledgerseq");
+    DatabaseUtils::deleteOldEntriesHelper(db, ledgerSeq, count, "ledgerheaders",
+                                          "ledgerseq");
 }
 
 size_t
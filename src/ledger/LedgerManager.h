@@ -8,10 +8,16 @@
 #include "history/HistoryManager.h"
 #include <memory>
 
+namespace medida
+{
+class Timer;
+}
+
 namespace stellar
 {
 
 class LedgerCloseData;
+class LedgerCloseStats;
 class Database;
 
 /**
@@ -160,6 +166,16 @@ class LedgerManager
     virtual void deleteOldEntries(Database& db, uint32_t ledgerSeq,
                                   uint32_t count) = 0;
 
+    // Return the time spent closing the last ledgers and their slowest
+    // transactions.
+    virtual LedgerCloseStats const& getCloseStats() const = 0;
+
+    // Return the timer for operations of type `type` that ended with
+    // `result`, named ledger.op-<type>.<result>. Timers are created on first
+    // use and cached, so this is cheap to call for every applied operation.
+    virtual medida::Timer& getOperationTimer(OperationType type,
+                                             OperationResult const& result) = 0;
+
     virtual ~LedgerManager()
     {
     }
@@ -3,18 +3,22 @@
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
 #include "ledger/LedgerManagerImpl.h"
+#include "bucket/BucketApplicator.h"
+#include "bucket/BucketList.h"
 #include "bucket/BucketManager.h"
 #include "crypto/Hex.h"
 #include "crypto/KeyUtils.h"
 #include "crypto/SHA.h"
 #include "crypto/SecretKey.h"
 #include "database/Database.h"
+#include "database/HistoryPartitions.h"
 #include "herder/Herder.h"
 #include "herder/HerderPersistence.h"
 #include "herder/LedgerCloseData.h"
 #include "herder/TxSetFrame.h"
 #include "herder/Upgrades.h"
 #include "history/HistoryManager.h"
+#include "history/HistorySegmentStore.h"
 #include "invariant/InvariantDoesNotHold.h"
 #include "invariant/InvariantManager.h"
 #include "ledger/LedgerHeaderUtils.h"
@@ -27,7 +31,9 @@
 #include "main/ErrorMessages.h"
 #include "overlay/OverlayManager.h"
 #include "transactions/OperationFrame.h"
+#include "transactions/TransactionHistoryBatch.h"
 #include "transactions/TransactionUtils.h"
+#include "util/IOThrottle.h"
 #include "util/Logging.h"
 #include "util/XDROperators.h"
 #include "util/format.h"
@@ -39,7 +45,10 @@
 #include "xdrpp/printer.h"
 #include "xdrpp/types.h"
 
+#include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <cstring>
 #include <numeric>
 #include <sstream>
 
@@ -72,6 +81,113 @@ const uint32_t LedgerManager::GENESIS_LEDGER_BASE_RESERVE = 100000000;
 const uint32_t LedgerManager::GENESIS_LEDGER_MAX_TX_SIZE = 100;
 const int64_t LedgerManager::GENESIS_LEDGER_TOTAL_COINS = 1000000000000000000;
 
+// The closetimes command reports on the slowest transactions of the last
+// ledgers, which is enough to see what made a recent close slow
+static const size_t CLOSE_STATS_LEDGERS = 100;
+static const size_t CLOSE_STATS_TRANSACTIONS = 10;
+
+namespace
+{
+// toMetricName turns an XDR enum name like PATH_PAYMENT_STRICT_SEND into
+// path-payment-strict-send
+std::string
+toMetricName(char const* name)
+{
+    std::string res(name ? name : "unknown");
+    for (auto& c : res)
+    {
+        c = c == '_' ? '-' : static_cast<char>(std::tolower(c));
+    }
+    return res;
+}
+
+// getInnerResultName drops the prefix that all the result codes of an
+// operation share, so that PAYMENT_NO_DESTINATION is reported as
+// no-destination
+template <typename T>
+std::string
+getInnerResultName(T code)
+{
+    std::string success = xdr::xdr_traits<T>::enum_name(static_cast<T>(0));
+    auto prefix = success.size() - std::strlen("SUCCESS");
+    auto name = toMetricName(xdr::xdr_traits<T>::enum_name(code));
+    return name.substr(std::min(prefix, name.size()));
+}
+
+// forInnerResultCode calls f with the operation specific result code of res,
+// which must be opINNER, and returns false for unknown operation types
+template <typename F>
+bool
+forInnerResultCode(OperationResult const& res, F&& f)
+{
+    auto const& tr = res.tr();
+    switch (tr.type())
+    {
+    case CREATE_ACCOUNT:
+        f(tr.createAccountResult().code());
+        return true;
+    case PAYMENT:
+        f(tr.paymentResult().code());
+        return true;
+    case PATH_PAYMENT_STRICT_RECEIVE:
+        f(tr.pathPaymentStrictReceiveResult().code());
+        return true;
+    case MANAGE_SELL_OFFER:
+        f(tr.manageSellOfferResult().code());
+        return true;
+    case CREATE_PASSIVE_SELL_OFFER:
+        f(tr.createPassiveSellOfferResult().code());
+        return true;
+    case SET_OPTIONS:
+        f(tr.setOptionsResult().code());
+        return true;
+    case CHANGE_TRUST:
+        f(tr.changeTrustResult().code());
+        return true;
+    case ALLOW_TRUST:
+        f(tr.allowTrustResult().code());
+        return true;
+    case ACCOUNT_MERGE:
+        f(tr.accountMergeResult().code());
+        return true;
+    case INFLATION:
+        f(tr.inflationResult().code());
+        return true;
+    case MANAGE_DATA:
+        f(tr.manageDataResult().code());
+        return true;
+    case BUMP_SEQUENCE:
+        f(tr.bumpSeqResult().code());
+        return true;
+    case MANAGE_BUY_OFFER:
+        f(tr.manageBuyOfferResult().code());
+        return true;
+    case PATH_PAYMENT_STRICT_SEND:
+        f(tr.pathPaymentStrictSendResult().code());
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::string
+getOperationResultName(OperationResult const& res)
+{
+    if (res.code() != opINNER)
+    {
+        auto name = toMetricName(
+            xdr::xdr_traits<OperationResultCode>::enum_name(res.code()));
+        // drop the "op" prefix
+        return name.compare(0, 2, "op") == 0 ? name.substr(2) : name;
+    }
+
+    std::string name = "unknown";
+    forInnerResultCode(
+        res, [&name](auto code) { name = getInnerResultName(code); });
+    return name;
+}
+}
+
 std::unique_ptr<LedgerManager>
 LedgerManager::create(Application& app)
 {
@@ -115,6 +231,7 @@ LedgerManagerImpl::LedgerManagerImpl(Application& app)
     , mInternalErrorCount(app.getMetrics().NewCounter(
           {"ledger", "transaction", "internal-error"}))
     , mLedgerClose(app.getMetrics().NewTimer({"ledger", "ledger", "close"}))
+    , mCloseStats(CLOSE_STATS_LEDGERS, CLOSE_STATS_TRANSACTIONS)
     , mLedgerAgeClosed(app.getMetrics().NewTimer({"ledger", "age", "closed"}))
     , mLedgerAge(
           app.getMetrics().NewCounter({"ledger", "age", "current-seconds"}))
@@ -128,6 +245,21 @@ LedgerManagerImpl::LedgerManagerImpl(Application& app)
     , mState(LM_BOOTING_STATE)
 
 {
+    for (auto const& type : {std::make_pair(ACCOUNT, "account-hit-rate"),
+                             std::make_pair(TRUSTLINE, "trustline-hit-rate"),
+                             std::make_pair(OFFER, "offer-hit-rate"),
+                             std::make_pair(DATA, "data-hit-rate")})
+    {
+        mEntryCacheHitRates.emplace_back(
+            type.first, &app.getMetrics().NewCounter(
+                            {"ledger", "entry-cache", type.second}));
+    }
+    for (size_t i = 0; i < LedgerCloseStats::PHASE_COUNT; ++i)
+    {
+        auto phase = static_cast<LedgerCloseStats::Phase>(i);
+        mLedgerClosePhases.emplace_back(&app.getMetrics().NewTimer(
+            {"ledger", "close", LedgerCloseStats::getPhaseName(phase)}));
+    }
 }
 
 void
@@ -234,6 +366,12 @@ LedgerManagerImpl::startNewLedger(LedgerHeader const& genesisLedger)
     CLOG(INFO, "Ledger") << "Established genesis ledger, closing";
     CLOG(INFO, "Ledger") << "Root account seed: " << skey.getStrKeySeed().value;
     ledgerClosed(ltx);
+    if (mApp.getConfig().MODE_USES_IN_MEMORY_LEDGER)
+    {
+        // See loadLastKnownLedger
+        mApp.getPersistentState().setState(PersistentState::kInMemoryLedger,
+                                           "true");
+    }
     ltx.commit();
 }
 
@@ -279,6 +417,52 @@ LedgerManagerImpl::loadLastKnownLedger(
             throw std::runtime_error("Could not load ledger from database");
         }
 
+        // With ASYNC_LEDGER_COMMIT, ledger entries are written after the
+        // ledger header, so a crash can leave them behind the last closed
+        // ledger. They are then rebuilt from the buckets of the LCL, which
+        // is done again if it is interrupted, as the marker is only updated
+        // once it is done. The marker then holds the LCL as long as
+        // ASYNC_LEDGER_COMMIT is in effect, so that a crash before the next
+        // flush is detected too, and is cleared otherwise.
+        //
+        // With MODE_USES_IN_MEMORY_LEDGER, the ledger entries in the database
+        // are not written at all, which is recorded so that they are rebuilt
+        // in the same way once the node runs without it.
+        auto& ps = mApp.getPersistentState();
+        bool inMemory = mApp.getConfig().MODE_USES_IN_MEMORY_LEDGER;
+        bool rebuild = false;
+        auto lastFlushed = ps.getState(PersistentState::kLastFlushedLedger);
+        if (!lastFlushed.empty() &&
+            std::stoul(lastFlushed) < currentLedger->ledgerSeq)
+        {
+            CLOG(WARNING, "Ledger")
+                << "Ledger entries were only written up to ledger "
+                << lastFlushed << ", LCL is "
+                << ledgerAbbrev(*currentLedger, lastLedgerHash);
+            rebuild = true;
+        }
+        if (!inMemory &&
+            ps.getState(PersistentState::kInMemoryLedger) == "true")
+        {
+            CLOG(WARNING, "Ledger")
+                << "Ledger entries were not written while the node ran "
+                   "with MODE_USES_IN_MEMORY_LEDGER";
+            rebuild = true;
+        }
+        if (rebuild && !inMemory)
+        {
+            CLOG(WARNING, "Ledger")
+                << "Rebuilding ledger entries from the buckets of the LCL";
+            rebuildLedgerEntriesFromBuckets(getLastClosedLedgerHAS(),
+                                            currentLedger->ledgerVersion);
+        }
+        auto sqlRoot = dynamic_cast<LedgerTxnRoot*>(&mApp.getLedgerTxnRoot());
+        bool asyncCommit = sqlRoot && sqlRoot->isAsyncCommit();
+        ps.setState(PersistentState::kLastFlushedLedger,
+                    asyncCommit ? std::to_string(currentLedger->ledgerSeq)
+                                : "");
+        ps.setState(PersistentState::kInMemoryLedger, inMemory ? "true" : "");
+
         {
             LedgerTxn ltx(mApp.getLedgerTxnRoot());
             ltx.loadHeader().current() = *currentLedger;
@@ -306,6 +490,10 @@ LedgerManagerImpl::loadLastKnownLedger(
                                              << ledgerAbbrev(header.current());
                         advanceLedgerPointers(header.current());
                     }
+                    if (mApp.getConfig().MODE_USES_IN_MEMORY_LEDGER)
+                    {
+                        loadLedgerStateFromBuckets();
+                    }
                     handler(ec);
                 }
             };
@@ -336,6 +524,103 @@ LedgerManagerImpl::loadLastKnownLedger(
     }
 }
 
+void
+LedgerManagerImpl::rebuildLedgerEntriesFromBuckets(
+    HistoryArchiveState const& has, uint32_t maxProtocolVersion)
+{
+    auto root = dynamic_cast<LedgerTxnRoot*>(&mApp.getLedgerTxnRoot());
+    if (!root)
+    {
+        // The ledger state is loaded from the buckets anyway
+        return;
+    }
+
+    auto& bm = mApp.getBucketManager();
+    auto missing = bm.checkForMissingBucketsFiles(has);
+    if (!missing.empty())
+    {
+        CLOG(ERROR, "Ledger")
+            << missing.size() << " buckets are missing from bucket directory '"
+            << bm.getBucketDir() << "'";
+        CLOG(ERROR, "Ledger") << POSSIBLY_CORRUPTED_LOCAL_DATA;
+        throw std::runtime_error(
+            "Unable to rebuild ledger entries: bucket directory is corrupt");
+    }
+
+    std::vector<std::shared_ptr<Bucket const>> buckets;
+    for (auto const& level : has.currentBuckets)
+    {
+        buckets.emplace_back(bm.getBucketByHash(hexToBin256(level.curr)));
+        buckets.emplace_back(bm.getBucketByHash(hexToBin256(level.snap)));
+    }
+
+    // The entries are written through sessions of their own rather than
+    // LedgerTxns, whose commits would write the marker before all the
+    // entries are
+    root->deleteObjectsModifiedOnOrAfterLedger(0);
+    BucketApplicator::Counters counters(mApp.getClock().now());
+    if (mApp.getDatabase().isSqlite())
+    {
+        // SQLite allows a single writer, and its LedgerTxns commit
+        // synchronously, without the marker
+        BucketApplicator applicator(mApp, maxProtocolVersion, buckets);
+        while (applicator)
+        {
+            applicator.advance(counters);
+        }
+    }
+    else
+    {
+        root->beginBucketApply();
+        try
+        {
+            BucketApplicator::applyInParallel(
+                mApp, *root, maxProtocolVersion, buckets,
+                std::max<size_t>(mApp.getConfig().BUCKET_APPLY_THREADS, 1),
+                counters);
+        }
+        catch (...)
+        {
+            root->endBucketApply();
+            throw;
+        }
+        root->endBucketApply();
+    }
+    CLOG(INFO, "Ledger") << "Rebuilt ledger entries from buckets";
+}
+
+void
+LedgerManagerImpl::loadLedgerStateFromBuckets()
+{
+    // Buckets are applied at once, from the newest (the curr of level 0) to
+    // the oldest (the snap of the deepest level), so that every entry is
+    // written once, in its newest state, and entries that have been deleted
+    // are erased.
+    CLOG(INFO, "Ledger") << "Loading ledger state from buckets";
+    auto& bl = mApp.getBucketManager().getBucketList();
+    std::vector<std::shared_ptr<Bucket const>> buckets;
+    for (uint32_t i = 0; i < BucketList::kNumLevels; ++i)
+    {
+        auto const& level = bl.getLevel(i);
+        buckets.emplace_back(level.getCurr());
+        buckets.emplace_back(level.getSnap());
+    }
+    BucketApplicator::Counters counters(mApp.getClock().now());
+    BucketApplicator applicator(mApp, Config::CURRENT_LEDGER_PROTOCOL_VERSION,
+                                buckets);
+    while (applicator)
+    {
+        applicator.advance(counters);
+    }
+
+    auto& root = mApp.getLedgerTxnRoot();
+    CLOG(INFO, "Ledger") << "Loaded ledger state from buckets: "
+                         << root.countObjects(ACCOUNT) << " accounts, "
+                         << root.countObjects(TRUSTLINE) << " trust lines, "
+                         << root.countObjects(OFFER) << " offers, "
+                         << root.countObjects(DATA) << " data entries";
+}
+
 Database&
 LedgerManagerImpl::getDatabase()
 {
@@ -771,6 +1056,11 @@ LedgerManagerImpl::syncMetrics()
     mLedgerAge.set_count(secondsSinceLastLedgerClose());
     mPrefetchHitRate.set_count(
         std::llround(mApp.getLedgerTxnRoot().getPrefetchHitRate() * 100));
+    for (auto const& kv : mEntryCacheHitRates)
+    {
+        kv.second->set_count(std::llround(
+            mApp.getLedgerTxnRoot().getEntryCacheHitRate(kv.first) * 100));
+    }
     mApp.syncOwnMetrics();
 }
 
@@ -785,13 +1075,28 @@ LedgerManagerImpl::closeLedger(LedgerCloseData const& ledgerData)
 {
     auto ledgerTime = mLedgerClose.TimeScope();
     DBTimeExcluder qtExclude(mApp);
-
+    // Background bucket I/O backs off while the ledger closes
+    IOThrottle::LedgerClose throttleClose(
+        mApp.getBucketManager().getIOThrottle());
+
+    // Each phase of the close is timed from the end of the previous one
+    LedgerCloseStats::PhaseTimes phases{};
+    auto phaseStart = std::chrono::steady_clock::now();
+    auto endPhase = [&](LedgerCloseStats::Phase phase) {
+        auto now = std::chrono::steady_clock::now();
+        phases[phase] += now - phaseStart;
+        phaseStart = now;
+    };
+
+    mApp.getDatabase().getHistoryPartitions().prepare(
+        getLastClosedLedgerNum() + 1);
     LedgerTxn ltx(mApp.getLedgerTxnRoot());
     auto header = ltx.loadHeader();
     ++header.current().ledgerSeq;
     header.current().previousLedgerHash = mLastClosedLedger.hash;
     CLOG(DEBUG, "Ledger") << "starting closeLedger() on ledgerSeq="
                           << header.current().ledgerSeq;
+    mCloseStats.beginLedger(header.current().ledgerSeq);
 
     auto now = mApp.getClock().now();
     mLedgerAgeClosed.Update(now - mLastClose);
@@ -846,18 +1151,38 @@ LedgerManagerImpl::closeLedger(LedgerCloseData const& ledgerData)
     // sorted such that sequence numbers are respected
     vector<TransactionFramePtr> txs = ledgerData.getTxSet()->sortForApply();
 
+    // the transaction history is written in one batch when ltx is committed.
+    // It always goes to the database, since the transaction meta and fee
+    // changes are only kept there; the history segment, if any, also gets
+    // the transactions and results that are published.
+    auto history =
+        std::make_shared<TransactionHistoryBatch>(header.current().ledgerSeq);
+    auto segments = mApp.getHistoryManager().getSegmentStore();
+    bool toSegment =
+        segments && segments->beginLedger(header.current().ledgerSeq);
+    endPhase(LedgerCloseStats::VALIDATE);
+
     // first, prefetch source accounts fot txset, then charge fees
     prefetchTxSourceIds(txs);
     processFeesSeqNums(txs, ltx,
-                       ledgerData.getTxSet()->getBaseFee(header.current()));
+                       ledgerData.getTxSet()->getBaseFee(header.current()),
+                       *history);
+    endPhase(LedgerCloseStats::FEES);
 
     TransactionResultSet txResultSet;
     txResultSet.results.reserve(txs.size());
 
-    applyTransactions(txs, ltx, txResultSet);
+    applyTransactions(txs, ltx, txResultSet, *history);
+
+    auto& db = mApp.getDatabase();
+    mApp.getLedgerTxnRoot().deferWrite(
+        [history, &db](soci::session& session) {
+            history->store(db, session);
+        });
 
     ltx.loadHeader().current().txSetResultHash =
         sha256(xdr::xdr_to_opaque(txResultSet));
+    endPhase(LedgerCloseStats::APPLY);
 
     // apply any upgrades that were decided during consensus
     // this must be done after applying transactions as the txset
@@ -903,8 +1228,14 @@ LedgerManagerImpl::closeLedger(LedgerCloseData const& ledgerData)
             CLOG(ERROR, "Ledger") << "Unknown exception during upgrade";
         }
     }
+    endPhase(LedgerCloseStats::UPGRADES);
 
     ledgerClosed(ltx);
+    endPhase(LedgerCloseStats::BUCKETS);
+    if (toSegment)
+    {
+        appendToHistorySegment(*segments, txs, txResultSet);
+    }
 
     // The next 4 steps happen in a relatively non-obvious, subtle order.
     // This is unfortunate and it would be nice if we could make it not
@@ -926,20 +1257,76 @@ LedgerManagerImpl::closeLedger(LedgerCloseData const& ledgerData)
     // step 1
     auto& hm = mApp.getHistoryManager();
     hm.maybeQueueHistoryCheckpoint();
+    endPhase(LedgerCloseStats::HISTORY);
 
     // step 2
     ltx.commit();
+    endPhase(LedgerCloseStats::COMMIT);
+    throttleClose.setCommitTime(phases[LedgerCloseStats::COMMIT]);
 
     // step 3
     hm.publishQueuedHistory();
     hm.logAndUpdatePublishStatus();
+    endPhase(LedgerCloseStats::HISTORY);
 
     // step 4
     mApp.getBucketManager().forgetUnreferencedBuckets();
+    endPhase(LedgerCloseStats::GC);
 
-    std::chrono::duration<double> ledgerTimeSeconds = ledgerTime.Stop();
-    CLOG(DEBUG, "Perf") << "Applied ledger in " << ledgerTimeSeconds.count()
-                        << " seconds";
+    auto ledgerDuration = ledgerTime.Stop();
+    for (size_t i = 0; i < LedgerCloseStats::PHASE_COUNT; ++i)
+    {
+        mLedgerClosePhases[i]->Update(phases[i]);
+    }
+    mCloseStats.endLedger(ledgerDuration, phases);
+
+    std::chrono::duration<double> ledgerTimeSeconds = ledgerDuration;
+    if (Logging::logDebug("Perf"))
+    {
+        std::ostringstream breakdown;
+        for (size_t i = 0; i < LedgerCloseStats::PHASE_COUNT; ++i)
+        {
+            std::chrono::duration<double, std::milli> ms = phases[i];
+            breakdown << (i == 0 ? "" : ", ")
+                      << LedgerCloseStats::getPhaseName(
+                             static_cast<LedgerCloseStats::Phase>(i))
+                      << ": " << ms.count() << "ms";
+        }
+        CLOG(DEBUG, "Perf") << "Applied ledger in " << ledgerTimeSeconds.count()
+                            << " seconds (" << breakdown.str() << ")";
+    }
+}
+
+LedgerCloseStats const&
+LedgerManagerImpl::getCloseStats() const
+{
+    return mCloseStats;
+}
+
+medida::Timer&
+LedgerManagerImpl::getOperationTimer(OperationType type,
+                                     OperationResult const& result)
+{
+    int32_t inner = -1;
+    if (result.code() == opINNER)
+    {
+        forInnerResultCode(result, [&inner](auto code) {
+            inner = static_cast<int32_t>(code);
+        });
+    }
+    auto key = std::make_tuple(static_cast<int32_t>(type),
+                               static_cast<int32_t>(result.code()), inner);
+    auto it = mOperationTimers.find(key);
+    if (it == mOperationTimers.end())
+    {
+        auto& timer = mApp.getMetrics().NewTimer(
+            {"ledger",
+             "op-" + toMetricName(
+                         xdr::xdr_traits<OperationType>::enum_name(type)),
+             getOperationResultName(result)});
+        it = mOperationTimers.emplace(key, &timer).first;
+    }
+    return *it->second;
 }
 
 void
@@ -954,6 +1341,11 @@ LedgerManagerImpl::deleteOldEntries(Database& db, uint32_t ledgerSeq,
     Upgrades::deleteOldEntries(db, ledgerSeq, count);
     db.clearPreparedStatementCache();
     txscope.commit();
+
+    if (auto segments = mApp.getHistoryManager().getSegmentStore())
+    {
+        segments->deleteSegments(ledgerSeq);
+    }
 }
 
 void
@@ -971,7 +1363,8 @@ LedgerManagerImpl::advanceLedgerPointers(LedgerHeader const& header)
 void
 LedgerManagerImpl::processFeesSeqNums(std::vector<TransactionFramePtr>& txs,
                                       AbstractLedgerTxn& ltxOuter,
-                                      int64_t baseFee)
+                                      int64_t baseFee,
+                                      TransactionHistoryBatch& history)
 {
     CLOG(DEBUG, "Ledger")
         << "processing fees and sequence numbers with base fee " << baseFee;
@@ -979,13 +1372,11 @@ LedgerManagerImpl::processFeesSeqNums(std::vector<TransactionFramePtr>& txs,
     try
     {
         LedgerTxn ltx(ltxOuter);
-        auto ledgerSeq = ltx.loadHeader().current().ledgerSeq;
         for (auto tx : txs)
         {
             LedgerTxn ltxTx(ltx);
             tx->processFeeSeqNum(ltxTx, baseFee);
-            tx->storeTransactionFee(mApp.getDatabase(), ledgerSeq,
-                                    ltxTx.getChanges(), ++index);
+            tx->storeTransactionFee(history, ltxTx.getChanges(), ++index);
             ltxTx.commit();
         }
         ltx.commit();
@@ -1040,7 +1431,8 @@ LedgerManagerImpl::prefetchTransactionData(
 void
 LedgerManagerImpl::applyTransactions(std::vector<TransactionFramePtr>& txs,
                                      AbstractLedgerTxn& ltx,
-                                     TransactionResultSet& txResultSet)
+                                     TransactionResultSet& txResultSet,
+                                     TransactionHistoryBatch& history)
 {
     int index = 0;
 
@@ -1097,9 +1489,10 @@ LedgerManagerImpl::applyTransactions(std::vector<TransactionFramePtr>& txs,
             mInternalErrorCount.inc();
             tx->getResult().result.code(txINTERNAL_ERROR);
         }
-        auto ledgerSeq = ltx.loadHeader().current().ledgerSeq;
-        tx->storeTransaction(mApp.getDatabase(), ledgerSeq, tm, ++index,
-                             txResultSet);
+        tx->storeTransaction(history, tm, ++index, txResultSet);
+        mCloseStats.addTransaction({tx->getFullHash(),
+                                    tx->getOperations().size(),
+                                    tx->getResultCode(), txTime.Stop()});
     }
 
     logTxApplyMetrics(ltx, numTxs, numOps);
@@ -1120,6 +1513,41 @@ LedgerManagerImpl::logTxApplyMetrics(AbstractLedgerTxn& ltx, size_t numTxs,
     mPrefetchHitRate.set_count(std::llround(hitRate));
 }
 
+void
+LedgerManagerImpl::appendToHistorySegment(
+    HistorySegmentStore& segments, std::vector<TransactionFramePtr> const& txs,
+    TransactionResultSet const& txResultSet)
+{
+    auto ledger = std::make_shared<HistorySegmentStore::Ledger>();
+    ledger->header.hash = mLastClosedLedger.hash;
+    ledger->header.header = mLastClosedLedger.header;
+    auto ledgerSeq = mLastClosedLedger.header.ledgerSeq;
+
+    // Like TransactionFrame::copyTransactionsToStream, the archives only hold
+    // entries for ledgers with transactions, with the transaction set sorted
+    // for hash and the results in apply order
+    if (!txs.empty())
+    {
+        TxSetFrame txSet(mLastClosedLedger.header.previousLedgerHash);
+        for (auto const& tx : txs)
+        {
+            txSet.add(tx);
+        }
+        txSet.sortForHash();
+        ledger->transactions = make_optional<TransactionHistoryEntry>();
+        ledger->transactions->ledgerSeq = ledgerSeq;
+        txSet.toXDR(ledger->transactions->txSet);
+
+        ledger->results = make_optional<TransactionHistoryResultEntry>();
+        ledger->results->ledgerSeq = ledgerSeq;
+        ledger->results->txResultSet = txResultSet;
+    }
+    ledger->scp = segments.takeSCPHistory(ledgerSeq);
+
+    mApp.getLedgerTxnRoot().deferWrite(
+        [&segments, ledger](soci::session&) { segments.append(*ledger); });
+}
+
 void
 LedgerManagerImpl::storeCurrentLedger(LedgerHeader const& header)
 {
@@ -1137,6 +1565,7 @@ LedgerManagerImpl::storeCurrentLedger(LedgerHeader const& header)
 
     mApp.getPersistentState().setState(PersistentState::kHistoryArchiveState,
                                        has.toString());
+    mApp.getBucketManager().setLastClosedLedgerHAS(has);
 }
 
 // NB: This is a separate method so a testing subclass can override it.
@@ -6,12 +6,17 @@
 #include "util/asio.h"
 
 #include "history/HistoryManager.h"
+#include "ledger/LedgerCloseStats.h"
 #include "ledger/LedgerManager.h"
 #include "ledger/SyncingLedgerChain.h"
 #include "main/PersistentState.h"
 #include "transactions/TransactionFrame.h"
 #include "xdr/Stellar-ledger.h"
+#include <map>
 #include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 /*
 Holds the current ledger
@@ -31,7 +36,9 @@ namespace stellar
 class AbstractLedgerTxn;
 class Application;
 class Database;
+class HistorySegmentStore;
 class LedgerTxnHeader;
+class TransactionHistoryBatch;
 
 class LedgerManagerImpl : public LedgerManager
 {
@@ -46,9 +53,17 @@ class LedgerManagerImpl : public LedgerManager
     medida::Histogram& mOperationCount;
     medida::Counter& mInternalErrorCount;
     medida::Timer& mLedgerClose;
+    std::vector<medida::Timer*> mLedgerClosePhases;
+    // keyed by operation type, result code and operation specific result
+    // code, so that the timer name is only built the first time
+    std::map<std::tuple<int32_t, int32_t, int32_t>, medida::Timer*>
+        mOperationTimers;
+    LedgerCloseStats mCloseStats;
     medida::Timer& mLedgerAgeClosed;
     medida::Counter& mLedgerAge;
     medida::Counter& mPrefetchHitRate;
+    std::vector<std::pair<LedgerEntryType, medida::Counter*>>
+        mEntryCacheHitRates;
     VirtualClock::time_point mLastClose;
 
     std::unique_ptr<VirtualClock::time_point> mStartCatchup;
@@ -67,15 +82,34 @@ class LedgerManagerImpl : public LedgerManager
                          CatchupConfiguration::Mode catchupMode);
 
     void processFeesSeqNums(std::vector<TransactionFramePtr>& txs,
-                            AbstractLedgerTxn& ltxOuter, int64_t baseFee);
+                            AbstractLedgerTxn& ltxOuter, int64_t baseFee,
+                            TransactionHistoryBatch& history);
 
     void applyTransactions(std::vector<TransactionFramePtr>& txs,
                            AbstractLedgerTxn& ltx,
-                           TransactionResultSet& txResultSet);
+                           TransactionResultSet& txResultSet,
+                           TransactionHistoryBatch& history);
 
     void ledgerClosed(AbstractLedgerTxn& ltx);
 
+    // appendToHistorySegment defers appending the last closed ledger, with
+    // its transactions and results, to segments
+    void appendToHistorySegment(HistorySegmentStore& segments,
+                                std::vector<TransactionFramePtr> const& txs,
+                                TransactionResultSet const& txResultSet);
+
     void storeCurrentLedger(LedgerHeader const& header);
+
+    // loadLedgerStateFromBuckets fills the ledger state from the bucket list
+    // when it is held in memory, see MODE_USES_IN_MEMORY_LEDGER.
+    void loadLedgerStateFromBuckets();
+
+    // rebuildLedgerEntriesFromBuckets replaces the ledger entries in the
+    // database with those of the buckets of has, when they were left behind
+    // it by a crash during an ASYNC_LEDGER_COMMIT flush or by running with
+    // MODE_USES_IN_MEMORY_LEDGER.
+    void rebuildLedgerEntriesFromBuckets(HistoryArchiveState const& has,
+                                         uint32_t maxProtocolVersion);
     void prefetchTransactionData(std::vector<TransactionFramePtr>& txs);
     void prefetchTxSourceIds(std::vector<TransactionFramePtr>& txs);
 
@@ -142,5 +176,10 @@ class LedgerManagerImpl : public LedgerManager
     void closeLedger(LedgerCloseData const& ledgerData) override;
     void deleteOldEntries(Database& db, uint32_t ledgerSeq,
                           uint32_t count) override;
+
+    LedgerCloseStats const& getCloseStats() const override;
+
+    medida::Timer& getOperationTimer(OperationType type,
+                                     OperationResult const& result) override;
 };
 }
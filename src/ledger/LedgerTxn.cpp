@@ -11,6 +11,7 @@
 #include "ledger/LedgerTxnEntry.h"
 #include "ledger/LedgerTxnHeader.h"
 #include "ledger/LedgerTxnImpl.h"
+#include "main/PersistentState.h"
 #include "util/GlobalChecks.h"
 #include "util/XDROperators.h"
 #include "util/types.h"
@@ -112,6 +113,18 @@ EntryIterator::key() const
     return getImpl()->key();
 }
 
+std::shared_ptr<LedgerEntry const>
+EntryIterator::sharedEntry() const
+{
+    return getImpl()->sharedEntry();
+}
+
+bool
+EntryIterator::entryInArena() const
+{
+    return getImpl()->entryInArena();
+}
+
 // Implementation of AbstractLedgerTxn --------------------------------------
 AbstractLedgerTxn::~AbstractLedgerTxn()
 {
@@ -132,8 +145,11 @@ LedgerTxn::LedgerTxn(LedgerTxn& parent, bool shouldUpdateLastModified)
 LedgerTxn::Impl::Impl(LedgerTxn& self, AbstractLedgerTxnParent& parent,
                       bool shouldUpdateLastModified)
     : mParent(parent)
+    , mParentImpl(getParentImpl(parent))
     , mChild(nullptr)
     , mHeader(std::make_unique<LedgerHeader>(mParent.getHeader()))
+    , mArena(std::make_shared<Arena>(mParentImpl ? mParentImpl->mArena
+                                                 : nullptr))
     , mShouldUpdateLastModified(shouldUpdateLastModified)
     , mIsSealed(false)
     , mConsistency(LedgerTxnConsistency::EXACT)
@@ -141,6 +157,28 @@ LedgerTxn::Impl::Impl(LedgerTxn& self, AbstractLedgerTxnParent& parent,
     mParent.addChild(self);
 }
 
+LedgerTxn::Impl*
+LedgerTxn::Impl::getParentImpl(AbstractLedgerTxnParent& parent)
+{
+    auto ltx = dynamic_cast<LedgerTxn*>(&parent);
+    return ltx ? ltx->mImpl.get() : nullptr;
+}
+
+LedgerTxn::Impl::EntryPtr
+LedgerTxn::Impl::makeEntry(LedgerEntry const& entry) const
+{
+    return {std::allocate_shared<LedgerEntry>(
+                ArenaAllocator<LedgerEntry>(mArena), entry),
+            true, true};
+}
+
+LedgerEntry&
+LedgerTxn::Impl::getMutable(EntryPtr const& ptr)
+{
+    assert(ptr.entry && ptr.owned);
+    return const_cast<LedgerEntry&>(*ptr.entry);
+}
+
 LedgerTxn::~LedgerTxn()
 {
     if (mImpl)
@@ -260,7 +298,15 @@ LedgerTxn::Impl::commitChild(EntryIterator iter, LedgerTxnConsistency cons)
             auto const& key = iter.key();
             if (iter.entryExists())
             {
-                mEntry[key] = std::make_shared<LedgerEntry>(iter.entry());
+                // The entry is kept as a snapshot, along with the Arena of
+                // the child if it was allocated there. If the child did not
+                // modify it, it may have loaded it from this LedgerTxn.
+                auto shared = iter.sharedEntry();
+                auto& current = mEntry[key];
+                if (current.entry != shared)
+                {
+                    current = {shared, false, iter.entryInArena()};
+                }
             }
             else if (!mParent.getNewestVersion(key))
             { // Created in this LedgerTxn
@@ -268,7 +314,7 @@ LedgerTxn::Impl::commitChild(EntryIterator iter, LedgerTxnConsistency cons)
             }
             else
             { // Existed in a previous LedgerTxn
-                mEntry[key] = nullptr;
+                mEntry[key] = EntryPtr();
             }
         }
     }
@@ -287,6 +333,18 @@ LedgerTxn::Impl::commitChild(EntryIterator iter, LedgerTxnConsistency cons)
     mChild = nullptr;
 }
 
+uint64_t
+LedgerTxn::countObjects(LedgerEntryType let) const
+{
+    throw std::runtime_error("called countObjects on non-root LedgerTxn");
+}
+
+uint64_t
+LedgerTxn::countObjects(LedgerEntryType let, LedgerRange const& ledgers) const
+{
+    throw std::runtime_error("called countObjects on non-root LedgerTxn");
+}
+
 LedgerTxnEntry
 LedgerTxn::create(LedgerEntry const& entry)
 {
@@ -305,8 +363,8 @@ LedgerTxn::Impl::create(LedgerTxn& self, LedgerEntry const& entry)
         throw std::runtime_error("Key already exists");
     }
 
-    auto current = std::make_shared<LedgerEntry>(entry);
-    auto impl = LedgerTxnEntry::makeSharedImpl(self, *current);
+    auto current = makeEntry(entry);
+    auto impl = LedgerTxnEntry::makeSharedImpl(self, current.entry);
 
     // Set the key to active before constructing the LedgerTxnEntry, as this
     // can throw and the LedgerTxnEntry destructor requires that mActive
@@ -342,7 +400,7 @@ LedgerTxn::Impl::createOrUpdateWithoutLoading(LedgerTxn& self,
 
     // std::shared_ptr assignment is noexcept, and map
     // index on a single key is strong-guarantee.
-    mEntry[key] = std::make_shared<LedgerEntry>(entry);
+    mEntry[key] = makeEntry(entry);
 }
 
 void
@@ -362,6 +420,28 @@ LedgerTxn::Impl::deactivate(LedgerKey const& key)
     mActive.erase(iter);
 }
 
+LedgerEntry&
+LedgerTxn::makeMutable(LedgerKey const& key)
+{
+    return getImpl()->makeMutable(key);
+}
+
+LedgerEntry&
+LedgerTxn::Impl::makeMutable(LedgerKey const& key)
+{
+    auto iter = mEntry.find(key);
+    if (iter == mEntry.end() || !iter->second.entry)
+    {
+        throw std::runtime_error("Key does not exist");
+    }
+    if (!iter->second.owned)
+    {
+        // std::shared_ptr assignment is noexcept
+        iter->second = makeEntry(*iter->second.entry);
+    }
+    return getMutable(iter->second);
+}
+
 void
 LedgerTxn::deactivateHeader()
 {
@@ -378,6 +458,37 @@ LedgerTxn::Impl::deactivateHeader()
     mActiveHeader.reset();
 }
 
+void
+LedgerTxn::deleteObjectsModifiedOnOrAfterLedger(uint32_t ledger) const
+{
+    throw std::runtime_error(
+        "called deleteObjectsModifiedOnOrAfterLedger on non-root LedgerTxn");
+}
+
+void
+LedgerTxn::dropAccounts()
+{
+    throw std::runtime_error("called dropAccounts on non-root LedgerTxn");
+}
+
+void
+LedgerTxn::dropData()
+{
+    throw std::runtime_error("called dropData on non-root LedgerTxn");
+}
+
+void
+LedgerTxn::dropOffers()
+{
+    throw std::runtime_error("called dropOffers on non-root LedgerTxn");
+}
+
+void
+LedgerTxn::dropTrustLines()
+{
+    throw std::runtime_error("called dropTrustLines on non-root LedgerTxn");
+}
+
 void
 LedgerTxn::erase(LedgerKey const& key)
 {
@@ -408,14 +519,14 @@ LedgerTxn::Impl::erase(LedgerKey const& key)
         auto iter = mEntry.find(key);
         if (iter != mEntry.end())
         {
-            iter->second.reset();
+            iter->second = EntryPtr();
         }
         else
         {
             // C++14 requirements for exception safety of associative containers
             // guarantee that if emplace throws when inserting a single element
             // then the insertion has no effect
-            mEntry.emplace(key, nullptr);
+            mEntry.emplace(key, EntryPtr());
         }
     }
     // Note: Cannot throw after this point because the entry will not be
@@ -447,14 +558,14 @@ LedgerTxn::Impl::eraseWithoutLoading(LedgerKey const& key)
     auto iter = mEntry.find(key);
     if (iter != mEntry.end())
     {
-        iter->second.reset();
+        iter->second = EntryPtr();
     }
     else
     {
         // C++14 requirements for exception safety of associative containers
         // guarantee that if emplace throws when inserting a single element
         // then the insertion has no effect
-        mEntry.emplace(key, nullptr);
+        mEntry.emplace(key, EntryPtr());
     }
     // Note: Cannot throw after this point because the entry will not be
     // deactivated in that case
@@ -481,7 +592,7 @@ LedgerTxn::Impl::getAllOffers()
     for (auto const& kv : mEntry)
     {
         auto const& key = kv.first;
-        auto const& entry = kv.second;
+        auto const& entry = kv.second.entry;
         if (key.type() != OFFER)
         {
             continue;
@@ -496,6 +607,48 @@ LedgerTxn::Impl::getAllOffers()
     return offers;
 }
 
+static bool
+isSellerInRange(AccountID const& seller, AccountID const* afterSeller,
+                xdr::pointer<AccountID> const& lastSeller)
+{
+    return (!afterSeller || *afterSeller < seller) &&
+           (!lastSeller || !(*lastSeller < seller));
+}
+
+OfferBatch
+LedgerTxn::getOffersBySellerRange(AccountID const* afterSeller,
+                                  size_t maxOffers)
+{
+    return getImpl()->getOffersBySellerRange(afterSeller, maxOffers);
+}
+
+OfferBatch
+LedgerTxn::Impl::getOffersBySellerRange(AccountID const* afterSeller,
+                                        size_t maxOffers)
+{
+    // The range is chosen by the root, the offers of this LedgerTxn only
+    // replace those in the range
+    auto batch = mParent.getOffersBySellerRange(afterSeller, maxOffers);
+    for (auto const& kv : mEntry)
+    {
+        auto const& key = kv.first;
+        auto const& entry = kv.second.entry;
+        if (key.type() != OFFER ||
+            !isSellerInRange(key.offer().sellerID, afterSeller,
+                             batch.lastSeller))
+        {
+            continue;
+        }
+        if (!entry)
+        {
+            batch.offers.erase(key);
+            continue;
+        }
+        batch.offers[key] = *entry;
+    }
+    return batch;
+}
+
 std::shared_ptr<LedgerEntry const>
 LedgerTxn::getBestOffer(Asset const& buying, Asset const& selling,
                         std::unordered_set<LedgerKey>& exclude)
@@ -519,7 +672,7 @@ LedgerTxn::Impl::getBestOffer(Asset const& buying, Asset const& selling,
     for (auto iter = mEntry.cbegin(); iter != end; ++iter)
     {
         auto const& key = iter->first;
-        auto const& entry = iter->second;
+        auto const& entry = iter->second.entry;
         if (key.type() != OFFER)
         {
             continue;
@@ -537,7 +690,7 @@ LedgerTxn::Impl::getBestOffer(Asset const& buying, Asset const& selling,
         }
 
         if ((bestOfferIter == end) ||
-            isBetterOffer(*entry, *bestOfferIter->second))
+            isBetterOffer(*entry, *bestOfferIter->second.entry))
         {
             bestOfferIter = iter;
         }
@@ -546,7 +699,8 @@ LedgerTxn::Impl::getBestOffer(Asset const& buying, Asset const& selling,
     std::shared_ptr<LedgerEntry const> bestOffer;
     if (bestOfferIter != end)
     {
-        bestOffer = std::make_shared<LedgerEntry const>(*bestOfferIter->second);
+        bestOffer = std::make_shared<LedgerEntry const>(
+            *bestOfferIter->second.entry);
     }
 
     auto parentBestOffer = mParent.getBestOffer(buying, selling, exclude);
@@ -577,7 +731,7 @@ LedgerTxn::Impl::getChanges()
         for (auto const& kv : entries)
         {
             auto const& key = kv.first;
-            auto const& entry = kv.second;
+            auto const& entry = kv.second.entry;
 
             auto previous = mParent.getNewestVersion(key);
             if (previous)
@@ -631,7 +785,7 @@ LedgerTxn::Impl::getDelta()
             // Deep copy is not required here because getDelta causes
             // LedgerTxn to enter the sealed state, meaning subsequent
             // modifications are impossible.
-            delta.entry[key] = {kv.second, previous};
+            delta.entry[key] = {kv.second.entry, previous};
         }
         delta.header = {*mHeader, mParent.getHeader()};
     });
@@ -667,12 +821,12 @@ LedgerTxn::getInflationWinners(size_t maxWinners, int64_t minVotes)
 std::map<AccountID, int64_t>
 LedgerTxn::Impl::getDeltaVotes() const
 {
-    int64_t const MIN_VOTES_TO_INCLUDE = 1000000000;
+    int64_t const MIN_VOTES_TO_INCLUDE = InflationVoteTally::MIN_VOTER_BALANCE;
     std::map<AccountID, int64_t> deltaVotes;
     for (auto const& kv : mEntry)
     {
         auto const& key = kv.first;
-        auto const& entry = kv.second;
+        auto const& entry = kv.second.entry;
         if (key.type() != ACCOUNT)
         {
             continue;
@@ -835,7 +989,7 @@ LedgerTxn::Impl::getAllEntries(std::vector<LedgerEntry>& initEntries,
         for (auto const& kv : entries)
         {
             auto const& key = kv.first;
-            auto const& entry = kv.second;
+            auto const& entry = kv.second.entry;
             if (entry)
             {
                 auto previous = mParent.getNewestVersion(key);
@@ -871,11 +1025,26 @@ LedgerTxn::Impl::getNewestVersion(LedgerKey const& key) const
     auto iter = mEntry.find(key);
     if (iter != mEntry.end())
     {
-        return iter->second;
+        return iter->second.entry;
     }
     return mParent.getNewestVersion(key);
 }
 
+LedgerTxn::Impl::EntryPtr
+LedgerTxn::Impl::getNewestEntry(LedgerKey const& key) const
+{
+    auto iter = mEntry.find(key);
+    if (iter != mEntry.end())
+    {
+        return {iter->second.entry, false, iter->second.inArena};
+    }
+    if (mParentImpl)
+    {
+        return mParentImpl->getNewestEntry(key);
+    }
+    return {mParent.getNewestVersion(key), false, false};
+}
+
 std::unordered_map<LedgerKey, LedgerEntry>
 LedgerTxn::getOffersByAccountAndAsset(AccountID const& account,
                                       Asset const& asset)
@@ -891,7 +1060,7 @@ LedgerTxn::Impl::getOffersByAccountAndAsset(AccountID const& account,
     for (auto const& kv : mEntry)
     {
         auto const& key = kv.first;
-        auto const& entry = kv.second;
+        auto const& entry = kv.second.entry;
         if (key.type() != OFFER)
         {
             continue;
@@ -932,14 +1101,15 @@ LedgerTxn::Impl::load(LedgerTxn& self, LedgerKey const& key)
         throw std::runtime_error("Key is active");
     }
 
-    auto newest = getNewestVersion(key);
-    if (!newest)
+    auto newest = getNewestEntry(key);
+    if (!newest.entry)
     {
         return {};
     }
 
-    auto current = std::make_shared<LedgerEntry>(*newest);
-    auto impl = LedgerTxnEntry::makeSharedImpl(self, *current);
+    // The entry is copied when it is first modified (see makeMutable), until
+    // then it is shared with the parent
+    auto impl = LedgerTxnEntry::makeSharedImpl(self, newest.entry);
 
     // Set the key to active before constructing the LedgerTxnEntry, as this
     // can throw and the LedgerTxnEntry destructor requires that mActive
@@ -948,8 +1118,14 @@ LedgerTxn::Impl::load(LedgerTxn& self, LedgerKey const& key)
     mActive.emplace(key, toEntryImplBase(impl));
     LedgerTxnEntry ltxe(impl);
 
-    // std::shared_ptr assignment is noexcept
-    mEntry[key] = current;
+    // If the newest version is already in this LedgerTxn it stays there (and
+    // stays owned), otherwise it is recorded. std::shared_ptr assignment is
+    // noexcept.
+    auto& current = mEntry[key];
+    if (current.entry != newest.entry)
+    {
+        current = newest;
+    }
     return ltxe;
 }
 
@@ -980,14 +1156,67 @@ LedgerTxn::Impl::loadAllOffers(LedgerTxn& self)
     }
     catch (...)
     {
-        // For associative containers, swap does not throw unless the exception
-        // is thrown by the swap of the Compare object (which is of type
-        // std::less<LedgerKey>, so this should not throw when swapped)
+        // FlatHashMap::swap does not throw
         mEntry.swap(previousEntries);
         throw;
     }
 }
 
+std::map<AccountID, std::vector<LedgerTxnEntry>>
+LedgerTxn::loadOffersBySellerRange(AccountID const* afterSeller,
+                                   size_t maxOffers,
+                                   xdr::pointer<AccountID>& lastSeller)
+{
+    return getImpl()->loadOffersBySellerRange(*this, afterSeller, maxOffers,
+                                              lastSeller);
+}
+
+std::map<AccountID, std::vector<LedgerTxnEntry>>
+LedgerTxn::Impl::loadOffersBySellerRange(LedgerTxn& self,
+                                         AccountID const* afterSeller,
+                                         size_t maxOffers,
+                                         xdr::pointer<AccountID>& lastSeller)
+{
+    throwIfSealed();
+    throwIfChild();
+
+    auto batch = getOffersBySellerRange(afterSeller, maxOffers);
+
+    // Unlike loadAllOffers, which is called once, this is called for every
+    // batch, so rather than copying mEntry the entries that were added by
+    // loading are erased if an exception is thrown.
+    std::vector<LedgerKey> added;
+    added.reserve(batch.offers.size());
+    try
+    {
+        std::map<AccountID, std::vector<LedgerTxnEntry>> offersByAccount;
+        for (auto const& kv : batch.offers)
+        {
+            auto const& key = kv.first;
+            if (mEntry.find(key) == mEntry.end())
+            {
+                added.emplace_back(key);
+            }
+            auto const& sellerID = key.offer().sellerID;
+            offersByAccount[sellerID].emplace_back(load(self, key));
+        }
+
+        // xdr::pointer<...>::swap does not throw
+        lastSeller.swap(batch.lastSeller);
+        return offersByAccount;
+    }
+    catch (...)
+    {
+        // The LedgerTxnEntry objects that were loaded have been destroyed, so
+        // the entries are no longer active
+        for (auto const& key : added)
+        {
+            mEntry.erase(key);
+        }
+        throw;
+    }
+}
+
 LedgerTxnEntry
 LedgerTxn::loadBestOffer(Asset const& buying, Asset const& selling)
 {
@@ -1060,9 +1289,7 @@ LedgerTxn::Impl::loadOffersByAccountAndAsset(LedgerTxn& self,
     }
     catch (...)
     {
-        // For associative containers, swap does not throw unless the exception
-        // is thrown by the swap of the Compare object (which is of type
-        // std::less<LedgerKey>, so this should not throw when swapped)
+        // FlatHashMap::swap does not throw
         mEntry.swap(previousEntries);
         throw;
     }
@@ -1090,7 +1317,7 @@ LedgerTxn::Impl::loadWithoutRecord(LedgerTxn& self, LedgerKey const& key)
         return {};
     }
 
-    auto impl = ConstLedgerTxnEntry::makeSharedImpl(self, *newest);
+    auto impl = ConstLedgerTxnEntry::makeSharedImpl(self, newest);
 
     // Set the key to active before constructing the ConstLedgerTxnEntry, as
     // this can throw and the LedgerTxnEntry destructor requires that mActive
@@ -1127,6 +1354,46 @@ LedgerTxn::rollbackChild()
     getImpl()->rollbackChild();
 }
 
+#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+void
+LedgerTxn::resetForFuzzer()
+{
+    throw std::runtime_error("called resetForFuzzer on non-root LedgerTxn");
+}
+#endif // FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+
+uint32_t
+LedgerTxn::prefetch(std::unordered_set<LedgerKey> const& keys)
+{
+    throw std::runtime_error("called prefetch on non-root LedgerTxn");
+}
+
+double
+LedgerTxn::getPrefetchHitRate() const
+{
+    throw std::runtime_error("called getPrefetchHitRate on non-root LedgerTxn");
+}
+
+double
+LedgerTxn::getEntryCacheHitRate(LedgerEntryType let) const
+{
+    throw std::runtime_error(
+        "called getEntryCacheHitRate on non-root LedgerTxn");
+}
+
+void
+LedgerTxn::deferWrite(DeferredWrite write)
+{
+    throw std::runtime_error("called deferWrite on non-root LedgerTxn");
+}
+
+void
+LedgerTxn::waitForDeferredWrites() const
+{
+    throw std::runtime_error(
+        "called waitForDeferredWrites on non-root LedgerTxn");
+}
+
 void
 LedgerTxn::Impl::rollbackChild()
 {
@@ -1157,48 +1424,71 @@ LedgerTxn::Impl::unsealHeader(LedgerTxn& self,
     f(header.current());
 }
 
-LedgerTxn::Impl::EntryMap
-LedgerTxn::Impl::maybeUpdateLastModified() const
-{
-    throwIfSealed();
-    throwIfChild();
-
-    // Note: We do a deep copy here since a shallow copy would not be exception
-    // safe.
-    EntryMap entries;
-    entries.reserve(mEntry.size());
-    for (auto const& kv : mEntry)
-    {
-        auto const& key = kv.first;
-        std::shared_ptr<LedgerEntry> entry;
-        if (kv.second)
-        {
-            entry = std::make_shared<LedgerEntry>(*kv.second);
-            if (mShouldUpdateLastModified)
-            {
-                entry->lastModifiedLedgerSeq = mHeader->ledgerSeq;
-            }
-        }
-        entries.emplace(key, entry);
-    }
-    return entries;
-}
-
 void
 LedgerTxn::Impl::maybeUpdateLastModifiedThenInvokeThenSeal(
     std::function<void(EntryMap const&)> f)
 {
     if (!mIsSealed)
     {
-        // Invokes throwIfChild and throwIfSealed
-        auto entries = maybeUpdateLastModified();
+        throwIfSealed();
+        throwIfChild();
+
+        // The entries whose last modified changes are updated in mEntry
+        // rather than copying every entry: owned entries in place, shared
+        // entries by an owned copy. Every change is recorded so that it can
+        // be undone if an exception is thrown.
+        std::vector<std::pair<EntryPtr*, EntryPtr>> replaced;
+        std::vector<std::pair<LedgerEntry*, uint32_t>> updated;
+        if (mShouldUpdateLastModified)
+        {
+            replaced.reserve(mEntry.size());
+            updated.reserve(mEntry.size());
+        }
+
+        try
+        {
+            uint32_t ledgerSeq = mHeader->ledgerSeq;
+            for (auto& kv : mEntry)
+            {
+                auto& ptr = kv.second;
+                if (!mShouldUpdateLastModified || !ptr.entry ||
+                    ptr.entry->lastModifiedLedgerSeq == ledgerSeq)
+                {
+                    continue;
+                }
+
+                if (ptr.owned)
+                {
+                    auto& entry = getMutable(ptr);
+                    updated.emplace_back(&entry, entry.lastModifiedLedgerSeq);
+                    entry.lastModifiedLedgerSeq = ledgerSeq;
+                }
+                else
+                {
+                    auto copy = makeEntry(*ptr.entry);
+                    getMutable(copy).lastModifiedLedgerSeq = ledgerSeq;
 
-        f(entries);
+                    // Capacity was reserved so emplace_back does not throw
+                    replaced.emplace_back(&ptr, ptr);
+                    ptr = std::move(copy);
+                }
+            }
 
-        // For associative containers, swap does not throw unless the exception
-        // is thrown by the swap of the Compare object (which is of type
-        // std::less<LedgerKey>, so this should not throw when swapped)
-        mEntry.swap(entries);
+            f(mEntry);
+        }
+        catch (...)
+        {
+            // std::shared_ptr assignment is noexcept
+            for (auto const& kv : replaced)
+            {
+                *kv.first = kv.second;
+            }
+            for (auto const& kv : updated)
+            {
+                kv.first->lastModifiedLedgerSeq = kv.second;
+            }
+            throw;
+        }
 
         // std::set<...>::clear does not throw
         // std::shared_ptr<...>::reset does not throw
@@ -1234,13 +1524,13 @@ LedgerTxn::Impl::EntryIteratorImpl::atEnd() const
 LedgerEntry const&
 LedgerTxn::Impl::EntryIteratorImpl::entry() const
 {
-    return *(mIter->second);
+    return *(mIter->second.entry);
 }
 
 bool
 LedgerTxn::Impl::EntryIteratorImpl::entryExists() const
 {
-    return (bool)(mIter->second);
+    return (bool)(mIter->second.entry);
 }
 
 LedgerKey const&
@@ -1249,6 +1539,18 @@ LedgerTxn::Impl::EntryIteratorImpl::key() const
     return mIter->first;
 }
 
+std::shared_ptr<LedgerEntry const>
+LedgerTxn::Impl::EntryIteratorImpl::sharedEntry() const
+{
+    return mIter->second.entry;
+}
+
+bool
+LedgerTxn::Impl::EntryIteratorImpl::entryInArena() const
+{
+    return mIter->second.inArena;
+}
+
 std::unique_ptr<EntryIterator::AbstractImpl>
 LedgerTxn::Impl::EntryIteratorImpl::clone() const
 {
@@ -1258,22 +1560,31 @@ LedgerTxn::Impl::EntryIteratorImpl::clone() const
 // Implementation of LedgerTxnRoot ------------------------------------------
 LedgerTxnRoot::LedgerTxnRoot(Database& db, size_t entryCacheSize,
                              size_t bestOfferCacheSize,
-                             size_t prefetchBatchSize)
+                             size_t prefetchBatchSize, bool asyncCommit)
     : mImpl(std::make_unique<Impl>(db, entryCacheSize, bestOfferCacheSize,
-                                   prefetchBatchSize))
+                                   prefetchBatchSize, asyncCommit))
 {
 }
 
 LedgerTxnRoot::Impl::Impl(Database& db, size_t entryCacheSize,
-                          size_t bestOfferCacheSize, size_t prefetchBatchSize)
+                          size_t bestOfferCacheSize, size_t prefetchBatchSize,
+                          bool asyncCommit)
     : mDatabase(db)
     , mHeader(std::make_unique<LedgerHeader>())
     , mEntryCache(entryCacheSize)
-    , mBestOffersCache(bestOfferCacheSize)
+    , mMaxOrderBooks(bestOfferCacheSize)
     , mMaxCacheSize(entryCacheSize)
     , mBulkLoadBatchSize(prefetchBatchSize)
     , mChild(nullptr)
+    , mAsyncCommit(asyncCommit)
 {
+    if (mAsyncCommit)
+    {
+        // The connection pool is created lazily, which is not thread-safe, so
+        // create it before the flush thread needs it.
+        mDatabase.getPool();
+        mFlushThread = std::thread([this]() { flushPendingDeltas(); });
+    }
 }
 
 LedgerTxnRoot::~LedgerTxnRoot()
@@ -1286,13 +1597,85 @@ LedgerTxnRoot::Impl::~Impl()
     {
         mChild->rollback();
     }
+
+    if (mFlushThread.joinable())
+    {
+        // The flush thread writes every queued delta before it exits
+        {
+            std::lock_guard<std::mutex> lock(mFlushMutex);
+            mStopFlushing = true;
+        }
+        mFlushCondition.notify_all();
+        mFlushThread.join();
+    }
+}
+
+void
+LedgerTxnRoot::upgradeToBinaryKeys(Database& db)
+{
+    size_t const BATCH_SIZE = 0x4000;
+    auto& session = db.getSession();
+
+    // Every StrKey that appears in the tables is decoded once, into strkeys,
+    // and the tables are then rewritten by joining with it. Base64 values are
+    // decoded by the database itself.
+    session << "CREATE TABLE strkeys ("
+               "strkey VARCHAR(56) PRIMARY KEY, "
+               "rawkey " +
+                   db.getBinaryType() + " NOT NULL)";
+
+    std::vector<std::string> strKeys, rawKeys;
+    auto insertKeys = [&]() {
+        if (!strKeys.empty())
+        {
+            session << "INSERT INTO strkeys (strkey, rawkey) "
+                       "VALUES (:s, decode(:r, 'hex'))",
+                soci::use(strKeys), soci::use(rawKeys);
+            strKeys.clear();
+            rawKeys.clear();
+        }
+    };
+
+    std::string strKey;
+    soci::statement st =
+        (session.prepare << "SELECT accountid FROM accounts UNION "
+                            "SELECT inflationdest FROM accounts "
+                            "WHERE inflationdest IS NOT NULL UNION "
+                            "SELECT accountid FROM trustlines UNION "
+                            "SELECT issuer FROM trustlines UNION "
+                            "SELECT sellerid FROM offers UNION "
+                            "SELECT accountid FROM accountdata",
+         soci::into(strKey));
+    st.execute(true);
+    while (st.got_data())
+    {
+        strKeys.emplace_back(strKey);
+        rawKeys.emplace_back(
+            toBinaryColumn(KeyUtils::fromStrKey<PublicKey>(strKey)));
+        if (strKeys.size() >= BATCH_SIZE)
+        {
+            insertKeys();
+        }
+        st.fetch();
+    }
+    insertKeys();
+
+    Impl::upgradeAccountsToBinaryKeys(db);
+    Impl::upgradeDataToBinaryKeys(db);
+    Impl::upgradeOffersToBinaryKeys(db);
+    Impl::upgradeTrustLinesToBinaryKeys(db);
+
+    session << "DROP TABLE strkeys";
 }
 
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 void
 LedgerTxnRoot::Impl::resetForFuzzer()
 {
-    mBestOffersCache.clear();
+    waitForFlush(0);
+    retireFlushedDeltas();
+    clearOrderBooks();
+    mInflationVotes.reset();
     mEntryCache.clear();
 }
 
@@ -1316,6 +1699,10 @@ LedgerTxnRoot::Impl::addChild(AbstractLedgerTxn& child)
     {
         throw std::runtime_error("LedgerTxnRoot already has child");
     }
+    throwIfApplyingBuckets();
+    // Deltas are only retired before the transaction is opened, so that the
+    // snapshot it reads from is guaranteed to include them
+    retireFlushedDeltas();
     mTransaction = std::make_unique<soci::transaction>(mDatabase.getSession());
     mChild = &child;
 }
@@ -1329,6 +1716,15 @@ LedgerTxnRoot::Impl::throwIfChild() const
     }
 }
 
+void
+LedgerTxnRoot::Impl::throwIfApplyingBuckets() const
+{
+    if (mApplyingBuckets)
+    {
+        throw std::runtime_error("LedgerTxnRoot is applying buckets");
+    }
+}
+
 void
 LedgerTxnRoot::commitChild(EntryIterator iter, LedgerTxnConsistency cons)
 {
@@ -1370,58 +1766,70 @@ BulkLedgerEntryChangeAccumulator::accumulate(EntryIterator const& iter)
 void
 LedgerTxnRoot::Impl::bulkApply(BulkLedgerEntryChangeAccumulator& bleca,
                                size_t bufferThreshold,
-                               LedgerTxnConsistency cons)
+                               LedgerTxnConsistency cons,
+                               soci::session& session)
 {
     auto& upsertAccounts = bleca.getAccountsToUpsert();
     if (upsertAccounts.size() > bufferThreshold)
     {
-        bulkUpsertAccounts(upsertAccounts);
+        bulkUpsertAccounts(upsertAccounts, session);
         upsertAccounts.clear();
     }
     auto& deleteAccounts = bleca.getAccountsToDelete();
     if (deleteAccounts.size() > bufferThreshold)
     {
-        bulkDeleteAccounts(deleteAccounts, cons);
+        bulkDeleteAccounts(deleteAccounts, cons, session);
         deleteAccounts.clear();
     }
     auto& upsertTrustLines = bleca.getTrustLinesToUpsert();
     if (upsertTrustLines.size() > bufferThreshold)
     {
-        bulkUpsertTrustLines(upsertTrustLines);
+        bulkUpsertTrustLines(upsertTrustLines, session);
         upsertTrustLines.clear();
     }
     auto& deleteTrustLines = bleca.getTrustLinesToDelete();
     if (deleteTrustLines.size() > bufferThreshold)
     {
-        bulkDeleteTrustLines(deleteTrustLines, cons);
+        bulkDeleteTrustLines(deleteTrustLines, cons, session);
         deleteTrustLines.clear();
     }
     auto& upsertOffers = bleca.getOffersToUpsert();
     if (upsertOffers.size() > bufferThreshold)
     {
-        bulkUpsertOffers(upsertOffers);
+        bulkUpsertOffers(upsertOffers, session);
         upsertOffers.clear();
     }
     auto& deleteOffers = bleca.getOffersToDelete();
     if (deleteOffers.size() > bufferThreshold)
     {
-        bulkDeleteOffers(deleteOffers, cons);
+        bulkDeleteOffers(deleteOffers, cons, session);
         deleteOffers.clear();
     }
     auto& upsertAccountData = bleca.getAccountDataToUpsert();
     if (upsertAccountData.size() > bufferThreshold)
     {
-        bulkUpsertAccountData(upsertAccountData);
+        bulkUpsertAccountData(upsertAccountData, session);
         upsertAccountData.clear();
     }
     auto& deleteAccountData = bleca.getAccountDataToDelete();
     if (deleteAccountData.size() > bufferThreshold)
     {
-        bulkDeleteAccountData(deleteAccountData, cons);
+        bulkDeleteAccountData(deleteAccountData, cons, session);
         deleteAccountData.clear();
     }
 }
 
+// The entries of the child that are in an Arena are copied, so that they do
+// not keep the Arena alive. The others are snapshots that the child loaded
+// from this LedgerTxnRoot and did not modify.
+static std::shared_ptr<LedgerEntry const>
+copyCommittedEntry(EntryIterator const& iter)
+{
+    return iter.entryInArena()
+               ? std::make_shared<LedgerEntry const>(iter.entry())
+               : iter.sharedEntry();
+}
+
 void
 LedgerTxnRoot::Impl::commitChild(EntryIterator iter, LedgerTxnConsistency cons)
 {
@@ -1430,22 +1838,91 @@ LedgerTxnRoot::Impl::commitChild(EntryIterator iter, LedgerTxnConsistency cons)
     auto childHeader = std::make_unique<LedgerHeader>(mChild->getHeader());
 
     auto bleca = BulkLedgerEntryChangeAccumulator();
+    std::vector<OfferChange> offerChanges;
+    std::vector<InflationVoteChange> voteChanges;
+    CommittedEntries committed;
     try
     {
-        while ((bool)iter)
+        if (mAsyncCommit)
+        {
+            // The entries are written by the flush thread once the
+            // transaction, which holds everything else written while closing
+            // the ledger, has committed. So the lastflushedledger marker can
+            // lag, but never lead, the last closed ledger.
+            auto delta = std::make_shared<PendingDelta>();
+            delta->ledgerSeq = childHeader->ledgerSeq;
+            delta->consistency = cons;
+            for (; (bool)iter; ++iter)
+            {
+                if (iter.key().type() == OFFER)
+                {
+                    recordOfferChange(iter, offerChanges);
+                }
+                else if (iter.key().type() == ACCOUNT)
+                {
+                    recordInflationVoteChange(iter, voteChanges);
+                }
+                auto& entry = delta->entries[iter.key()];
+                if (iter.entryExists())
+                {
+                    entry = copyCommittedEntry(iter);
+                }
+                if (mEntryCache.exists(iter.key()))
+                {
+                    committed.emplace_back(iter.key(), entry);
+                }
+            }
+            delta->writes.swap(mDeferredWrites);
+
+            waitForFlush(MAX_UNFLUSHED_DELTAS - 1);
+            mTransaction->commit();
+
+            mPendingDeltas.emplace_back(delta);
+            {
+                std::lock_guard<std::mutex> lock(mFlushMutex);
+                mFlushQueue.emplace_back(delta);
+            }
+            mFlushCondition.notify_all();
+        }
+        else
         {
-            bleca.accumulate(iter);
-            ++iter;
-            size_t bufferThreshold =
-                (bool)iter ? LEDGER_ENTRY_BATCH_COMMIT_SIZE : 0;
-            bulkApply(bleca, bufferThreshold, cons);
+            while ((bool)iter)
+            {
+                if (iter.key().type() == OFFER)
+                {
+                    recordOfferChange(iter, offerChanges);
+                }
+                else if (iter.key().type() == ACCOUNT)
+                {
+                    recordInflationVoteChange(iter, voteChanges);
+                }
+                if (mEntryCache.exists(iter.key()))
+                {
+                    std::shared_ptr<LedgerEntry const> entry;
+                    if (iter.entryExists())
+                    {
+                        entry = copyCommittedEntry(iter);
+                    }
+                    committed.emplace_back(iter.key(), entry);
+                }
+                bleca.accumulate(iter);
+                ++iter;
+                size_t bufferThreshold =
+                    (bool)iter ? LEDGER_ENTRY_BATCH_COMMIT_SIZE : 0;
+                bulkApply(bleca, bufferThreshold, cons,
+                          mDatabase.getSession());
+            }
+            for (auto const& write : mDeferredWrites)
+            {
+                write(mDatabase.getSession());
+            }
+            // NB: we want to clear the prepared statement cache _before_
+            // committing; on postgres this doesn't matter but on SQLite the
+            // passive WAL-auto-checkpointing-at-commit behaviour will starve
+            // if there are still prepared statements open at commit time.
+            mDatabase.clearPreparedStatementCache();
+            mTransaction->commit();
         }
-        // NB: we want to clear the prepared statement cache _before_
-        // committing; on postgres this doesn't matter but on SQLite the passive
-        // WAL-auto-checkpointing-at-commit behaviour will starve if there are
-        // still prepared statements open at commit time.
-        mDatabase.clearPreparedStatementCache();
-        mTransaction->commit();
     }
     catch (std::exception& e)
     {
@@ -1458,10 +1935,17 @@ LedgerTxnRoot::Impl::commitChild(EntryIterator iter, LedgerTxnConsistency cons)
             "unknown fatal error during commit to LedgerTxnRoot");
     }
 
-    // Clearing the cache does not throw
-    mBestOffersCache.clear();
-    mEntryCache.clear();
+    // std::unordered_map<...>::clear and std::vector<...>::clear do not
+    // throw
     mPrefetchMetrics.clear();
+    mPrefetchedEntries = 0;
+    mDeferredWrites.clear();
+
+    // updateEntryCache, updateOrderBooks and updateInflationVotes do not
+    // throw
+    updateEntryCache(committed);
+    updateOrderBooks(offerChanges);
+    updateInflationVotes(voteChanges);
 
     // std::unique_ptr<...>::reset does not throw
     mTransaction.reset();
@@ -1500,6 +1984,8 @@ LedgerTxnRoot::Impl::countObjects(LedgerEntryType let) const
 {
     using namespace soci;
     throwIfChild();
+    waitForFlush(0);
+    retireFlushedDeltas();
 
     std::string query =
         "SELECT COUNT(*) FROM " + tableFromLedgerEntryType(let) + ";";
@@ -1521,6 +2007,8 @@ LedgerTxnRoot::Impl::countObjects(LedgerEntryType let,
 {
     using namespace soci;
     throwIfChild();
+    waitForFlush(0);
+    retireFlushedDeltas();
 
     std::string query = "SELECT COUNT(*) FROM " +
                         tableFromLedgerEntryType(let) +
@@ -1538,13 +2026,22 @@ LedgerTxnRoot::deleteObjectsModifiedOnOrAfterLedger(uint32_t ledger) const
     return mImpl->deleteObjectsModifiedOnOrAfterLedger(ledger);
 }
 
+bool
+LedgerTxnRoot::isAsyncCommit() const
+{
+    return mImpl->isAsyncCommit();
+}
+
 void
 LedgerTxnRoot::Impl::deleteObjectsModifiedOnOrAfterLedger(uint32_t ledger) const
 {
     using namespace soci;
     throwIfChild();
+    waitForFlush(0);
+    retireFlushedDeltas();
     mEntryCache.clear();
-    mBestOffersCache.clear();
+    clearOrderBooks();
+    mInflationVotes.reset();
 
     for (auto let : {ACCOUNT, DATA, TRUSTLINE, OFFER})
     {
@@ -1554,6 +2051,101 @@ LedgerTxnRoot::Impl::deleteObjectsModifiedOnOrAfterLedger(uint32_t ledger) const
     }
 }
 
+void
+LedgerTxnRoot::beginBucketApply()
+{
+    mImpl->beginBucketApply();
+}
+
+void
+LedgerTxnRoot::Impl::beginBucketApply()
+{
+    throwIfChild();
+    throwIfApplyingBuckets();
+    waitForFlush(0);
+    retireFlushedDeltas();
+    mEntryCache.clear();
+    clearOrderBooks();
+    mInflationVotes.reset();
+    mApplyingBuckets = true;
+}
+
+void
+LedgerTxnRoot::endBucketApply()
+{
+    mImpl->endBucketApply();
+}
+
+void
+LedgerTxnRoot::Impl::endBucketApply()
+{
+    // Anything loaded before the buckets were applied is stale
+    mEntryCache.clear();
+    clearOrderBooks();
+    mInflationVotes.reset();
+    mApplyingBuckets = false;
+}
+
+bool
+LedgerTxnRoot::isApplyingBuckets() const
+{
+    return mImpl->isApplyingBuckets();
+}
+
+void
+LedgerTxnRoot::writeBucketEntries(std::vector<BucketEntry> const& entries,
+                                  soci::session& session)
+{
+    mImpl->writeBucketEntries(entries, session);
+}
+
+void
+LedgerTxnRoot::Impl::writeBucketEntries(
+    std::vector<BucketEntry> const& entries, soci::session& session)
+{
+    if (!mApplyingBuckets)
+    {
+        throw std::runtime_error(
+            "writeBucketEntries called outside of a bucket apply");
+    }
+
+    decltype(PendingDelta::entries) changes;
+    for (auto const& e : entries)
+    {
+        if (e.type() == LIVEENTRY || e.type() == INITENTRY)
+        {
+            changes[LedgerEntryKey(e.liveEntry())] =
+                std::make_shared<LedgerEntry const>(e.liveEntry());
+        }
+        else
+        {
+            changes[e.deadEntry()] = nullptr;
+        }
+    }
+
+    soci::transaction tx(session);
+    // Sessions applying buckets write distinct keys, so there is nothing for
+    // serializable isolation to protect
+    if (!mDatabase.isSqlite())
+    {
+        session << "SET TRANSACTION ISOLATION LEVEL READ COMMITTED";
+    }
+
+    auto bleca = BulkLedgerEntryChangeAccumulator();
+    EntryIterator iter(std::make_unique<PendingDeltaIteratorImpl>(
+        changes.cbegin(), changes.cend()));
+    while ((bool)iter)
+    {
+        bleca.accumulate(iter);
+        ++iter;
+        size_t bufferThreshold =
+            (bool)iter ? LEDGER_ENTRY_BATCH_COMMIT_SIZE : 0;
+        bulkApply(bleca, bufferThreshold, LedgerTxnConsistency::EXTRA_DELETES,
+                  session);
+    }
+    tx.commit();
+}
+
 void
 LedgerTxnRoot::dropAccounts()
 {
@@ -1587,6 +2179,7 @@ LedgerTxnRoot::prefetch(std::unordered_set<LedgerKey> const& keys)
 uint32_t
 LedgerTxnRoot::Impl::prefetch(std::unordered_set<LedgerKey> const& keys)
 {
+    throwIfApplyingBuckets();
     uint32_t total = 0;
 
     std::unordered_set<LedgerKey> accounts;
@@ -1601,12 +2194,17 @@ LedgerTxnRoot::Impl::prefetch(std::unordered_set<LedgerKey> const& keys)
             {
                 putInEntryCache(item.first, item.second, LoadType::PREFETCH);
                 ++total;
+                ++mPrefetchedEntries;
             }
         };
 
+    // Keys with a pending version are never loaded from the database, as
+    // the database might not reflect that version yet
+    std::shared_ptr<LedgerEntry const> pending;
     auto insertIfNotLoaded = [&](std::unordered_set<LedgerKey>& keys,
                                  LedgerKey const& key) {
-        if (!mEntryCache.exists(key, false))
+        if (!mEntryCache.exists(key) &&
+            !getFromPendingDeltas(key, pending))
         {
             keys.insert(key);
         }
@@ -1614,7 +2212,7 @@ LedgerTxnRoot::Impl::prefetch(std::unordered_set<LedgerKey> const& keys)
 
     for (auto const& key : keys)
     {
-        if ((static_cast<double>(mEntryCache.size()) / mMaxCacheSize) >=
+        if ((static_cast<double>(mPrefetchedEntries) / mMaxCacheSize) >=
             ENTRY_CACHE_FILL_RATIO)
         {
             return total;
@@ -1675,7 +2273,7 @@ LedgerTxnRoot::getPrefetchHitRate() const
 double
 LedgerTxnRoot::Impl::getPrefetchHitRate() const
 {
-    auto totalMisses = mEntryCache.getCounters().mMisses;
+    auto totalMisses = mEntryCache.getMisses();
     if (totalMisses == 0 && mTotalPrefetchHits == 0)
     {
         return 0;
@@ -1684,6 +2282,44 @@ LedgerTxnRoot::Impl::getPrefetchHitRate() const
            (totalMisses + mTotalPrefetchHits);
 }
 
+double
+LedgerTxnRoot::getEntryCacheHitRate(LedgerEntryType let) const
+{
+    return mImpl->getEntryCacheHitRate(let);
+}
+
+double
+LedgerTxnRoot::Impl::getEntryCacheHitRate(LedgerEntryType let) const
+{
+    return mEntryCache.getHitRate(let);
+}
+
+void
+LedgerTxnRoot::deferWrite(DeferredWrite write)
+{
+    mImpl->deferWrite(std::move(write));
+}
+
+void
+LedgerTxnRoot::Impl::deferWrite(DeferredWrite write)
+{
+    mDeferredWrites.emplace_back(std::move(write));
+}
+
+void
+LedgerTxnRoot::waitForDeferredWrites() const
+{
+    mImpl->waitForDeferredWrites();
+}
+
+void
+LedgerTxnRoot::Impl::waitForDeferredWrites() const
+{
+    // Deferred writes are flushed with the delta of the commit they were
+    // deferred to, if commits are asynchronous
+    waitForFlush(0);
+}
+
 std::unordered_map<LedgerKey, LedgerEntry>
 LedgerTxnRoot::getAllOffers()
 {
@@ -1693,10 +2329,12 @@ LedgerTxnRoot::getAllOffers()
 std::unordered_map<LedgerKey, LedgerEntry>
 LedgerTxnRoot::Impl::getAllOffers()
 {
+    throwIfApplyingBuckets();
     std::vector<LedgerEntry> offers;
     try
     {
-        offers = loadAllOffers();
+        offers = applyPendingOffers(loadAllOffers(),
+                                    [](OfferEntry const&) { return true; });
     }
     catch (std::exception& e)
     {
@@ -1718,71 +2356,93 @@ LedgerTxnRoot::Impl::getAllOffers()
     return offersByKey;
 }
 
-std::shared_ptr<LedgerEntry const>
-LedgerTxnRoot::getBestOffer(Asset const& buying, Asset const& selling,
-                            std::unordered_set<LedgerKey>& exclude)
+OfferBatch
+LedgerTxnRoot::getOffersBySellerRange(AccountID const* afterSeller,
+                                      size_t maxOffers)
 {
-    return mImpl->getBestOffer(buying, selling, exclude);
+    return mImpl->getOffersBySellerRange(afterSeller, maxOffers);
 }
 
-static std::shared_ptr<LedgerEntry const>
-findIncludedOffer(std::list<LedgerEntry>::const_iterator iter,
-                  std::list<LedgerEntry>::const_iterator const& end,
-                  std::unordered_set<LedgerKey> const& exclude)
+OfferBatch
+LedgerTxnRoot::Impl::getOffersBySellerRange(AccountID const* afterSeller,
+                                            size_t maxOffers)
 {
-    for (; iter != end; ++iter)
+    throwIfApplyingBuckets();
+    OfferBatch batch;
+    std::vector<LedgerEntry> offers;
+    try
     {
-        auto key = LedgerEntryKey(*iter);
-        if (exclude.find(key) == exclude.end())
-        {
-            return std::make_shared<LedgerEntry const>(*iter);
-        }
+        // The range is determined by the offers in the database. The pending
+        // deltas can only modify the offers within it.
+        offers = loadOffersBySellerRange(afterSeller, maxOffers,
+                                         batch.lastSeller);
+        offers = applyPendingOffers(
+            std::move(offers), [&](OfferEntry const& oe) {
+                return isSellerInRange(oe.sellerID, afterSeller,
+                                       batch.lastSeller);
+            });
+    }
+    catch (std::exception& e)
+    {
+        printErrorAndAbort(
+            "fatal error when getting offers from LedgerTxnRoot: ", e.what());
     }
-    return {};
+    catch (...)
+    {
+        printErrorAndAbort(
+            "unknown fatal error when getting offers from LedgerTxnRoot");
+    }
+
+    batch.offers.reserve(offers.size());
+    for (auto const& offer : offers)
+    {
+        batch.offers.emplace(LedgerEntryKey(offer), offer);
+    }
+    return batch;
+}
+
+std::shared_ptr<LedgerEntry const>
+LedgerTxnRoot::getBestOffer(Asset const& buying, Asset const& selling,
+                            std::unordered_set<LedgerKey>& exclude)
+{
+    return mImpl->getBestOffer(buying, selling, exclude);
 }
 
 std::shared_ptr<LedgerEntry const>
 LedgerTxnRoot::Impl::getBestOffer(Asset const& buying, Asset const& selling,
                                   std::unordered_set<LedgerKey>& exclude)
 {
-    // Note: Elements of mBestOffersCache are properly sorted lists of the best
-    // offers for a certain asset pair. This function maintaints the invariant
-    // that the lists of best offers remain properly sorted. The sort order is
-    // that determined by loadBestOffers and isBetterOffer (both induce the same
-    // order).
-    BestOffersCacheEntry emptyCacheEntry{{}, false};
-    auto& cached = getFromBestOffersCache(buying, selling, emptyCacheEntry);
-    auto& offers = cached.bestOffers;
-
-    auto res = findIncludedOffer(offers.cbegin(), offers.cend(), exclude);
-
-    size_t const BATCH_SIZE = 5;
-    while (!res && !cached.allLoaded)
+    throwIfApplyingBuckets();
+    std::shared_ptr<LedgerEntry const> res;
+    try
     {
-        std::list<LedgerEntry>::const_iterator newOfferIter;
-        try
-        {
-            newOfferIter = loadBestOffers(offers, buying, selling, BATCH_SIZE,
-                                          offers.size());
-        }
-        catch (std::exception& e)
-        {
-            printErrorAndAbort(
-                "fatal error when getting best offer from LedgerTxnRoot: ",
-                e.what());
-        }
-        catch (...)
-        {
-            printErrorAndAbort("unknown fatal error when getting best offer "
-                               "from LedgerTxnRoot");
-        }
-
-        if (std::distance(newOfferIter, offers.cend()) < BATCH_SIZE)
+        // Offers are visited in the order induced by isBetterOffer, so the
+        // first offer that is not excluded is the best offer. Excluded offers
+        // are those that have been modified in some child LedgerTxn.
+        for (auto const& kv : getOrderBook(buying, selling))
         {
-            cached.allLoaded = true;
+            if (exclude.find(LedgerEntryKey(*kv.second)) == exclude.end())
+            {
+                res = kv.second;
+                break;
+            }
         }
-        res = findIncludedOffer(newOfferIter, offers.cend(), exclude);
     }
+    catch (std::exception& e)
+    {
+        printErrorAndAbort(
+            "fatal error when getting best offer from LedgerTxnRoot: ",
+            e.what());
+    }
+    catch (...)
+    {
+        printErrorAndAbort("unknown fatal error when getting best offer "
+                           "from LedgerTxnRoot");
+    }
+
+    // Order books beyond the configured limit are only evicted once the query
+    // is complete, as getOrderBook returns a reference into mOrderBooks
+    evictOrderBooks();
 
     if (res)
     {
@@ -1802,10 +2462,16 @@ std::unordered_map<LedgerKey, LedgerEntry>
 LedgerTxnRoot::Impl::getOffersByAccountAndAsset(AccountID const& account,
                                                 Asset const& asset)
 {
+    throwIfApplyingBuckets();
     std::vector<LedgerEntry> offers;
     try
     {
-        offers = loadOffersByAccountAndAsset(account, asset);
+        offers = applyPendingOffers(
+            loadOffersByAccountAndAsset(account, asset),
+            [&](OfferEntry const& oe) {
+                return oe.sellerID == account &&
+                       (oe.selling == asset || oe.buying == asset);
+            });
     }
     catch (std::exception& e)
     {
@@ -1848,9 +2514,10 @@ LedgerTxnRoot::getInflationWinners(size_t maxWinners, int64_t minVotes)
 std::vector<InflationWinner>
 LedgerTxnRoot::Impl::getInflationWinners(size_t maxWinners, int64_t minVotes)
 {
+    throwIfApplyingBuckets();
     try
     {
-        return loadInflationWinners(maxWinners, minVotes);
+        return getInflationVotes().getWinners(maxWinners, minVotes);
     }
     catch (std::exception& e)
     {
@@ -1874,9 +2541,19 @@ LedgerTxnRoot::getNewestVersion(LedgerKey const& key) const
 std::shared_ptr<LedgerEntry const>
 LedgerTxnRoot::Impl::getNewestVersion(LedgerKey const& key) const
 {
-    if (mEntryCache.exists(key))
+    throwIfApplyingBuckets();
+    // Pending versions are only put in the entry cache when a cached entry is
+    // committed, so they are consulted first
+    std::shared_ptr<LedgerEntry const> pending;
+    if (getFromPendingDeltas(key, pending))
     {
-        return getFromEntryCache(key);
+        return pending;
+    }
+
+    std::shared_ptr<LedgerEntry const> entry;
+    if (getFromEntryCache(key, entry))
+    {
+        return entry;
     }
     else
     {
@@ -1884,7 +2561,6 @@ LedgerTxnRoot::Impl::getNewestVersion(LedgerKey const& key) const
         ++metrics.misses;
     }
 
-    std::shared_ptr<LedgerEntry const> entry;
     try
     {
         switch (key.type())
@@ -1946,27 +2622,35 @@ LedgerTxnRoot::Impl::rollbackChild()
             "unknown fatal error when rolling back child of LedgerTxnRoot");
     }
 
+    // std::vector<...>::clear does not throw
+    mDeferredWrites.clear();
     mChild = nullptr;
 }
 
-std::shared_ptr<LedgerEntry const>
-LedgerTxnRoot::Impl::getFromEntryCache(LedgerKey const& key) const
+bool
+LedgerTxnRoot::Impl::getFromEntryCache(
+    LedgerKey const& key, std::shared_ptr<LedgerEntry const>& entry) const
 {
     try
     {
-        auto cached = mEntryCache.get(key);
+        CacheEntry cached;
+        if (!mEntryCache.get(key, cached))
+        {
+            return false;
+        }
         if (cached.type == LoadType::PREFETCH)
         {
+            // Entries prefetched before the last commit no longer have
+            // metrics, as metrics are per ledger
             auto metric = mPrefetchMetrics.find(key);
-            if (metric == mPrefetchMetrics.end())
+            if (metric != mPrefetchMetrics.end())
             {
-                throw std::runtime_error(
-                    "Inconsistent state when retrieving entry from cache");
+                ++metric->second.hits;
+                ++mTotalPrefetchHits;
             }
-            ++metric->second.hits;
-            ++mTotalPrefetchHits;
         }
-        return cached.entry;
+        entry = cached.entry;
+        return true;
     }
     catch (...)
     {
@@ -1982,16 +2666,17 @@ LedgerTxnRoot::Impl::putInEntryCache(
 {
     try
     {
-        mEntryCache.put(key, {entry, type});
         if (type == LoadType::PREFETCH)
         {
-            if (mPrefetchMetrics.find(key) != mPrefetchMetrics.end())
-            {
-                throw std::runtime_error(
-                    "Inconsistent state when putting entry into cache");
-            }
+            // Prefetched entries are about to be used, so they bypass the
+            // admission filter
+            mEntryCache.admit(key, {entry, type});
             mPrefetchMetrics.emplace(key, KeyAccesses{});
         }
+        else
+        {
+            mEntryCache.put(key, {entry, type});
+        }
     }
     catch (...)
     {
@@ -2000,27 +2685,465 @@ LedgerTxnRoot::Impl::putInEntryCache(
     }
 }
 
-LedgerTxnRoot::Impl::BestOffersCacheEntry&
-LedgerTxnRoot::Impl::getFromBestOffersCache(
-    Asset const& buying, Asset const& selling,
-    BestOffersCacheEntry& defaultValue) const
+void
+LedgerTxnRoot::Impl::updateEntryCache(CommittedEntries const& committed)
 {
     try
     {
-        auto cacheKey = binToHex(xdr::xdr_to_opaque(buying)) +
-                        binToHex(xdr::xdr_to_opaque(selling));
-        if (!mBestOffersCache.exists(cacheKey))
+        for (auto const& kv : committed)
         {
-            mBestOffersCache.put(cacheKey, defaultValue);
+            mEntryCache.update(kv.first, {kv.second, LoadType::IMMEDIATE});
         }
-        return mBestOffersCache.exists(cacheKey)
-                   ? mBestOffersCache.get(cacheKey)
-                   : defaultValue;
     }
     catch (...)
     {
-        mBestOffersCache.clear();
+        mEntryCache.clear();
+    }
+}
+
+bool
+LedgerTxnRoot::Impl::AssetPair::operator==(AssetPair const& other) const
+{
+    return buying == other.buying && selling == other.selling;
+}
+
+size_t
+LedgerTxnRoot::Impl::AssetPairHash::operator()(AssetPair const& key) const
+{
+    std::hash<Asset> hashAsset;
+    size_t res = hashAsset(key.buying);
+    // Mix the two hashes asymmetrically so that (A, B) and (B, A), which are
+    // both commonly resident, do not collide
+    res ^= hashAsset(key.selling) + 0x9e3779b97f4a7c15ULL + (res << 6) +
+           (res >> 2);
+    return res;
+}
+
+// Note: The order induced by this function must match the order induced by
+// isBetterOffer.
+bool
+LedgerTxnRoot::Impl::OfferDescriptor::operator<(
+    OfferDescriptor const& other) const
+{
+    if (price < other.price)
+    {
+        return true;
+    }
+    else if (price == other.price)
+    {
+        return offerID < other.offerID;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+static double
+offerPrice(OfferEntry const& oe)
+{
+    return double(oe.price.n) / double(oe.price.d);
+}
+
+LedgerTxnRoot::Impl::OrderBook const&
+LedgerTxnRoot::Impl::getOrderBook(Asset const& buying,
+                                  Asset const& selling) const
+{
+    try
+    {
+        AssetPair assets{buying, selling};
+        auto iter = mOrderBooks.find(assets);
+        if (iter == mOrderBooks.end())
+        {
+            OrderBook book;
+            auto offers = applyPendingOffers(
+                loadOffersByAssetPair(buying, selling),
+                [&](OfferEntry const& oe) {
+                    return oe.buying == buying && oe.selling == selling;
+                });
+            for (auto& le : offers)
+            {
+                auto const& oe = le.data.offer();
+                OfferDescriptor desc{offerPrice(oe), oe.offerID};
+                book.emplace(desc, std::make_shared<LedgerEntry const>(le));
+            }
+
+            iter = mOrderBooks.emplace(assets, OrderBookEntry{{}, 0}).first;
+            iter->second.offers.swap(book);
+            for (auto const& kv : iter->second.offers)
+            {
+                mOrderBookIndex[kv.first.offerID] = {assets, kv.first};
+            }
+        }
+        iter->second.lastAccess = ++mOrderBookGeneration;
+        return iter->second.offers;
+    }
+    catch (...)
+    {
+        clearOrderBooks();
         throw;
     }
 }
+
+void
+LedgerTxnRoot::Impl::recordOfferChange(EntryIterator const& iter,
+                                       std::vector<OfferChange>& changes) const
+{
+    OfferChange change{iter.key().offer().offerID, nullptr};
+    if (iter.entryExists())
+    {
+        auto const& oe = iter.entry().data.offer();
+        if (mOrderBooks.find({oe.buying, oe.selling}) != mOrderBooks.end())
+        {
+            change.entry = std::make_shared<LedgerEntry const>(iter.entry());
+        }
+    }
+    changes.emplace_back(change);
+}
+
+void
+LedgerTxnRoot::Impl::updateOrderBooks(std::vector<OfferChange> const& changes)
+{
+    try
+    {
+        for (auto const& change : changes)
+        {
+            // Remove the previous version of the offer from whichever order
+            // book contains it. The assets of an offer can be modified, so the
+            // previous version is not necessarily in the same order book as
+            // the new version.
+            auto indexIter = mOrderBookIndex.find(change.offerID);
+            if (indexIter != mOrderBookIndex.end())
+            {
+                auto const& location = indexIter->second;
+                auto bookIter = mOrderBooks.find(location.assets);
+                if (bookIter != mOrderBooks.end())
+                {
+                    bookIter->second.offers.erase(location.desc);
+                }
+                mOrderBookIndex.erase(indexIter);
+            }
+
+            if (change.entry)
+            {
+                auto const& oe = change.entry->data.offer();
+                AssetPair assets{oe.buying, oe.selling};
+                auto bookIter = mOrderBooks.find(assets);
+                if (bookIter != mOrderBooks.end())
+                {
+                    OfferDescriptor desc{offerPrice(oe), oe.offerID};
+                    bookIter->second.offers[desc] = change.entry;
+                    mOrderBookIndex[oe.offerID] = {assets, desc};
+                }
+            }
+        }
+    }
+    catch (...)
+    {
+        clearOrderBooks();
+    }
+}
+
+InflationVoteTally const&
+LedgerTxnRoot::Impl::getInflationVotes() const
+{
+    if (!mInflationVotes)
+    {
+        auto tally = std::make_unique<InflationVoteTally>();
+        if (mAsyncCommit)
+        {
+            // The votes cannot be tallied from the pending deltas, so wait
+            // until they have been written and then query a session whose
+            // snapshot is guaranteed to include them.
+            waitForFlush(0);
+            soci::session session(mDatabase.getPool());
+            loadInflationVotes(*tally, session);
+        }
+        else
+        {
+            loadInflationVotes(*tally, mDatabase.getSession());
+        }
+        mInflationVotes = std::move(tally);
+    }
+    return *mInflationVotes;
+}
+
+void
+LedgerTxnRoot::Impl::recordInflationVoteChange(
+    EntryIterator const& iter, std::vector<InflationVoteChange>& changes) const
+{
+    if (!mInflationVotes)
+    {
+        return;
+    }
+
+    InflationVoteChange change{iter.key().account().accountID, {}, 0};
+    if (iter.entryExists())
+    {
+        auto const& ae = iter.entry().data.account();
+        change.inflationDest = ae.inflationDest;
+        change.balance = ae.balance;
+    }
+    changes.emplace_back(std::move(change));
+}
+
+void
+LedgerTxnRoot::Impl::updateInflationVotes(
+    std::vector<InflationVoteChange> const& changes)
+{
+    if (!mInflationVotes)
+    {
+        return;
+    }
+
+    try
+    {
+        for (auto const& change : changes)
+        {
+            mInflationVotes->updateAccount(
+                change.accountID, change.inflationDest, change.balance);
+        }
+    }
+    catch (...)
+    {
+        mInflationVotes.reset();
+    }
+}
+
+void
+LedgerTxnRoot::Impl::evictOrderBooks() const
+{
+    while (mOrderBooks.size() > mMaxOrderBooks)
+    {
+        auto victim = std::min_element(mOrderBooks.begin(), mOrderBooks.end(),
+                                       [](auto const& lhs, auto const& rhs) {
+                                           return lhs.second.lastAccess <
+                                                  rhs.second.lastAccess;
+                                       });
+        for (auto const& kv : victim->second.offers)
+        {
+            mOrderBookIndex.erase(kv.first.offerID);
+        }
+        mOrderBooks.erase(victim);
+    }
+}
+
+void
+LedgerTxnRoot::Impl::clearOrderBooks() const
+{
+    mOrderBooks.clear();
+    mOrderBookIndex.clear();
+}
+
+LedgerTxnRoot::Impl::PendingDeltaIteratorImpl::PendingDeltaIteratorImpl(
+    IteratorType const& begin, IteratorType const& end)
+    : mIter(begin), mEnd(end)
+{
+}
+
+void
+LedgerTxnRoot::Impl::PendingDeltaIteratorImpl::advance()
+{
+    ++mIter;
+}
+
+bool
+LedgerTxnRoot::Impl::PendingDeltaIteratorImpl::atEnd() const
+{
+    return mIter == mEnd;
+}
+
+LedgerEntry const&
+LedgerTxnRoot::Impl::PendingDeltaIteratorImpl::entry() const
+{
+    return *(mIter->second);
+}
+
+bool
+LedgerTxnRoot::Impl::PendingDeltaIteratorImpl::entryExists() const
+{
+    return (bool)(mIter->second);
+}
+
+LedgerKey const&
+LedgerTxnRoot::Impl::PendingDeltaIteratorImpl::key() const
+{
+    return mIter->first;
+}
+
+std::shared_ptr<LedgerEntry const>
+LedgerTxnRoot::Impl::PendingDeltaIteratorImpl::sharedEntry() const
+{
+    // The entries of a pending delta are never modified
+    return mIter->second;
+}
+
+bool
+LedgerTxnRoot::Impl::PendingDeltaIteratorImpl::entryInArena() const
+{
+    return false;
+}
+
+std::unique_ptr<EntryIterator::AbstractImpl>
+LedgerTxnRoot::Impl::PendingDeltaIteratorImpl::clone() const
+{
+    return std::make_unique<PendingDeltaIteratorImpl>(mIter, mEnd);
+}
+
+void
+LedgerTxnRoot::Impl::flushPendingDeltas()
+{
+    while (true)
+    {
+        std::shared_ptr<PendingDelta const> delta;
+        {
+            std::unique_lock<std::mutex> lock(mFlushMutex);
+            mFlushCondition.wait(lock, [this]() {
+                return mStopFlushing || !mFlushQueue.empty();
+            });
+            if (mFlushQueue.empty())
+            {
+                return;
+            }
+            delta = mFlushQueue.front();
+        }
+
+        try
+        {
+            soci::session session(mDatabase.getPool());
+            writePendingDelta(*delta, session);
+        }
+        catch (std::exception& e)
+        {
+            printErrorAndAbort(
+                "fatal error when flushing pending delta of LedgerTxnRoot: ",
+                e.what());
+        }
+        catch (...)
+        {
+            printErrorAndAbort("unknown fatal error when flushing pending "
+                               "delta of LedgerTxnRoot");
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mFlushMutex);
+            mFlushQueue.pop_front();
+            ++mFlushedDeltas;
+        }
+        mFlushCondition.notify_all();
+    }
+}
+
+void
+LedgerTxnRoot::Impl::writePendingDelta(PendingDelta const& delta,
+                                       soci::session& session)
+{
+    soci::transaction tx(session);
+    // Only the flush thread writes to the ledger entry tables, so there is
+    // nothing for serializable isolation to protect and it would only expose
+    // the transactions of the main thread to serialization failures.
+    session << "SET TRANSACTION ISOLATION LEVEL READ COMMITTED";
+
+    auto bleca = BulkLedgerEntryChangeAccumulator();
+    EntryIterator iter(std::make_unique<PendingDeltaIteratorImpl>(
+        delta.entries.cbegin(), delta.entries.cend()));
+    while ((bool)iter)
+    {
+        bleca.accumulate(iter);
+        ++iter;
+        size_t bufferThreshold =
+            (bool)iter ? LEDGER_ENTRY_BATCH_COMMIT_SIZE : 0;
+        bulkApply(bleca, bufferThreshold, delta.consistency, session);
+    }
+    for (auto const& write : delta.writes)
+    {
+        write(session);
+    }
+
+    PersistentState::setState(mDatabase, session,
+                              PersistentState::kLastFlushedLedger,
+                              std::to_string(delta.ledgerSeq));
+    tx.commit();
+}
+
+void
+LedgerTxnRoot::Impl::waitForFlush(size_t maxUnflushed) const
+{
+    std::unique_lock<std::mutex> lock(mFlushMutex);
+    mFlushCondition.wait(
+        lock, [&]() { return mFlushQueue.size() <= maxUnflushed; });
+}
+
+void
+LedgerTxnRoot::Impl::retireFlushedDeltas() const
+{
+    uint64_t flushed;
+    {
+        std::lock_guard<std::mutex> lock(mFlushMutex);
+        flushed = mFlushedDeltas;
+    }
+    for (; mRetiredDeltas < flushed; ++mRetiredDeltas)
+    {
+        mPendingDeltas.pop_front();
+    }
+}
+
+bool
+LedgerTxnRoot::Impl::getFromPendingDeltas(
+    LedgerKey const& key, std::shared_ptr<LedgerEntry const>& entry) const
+{
+    for (auto iter = mPendingDeltas.rbegin(); iter != mPendingDeltas.rend();
+         ++iter)
+    {
+        auto found = (*iter)->entries.find(key);
+        if (found != (*iter)->entries.end())
+        {
+            entry = found->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<LedgerEntry>
+LedgerTxnRoot::Impl::applyPendingOffers(
+    std::vector<LedgerEntry>&& offers,
+    std::function<bool(OfferEntry const&)> const& filter) const
+{
+    if (mPendingDeltas.empty())
+    {
+        return std::move(offers);
+    }
+
+    std::unordered_map<int64_t, LedgerEntry> offersByID;
+    for (auto& le : offers)
+    {
+        auto offerID = le.data.offer().offerID;
+        offersByID.emplace(offerID, std::move(le));
+    }
+
+    for (auto const& delta : mPendingDeltas)
+    {
+        for (auto const& kv : delta->entries)
+        {
+            if (kv.first.type() != OFFER)
+            {
+                continue;
+            }
+            offersByID.erase(kv.first.offer().offerID);
+            if (kv.second && filter(kv.second->data.offer()))
+            {
+                offersByID.emplace(kv.first.offer().offerID, *kv.second);
+            }
+        }
+    }
+
+    std::vector<LedgerEntry> res;
+    res.reserve(offersByID.size());
+    for (auto& kv : offersByID)
+    {
+        res.emplace_back(std::move(kv.second));
+    }
+    return res;
+}
 }
@@ -102,6 +102,12 @@
 //    where the parent is the LedgerTxnRoot, this means opening a Real SQL
 //    Transaction against the database and writing the entries to it.
 //
+//  - If the LedgerTxnRoot is in asynchronous commit mode, the entries are
+//    instead frozen into an immutable delta that is written to the database
+//    by a dedicated thread. The LedgerTxnRoot serves reads from the delta
+//    until it has been written, so the write is not observable other than
+//    through the lastflushedledger marker in the storestate table.
+//
 //  - Each entry may also be designated as _active_ in a given LedgerTxn;
 //    tracking active-ness is the purpose of the other (mActive) map in
 //    the diagram above. Active-ness is a logical state that simply means
@@ -124,6 +130,14 @@
 //    recurses until it hits an entry or terminates at the root, where an
 //    LRU cache is consulted and then (finally!) the database itself.
 //
+//  - load()ing an entry does not copy it: the LedgerTxn records the
+//    newest version of the entry, an immutable snapshot shared with the
+//    parent. The entry is only copied into the LedgerTxn the first time it
+//    is modified through LedgerTxnEntry::current(), so entries that are
+//    only read (through loadWithoutRecord or a const LedgerTxnEntry) are
+//    never copied, and committing a child shares its unmodified entries
+//    with the parent.
+//
 //  - The LedgerTxnEntry handles that clients should use are
 //    double-indirect references.
 //
@@ -163,6 +177,11 @@
 //    accesses to a parent's entries when a child is open.
 //
 
+namespace soci
+{
+class session;
+}
+
 namespace stellar
 {
 
@@ -218,12 +237,25 @@ bool isBetterOffer(LedgerEntry const& lhsEntry, LedgerEntry const& rhsEntry);
 
 class AbstractLedgerTxn;
 
+// A database write, such as the transaction history of a ledger, that is
+// deferred until the entries it goes with are committed (see deferWrite).
+typedef std::function<void(soci::session&)> DeferredWrite;
+
 struct InflationWinner
 {
     AccountID accountID;
     int64_t votes;
 };
 
+// OfferBatch holds every offer of a range of consecutive sellers, in the order
+// of AccountID. The range ends with lastSeller, or extends past the last seller
+// if lastSeller is not set.
+struct OfferBatch
+{
+    std::unordered_map<LedgerKey, LedgerEntry> offers;
+    xdr::pointer<AccountID> lastSeller;
+};
+
 // LedgerTxnDelta represents the difference between a LedgerTxn and its
 // parent. Used in the Invariants subsystem.
 struct LedgerTxnDelta
@@ -274,6 +306,15 @@ class EntryIterator
     bool entryExists() const;
 
     LedgerKey const& key() const;
+
+    // sharedEntry returns the entry. It is not modified once the LedgerTxn
+    // being iterated is committed, so the parent can keep it rather than copy
+    // it.
+    std::shared_ptr<LedgerEntry const> sharedEntry() const;
+
+    // entryInArena returns true if the entry was allocated from the Arena of
+    // a LedgerTxn, which it keeps alive.
+    bool entryInArena() const;
 };
 
 // An abstraction for an object that can be the parent of an AbstractLedgerTxn
@@ -301,16 +342,25 @@ class AbstractLedgerTxnParent
     virtual void commitChild(EntryIterator iter, LedgerTxnConsistency cons) = 0;
     virtual void rollbackChild() = 0;
 
-    // getAllOffers, getBestOffer, and getOffersByAccountAndAsset are used to
-    // handle some specific queries related to Offers.
+    // getAllOffers, getOffersBySellerRange, getBestOffer, and
+    // getOffersByAccountAndAsset are used to handle some specific queries
+    // related to Offers.
     // - getAllOffers
     //     Get XDR for every offer, grouped by account.
+    // - getOffersBySellerRange
+    //     Get XDR for every offer of the sellers that follow afterSeller (or of
+    //     every seller if afterSeller is nullptr), up to a seller chosen such
+    //     that the batch holds about maxOffers offers. The offers of a seller
+    //     are never split across batches, so iterating from the lastSeller of
+    //     each batch until it is not set visits every offer exactly once.
     // - getBestOffer
     //     Get XDR for the best offer with specified buying and selling assets.
     // - getOffersByAccountAndAsset
     //     Get XDR for every offer owned by the specified account that is either
     //     buying or selling the specified asset.
     virtual std::unordered_map<LedgerKey, LedgerEntry> getAllOffers() = 0;
+    virtual OfferBatch getOffersBySellerRange(AccountID const* afterSeller,
+                                              size_t maxOffers) = 0;
     virtual std::shared_ptr<LedgerEntry const>
     getBestOffer(Asset const& buying, Asset const& selling,
                  std::unordered_set<LedgerKey>& exclude) = 0;
@@ -335,6 +385,52 @@ class AbstractLedgerTxnParent
     // or if the corresponding LedgerEntry has been erased.
     virtual std::shared_ptr<LedgerEntry const>
     getNewestVersion(LedgerKey const& key) const = 0;
+
+    // The following functions are only meaningful for the root of a tree of
+    // AbstractLedgerTxn, that is the object that holds the committed ledger
+    // state. They throw if they are invoked on an AbstractLedgerTxn.
+    // - countObjects
+    //     Count the number of entries of the given type, optionally restricted
+    //     to those last modified in the given range of ledgers.
+    // - deleteObjectsModifiedOnOrAfterLedger
+    //     Erase every entry last modified on or after the given ledger.
+    // - dropAccounts, dropData, dropOffers, dropTrustLines
+    //     Erase every entry of the given type and reset the underlying storage.
+    // - prefetch, getPrefetchHitRate
+    //     Load the given keys ahead of use, and report the fraction of
+    //     prefetched keys that were later used.
+    // - getEntryCacheHitRate
+    //     Report the fraction of the lookups of entries of the given type
+    //     that hit the entry cache.
+    // - deferWrite
+    //     Run write when the child is next committed, in the database
+    //     transaction that commits its entries, or discard it if the child
+    //     is rolled back. With asynchronous commit, write runs later on the
+    //     thread that flushes the entries, so it must own everything it uses.
+    // - waitForDeferredWrites
+    //     Block until every deferred write of a committed child has been
+    //     written to the database.
+    virtual uint64_t countObjects(LedgerEntryType let) const = 0;
+    virtual uint64_t countObjects(LedgerEntryType let,
+                                  LedgerRange const& ledgers) const = 0;
+
+    virtual void deleteObjectsModifiedOnOrAfterLedger(uint32_t ledger) const = 0;
+
+    virtual void dropAccounts() = 0;
+    virtual void dropData() = 0;
+    virtual void dropOffers() = 0;
+    virtual void dropTrustLines() = 0;
+
+#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+    virtual void resetForFuzzer() = 0;
+#endif // FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+
+    virtual uint32_t prefetch(std::unordered_set<LedgerKey> const& keys) = 0;
+    virtual double getPrefetchHitRate() const = 0;
+    virtual double getEntryCacheHitRate(LedgerEntryType let) const = 0;
+
+    virtual void deferWrite(DeferredWrite write) = 0;
+    virtual void waitForDeferredWrites() const = 0;
 };
 
 // An abstraction for an object that is an AbstractLedgerTxnParent and has
@@ -348,6 +444,12 @@ class AbstractLedgerTxn : public AbstractLedgerTxnParent
     friend class ConstLedgerTxnEntry::Impl;
     virtual void deactivate(LedgerKey const& key) = 0;
 
+    // makeMutable is used by a LedgerTxnEntry the first time the entry
+    // associated with the given key is modified, to replace the snapshot
+    // shared with the parent by a copy owned by this AbstractLedgerTxn.
+    // Returns the copy, which is created only once.
+    virtual LedgerEntry& makeMutable(LedgerKey const& key) = 0;
+
     // deactivateHeader is used to deactivate the LedgerTxnHeader.
     friend class LedgerTxnHeader::Impl;
     virtual void deactivateHeader() = 0;
@@ -435,11 +537,16 @@ class AbstractLedgerTxn : public AbstractLedgerTxnParent
                                std::vector<LedgerEntry>& liveEntries,
                                std::vector<LedgerKey>& deadEntries) = 0;
 
-    // loadAllOffers, loadBestOffer, and loadOffersByAccountAndAsset are used to
-    // handle some specific queries related to Offers. These functions are built
-    // on top of load, and so share many properties with that function.
+    // loadAllOffers, loadOffersBySellerRange, loadBestOffer, and
+    // loadOffersByAccountAndAsset are used to handle some specific queries
+    // related to Offers. These functions are built on top of load, and so
+    // share many properties with that function.
     // - loadAllOffers
     //     Load every offer, grouped by account.
+    // - loadOffersBySellerRange
+    //     Load the offers returned by getOffersBySellerRange, grouped by
+    //     account, and set lastSeller to the end of the range. Loading the
+    //     order book one batch at a time bounds the number of active entries.
     // - loadBestOffer
     //     Load the best offer with specified buying and selling assets.
     // - loadOffersByAccountAndAsset
@@ -450,6 +557,9 @@ class AbstractLedgerTxn : public AbstractLedgerTxnParent
     // LedgerKey they try to load is already active.
     virtual std::map<AccountID, std::vector<LedgerTxnEntry>>
     loadAllOffers() = 0;
+    virtual std::map<AccountID, std::vector<LedgerTxnEntry>>
+    loadOffersBySellerRange(AccountID const* afterSeller, size_t maxOffers,
+                            xdr::pointer<AccountID>& lastSeller) = 0;
     virtual LedgerTxnEntry loadBestOffer(Asset const& buying,
                                          Asset const& selling) = 0;
     virtual std::vector<LedgerTxnEntry>
@@ -476,6 +586,8 @@ class LedgerTxn final : public AbstractLedgerTxn
 
     void deactivate(LedgerKey const& key) override;
 
+    LedgerEntry& makeMutable(LedgerKey const& key) override;
+
     void deactivateHeader() override;
 
     std::unique_ptr<Impl> const& getImpl() const;
@@ -493,12 +605,26 @@ class LedgerTxn final : public AbstractLedgerTxn
 
     void commitChild(EntryIterator iter, LedgerTxnConsistency cons) override;
 
+    uint64_t countObjects(LedgerEntryType let) const override;
+    uint64_t countObjects(LedgerEntryType let,
+                          LedgerRange const& ledgers) const override;
+
     LedgerTxnEntry create(LedgerEntry const& entry) override;
 
+    void deleteObjectsModifiedOnOrAfterLedger(uint32_t ledger) const override;
+
+    void dropAccounts() override;
+    void dropData() override;
+    void dropOffers() override;
+    void dropTrustLines() override;
+
     void erase(LedgerKey const& key) override;
 
     std::unordered_map<LedgerKey, LedgerEntry> getAllOffers() override;
 
+    OfferBatch getOffersBySellerRange(AccountID const* afterSeller,
+                                      size_t maxOffers) override;
+
     std::shared_ptr<LedgerEntry const>
     getBestOffer(Asset const& buying, Asset const& selling,
                  std::unordered_set<LedgerKey>& exclude) override;
@@ -533,6 +659,10 @@ class LedgerTxn final : public AbstractLedgerTxn
 
     std::map<AccountID, std::vector<LedgerTxnEntry>> loadAllOffers() override;
 
+    std::map<AccountID, std::vector<LedgerTxnEntry>>
+    loadOffersBySellerRange(AccountID const* afterSeller, size_t maxOffers,
+                            xdr::pointer<AccountID>& lastSeller) override;
+
     LedgerTxnEntry loadBestOffer(Asset const& buying,
                                  Asset const& selling) override;
 
@@ -549,6 +679,17 @@ class LedgerTxn final : public AbstractLedgerTxn
     void rollbackChild() override;
 
     void unsealHeader(std::function<void(LedgerHeader&)> f) override;
+
+#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+    void resetForFuzzer() override;
+#endif // FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+
+    uint32_t prefetch(std::unordered_set<LedgerKey> const& keys) override;
+    double getPrefetchHitRate() const override;
+    double getEntryCacheHitRate(LedgerEntryType let) const override;
+
+    void deferWrite(DeferredWrite write) override;
+    void waitForDeferredWrites() const override;
 };
 
 class LedgerTxnRoot : public AbstractLedgerTxnParent
@@ -558,31 +699,67 @@ class LedgerTxnRoot : public AbstractLedgerTxnParent
 
   public:
     explicit LedgerTxnRoot(Database& db, size_t entryCacheSize,
-                           size_t bestOfferCacheSize, size_t prefetchBatchSize);
+                           size_t bestOfferCacheSize, size_t prefetchBatchSize,
+                           bool asyncCommit);
 
     virtual ~LedgerTxnRoot();
 
+    // upgradeToBinaryKeys converts the accounts, trustlines, offers and
+    // accountdata tables of a database older than schema version 11, which
+    // stored keys as StrKeys and XDR values as base64, to binary keys and
+    // XDR columns. It is run by Database::applySchemaUpgrade.
+    static void upgradeToBinaryKeys(Database& db);
+
     void addChild(AbstractLedgerTxn& child) override;
 
     void commitChild(EntryIterator iter, LedgerTxnConsistency cons) override;
 
-    uint64_t countObjects(LedgerEntryType let) const;
+    uint64_t countObjects(LedgerEntryType let) const override;
     uint64_t countObjects(LedgerEntryType let,
-                          LedgerRange const& ledgers) const;
-
-    void deleteObjectsModifiedOnOrAfterLedger(uint32_t ledger) const;
-
-    void dropAccounts();
-    void dropData();
-    void dropOffers();
-    void dropTrustLines();
+                          LedgerRange const& ledgers) const override;
+
+    void deleteObjectsModifiedOnOrAfterLedger(uint32_t ledger) const override;
+
+    // isAsyncCommit returns whether ledger entries are written by the flush
+    // thread after the commit (see ASYNC_LEDGER_COMMIT)
+    bool isAsyncCommit() const;
+
+    // beginBucketApply and endBucketApply surround the calls to
+    // writeBucketEntries, and are called on the main thread. Both clear the
+    // caches, which writeBucketEntries bypasses, and in between every read
+    // through this LedgerTxnRoot, including adding a child, throws, as it
+    // would see and cache entries that are only partly applied.
+    void beginBucketApply();
+    void endBucketApply();
+
+    // isApplyingBuckets returns whether this LedgerTxnRoot is between
+    // beginBucketApply and endBucketApply
+    bool isApplyingBuckets() const;
+
+    // writeBucketEntries writes entries, which are the newest entries of
+    // distinct keys in the buckets being applied, to the database through
+    // session, in a transaction of their own. It bypasses the caches and the
+    // child of this LedgerTxnRoot, so that buckets can be applied by several
+    // threads, each on a session of its own. It must only be called between
+    // beginBucketApply and endBucketApply, after
+    // deleteObjectsModifiedOnOrAfterLedger.
+    void writeBucketEntries(std::vector<BucketEntry> const& entries,
+                            soci::session& session);
+
+    void dropAccounts() override;
+    void dropData() override;
+    void dropOffers() override;
+    void dropTrustLines() override;
 
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
-    void resetForFuzzer();
+    void resetForFuzzer() override;
 #endif // FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 
     std::unordered_map<LedgerKey, LedgerEntry> getAllOffers() override;
 
+    OfferBatch getOffersBySellerRange(AccountID const* afterSeller,
+                                      size_t maxOffers) override;
+
     std::shared_ptr<LedgerEntry const>
     getBestOffer(Asset const& buying, Asset const& selling,
                  std::unordered_set<LedgerKey>& exclude) override;
@@ -601,7 +778,11 @@ class LedgerTxnRoot : public AbstractLedgerTxnParent
 
     void rollbackChild() override;
 
-    uint32_t prefetch(std::unordered_set<LedgerKey> const& keys);
-    double getPrefetchHitRate() const;
+    uint32_t prefetch(std::unordered_set<LedgerKey> const& keys) override;
+    double getPrefetchHitRate() const override;
+    double getEntryCacheHitRate(LedgerEntryType let) const override;
+
+    void deferWrite(DeferredWrite write) override;
+    void waitForDeferredWrites() const override;
 };
 }
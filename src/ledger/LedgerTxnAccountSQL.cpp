@@ -2,11 +2,11 @@
 // under the Apache License, Version 2.0. See the COPYING file at the root
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
-#include "crypto/KeyUtils.h"
 #include "crypto/SecretKey.h"
 #include "crypto/SignerKey.h"
 #include "database/Database.h"
 #include "database/DatabaseTypeSpecificOperation.h"
+#include "database/PostgresBinaryCopy.h"
 #include "ledger/LedgerTxnImpl.h"
 #include "util/Decoder.h"
 #include "util/Logging.h"
@@ -20,7 +20,7 @@ namespace stellar
 std::shared_ptr<LedgerEntry const>
 LedgerTxnRoot::Impl::loadAccount(LedgerKey const& key) const
 {
-    std::string actIDStrKey = KeyUtils::toStrKey(key.account().accountID);
+    std::string accountID = toBinaryColumn(key.account().accountID);
 
     std::string inflationDest, homeDomain, thresholds, signers;
     soci::indicator inflationDestInd, signersInd;
@@ -31,13 +31,12 @@ LedgerTxnRoot::Impl::loadAccount(LedgerKey const& key) const
     le.data.type(ACCOUNT);
     auto& account = le.data.account();
 
-    auto prep =
-        mDatabase.getPreparedStatement("SELECT balance, seqnum, numsubentries, "
-                                       "inflationdest, homedomain, thresholds, "
-                                       "flags, lastmodified, "
-                                       "buyingliabilities, sellingliabilities, "
-                                       "signers "
-                                       "FROM accounts WHERE accountid=:v1");
+    auto prep = mDatabase.getPreparedStatement(
+        "SELECT balance, seqnum, numsubentries, "
+        "encode(inflationdest, 'hex'), homedomain, encode(thresholds, 'hex'), "
+        "flags, lastmodified, buyingliabilities, sellingliabilities, "
+        "encode(signers, 'hex') "
+        "FROM accounts WHERE accountid = decode(:v1, 'hex')");
     auto& st = prep.statement();
     st.exchange(soci::into(account.balance));
     st.exchange(soci::into(account.seqNum));
@@ -50,7 +49,7 @@ LedgerTxnRoot::Impl::loadAccount(LedgerKey const& key) const
     st.exchange(soci::into(liabilities.buying, buyingLiabilitiesInd));
     st.exchange(soci::into(liabilities.selling, sellingLiabilitiesInd));
     st.exchange(soci::into(signers, signersInd));
-    st.exchange(soci::use(actIDStrKey));
+    st.exchange(soci::use(accountID));
     st.define_and_bind();
     {
         auto timer = mDatabase.getSelectTimer("account");
@@ -63,21 +62,17 @@ LedgerTxnRoot::Impl::loadAccount(LedgerKey const& key) const
 
     account.accountID = key.account().accountID;
     decoder::decode_b64(homeDomain, account.homeDomain);
-
-    bn::decode_b64(thresholds.begin(), thresholds.end(),
-                   account.thresholds.begin());
+    xdrFromBinaryColumn(thresholds, account.thresholds);
 
     if (inflationDestInd == soci::i_ok)
     {
         account.inflationDest.activate() =
-            KeyUtils::fromStrKey<PublicKey>(inflationDest);
+            publicKeyFromBinaryColumn(inflationDest);
     }
 
     if (signersInd == soci::i_ok)
     {
-        std::vector<uint8_t> signersOpaque;
-        decoder::decode_b64(signers, signersOpaque);
-        xdr::xdr_from_opaque(signersOpaque, account.signers);
+        xdrFromBinaryColumn(signers, account.signers);
         assert(std::adjacent_find(account.signers.begin(),
                                   account.signers.end(),
                                   [](Signer const& lhs, Signer const& rhs) {
@@ -95,42 +90,39 @@ LedgerTxnRoot::Impl::loadAccount(LedgerKey const& key) const
     return std::make_shared<LedgerEntry const>(std::move(le));
 }
 
-std::vector<InflationWinner>
-LedgerTxnRoot::Impl::loadInflationWinners(size_t maxWinners,
-                                          int64_t minBalance) const
+void
+LedgerTxnRoot::Impl::loadInflationVotes(InflationVoteTally& tally,
+                                        soci::session& session) const
 {
-    InflationWinner w;
-    std::string inflationDest;
+    std::string accountID, inflationDest;
+    int64_t balance;
 
     auto prep = mDatabase.getPreparedStatement(
-        "SELECT sum(balance) AS votes, inflationdest"
-        " FROM accounts WHERE inflationdest IS NOT NULL"
-        " AND balance >= 1000000000 GROUP BY inflationdest"
-        " ORDER BY votes DESC, inflationdest DESC LIMIT :lim");
+        "SELECT encode(accountid, 'hex'), encode(inflationdest, 'hex'),"
+        " balance FROM accounts WHERE inflationdest IS NOT NULL"
+        " AND balance >= 1000000000",
+        session);
     auto& st = prep.statement();
-    st.exchange(soci::into(w.votes));
+    st.exchange(soci::into(accountID));
     st.exchange(soci::into(inflationDest));
-    st.exchange(soci::use(maxWinners));
+    st.exchange(soci::into(balance));
     st.define_and_bind();
     st.execute(true);
 
-    std::vector<InflationWinner> winners;
+    xdr::pointer<AccountID> dest;
     while (st.got_data())
     {
-        w.accountID = KeyUtils::fromStrKey<PublicKey>(inflationDest);
-        if (w.votes < minBalance)
-        {
-            break;
-        }
-        winners.push_back(w);
+        dest.activate() = publicKeyFromBinaryColumn(inflationDest);
+        tally.updateAccount(publicKeyFromBinaryColumn(accountID), dest,
+                            balance);
         st.fetch();
     }
-    return winners;
 }
 
 class BulkUpsertAccountsOperation : public DatabaseTypeSpecificOperation<void>
 {
     Database& mDB;
+    soci::session& mSession;
     std::vector<std::string> mAccountIDs;
     std::vector<int64_t> mBalances;
     std::vector<int64_t> mSeqNums;
@@ -148,9 +140,9 @@ class BulkUpsertAccountsOperation : public DatabaseTypeSpecificOperation<void>
     std::vector<soci::indicator> mLiabilitiesInds;
 
   public:
-    BulkUpsertAccountsOperation(Database& DB,
+    BulkUpsertAccountsOperation(Database& DB, soci::session& session,
                                 std::vector<EntryIterator> const& entries)
-        : mDB(DB)
+        : mDB(DB), mSession(session)
     {
         mAccountIDs.reserve(entries.size());
         mBalances.reserve(entries.size());
@@ -173,7 +165,7 @@ class BulkUpsertAccountsOperation : public DatabaseTypeSpecificOperation<void>
             assert(e.entryExists());
             assert(e.entry().data.type() == ACCOUNT);
             auto const& account = e.entry().data.account();
-            mAccountIDs.emplace_back(KeyUtils::toStrKey(account.accountID));
+            mAccountIDs.emplace_back(toBinaryColumn(account.accountID));
             mBalances.emplace_back(account.balance);
             mSeqNums.emplace_back(account.seqNum);
             mSubEntryNums.emplace_back(unsignedToSigned(account.numSubEntries));
@@ -181,7 +173,7 @@ class BulkUpsertAccountsOperation : public DatabaseTypeSpecificOperation<void>
             if (account.inflationDest)
             {
                 mInflationDests.emplace_back(
-                    KeyUtils::toStrKey(*account.inflationDest));
+                    toBinaryColumn(*account.inflationDest));
                 mInflationDestInds.emplace_back(soci::i_ok);
             }
             else
@@ -191,7 +183,7 @@ class BulkUpsertAccountsOperation : public DatabaseTypeSpecificOperation<void>
             }
             mFlags.emplace_back(unsignedToSigned(account.flags));
             mHomeDomains.emplace_back(decoder::encode_b64(account.homeDomain));
-            mThresholds.emplace_back(decoder::encode_b64(account.thresholds));
+            mThresholds.emplace_back(xdrToBinaryColumn(account.thresholds));
             if (account.signers.empty())
             {
                 mSigners.emplace_back("");
@@ -199,8 +191,7 @@ class BulkUpsertAccountsOperation : public DatabaseTypeSpecificOperation<void>
             }
             else
             {
-                mSigners.emplace_back(
-                    decoder::encode_b64(xdr::xdr_to_opaque(account.signers)));
+                mSigners.emplace_back(xdrToBinaryColumn(account.signers));
                 mSignerInds.emplace_back(soci::i_ok);
             }
             mLastModifieds.emplace_back(
@@ -232,7 +223,8 @@ class BulkUpsertAccountsOperation : public DatabaseTypeSpecificOperation<void>
             "homedomain, thresholds, signers, flags, lastmodified, "
             "buyingliabilities, sellingliabilities "
             ") VALUES ( "
-            ":id, :v1, :v2, :v3, :v4, :v5, :v6, :v7, :v8, :v9, :v10, :v11 "
+            "decode(:id, 'hex'), :v1, :v2, :v3, decode(:v4, 'hex'), :v5, "
+            "decode(:v6, 'hex'), decode(:v7, 'hex'), :v8, :v9, :v10, :v11 "
             ") ON CONFLICT (accountid) DO UPDATE SET "
             "balance = excluded.balance, "
             "seqnum = excluded.seqnum, "
@@ -245,7 +237,7 @@ class BulkUpsertAccountsOperation : public DatabaseTypeSpecificOperation<void>
             "lastmodified = excluded.lastmodified, "
             "buyingliabilities = excluded.buyingliabilities, "
             "sellingliabilities = excluded.sellingliabilities";
-        auto prep = mDB.getPreparedStatement(sql);
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(mAccountIDs));
         st.exchange(soci::use(mBalances));
@@ -277,9 +269,75 @@ class BulkUpsertAccountsOperation : public DatabaseTypeSpecificOperation<void>
     }
 
 #ifdef USE_POSTGRES
+    void
+    doPostgresCopyOperation(soci::postgresql_session_backend* pg)
+    {
+        std::string columns =
+            "accountid, balance, seqnum, numsubentries, inflationdest, "
+            "homedomain, thresholds, signers, flags, lastmodified, "
+            "buyingliabilities, sellingliabilities";
+
+        PostgresBinaryCopy copy(12);
+        for (size_t i = 0; i < mAccountIDs.size(); ++i)
+        {
+            copy.startRow();
+            copy.appendHex(mAccountIDs[i]);
+            copy.append(mBalances[i]);
+            copy.append(mSeqNums[i]);
+            copy.append(mSubEntryNums[i]);
+            copy.appendHex(mInflationDests[i], mInflationDestInds[i]);
+            copy.append(mHomeDomains[i]);
+            copy.appendHex(mThresholds[i]);
+            copy.appendHex(mSigners[i], mSignerInds[i]);
+            copy.append(mFlags[i]);
+            copy.append(mLastModifieds[i]);
+            copy.append(mBuyingLiabilities[i], mLiabilitiesInds[i]);
+            copy.append(mSellingLiabilities[i], mLiabilitiesInds[i]);
+        }
+
+        std::string sql = "INSERT INTO accounts ( " + columns +
+                          " ) SELECT " + columns +
+                          " FROM tmpaccounts "
+                          "ON CONFLICT (accountid) DO UPDATE SET "
+                          "balance = excluded.balance, "
+                          "seqnum = excluded.seqnum, "
+                          "numsubentries = excluded.numsubentries, "
+                          "inflationdest = excluded.inflationdest, "
+                          "homedomain = excluded.homedomain, "
+                          "thresholds = excluded.thresholds, "
+                          "signers = excluded.signers, "
+                          "flags = excluded.flags, "
+                          "lastmodified = excluded.lastmodified, "
+                          "buyingliabilities = excluded.buyingliabilities, "
+                          "sellingliabilities = excluded.sellingliabilities";
+        // The statement is prepared as soon as it is created, so the
+        // temporary table it reads from has to exist by then
+        mSession << "CREATE TEMP TABLE IF NOT EXISTS tmpaccounts "
+                    "(LIKE accounts)";
+        auto prep = mDB.getPreparedStatement(sql, mSession);
+        soci::statement& st = prep.statement();
+        st.define_and_bind();
+        {
+            auto timer = mDB.getUpsertTimer("account");
+            mSession << "TRUNCATE tmpaccounts";
+            copy.copyInto(pg->conn_, "tmpaccounts", columns);
+            st.execute(true);
+        }
+        if (static_cast<size_t>(st.get_affected_rows()) != mAccountIDs.size())
+        {
+            throw std::runtime_error("Could not update data in SQL");
+        }
+    }
+
     void
     doPostgresSpecificOperation(soci::postgresql_session_backend* pg) override
     {
+        if (mAccountIDs.size() >= mDB.getBulkUpsertCopyThreshold())
+        {
+            doPostgresCopyOperation(pg);
+            return;
+        }
+
         std::string strAccountIDs, strBalances, strSeqNums, strSubEntryNums,
             strInflationDests, strFlags, strHomeDomains, strThresholds,
             strSigners, strLastModifieds, strBuyingLiabilities,
@@ -304,14 +362,14 @@ class BulkUpsertAccountsOperation : public DatabaseTypeSpecificOperation<void>
 
         std::string sql =
             "WITH r AS (SELECT "
-            "unnest(:ids::TEXT[]), "
+            "decode(unnest(:ids::TEXT[]), 'hex'), "
             "unnest(:v1::BIGINT[]), "
             "unnest(:v2::BIGINT[]), "
             "unnest(:v3::INT[]), "
-            "unnest(:v4::TEXT[]), "
+            "decode(unnest(:v4::TEXT[]), 'hex'), "
             "unnest(:v5::TEXT[]), "
-            "unnest(:v6::TEXT[]), "
-            "unnest(:v7::TEXT[]), "
+            "decode(unnest(:v6::TEXT[]), 'hex'), "
+            "decode(unnest(:v7::TEXT[]), 'hex'), "
             "unnest(:v8::INT[]), "
             "unnest(:v9::INT[]), "
             "unnest(:v10::BIGINT[]), "
@@ -334,7 +392,7 @@ class BulkUpsertAccountsOperation : public DatabaseTypeSpecificOperation<void>
             "lastmodified = excluded.lastmodified, "
             "buyingliabilities = excluded.buyingliabilities, "
             "sellingliabilities = excluded.sellingliabilities";
-        auto prep = mDB.getPreparedStatement(sql);
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(strAccountIDs));
         st.exchange(soci::use(strBalances));
@@ -364,28 +422,31 @@ class BulkUpsertAccountsOperation : public DatabaseTypeSpecificOperation<void>
 class BulkDeleteAccountsOperation : public DatabaseTypeSpecificOperation<void>
 {
     Database& mDB;
+    soci::session& mSession;
     LedgerTxnConsistency mCons;
     std::vector<std::string> mAccountIDs;
 
   public:
-    BulkDeleteAccountsOperation(Database& DB, LedgerTxnConsistency cons,
+    BulkDeleteAccountsOperation(Database& DB, soci::session& session,
+                                LedgerTxnConsistency cons,
                                 std::vector<EntryIterator> const& entries)
-        : mDB(DB), mCons(cons)
+        : mDB(DB), mSession(session), mCons(cons)
     {
         for (auto const& e : entries)
         {
             assert(!e.entryExists());
             assert(e.key().type() == ACCOUNT);
             auto const& account = e.key().account();
-            mAccountIDs.emplace_back(KeyUtils::toStrKey(account.accountID));
+            mAccountIDs.emplace_back(toBinaryColumn(account.accountID));
         }
     }
 
     void
     doSociGenericOperation()
     {
-        std::string sql = "DELETE FROM accounts WHERE accountid = :id";
-        auto prep = mDB.getPreparedStatement(sql);
+        std::string sql =
+            "DELETE FROM accounts WHERE accountid = decode(:id, 'hex')";
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(mAccountIDs));
         st.define_and_bind();
@@ -414,9 +475,9 @@ class BulkDeleteAccountsOperation : public DatabaseTypeSpecificOperation<void>
         std::string strAccountIDs;
         marshalToPGArray(conn, strAccountIDs, mAccountIDs);
         std::string sql =
-            "WITH r AS (SELECT unnest(:ids::TEXT[])) "
+            "WITH r AS (SELECT decode(unnest(:ids::TEXT[]), 'hex')) "
             "DELETE FROM accounts WHERE accountid IN (SELECT * FROM r)";
-        auto prep = mDB.getPreparedStatement(sql);
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(strAccountIDs));
         st.define_and_bind();
@@ -435,26 +496,30 @@ class BulkDeleteAccountsOperation : public DatabaseTypeSpecificOperation<void>
 
 void
 LedgerTxnRoot::Impl::bulkUpsertAccounts(
-    std::vector<EntryIterator> const& entries)
+    std::vector<EntryIterator> const& entries, soci::session& session)
 {
-    BulkUpsertAccountsOperation op(mDatabase, entries);
-    mDatabase.doDatabaseTypeSpecificOperation(op);
+    BulkUpsertAccountsOperation op(mDatabase, session, entries);
+    mDatabase.doDatabaseTypeSpecificOperation(op, session);
 }
 
 void
 LedgerTxnRoot::Impl::bulkDeleteAccounts(
-    std::vector<EntryIterator> const& entries, LedgerTxnConsistency cons)
+    std::vector<EntryIterator> const& entries, LedgerTxnConsistency cons,
+    soci::session& session)
 {
-    BulkDeleteAccountsOperation op(mDatabase, cons, entries);
-    mDatabase.doDatabaseTypeSpecificOperation(op);
+    BulkDeleteAccountsOperation op(mDatabase, session, cons, entries);
+    mDatabase.doDatabaseTypeSpecificOperation(op, session);
 }
 
 void
 LedgerTxnRoot::Impl::dropAccounts()
 {
     throwIfChild();
+    waitForFlush(0);
+    retireFlushedDeltas();
     mEntryCache.clear();
-    mBestOffersCache.clear();
+    clearOrderBooks();
+    mInflationVotes.reset();
 
     mDatabase.getSession() << "DROP TABLE IF EXISTS accounts;";
     mDatabase.getSession() << "DROP TABLE IF EXISTS signers;";
@@ -481,6 +546,45 @@ LedgerTxnRoot::Impl::dropAccounts()
            "balance >= 1000000000";
 }
 
+void
+LedgerTxnRoot::Impl::upgradeAccountsToBinaryKeys(Database& db)
+{
+    auto& session = db.getSession();
+    auto binary = db.getBinaryType();
+
+    std::string sql =
+        "CREATE TABLE accountsbinary"
+        "("
+        "accountid          " + binary + "         PRIMARY KEY,"
+        "balance            BIGINT       NOT NULL CHECK (balance >= 0),"
+        "buyingliabilities  BIGINT CHECK (buyingliabilities >= 0),"
+        "sellingliabilities BIGINT CHECK (sellingliabilities >= 0),"
+        "seqnum             BIGINT       NOT NULL,"
+        "numsubentries      INT          NOT NULL CHECK (numsubentries >= 0),"
+        "inflationdest      " + binary + ","
+        "homedomain         VARCHAR(44)  NOT NULL,"
+        "thresholds         " + binary + "         NOT NULL,"
+        "flags              INT          NOT NULL,"
+        "signers            " + binary + ","
+        "lastmodified       INT          NOT NULL"
+        ");";
+    session << sql;
+    session << "INSERT INTO accountsbinary (accountid, balance, "
+               "buyingliabilities, sellingliabilities, seqnum, numsubentries, "
+               "inflationdest, homedomain, thresholds, flags, signers, "
+               "lastmodified) "
+               "SELECT a.rawkey, balance, buyingliabilities, "
+               "sellingliabilities, seqnum, numsubentries, d.rawkey, "
+               "homedomain, decode(thresholds, 'base64'), flags, "
+               "decode(signers, 'base64'), lastmodified "
+               "FROM accounts JOIN strkeys a ON accountid = a.strkey "
+               "LEFT JOIN strkeys d ON inflationdest = d.strkey";
+    session << "DROP TABLE accounts";
+    session << "ALTER TABLE accountsbinary RENAME TO accounts";
+    session << "CREATE INDEX accountbalances ON accounts (balance) WHERE "
+               "balance >= 1000000000";
+}
+
 class BulkLoadAccountsOperation
     : public DatabaseTypeSpecificOperation<std::vector<LedgerEntry>>
 {
@@ -524,7 +628,7 @@ class BulkLoadAccountsOperation
             le.data.type(ACCOUNT);
             auto& ae = le.data.account();
 
-            ae.accountID = KeyUtils::fromStrKey<PublicKey>(accountID);
+            ae.accountID = publicKeyFromBinaryColumn(accountID);
             ae.balance = balance;
             ae.seqNum = seqNum;
             ae.numSubEntries = numSubEntries;
@@ -532,19 +636,11 @@ class BulkLoadAccountsOperation
             if (inflationDestInd == soci::i_ok)
             {
                 ae.inflationDest.activate() =
-                    KeyUtils::fromStrKey<PublicKey>(inflationDest);
+                    publicKeyFromBinaryColumn(inflationDest);
             }
 
             decoder::decode_b64(homeDomain, ae.homeDomain);
-
-            bn::decode_b64(thresholds.begin(), thresholds.end(),
-                           ae.thresholds.begin());
-
-            if (inflationDestInd == soci::i_ok)
-            {
-                ae.inflationDest.activate() =
-                    KeyUtils::fromStrKey<PublicKey>(inflationDest);
-            }
+            xdrFromBinaryColumn(thresholds, ae.thresholds);
 
             ae.flags = flags;
             le.lastModifiedLedgerSeq = lastModified;
@@ -558,9 +654,7 @@ class BulkLoadAccountsOperation
 
             if (signersInd == soci::i_ok)
             {
-                std::vector<uint8_t> signersOpaque;
-                decoder::decode_b64(signers, signersOpaque);
-                xdr::xdr_from_opaque(signersOpaque, ae.signers);
+                xdrFromBinaryColumn(signers, ae.signers);
                 assert(std::adjacent_find(
                            ae.signers.begin(), ae.signers.end(),
                            [](Signer const& lhs, Signer const& rhs) {
@@ -582,7 +676,7 @@ class BulkLoadAccountsOperation
         for (auto const& k : keys)
         {
             assert(k.type() == ACCOUNT);
-            mAccountIDs.emplace_back(KeyUtils::toStrKey(k.account().accountID));
+            mAccountIDs.emplace_back(toBinaryColumn(k.account().accountID));
         }
     }
 
@@ -597,10 +691,12 @@ class BulkLoadAccountsOperation
         }
 
         std::string sql =
-            "SELECT accountid, balance, seqnum, numsubentries, "
-            "inflationdest, homedomain, thresholds, flags, lastmodified, "
-            "buyingliabilities, sellingliabilities, signers FROM accounts "
-            "WHERE accountid IN carray(?, ?, 'char*')";
+            "SELECT encode(accountid, 'hex'), balance, seqnum, numsubentries, "
+            "encode(inflationdest, 'hex'), homedomain, "
+            "encode(thresholds, 'hex'), flags, lastmodified, "
+            "buyingliabilities, sellingliabilities, encode(signers, 'hex') "
+            "FROM accounts WHERE accountid IN "
+            "(SELECT decode(value, 'hex') FROM carray(?, ?, 'char*'))";
 
         auto prep = mDb.getPreparedStatement(sql);
         auto be = prep.statement().get_backend();
@@ -627,11 +723,12 @@ class BulkLoadAccountsOperation
         marshalToPGArray(pg->conn_, strAccountIDs, mAccountIDs);
 
         std::string sql =
-            "WITH r AS (SELECT unnest(:v1::TEXT[])) "
-            "SELECT accountid, balance, seqnum, numsubentries, "
-            "inflationdest, homedomain, thresholds, flags, lastmodified, "
-            "buyingliabilities, sellingliabilities, signers FROM accounts "
-            "WHERE accountid IN (SELECT * FROM r)";
+            "WITH r AS (SELECT decode(unnest(:v1::TEXT[]), 'hex')) "
+            "SELECT encode(accountid, 'hex'), balance, seqnum, numsubentries, "
+            "encode(inflationdest, 'hex'), homedomain, "
+            "encode(thresholds, 'hex'), flags, lastmodified, "
+            "buyingliabilities, sellingliabilities, encode(signers, 'hex') "
+            "FROM accounts WHERE accountid IN (SELECT * FROM r)";
 
         auto prep = mDb.getPreparedStatement(sql);
         auto& st = prep.statement();
@@ -17,7 +17,7 @@ namespace stellar
 std::shared_ptr<LedgerEntry const>
 LedgerTxnRoot::Impl::loadData(LedgerKey const& key) const
 {
-    std::string actIDStrKey = KeyUtils::toStrKey(key.data().accountID);
+    std::string accountID = toBinaryColumn(key.data().accountID);
     std::string dataName = decoder::encode_b64(key.data().dataName);
 
     std::string dataValue;
@@ -29,12 +29,13 @@ LedgerTxnRoot::Impl::loadData(LedgerKey const& key) const
 
     std::string sql = "SELECT datavalue, lastmodified "
                       "FROM accountdata "
-                      "WHERE accountid= :id AND dataname= :dataname";
+                      "WHERE accountid = decode(:id, 'hex') "
+                      "AND dataname = :dataname";
     auto prep = mDatabase.getPreparedStatement(sql);
     auto& st = prep.statement();
     st.exchange(soci::into(dataValue, dataValueIndicator));
     st.exchange(soci::into(le.lastModifiedLedgerSeq));
-    st.exchange(soci::use(actIDStrKey));
+    st.exchange(soci::use(accountID));
     st.exchange(soci::use(dataName));
     st.define_and_bind();
     st.execute(true);
@@ -58,6 +59,7 @@ LedgerTxnRoot::Impl::loadData(LedgerKey const& key) const
 class BulkUpsertDataOperation : public DatabaseTypeSpecificOperation<void>
 {
     Database& mDB;
+    soci::session& mSession;
     std::vector<std::string> mAccountIDs;
     std::vector<std::string> mDataNames;
     std::vector<std::string> mDataValues;
@@ -68,7 +70,7 @@ class BulkUpsertDataOperation : public DatabaseTypeSpecificOperation<void>
     {
         assert(entry.data.type() == DATA);
         DataEntry const& data = entry.data.data();
-        mAccountIDs.emplace_back(KeyUtils::toStrKey(data.accountID));
+        mAccountIDs.emplace_back(toBinaryColumn(data.accountID));
         mDataNames.emplace_back(decoder::encode_b64(data.dataName));
         mDataValues.emplace_back(decoder::encode_b64(data.dataValue));
         mLastModifieds.emplace_back(
@@ -76,9 +78,9 @@ class BulkUpsertDataOperation : public DatabaseTypeSpecificOperation<void>
     }
 
   public:
-    BulkUpsertDataOperation(Database& DB,
+    BulkUpsertDataOperation(Database& DB, soci::session& session,
                             std::vector<LedgerEntry> const& entries)
-        : mDB(DB)
+        : mDB(DB), mSession(session)
     {
         for (auto const& e : entries)
         {
@@ -86,9 +88,9 @@ class BulkUpsertDataOperation : public DatabaseTypeSpecificOperation<void>
         }
     }
 
-    BulkUpsertDataOperation(Database& DB,
+    BulkUpsertDataOperation(Database& DB, soci::session& session,
                             std::vector<EntryIterator> const& entryIter)
-        : mDB(DB)
+        : mDB(DB), mSession(session)
     {
         for (auto const& e : entryIter)
         {
@@ -103,11 +105,11 @@ class BulkUpsertDataOperation : public DatabaseTypeSpecificOperation<void>
         std::string sql = "INSERT INTO accountdata ( "
                           "accountid, dataname, datavalue, lastmodified "
                           ") VALUES ( "
-                          ":id, :v1, :v2, :v3 "
+                          "decode(:id, 'hex'), :v1, :v2, :v3 "
                           ") ON CONFLICT (accountid, dataname) DO UPDATE SET "
                           "datavalue = excluded.datavalue, "
                           "lastmodified = excluded.lastmodified ";
-        auto prep = mDB.getPreparedStatement(sql);
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(mAccountIDs));
         st.exchange(soci::use(mDataNames));
@@ -142,7 +144,7 @@ class BulkUpsertDataOperation : public DatabaseTypeSpecificOperation<void>
         marshalToPGArray(conn, strDataValues, mDataValues);
         marshalToPGArray(conn, strLastModifieds, mLastModifieds);
         std::string sql = "WITH r AS (SELECT "
-                          "unnest(:ids::TEXT[]), "
+                          "decode(unnest(:ids::TEXT[]), 'hex'), "
                           "unnest(:v1::TEXT[]), "
                           "unnest(:v2::TEXT[]), "
                           "unnest(:v3::INT[]) "
@@ -153,7 +155,7 @@ class BulkUpsertDataOperation : public DatabaseTypeSpecificOperation<void>
                           "ON CONFLICT (accountid, dataname) DO UPDATE SET "
                           "datavalue = excluded.datavalue, "
                           "lastmodified = excluded.lastmodified ";
-        auto prep = mDB.getPreparedStatement(sql);
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(strAccountIDs));
         st.exchange(soci::use(strDataNames));
@@ -175,21 +177,23 @@ class BulkUpsertDataOperation : public DatabaseTypeSpecificOperation<void>
 class BulkDeleteDataOperation : public DatabaseTypeSpecificOperation<void>
 {
     Database& mDB;
+    soci::session& mSession;
     LedgerTxnConsistency mCons;
     std::vector<std::string> mAccountIDs;
     std::vector<std::string> mDataNames;
 
   public:
-    BulkDeleteDataOperation(Database& DB, LedgerTxnConsistency cons,
+    BulkDeleteDataOperation(Database& DB, soci::session& session,
+                            LedgerTxnConsistency cons,
                             std::vector<EntryIterator> const& entries)
-        : mDB(DB), mCons(cons)
+        : mDB(DB), mSession(session), mCons(cons)
     {
         for (auto const& e : entries)
         {
             assert(!e.entryExists());
             assert(e.key().type() == DATA);
             auto const& data = e.key().data();
-            mAccountIDs.emplace_back(KeyUtils::toStrKey(data.accountID));
+            mAccountIDs.emplace_back(toBinaryColumn(data.accountID));
             mDataNames.emplace_back(decoder::encode_b64(data.dataName));
         }
     }
@@ -197,9 +201,10 @@ class BulkDeleteDataOperation : public DatabaseTypeSpecificOperation<void>
     void
     doSociGenericOperation()
     {
-        std::string sql = "DELETE FROM accountdata WHERE accountid = :id AND "
+        std::string sql = "DELETE FROM accountdata "
+                          "WHERE accountid = decode(:id, 'hex') AND "
                           " dataname = :v1 ";
-        auto prep = mDB.getPreparedStatement(sql);
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(mAccountIDs));
         st.exchange(soci::use(mDataNames));
@@ -232,12 +237,12 @@ class BulkDeleteDataOperation : public DatabaseTypeSpecificOperation<void>
         marshalToPGArray(conn, strDataNames, mDataNames);
         std::string sql =
             "WITH r AS ( SELECT "
-            "unnest(:ids::TEXT[]),"
+            "decode(unnest(:ids::TEXT[]), 'hex'),"
             "unnest(:v1::TEXT[])"
             " ) "
             "DELETE FROM accountdata WHERE (accountid, dataname) IN "
             "(SELECT * FROM r)";
-        auto prep = mDB.getPreparedStatement(sql);
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(strAccountIDs));
         st.exchange(soci::use(strDataNames));
@@ -257,26 +262,29 @@ class BulkDeleteDataOperation : public DatabaseTypeSpecificOperation<void>
 
 void
 LedgerTxnRoot::Impl::bulkUpsertAccountData(
-    std::vector<EntryIterator> const& entries)
+    std::vector<EntryIterator> const& entries, soci::session& session)
 {
-    BulkUpsertDataOperation op(mDatabase, entries);
-    mDatabase.doDatabaseTypeSpecificOperation(op);
+    BulkUpsertDataOperation op(mDatabase, session, entries);
+    mDatabase.doDatabaseTypeSpecificOperation(op, session);
 }
 
 void
 LedgerTxnRoot::Impl::bulkDeleteAccountData(
-    std::vector<EntryIterator> const& entries, LedgerTxnConsistency cons)
+    std::vector<EntryIterator> const& entries, LedgerTxnConsistency cons,
+    soci::session& session)
 {
-    BulkDeleteDataOperation op(mDatabase, cons, entries);
-    mDatabase.doDatabaseTypeSpecificOperation(op);
+    BulkDeleteDataOperation op(mDatabase, session, cons, entries);
+    mDatabase.doDatabaseTypeSpecificOperation(op, session);
 }
 
 void
 LedgerTxnRoot::Impl::dropData()
 {
     throwIfChild();
+    waitForFlush(0);
+    retireFlushedDeltas();
     mEntryCache.clear();
-    mBestOffersCache.clear();
+    clearOrderBooks();
 
     mDatabase.getSession() << "DROP TABLE IF EXISTS accountdata;";
     mDatabase.getSession() << "CREATE TABLE accountdata"
@@ -289,6 +297,30 @@ LedgerTxnRoot::Impl::dropData()
                               ");";
 }
 
+void
+LedgerTxnRoot::Impl::upgradeDataToBinaryKeys(Database& db)
+{
+    auto& session = db.getSession();
+
+    std::string sql = "CREATE TABLE accountdatabinary"
+                      "("
+                      "accountid    " +
+                      db.getBinaryType() +
+                      "         NOT NULL,"
+                      "dataname     VARCHAR(88)  NOT NULL,"
+                      "datavalue    VARCHAR(112) NOT NULL,"
+                      "lastmodified INT          NOT NULL,"
+                      "PRIMARY KEY  (accountid, dataname)"
+                      ");";
+    session << sql;
+    session << "INSERT INTO accountdatabinary (accountid, dataname, "
+               "datavalue, lastmodified) "
+               "SELECT rawkey, dataname, datavalue, lastmodified "
+               "FROM accountdata JOIN strkeys ON accountid = strkey";
+    session << "DROP TABLE accountdata";
+    session << "ALTER TABLE accountdatabinary RENAME TO accountdata";
+}
+
 class BulkLoadDataOperation
     : public DatabaseTypeSpecificOperation<std::vector<LedgerEntry>>
 {
@@ -320,7 +352,7 @@ class BulkLoadDataOperation
             le.data.type(DATA);
             auto& de = le.data.data();
 
-            de.accountID = KeyUtils::fromStrKey<PublicKey>(accountID);
+            de.accountID = publicKeyFromBinaryColumn(accountID);
             decoder::decode_b64(dataName, de.dataName);
             decoder::decode_b64(dataValue, de.dataValue);
             le.lastModifiedLedgerSeq = lastModified;
@@ -340,7 +372,7 @@ class BulkLoadDataOperation
         for (auto const& k : keys)
         {
             assert(k.type() == DATA);
-            mAccountIDs.emplace_back(KeyUtils::toStrKey(k.data().accountID));
+            mAccountIDs.emplace_back(toBinaryColumn(k.data().accountID));
             mDataNames.emplace_back(decoder::encode_b64(k.data().dataName));
         }
     }
@@ -361,14 +393,15 @@ class BulkLoadDataOperation
         }
 
         std::string sqlJoin =
-            "SELECT x.value, y.value FROM "
+            "SELECT decode(x.value, 'hex'), y.value FROM "
             "(SELECT rowid, value FROM carray(?, ?, 'char*') ORDER BY rowid) "
             "AS x "
             "INNER JOIN (SELECT rowid, value FROM carray(?, ?, 'char*') ORDER "
             "BY rowid) AS y ON x.rowid = y.rowid";
         std::string sql =
             "WITH r AS (" + sqlJoin +
-            ") SELECT accountid, dataname, datavalue, lastmodified "
+            ") SELECT encode(accountid, 'hex'), dataname, datavalue, "
+            "lastmodified "
             "FROM accountdata WHERE (accountid, dataname) IN r";
 
         auto prep = mDb.getPreparedStatement(sql);
@@ -401,8 +434,10 @@ class BulkLoadDataOperation
         marshalToPGArray(pg->conn_, strDataNames, mDataNames);
 
         std::string sql =
-            "WITH r AS (SELECT unnest(:v1::TEXT[]), unnest(:v2::TEXT[])) "
-            "SELECT accountid, dataname, datavalue, lastmodified "
+            "WITH r AS (SELECT decode(unnest(:v1::TEXT[]), 'hex'), "
+            "unnest(:v2::TEXT[])) "
+            "SELECT encode(accountid, 'hex'), dataname, datavalue, "
+            "lastmodified "
             "FROM accountdata WHERE (accountid, dataname) IN (SELECT * FROM r)";
 
         auto prep = mDb.getPreparedStatement(sql);
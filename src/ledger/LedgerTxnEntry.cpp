@@ -12,13 +12,18 @@ namespace stellar
 {
 
 // Implementation of LedgerTxnEntry -----------------------------------------
+// The entry is a snapshot that may be shared with the parent of mLedgerTxn
+// until it is first modified, when mLedgerTxn makes a copy that it owns and
+// that is then modified in place.
 class LedgerTxnEntry::Impl : public EntryImplBase
 {
     AbstractLedgerTxn& mLedgerTxn;
-    LedgerEntry& mCurrent;
+    std::shared_ptr<LedgerEntry const> const mSnapshot;
+    LedgerEntry* mCurrent;
 
   public:
-    explicit Impl(AbstractLedgerTxn& ltx, LedgerEntry& current);
+    explicit Impl(AbstractLedgerTxn& ltx,
+                  std::shared_ptr<LedgerEntry const> const& current);
 
     ~Impl() override;
 
@@ -39,7 +44,8 @@ class LedgerTxnEntry::Impl : public EntryImplBase
 };
 
 std::shared_ptr<LedgerTxnEntry::Impl>
-LedgerTxnEntry::makeSharedImpl(AbstractLedgerTxn& ltx, LedgerEntry& current)
+LedgerTxnEntry::makeSharedImpl(
+    AbstractLedgerTxn& ltx, std::shared_ptr<LedgerEntry const> const& current)
 {
     return std::make_shared<Impl>(ltx, current);
 }
@@ -59,8 +65,9 @@ LedgerTxnEntry::LedgerTxnEntry(std::shared_ptr<Impl> const& impl)
 {
 }
 
-LedgerTxnEntry::Impl::Impl(AbstractLedgerTxn& ltx, LedgerEntry& current)
-    : mLedgerTxn(ltx), mCurrent(current)
+LedgerTxnEntry::Impl::Impl(AbstractLedgerTxn& ltx,
+                           std::shared_ptr<LedgerEntry const> const& current)
+    : mLedgerTxn(ltx), mSnapshot(current), mCurrent(nullptr)
 {
 }
 
@@ -119,13 +126,17 @@ LedgerTxnEntry::current() const
 LedgerEntry&
 LedgerTxnEntry::Impl::current()
 {
-    return mCurrent;
+    if (!mCurrent)
+    {
+        mCurrent = &mLedgerTxn.makeMutable(LedgerEntryKey(*mSnapshot));
+    }
+    return *mCurrent;
 }
 
 LedgerEntry const&
 LedgerTxnEntry::Impl::current() const
 {
-    return mCurrent;
+    return mCurrent ? *mCurrent : *mSnapshot;
 }
 
 void
@@ -137,7 +148,7 @@ LedgerTxnEntry::deactivate()
 void
 LedgerTxnEntry::Impl::deactivate()
 {
-    auto key = LedgerEntryKey(mCurrent);
+    auto key = LedgerEntryKey(*mSnapshot);
     mLedgerTxn.deactivate(key);
 }
 
@@ -150,7 +161,7 @@ LedgerTxnEntry::erase()
 void
 LedgerTxnEntry::Impl::erase()
 {
-    auto key = LedgerEntryKey(mCurrent);
+    auto key = LedgerEntryKey(*mSnapshot);
     mLedgerTxn.erase(key);
 }
 
@@ -186,10 +197,11 @@ LedgerTxnEntry::swap(LedgerTxnEntry& other)
 class ConstLedgerTxnEntry::Impl : public EntryImplBase
 {
     AbstractLedgerTxn& mLedgerTxn;
-    LedgerEntry const mCurrent;
+    std::shared_ptr<LedgerEntry const> const mCurrent;
 
   public:
-    explicit Impl(AbstractLedgerTxn& ltx, LedgerEntry const& current);
+    explicit Impl(AbstractLedgerTxn& ltx,
+                  std::shared_ptr<LedgerEntry const> const& current);
 
     ~Impl() override;
 
@@ -207,8 +219,8 @@ class ConstLedgerTxnEntry::Impl : public EntryImplBase
 };
 
 std::shared_ptr<ConstLedgerTxnEntry::Impl>
-ConstLedgerTxnEntry::makeSharedImpl(AbstractLedgerTxn& ltx,
-                                    LedgerEntry const& current)
+ConstLedgerTxnEntry::makeSharedImpl(
+    AbstractLedgerTxn& ltx, std::shared_ptr<LedgerEntry const> const& current)
 {
     return std::make_shared<Impl>(ltx, current);
 }
@@ -228,8 +240,8 @@ ConstLedgerTxnEntry::ConstLedgerTxnEntry(std::shared_ptr<Impl> const& impl)
 {
 }
 
-ConstLedgerTxnEntry::Impl::Impl(AbstractLedgerTxn& ltx,
-                                LedgerEntry const& current)
+ConstLedgerTxnEntry::Impl::Impl(
+    AbstractLedgerTxn& ltx, std::shared_ptr<LedgerEntry const> const& current)
     : mLedgerTxn(ltx), mCurrent(current)
 {
 }
@@ -283,7 +295,7 @@ ConstLedgerTxnEntry::current() const
 LedgerEntry const&
 ConstLedgerTxnEntry::Impl::current() const
 {
-    return mCurrent;
+    return *mCurrent;
 }
 
 std::shared_ptr<ConstLedgerTxnEntry::Impl>
@@ -317,7 +329,7 @@ ConstLedgerTxnEntry::deactivate()
 void
 ConstLedgerTxnEntry::Impl::deactivate()
 {
-    auto key = LedgerEntryKey(mCurrent);
+    auto key = LedgerEntryKey(*mCurrent);
     mLedgerTxn.deactivate(key);
 }
 
@@ -57,8 +57,9 @@ class LedgerTxnEntry
 
     void swap(LedgerTxnEntry& other);
 
-    static std::shared_ptr<Impl> makeSharedImpl(AbstractLedgerTxn& ltx,
-                                                LedgerEntry& current);
+    static std::shared_ptr<Impl>
+    makeSharedImpl(AbstractLedgerTxn& ltx,
+                   std::shared_ptr<LedgerEntry const> const& current);
 };
 
 class ConstLedgerTxnEntry
@@ -95,8 +96,9 @@ class ConstLedgerTxnEntry
 
     void swap(ConstLedgerTxnEntry& other);
 
-    static std::shared_ptr<Impl> makeSharedImpl(AbstractLedgerTxn& ltx,
-                                                LedgerEntry const& current);
+    static std::shared_ptr<Impl>
+    makeSharedImpl(AbstractLedgerTxn& ltx,
+                   std::shared_ptr<LedgerEntry const> const& current);
 };
 
 std::shared_ptr<EntryImplBase>
@@ -2,10 +2,21 @@
 // under the Apache License, Version 2.0. See the COPYING file at the root
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
+#include "crypto/Hex.h"
 #include "database/Database.h"
+#include "ledger/InflationVoteTally.h"
+#include "ledger/LedgerEntryCache.h"
 #include "ledger/LedgerTxn.h"
-#include "util/RandomEvictionCache.h"
-#include <list>
+#include "util/Arena.h"
+#include "util/FlatHashMap.h"
+#include "xdrpp/marshal.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
 #ifdef USE_POSTGRES
 #include <iomanip>
 #include <libpq-fe.h>
@@ -22,10 +33,46 @@ std::unordered_map<LedgerKey, std::shared_ptr<LedgerEntry const>>
 populateLoadedEntries(std::unordered_set<LedgerKey> const& keys,
                       std::vector<LedgerEntry> const& entries);
 
-// A defensive heuristic to ensure prefetching stops if entry cache is filling
-// up.
+// Keys and XDR values are stored in binary columns (see
+// Database::getBinaryType). soci binds strings as NUL-terminated buffers, so
+// they are exchanged as hex: queries write them with decode(:v, 'hex') and
+// read them with encode(column, 'hex').
+inline std::string
+toBinaryColumn(PublicKey const& key)
+{
+    return binToHex(key.ed25519());
+}
+
+inline PublicKey
+publicKeyFromBinaryColumn(std::string const& hex)
+{
+    PublicKey key;
+    key.ed25519() = hexToBin256(hex);
+    return key;
+}
+
+template <typename T>
+inline std::string
+xdrToBinaryColumn(T const& value)
+{
+    return binToHex(xdr::xdr_to_opaque(value));
+}
+
+template <typename T>
+inline void
+xdrFromBinaryColumn(std::string const& hex, T& value)
+{
+    xdr::xdr_from_opaque(hexToBin(hex), value);
+}
+
+// A defensive heuristic to ensure prefetching stops before prefetched entries
+// fill up the entry cache.
 static const double ENTRY_CACHE_FILL_RATIO = 0.5;
 
+// In asynchronous commit mode, the maximum number of committed deltas that can
+// be waiting to be written to the database before commitChild blocks.
+static const size_t MAX_UNFLUSHED_DELTAS = 2;
+
 class EntryIterator::AbstractImpl
 {
   public:
@@ -43,6 +90,10 @@ class EntryIterator::AbstractImpl
 
     virtual LedgerKey const& key() const = 0;
 
+    virtual std::shared_ptr<LedgerEntry const> sharedEntry() const = 0;
+
+    virtual bool entryInArena() const = 0;
+
     virtual std::unique_ptr<AbstractImpl> clone() const = 0;
 };
 
@@ -132,13 +183,37 @@ class LedgerTxn::Impl
 {
     class EntryIteratorImpl;
 
-    typedef std::unordered_map<LedgerKey, std::shared_ptr<LedgerEntry>>
-        EntryMap;
+    // The entries of a LedgerTxn are allocated from mArena. The Arena of a
+    // LedgerTxn whose parent is also a LedgerTxn is nested in the Arena of
+    // the parent, so the space used by the LedgerTxns nested in a ledger close
+    // (one per transaction and per operation) is reused when they roll back
+    // rather than freed piece by piece. The map that holds them is a
+    // FlatHashMap, whose slots are a single allocation that is reallocated as
+    // the map grows, so it does not use the Arena.
+    //
+    // An entry is either a snapshot, or a copy owned by this LedgerTxn, made
+    // from mArena when the entry was created or first modified. A snapshot is
+    // an entry that was loaded and never modified, or the entry of a child
+    // that committed, which keeps the Arena of the child alive instead of
+    // being copied. Snapshots are never modified, and an owned copy is only
+    // modified by this LedgerTxn (it is allocated as a non-const LedgerEntry,
+    // see getMutable). inArena tells whether the entry was allocated from the
+    // Arena of a LedgerTxn, LedgerTxnRoot copies those when they are
+    // committed so that they do not keep the Arena alive.
+    struct EntryPtr
+    {
+        std::shared_ptr<LedgerEntry const> entry;
+        bool owned{false};
+        bool inArena{false};
+    };
+    typedef FlatHashMap<LedgerKey, EntryPtr> EntryMap;
 
     AbstractLedgerTxnParent& mParent;
+    Impl* const mParentImpl;
     AbstractLedgerTxn* mChild;
     std::unique_ptr<LedgerHeader> mHeader;
     std::shared_ptr<LedgerTxnHeader::Impl> mActiveHeader;
+    std::shared_ptr<Arena> const mArena;
     EntryMap mEntry;
     std::unordered_map<LedgerKey, std::shared_ptr<EntryImplBase>> mActive;
     bool const mShouldUpdateLastModified;
@@ -149,6 +224,21 @@ class LedgerTxn::Impl
     void throwIfSealed() const;
     void throwIfNotExactConsistency() const;
 
+    // getParentImpl returns the Impl of parent if it is a LedgerTxn, and
+    // nullptr otherwise. Does not throw.
+    static Impl* getParentImpl(AbstractLedgerTxnParent& parent);
+
+    // makeEntry allocates a copy of entry from mArena, owned by this
+    // LedgerTxn. It has the strong exception safety guarantee.
+    EntryPtr makeEntry(LedgerEntry const& entry) const;
+
+    // getNewestEntry is getNewestVersion, as a snapshot that tells whether
+    // the entry is in an Arena. It has the same exception safety guarantee.
+    EntryPtr getNewestEntry(LedgerKey const& key) const;
+
+    // getMutable returns the entry of an owned EntryPtr. Does not throw.
+    static LedgerEntry& getMutable(EntryPtr const& ptr);
+
     // getDeltaVotes has the basic exception safety guarantee. If it throws an
     // exception, then
     // - the prepared statement cache may be, but is not guaranteed to be,
@@ -170,11 +260,10 @@ class LedgerTxn::Impl
     // getEntryIterator has the strong exception safety guarantee
     EntryIterator getEntryIterator(EntryMap const& entries) const;
 
-    // maybeUpdateLastModified has the strong exception safety guarantee
-    EntryMap maybeUpdateLastModified() const;
-
     // maybeUpdateLastModifiedThenInvokeThenSeal has the same exception safety
-    // guarantee as f
+    // guarantee as f. Only the shared entries whose last modified must change
+    // are copied, the owned entries are updated in place and restored if f
+    // throws.
     void maybeUpdateLastModifiedThenInvokeThenSeal(
         std::function<void(EntryMap const&)> f);
 
@@ -202,6 +291,9 @@ class LedgerTxn::Impl
     // deactivate has the strong exception safety guarantee
     void deactivate(LedgerKey const& key);
 
+    // makeMutable has the strong exception safety guarantee
+    LedgerEntry& makeMutable(LedgerKey const& key);
+
     // deactivateHeader has the strong exception safety guarantee
     void deactivateHeader();
 
@@ -218,13 +310,20 @@ class LedgerTxn::Impl
     //   modified.
     std::unordered_map<LedgerKey, LedgerEntry> getAllOffers();
 
+    // getOffersBySellerRange has the basic exception safety guarantee. If it
+    // throws an exception, then
+    // - the prepared statement cache may be, but is not guaranteed to be,
+    //   modified.
+    OfferBatch getOffersBySellerRange(AccountID const* afterSeller,
+                                      size_t maxOffers);
+
     // getBestOffer has the basic exception safety guarantee. If it throws an
     // exception, then
     // - the prepared statement cache may be, but is not guaranteed to be,
     //   modified
     // - the entry cache may be, but is not guaranteed to be, modified or even
     //   cleared
-    // - the best offers cache may be, but is not guaranteed to be, modified or
+    // - the order books may be, but are not guaranteed to be, modified or
     //   even cleared
     std::shared_ptr<LedgerEntry const>
     getBestOffer(Asset const& buying, Asset const& selling,
@@ -305,13 +404,23 @@ class LedgerTxn::Impl
     std::map<AccountID, std::vector<LedgerTxnEntry>>
     loadAllOffers(LedgerTxn& self);
 
+    // loadOffersBySellerRange has the basic exception safety guarantee. If it
+    // throws an exception, then
+    // - the prepared statement cache may be, but is not guaranteed to be,
+    //   modified
+    // - the entry cache may be, but is not guaranteed to be, cleared.
+    std::map<AccountID, std::vector<LedgerTxnEntry>>
+    loadOffersBySellerRange(LedgerTxn& self, AccountID const* afterSeller,
+                            size_t maxOffers,
+                            xdr::pointer<AccountID>& lastSeller);
+
     // loadBestOffer has the basic exception safety guarantee. If it throws an
     // exception, then
     // - the prepared statement cache may be, but is not guaranteed to be,
     //   modified
     // - the entry cache may be, but is not guaranteed to be, modified or even
     //   cleared
-    // - the best offers cache may be, but is not guaranteed to be, modified or
+    // - the order books may be, but are not guaranteed to be, modified or
     //   even cleared
     LedgerTxnEntry loadBestOffer(LedgerTxn& self, Asset const& buying,
                                  Asset const& selling);
@@ -365,6 +474,10 @@ class LedgerTxn::Impl::EntryIteratorImpl : public EntryIterator::AbstractImpl
 
     LedgerKey const& key() const override;
 
+    std::shared_ptr<LedgerEntry const> sharedEntry() const override;
+
+    bool entryInArena() const override;
+
     std::unique_ptr<EntryIterator::AbstractImpl> clone() const override;
 };
 
@@ -398,63 +511,209 @@ class LedgerTxnRoot::Impl
         LoadType type;
     };
 
-    typedef RandomEvictionCache<LedgerKey, CacheEntry> EntryCache;
+    typedef LedgerEntryCache<CacheEntry> EntryCache;
+
+    // The new versions of the committed entries that were in the entry cache
+    typedef std::vector<
+        std::pair<LedgerKey, std::shared_ptr<LedgerEntry const>>>
+        CommittedEntries;
+
+    // An order book holds every offer for a single asset pair, sorted in the
+    // order induced by isBetterOffer. Order books are loaded from the database
+    // the first time an asset pair is queried and are then maintained
+    // incrementally in commitChild, so they are always an exact image of the
+    // committed offers (in the database or in a pending delta) for the asset
+    // pairs that are resident.
+    struct AssetPair
+    {
+        Asset buying;
+        Asset selling;
+
+        bool operator==(AssetPair const& other) const;
+    };
+
+    struct AssetPairHash
+    {
+        size_t operator()(AssetPair const& key) const;
+    };
+
+    struct OfferDescriptor
+    {
+        double price;
+        int64_t offerID;
+
+        bool operator<(OfferDescriptor const& other) const;
+    };
+
+    typedef std::map<OfferDescriptor, std::shared_ptr<LedgerEntry const>>
+        OrderBook;
 
-    typedef std::string BestOffersCacheKey;
-    struct BestOffersCacheEntry
+    struct OrderBookEntry
     {
-        std::list<LedgerEntry> bestOffers;
-        bool allLoaded;
+        OrderBook offers;
+        uint64_t lastAccess;
     };
-    typedef RandomEvictionCache<std::string, BestOffersCacheEntry>
-        BestOffersCache;
+
+    typedef std::unordered_map<AssetPair, OrderBookEntry, AssetPairHash>
+        OrderBooks;
+
+    struct OrderBookLocation
+    {
+        AssetPair assets;
+        OfferDescriptor desc;
+    };
+
+    // An offer that was modified or erased by a commit. If the new version of
+    // the offer belongs to a resident order book then entry holds that
+    // version, otherwise entry is nullptr and the offer is only removed from
+    // whichever order book previously contained it.
+    struct OfferChange
+    {
+        int64_t offerID;
+        std::shared_ptr<LedgerEntry const> entry;
+    };
+
+    // An account that was modified or erased by a commit, reduced to what the
+    // inflation vote tally needs. An erased account has no inflation
+    // destination.
+    struct InflationVoteChange
+    {
+        AccountID accountID;
+        xdr::pointer<AccountID> inflationDest;
+        int64_t balance;
+    };
+
+    // In asynchronous commit mode, commitChild freezes the changes of the
+    // child into a PendingDelta and hands it to the flush thread, which writes
+    // it to the database. Until the delta is known to be written, reads
+    // consult it before the database. A nullptr entry denotes an erased entry.
+    struct PendingDelta
+    {
+        uint32_t ledgerSeq;
+        LedgerTxnConsistency consistency;
+        std::unordered_map<LedgerKey, std::shared_ptr<LedgerEntry const>>
+            entries;
+        std::vector<DeferredWrite> writes;
+    };
+
+    class PendingDeltaIteratorImpl;
 
     Database& mDatabase;
     std::unique_ptr<LedgerHeader> mHeader;
     mutable EntryCache mEntryCache;
-    mutable BestOffersCache mBestOffersCache;
+    mutable OrderBooks mOrderBooks;
+    mutable std::unordered_map<int64_t, OrderBookLocation> mOrderBookIndex;
+    mutable uint64_t mOrderBookGeneration{0};
+    size_t mMaxOrderBooks;
+
+    // The inflation vote tally is loaded from the database the first time
+    // inflation winners are queried and is then maintained incrementally in
+    // commitChild, like the order books. It is nullptr when it is not loaded.
+    mutable std::unique_ptr<InflationVoteTally> mInflationVotes;
     mutable std::unordered_map<LedgerKey, KeyAccesses> mPrefetchMetrics;
     mutable uint64_t mTotalPrefetchHits{0};
 
+    // The number of entries that were prefetched since the last commit
+    mutable size_t mPrefetchedEntries{0};
+
+    // The writes deferred to the next commit, see deferWrite
+    std::vector<DeferredWrite> mDeferredWrites;
+
     size_t mMaxCacheSize;
     size_t mBulkLoadBatchSize;
     std::unique_ptr<soci::transaction> mTransaction;
     AbstractLedgerTxn* mChild;
 
+    // mPendingDeltas holds, oldest first, every delta that has not been
+    // retired. It is only accessed by the main thread. mFlushQueue holds the
+    // deltas that have not been written yet and is shared with the flush
+    // thread, as is everything else below that is guarded by mFlushMutex.
+    bool const mAsyncCommit;
+    mutable std::deque<std::shared_ptr<PendingDelta const>> mPendingDeltas;
+    mutable std::mutex mFlushMutex;
+    mutable std::condition_variable mFlushCondition;
+    std::deque<std::shared_ptr<PendingDelta const>> mFlushQueue;
+    uint64_t mFlushedDeltas{0};
+    mutable uint64_t mRetiredDeltas{0};
+    bool mStopFlushing{false};
+    std::thread mFlushThread;
+
+    // Set between beginBucketApply and endBucketApply, and read by the
+    // threads applying buckets
+    std::atomic<bool> mApplyingBuckets{false};
+
     void throwIfChild() const;
+    void throwIfApplyingBuckets() const;
 
     std::shared_ptr<LedgerEntry const> loadAccount(LedgerKey const& key) const;
     std::shared_ptr<LedgerEntry const> loadData(LedgerKey const& key) const;
     std::shared_ptr<LedgerEntry const> loadOffer(LedgerKey const& key) const;
     std::vector<LedgerEntry> loadAllOffers() const;
-    std::list<LedgerEntry>::const_iterator
-    loadOffers(StatementContext& prep, std::list<LedgerEntry>& offers) const;
-    std::list<LedgerEntry>::const_iterator
-    loadBestOffers(std::list<LedgerEntry>& offers, Asset const& buying,
-                   Asset const& selling, size_t numOffers, size_t offset) const;
+    std::vector<LedgerEntry>
+    loadOffersBySellerRange(AccountID const* afterSeller, size_t maxOffers,
+                            xdr::pointer<AccountID>& lastSeller) const;
+    std::vector<LedgerEntry> loadOffersByAssetPair(Asset const& buying,
+                                                   Asset const& selling) const;
     std::vector<LedgerEntry>
     loadOffersByAccountAndAsset(AccountID const& accountID,
                                 Asset const& asset) const;
     std::vector<LedgerEntry> loadOffers(StatementContext& prep) const;
-    std::vector<InflationWinner> loadInflationWinners(size_t maxWinners,
-                                                      int64_t minBalance) const;
+    void loadInflationVotes(InflationVoteTally& tally,
+                            soci::session& session) const;
     std::shared_ptr<LedgerEntry const>
     loadTrustLine(LedgerKey const& key) const;
 
+    // The bulk operations write through the provided session, which is the
+    // main session except when called by the flush thread.
     void bulkApply(BulkLedgerEntryChangeAccumulator& bleca,
-                   size_t bufferThreshold, LedgerTxnConsistency cons);
-    void bulkUpsertAccounts(std::vector<EntryIterator> const& entries);
+                   size_t bufferThreshold, LedgerTxnConsistency cons,
+                   soci::session& session);
+    void bulkUpsertAccounts(std::vector<EntryIterator> const& entries,
+                            soci::session& session);
     void bulkDeleteAccounts(std::vector<EntryIterator> const& entries,
-                            LedgerTxnConsistency cons);
-    void bulkUpsertTrustLines(std::vector<EntryIterator> const& entries);
+                            LedgerTxnConsistency cons, soci::session& session);
+    void bulkUpsertTrustLines(std::vector<EntryIterator> const& entries,
+                              soci::session& session);
     void bulkDeleteTrustLines(std::vector<EntryIterator> const& entries,
-                              LedgerTxnConsistency cons);
-    void bulkUpsertOffers(std::vector<EntryIterator> const& entries);
+                              LedgerTxnConsistency cons,
+                              soci::session& session);
+    void bulkUpsertOffers(std::vector<EntryIterator> const& entries,
+                          soci::session& session);
     void bulkDeleteOffers(std::vector<EntryIterator> const& entries,
-                          LedgerTxnConsistency cons);
-    void bulkUpsertAccountData(std::vector<EntryIterator> const& entries);
+                          LedgerTxnConsistency cons, soci::session& session);
+    void bulkUpsertAccountData(std::vector<EntryIterator> const& entries,
+                               soci::session& session);
     void bulkDeleteAccountData(std::vector<EntryIterator> const& entries,
-                               LedgerTxnConsistency cons);
+                               LedgerTxnConsistency cons,
+                               soci::session& session);
+
+    // flushPendingDeltas is the body of the flush thread. It writes each
+    // queued delta, along with the lastflushedledger marker, in its own
+    // transaction on a session borrowed from the connection pool. Errors are
+    // fatal.
+    void flushPendingDeltas();
+    void writePendingDelta(PendingDelta const& delta, soci::session& session);
+
+    // waitForFlush blocks until at most maxUnflushed deltas remain to be
+    // written. retireFlushedDeltas drops the deltas that have been written
+    // from mPendingDeltas; it must only be called when there is no child, as
+    // the database snapshot of an open transaction might not include them.
+    // Neither throws.
+    void waitForFlush(size_t maxUnflushed) const;
+    void retireFlushedDeltas() const;
+
+    // getFromPendingDeltas returns true and sets entry to the newest pending
+    // version of key if there is one. It does not throw.
+    bool getFromPendingDeltas(LedgerKey const& key,
+                              std::shared_ptr<LedgerEntry const>& entry) const;
+
+    // applyPendingOffers applies the offers in the pending deltas, oldest
+    // first, to offers loaded from the database. Offers that do not satisfy
+    // filter are removed. Applying a delta that has already been written is
+    // harmless, since deltas contain entire entries.
+    std::vector<LedgerEntry> applyPendingOffers(
+        std::vector<LedgerEntry>&& offers,
+        std::function<bool(OfferEntry const&)> const& filter) const;
 
     static std::string tableFromLedgerEntryType(LedgerEntryType let);
 
@@ -466,20 +725,64 @@ class LedgerTxnRoot::Impl
     //    database operations are SELECTs, which only populate the cache
     //    with fresh data from the DB.
     //
-    //  - On LedgerTxnRoot::commitChild, the cache is cleared.
+    //  - On LedgerTxnRoot::commitChild, the cached entries that were
+    //    committed are replaced by their new version, or by nullptr if they
+    //    were erased. Entries that were not cached are not added.
     //
     //  - It is therefore always kept in exact correspondence with the
-    //    database for the keyset that it has entries for. It's a precise
-    //    image of a subset of the database.
-    std::shared_ptr<LedgerEntry const>
-    getFromEntryCache(LedgerKey const& key) const;
+    //    committed state for the keyset that it has entries for. Without
+    //    asynchronous commit that is a precise image of a subset of the
+    //    database. With it, a cached entry can be newer than the database,
+    //    but then it is also in a pending delta, which is consulted first.
+    //
+    // The cache persists across ledgers, so its admission filter can tell
+    // which entries are popular.
+    //
+    // getFromEntryCache returns true and sets entry if key is cached.
+    bool getFromEntryCache(LedgerKey const& key,
+                           std::shared_ptr<LedgerEntry const>& entry) const;
     void putInEntryCache(LedgerKey const& key,
                          std::shared_ptr<LedgerEntry const> const& entry,
                          LoadType type) const;
 
-    BestOffersCacheEntry&
-    getFromBestOffersCache(Asset const& buying, Asset const& selling,
-                           BestOffersCacheEntry& defaultValue) const;
+    // updateEntryCache replaces the cached versions of committed entries. It
+    // does not throw; if an error occurs, then the entry cache is cleared.
+    void updateEntryCache(CommittedEntries const& committed);
+
+    // getOrderBook returns the resident order book for the given asset pair,
+    // loading it from the database if necessary. It has the basic exception
+    // safety guarantee. If it throws an exception, then the order books may
+    // be, but are not guaranteed to be, cleared.
+    OrderBook const& getOrderBook(Asset const& buying,
+                                  Asset const& selling) const;
+
+    // updateOrderBooks applies committed offer changes to the resident order
+    // books. It does not throw; if an error occurs, then the order books are
+    // cleared.
+    void updateOrderBooks(std::vector<OfferChange> const& changes);
+
+    // recordOfferChange has the strong exception safety guarantee
+    void recordOfferChange(EntryIterator const& iter,
+                           std::vector<OfferChange>& changes) const;
+
+    // getInflationVotes returns the inflation vote tally, loading it from the
+    // database if necessary. It has the basic exception safety guarantee. If
+    // it throws an exception, then the tally is not loaded.
+    InflationVoteTally const& getInflationVotes() const;
+
+    // updateInflationVotes applies committed account changes to the tally, if
+    // it is loaded. It does not throw; if an error occurs, then the tally is
+    // unloaded.
+    void updateInflationVotes(std::vector<InflationVoteChange> const& changes);
+
+    // recordInflationVoteChange has the strong exception safety guarantee
+    void
+    recordInflationVoteChange(EntryIterator const& iter,
+                              std::vector<InflationVoteChange>& changes) const;
+
+    // evictOrderBooks and clearOrderBooks do not throw
+    void evictOrderBooks() const;
+    void clearOrderBooks() const;
 
     std::unordered_map<LedgerKey, std::shared_ptr<LedgerEntry const>>
     bulkLoadAccounts(std::unordered_set<LedgerKey> const& keys) const;
@@ -493,7 +796,7 @@ class LedgerTxnRoot::Impl
   public:
     // Constructor has the strong exception safety guarantee
     Impl(Database& db, size_t entryCacheSize, size_t bestOfferCacheSize,
-         size_t prefetchBatchSize);
+         size_t prefetchBatchSize, bool asyncCommit);
 
     ~Impl();
 
@@ -511,6 +814,28 @@ class LedgerTxnRoot::Impl
     // deleteObjectsModifiedOnOrAfterLedger has no exception safety guarantees.
     void deleteObjectsModifiedOnOrAfterLedger(uint32_t ledger) const;
 
+    // isAsyncCommit does not throw
+    bool
+    isAsyncCommit() const
+    {
+        return mAsyncCommit;
+    }
+
+    // beginBucketApply has the basic exception safety guarantee.
+    void beginBucketApply();
+
+    // endBucketApply and isApplyingBuckets do not throw
+    void endBucketApply();
+    bool
+    isApplyingBuckets() const
+    {
+        return mApplyingBuckets;
+    }
+
+    // writeBucketEntries has no exception safety guarantees.
+    void writeBucketEntries(std::vector<BucketEntry> const& entries,
+                            soci::session& session);
+
     // dropAccounts, dropData, dropOffers, and dropTrustLines have no exception
     // safety guarantees.
     void dropAccounts();
@@ -518,6 +843,14 @@ class LedgerTxnRoot::Impl
     void dropOffers();
     void dropTrustLines();
 
+    // The upgrade*ToBinaryKeys functions rewrite one table each for
+    // LedgerTxnRoot::upgradeToBinaryKeys, mapping StrKeys through the strkeys
+    // table it fills. They have no exception safety guarantees.
+    static void upgradeAccountsToBinaryKeys(Database& db);
+    static void upgradeDataToBinaryKeys(Database& db);
+    static void upgradeOffersToBinaryKeys(Database& db);
+    static void upgradeTrustLinesToBinaryKeys(Database& db);
+
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
     void resetForFuzzer();
 #endif // FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
@@ -528,13 +861,20 @@ class LedgerTxnRoot::Impl
     //   modified.
     std::unordered_map<LedgerKey, LedgerEntry> getAllOffers();
 
+    // getOffersBySellerRange has the basic exception safety guarantee. If it
+    // throws an exception, then
+    // - the prepared statement cache may be, but is not guaranteed to be,
+    //   modified.
+    OfferBatch getOffersBySellerRange(AccountID const* afterSeller,
+                                      size_t maxOffers);
+
     // getBestOffer has the basic exception safety guarantee. If it throws an
     // exception, then
     // - the prepared statement cache may be, but is not guaranteed to be,
     //   modified
     // - the entry cache may be, but is not guaranteed to be, modified or even
     //   cleared
-    // - the best offers cache may be, but is not guaranteed to be, modified or
+    // - the order books may be, but are not guaranteed to be, modified or
     //   even cleared
     std::shared_ptr<LedgerEntry const>
     getBestOffer(Asset const& buying, Asset const& selling,
@@ -569,11 +909,47 @@ class LedgerTxnRoot::Impl
     void rollbackChild();
 
     // Prefetch some or all of given keys in batches. Note that no prefetching
-    // could occur if the cache is at its fill ratio. Returns number of keys
-    // prefetched.
+    // could occur if the entries prefetched since the last commit reached the
+    // fill ratio of the cache. Returns number of keys prefetched.
     uint32_t prefetch(std::unordered_set<LedgerKey> const& keys);
 
     double getPrefetchHitRate() const;
+
+    double getEntryCacheHitRate(LedgerEntryType let) const;
+
+    // deferWrite has the strong exception safety guarantee.
+    void deferWrite(DeferredWrite write);
+
+    // waitForDeferredWrites does not throw
+    void waitForDeferredWrites() const;
+};
+
+class LedgerTxnRoot::Impl::PendingDeltaIteratorImpl
+    : public EntryIterator::AbstractImpl
+{
+    typedef decltype(PendingDelta::entries)::const_iterator IteratorType;
+    IteratorType mIter;
+    IteratorType const mEnd;
+
+  public:
+    PendingDeltaIteratorImpl(IteratorType const& begin,
+                             IteratorType const& end);
+
+    void advance() override;
+
+    bool atEnd() const override;
+
+    LedgerEntry const& entry() const override;
+
+    bool entryExists() const override;
+
+    LedgerKey const& key() const override;
+
+    std::shared_ptr<LedgerEntry const> sharedEntry() const override;
+
+    bool entryInArena() const override;
+
+    std::unique_ptr<AbstractImpl> clone() const override;
 };
 
 #ifdef USE_POSTGRES
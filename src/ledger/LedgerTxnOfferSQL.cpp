@@ -6,6 +6,7 @@
 #include "crypto/SecretKey.h"
 #include "database/Database.h"
 #include "database/DatabaseTypeSpecificOperation.h"
+#include "database/PostgresBinaryCopy.h"
 #include "ledger/LedgerTxnImpl.h"
 #include "util/Decoder.h"
 #include "util/Logging.h"
@@ -25,15 +26,18 @@ LedgerTxnRoot::Impl::loadOffer(LedgerKey const& key) const
         return nullptr;
     }
 
-    std::string actIDStrKey = KeyUtils::toStrKey(key.offer().sellerID);
+    std::string sellerID = toBinaryColumn(key.offer().sellerID);
 
-    std::string sql = "SELECT sellerid, offerid, sellingasset, buyingasset, "
+    std::string sql = "SELECT encode(sellerid, 'hex'), offerid, "
+                      "encode(sellingasset, 'hex'), "
+                      "encode(buyingasset, 'hex'), "
                       "amount, pricen, priced, flags, lastmodified "
                       "FROM offers "
-                      "WHERE sellerid= :id AND offerid= :offerid";
+                      "WHERE sellerid = decode(:id, 'hex') "
+                      "AND offerid = :offerid";
     auto prep = mDatabase.getPreparedStatement(sql);
     auto& st = prep.statement();
-    st.exchange(soci::use(actIDStrKey));
+    st.exchange(soci::use(sellerID));
     st.exchange(soci::use(offerID));
 
     std::vector<LedgerEntry> offers;
@@ -49,7 +53,9 @@ LedgerTxnRoot::Impl::loadOffer(LedgerKey const& key) const
 std::vector<LedgerEntry>
 LedgerTxnRoot::Impl::loadAllOffers() const
 {
-    std::string sql = "SELECT sellerid, offerid, sellingasset, buyingasset, "
+    std::string sql = "SELECT encode(sellerid, 'hex'), offerid, "
+                      "encode(sellingasset, 'hex'), "
+                      "encode(buyingasset, 'hex'), "
                       "amount, pricen, priced, flags, lastmodified "
                       "FROM offers";
     auto prep = mDatabase.getPreparedStatement(sql);
@@ -62,39 +68,99 @@ LedgerTxnRoot::Impl::loadAllOffers() const
     return offers;
 }
 
-std::list<LedgerEntry>::const_iterator
-LedgerTxnRoot::Impl::loadBestOffers(std::list<LedgerEntry>& offers,
-                                    Asset const& buying, Asset const& selling,
-                                    size_t numOffers, size_t offset) const
+std::vector<LedgerEntry>
+LedgerTxnRoot::Impl::loadOffersBySellerRange(
+    AccountID const* afterSeller, size_t maxOffers,
+    xdr::pointer<AccountID>& lastSeller) const
+{
+    // The offersbyseller index serves both queries. Without afterSeller, the
+    // range starts at the empty blob, which sorts before every key.
+    std::string sql = "SELECT encode(sellerid, 'hex'), offerid, "
+                      "encode(sellingasset, 'hex'), "
+                      "encode(buyingasset, 'hex'), "
+                      "amount, pricen, priced, flags, lastmodified "
+                      "FROM offers WHERE sellerid > decode(:v1, 'hex') "
+                      "ORDER BY sellerid, offerid LIMIT :v2";
+    std::string after = afterSeller ? toBinaryColumn(*afterSeller) : "";
+    int64_t limit = std::max<int64_t>(1, maxOffers);
+
+    auto prep = mDatabase.getPreparedStatement(sql);
+    auto& st = prep.statement();
+    st.exchange(soci::use(after));
+    st.exchange(soci::use(limit));
+
+    std::vector<LedgerEntry> offers;
+    {
+        auto timer = mDatabase.getSelectTimer("offer");
+        offers = loadOffers(prep);
+    }
+
+    lastSeller.reset();
+    if (offers.size() < static_cast<size_t>(limit))
+    {
+        // Every remaining offer was loaded
+        return offers;
+    }
+
+    // The offers of the last seller are never split, so the rest of them are
+    // loaded as well
+    auto const sellerID = offers.back().data.offer().sellerID;
+    int64_t offerID = offers.back().data.offer().offerID;
+    std::string seller = toBinaryColumn(sellerID);
+    std::string sqlRest = "SELECT encode(sellerid, 'hex'), offerid, "
+                          "encode(sellingasset, 'hex'), "
+                          "encode(buyingasset, 'hex'), "
+                          "amount, pricen, priced, flags, lastmodified "
+                          "FROM offers WHERE sellerid = decode(:v1, 'hex') "
+                          "AND offerid > :v2";
+
+    auto prepRest = mDatabase.getPreparedStatement(sqlRest);
+    auto& stRest = prepRest.statement();
+    stRest.exchange(soci::use(seller));
+    stRest.exchange(soci::use(offerID));
+
+    std::vector<LedgerEntry> rest;
+    {
+        auto timer = mDatabase.getSelectTimer("offer");
+        rest = loadOffers(prepRest);
+    }
+    offers.insert(offers.end(), std::make_move_iterator(rest.begin()),
+                  std::make_move_iterator(rest.end()));
+    lastSeller.activate() = sellerID;
+    return offers;
+}
+
+std::vector<LedgerEntry>
+LedgerTxnRoot::Impl::loadOffersByAssetPair(Asset const& buying,
+                                           Asset const& selling) const
 {
-    std::string sql = "SELECT sellerid, offerid, sellingasset, buyingasset, "
+    std::string sql = "SELECT encode(sellerid, 'hex'), offerid, "
+                      "encode(sellingasset, 'hex'), "
+                      "encode(buyingasset, 'hex'), "
                       "amount, pricen, priced, flags, lastmodified "
                       "FROM offers "
-                      "WHERE sellingasset = :v1 AND buyingasset = :v2";
+                      "WHERE sellingasset = decode(:v1, 'hex') "
+                      "AND buyingasset = decode(:v2, 'hex')";
 
     std::string buyingAsset, sellingAsset;
-    buyingAsset = decoder::encode_b64(xdr::xdr_to_opaque(buying));
-    sellingAsset = decoder::encode_b64(xdr::xdr_to_opaque(selling));
-
-    // price is an approximation of the actual n/d (truncated math, 15 digits)
-    // ordering by offerid gives precendence to older offers for fairness
-    sql += " ORDER BY price, offerid LIMIT :n OFFSET :o";
+    buyingAsset = xdrToBinaryColumn(buying);
+    sellingAsset = xdrToBinaryColumn(selling);
 
     auto prep = mDatabase.getPreparedStatement(sql);
     auto& st = prep.statement();
     st.exchange(soci::use(sellingAsset));
     st.exchange(soci::use(buyingAsset));
-    st.exchange(soci::use(numOffers));
-    st.exchange(soci::use(offset));
 
+    std::vector<LedgerEntry> offers;
     {
         auto timer = mDatabase.getSelectTimer("offer");
-        return loadOffers(prep, offers);
+        offers = loadOffers(prep);
     }
+    return offers;
 }
 
-// Note: The order induced by this function must match the order used in the
-// SQL query for loadBestOffers above.
+// Note: The order induced by this function must match the order induced by
+// LedgerTxnRoot::Impl::OfferDescriptor, which is used to sort order books.
 bool
 isBetterOffer(LedgerEntry const& lhsEntry, LedgerEntry const& rhsEntry)
 {
@@ -127,19 +193,22 @@ std::vector<LedgerEntry>
 LedgerTxnRoot::Impl::loadOffersByAccountAndAsset(AccountID const& accountID,
                                                  Asset const& asset) const
 {
-    std::string sql = "SELECT sellerid, offerid, sellingasset, buyingasset, "
+    std::string sql = "SELECT encode(sellerid, 'hex'), offerid, "
+                      "encode(sellingasset, 'hex'), "
+                      "encode(buyingasset, 'hex'), "
                       "amount, pricen, priced, flags, lastmodified "
-                      "FROM offers WHERE sellerid = :v1 AND "
-                      "(sellingasset = :v2 OR buyingasset = :v3)";
+                      "FROM offers WHERE sellerid = decode(:v1, 'hex') AND "
+                      "(sellingasset = decode(:v2, 'hex') OR "
+                      "buyingasset = decode(:v3, 'hex'))";
     // Note: v2 == v3 but positional parameters are faster
 
-    std::string accountStr = KeyUtils::toStrKey(accountID);
+    std::string accountStr = toBinaryColumn(accountID);
 
     if (asset.type() == ASSET_TYPE_NATIVE)
     {
         throw std::runtime_error("Invalid asset type");
     }
-    std::string assetStr = decoder::encode_b64(xdr::xdr_to_opaque(asset));
+    std::string assetStr = xdrToBinaryColumn(asset);
 
     auto prep = mDatabase.getPreparedStatement(sql);
     auto& st = prep.statement();
@@ -159,63 +228,16 @@ static Asset
 processAsset(std::string const& asset)
 {
     Asset res;
-    std::vector<uint8_t> assetOpaque;
-    decoder::decode_b64(asset, assetOpaque);
-    xdr::xdr_from_opaque(assetOpaque, res);
+    xdrFromBinaryColumn(asset, res);
     return res;
 }
 
-std::list<LedgerEntry>::const_iterator
-LedgerTxnRoot::Impl::loadOffers(StatementContext& prep,
-                                std::list<LedgerEntry>& offers) const
-{
-    std::string actIDStrKey;
-    std::string sellingAsset, buyingAsset;
-
-    LedgerEntry le;
-    le.data.type(OFFER);
-    OfferEntry& oe = le.data.offer();
-
-    auto& st = prep.statement();
-    st.exchange(soci::into(actIDStrKey));
-    st.exchange(soci::into(oe.offerID));
-    st.exchange(soci::into(sellingAsset));
-    st.exchange(soci::into(buyingAsset));
-    st.exchange(soci::into(oe.amount));
-    st.exchange(soci::into(oe.price.n));
-    st.exchange(soci::into(oe.price.d));
-    st.exchange(soci::into(oe.flags));
-    st.exchange(soci::into(le.lastModifiedLedgerSeq));
-    st.define_and_bind();
-    st.execute(true);
-
-    auto iterNext = offers.cend();
-    while (st.got_data())
-    {
-        oe.sellerID = KeyUtils::fromStrKey<PublicKey>(actIDStrKey);
-        oe.selling = processAsset(sellingAsset);
-        oe.buying = processAsset(buyingAsset);
-
-        if (iterNext == offers.cend())
-        {
-            iterNext = offers.emplace(iterNext, le);
-        }
-        else
-        {
-            offers.emplace_back(le);
-        }
-        st.fetch();
-    }
-
-    return iterNext;
-}
-
 std::vector<LedgerEntry>
 LedgerTxnRoot::Impl::loadOffers(StatementContext& prep) const
 {
     std::vector<LedgerEntry> offers;
 
-    std::string actIDStrKey;
+    std::string sellerID;
     std::string sellingAsset, buyingAsset;
 
     LedgerEntry le;
@@ -223,7 +245,7 @@ LedgerTxnRoot::Impl::loadOffers(StatementContext& prep) const
     OfferEntry& oe = le.data.offer();
 
     auto& st = prep.statement();
-    st.exchange(soci::into(actIDStrKey));
+    st.exchange(soci::into(sellerID));
     st.exchange(soci::into(oe.offerID));
     st.exchange(soci::into(sellingAsset));
     st.exchange(soci::into(buyingAsset));
@@ -237,7 +259,7 @@ LedgerTxnRoot::Impl::loadOffers(StatementContext& prep) const
 
     while (st.got_data())
     {
-        oe.sellerID = KeyUtils::fromStrKey<PublicKey>(actIDStrKey);
+        oe.sellerID = publicKeyFromBinaryColumn(sellerID);
         oe.selling = processAsset(sellingAsset);
         oe.buying = processAsset(buyingAsset);
 
@@ -251,6 +273,7 @@ LedgerTxnRoot::Impl::loadOffers(StatementContext& prep) const
 class BulkUpsertOffersOperation : public DatabaseTypeSpecificOperation<void>
 {
     Database& mDB;
+    soci::session& mSession;
     std::vector<std::string> mSellerIDs;
     std::vector<int64_t> mOfferIDs;
     std::vector<std::string> mSellingAssets;
@@ -268,13 +291,11 @@ class BulkUpsertOffersOperation : public DatabaseTypeSpecificOperation<void>
         assert(entry.data.type() == OFFER);
         auto const& offer = entry.data.offer();
 
-        mSellerIDs.emplace_back(KeyUtils::toStrKey(offer.sellerID));
+        mSellerIDs.emplace_back(toBinaryColumn(offer.sellerID));
         mOfferIDs.emplace_back(offer.offerID);
 
-        mSellingAssets.emplace_back(
-            decoder::encode_b64(xdr::xdr_to_opaque(offer.selling)));
-        mBuyingAssets.emplace_back(
-            decoder::encode_b64(xdr::xdr_to_opaque(offer.buying)));
+        mSellingAssets.emplace_back(xdrToBinaryColumn(offer.selling));
+        mBuyingAssets.emplace_back(xdrToBinaryColumn(offer.buying));
 
         mAmounts.emplace_back(offer.amount);
         mPriceNs.emplace_back(offer.price.n);
@@ -288,9 +309,9 @@ class BulkUpsertOffersOperation : public DatabaseTypeSpecificOperation<void>
     }
 
   public:
-    BulkUpsertOffersOperation(Database& DB,
+    BulkUpsertOffersOperation(Database& DB, soci::session& session,
                               std::vector<LedgerEntry> const& entries)
-        : mDB(DB)
+        : mDB(DB), mSession(session)
     {
         mSellerIDs.reserve(entries.size());
         mOfferIDs.reserve(entries.size());
@@ -309,9 +330,9 @@ class BulkUpsertOffersOperation : public DatabaseTypeSpecificOperation<void>
         }
     }
 
-    BulkUpsertOffersOperation(Database& DB,
+    BulkUpsertOffersOperation(Database& DB, soci::session& session,
                               std::vector<EntryIterator> const& entries)
-        : mDB(DB)
+        : mDB(DB), mSession(session)
     {
         mSellerIDs.reserve(entries.size());
         mOfferIDs.reserve(entries.size());
@@ -338,7 +359,8 @@ class BulkUpsertOffersOperation : public DatabaseTypeSpecificOperation<void>
                           "sellerid, offerid, sellingasset, buyingasset, "
                           "amount, pricen, priced, price, flags, lastmodified "
                           ") VALUES ( "
-                          ":v1, :v2, :v3, :v4, :v5, :v6, :v7, :v8, :v9, :v10 "
+                          "decode(:v1, 'hex'), :v2, decode(:v3, 'hex'), "
+                          "decode(:v4, 'hex'), :v5, :v6, :v7, :v8, :v9, :v10 "
                           ") ON CONFLICT (offerid) DO UPDATE SET "
                           "sellerid = excluded.sellerid, "
                           "sellingasset = excluded.sellingasset, "
@@ -349,7 +371,7 @@ class BulkUpsertOffersOperation : public DatabaseTypeSpecificOperation<void>
                           "price = excluded.price, "
                           "flags = excluded.flags, "
                           "lastmodified = excluded.lastmodified ";
-        auto prep = mDB.getPreparedStatement(sql);
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(mSellerIDs));
         st.exchange(soci::use(mOfferIDs));
@@ -379,9 +401,69 @@ class BulkUpsertOffersOperation : public DatabaseTypeSpecificOperation<void>
     }
 
 #ifdef USE_POSTGRES
+    void
+    doPostgresCopyOperation(soci::postgresql_session_backend* pg)
+    {
+        std::string columns = "sellerid, offerid, sellingasset, buyingasset, "
+                              "amount, pricen, priced, price, flags, "
+                              "lastmodified";
+
+        PostgresBinaryCopy copy(10);
+        for (size_t i = 0; i < mOfferIDs.size(); ++i)
+        {
+            copy.startRow();
+            copy.appendHex(mSellerIDs[i]);
+            copy.append(mOfferIDs[i]);
+            copy.appendHex(mSellingAssets[i]);
+            copy.appendHex(mBuyingAssets[i]);
+            copy.append(mAmounts[i]);
+            copy.append(mPriceNs[i]);
+            copy.append(mPriceDs[i]);
+            copy.append(mPrices[i]);
+            copy.append(mFlags[i]);
+            copy.append(mLastModifieds[i]);
+        }
+
+        std::string sql = "INSERT INTO offers ( " + columns + " ) SELECT " +
+                          columns +
+                          " FROM tmpoffers "
+                          "ON CONFLICT (offerid) DO UPDATE SET "
+                          "sellerid = excluded.sellerid, "
+                          "sellingasset = excluded.sellingasset, "
+                          "buyingasset = excluded.buyingasset, "
+                          "amount = excluded.amount, "
+                          "pricen = excluded.pricen, "
+                          "priced = excluded.priced, "
+                          "price = excluded.price, "
+                          "flags = excluded.flags, "
+                          "lastmodified = excluded.lastmodified ";
+        // The statement is prepared as soon as it is created, so the
+        // temporary table it reads from has to exist by then
+        mSession << "CREATE TEMP TABLE IF NOT EXISTS tmpoffers "
+                    "(LIKE offers)";
+        auto prep = mDB.getPreparedStatement(sql, mSession);
+        soci::statement& st = prep.statement();
+        st.define_and_bind();
+        {
+            auto timer = mDB.getUpsertTimer("offer");
+            mSession << "TRUNCATE tmpoffers";
+            copy.copyInto(pg->conn_, "tmpoffers", columns);
+            st.execute(true);
+        }
+        if (static_cast<size_t>(st.get_affected_rows()) != mOfferIDs.size())
+        {
+            throw std::runtime_error("Could not update data in SQL");
+        }
+    }
+
     void
     doPostgresSpecificOperation(soci::postgresql_session_backend* pg) override
     {
+        if (mOfferIDs.size() >= mDB.getBulkUpsertCopyThreshold())
+        {
+            doPostgresCopyOperation(pg);
+            return;
+        }
 
         std::string strSellerIDs, strOfferIDs, strSellingAssets,
             strBuyingAssets, strAmounts, strPriceNs, strPriceDs, strPrices,
@@ -402,10 +484,10 @@ class BulkUpsertOffersOperation : public DatabaseTypeSpecificOperation<void>
         marshalToPGArray(conn, strLastModifieds, mLastModifieds);
 
         std::string sql = "WITH r AS (SELECT "
-                          "unnest(:v1::TEXT[]), "
+                          "decode(unnest(:v1::TEXT[]), 'hex'), "
                           "unnest(:v2::BIGINT[]), "
-                          "unnest(:v3::TEXT[]), "
-                          "unnest(:v4::TEXT[]), "
+                          "decode(unnest(:v3::TEXT[]), 'hex'), "
+                          "decode(unnest(:v4::TEXT[]), 'hex'), "
                           "unnest(:v5::BIGINT[]), "
                           "unnest(:v6::INT[]), "
                           "unnest(:v7::INT[]), "
@@ -427,7 +509,7 @@ class BulkUpsertOffersOperation : public DatabaseTypeSpecificOperation<void>
                           "price = excluded.price, "
                           "flags = excluded.flags, "
                           "lastmodified = excluded.lastmodified ";
-        auto prep = mDB.getPreparedStatement(sql);
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(strSellerIDs));
         st.exchange(soci::use(strOfferIDs));
@@ -455,13 +537,15 @@ class BulkUpsertOffersOperation : public DatabaseTypeSpecificOperation<void>
 class BulkDeleteOffersOperation : public DatabaseTypeSpecificOperation<void>
 {
     Database& mDB;
+    soci::session& mSession;
     LedgerTxnConsistency mCons;
     std::vector<int64_t> mOfferIDs;
 
   public:
-    BulkDeleteOffersOperation(Database& DB, LedgerTxnConsistency cons,
+    BulkDeleteOffersOperation(Database& DB, soci::session& session,
+                              LedgerTxnConsistency cons,
                               std::vector<EntryIterator> const& entries)
-        : mDB(DB), mCons(cons)
+        : mDB(DB), mSession(session), mCons(cons)
     {
         for (auto const& e : entries)
         {
@@ -476,7 +560,7 @@ class BulkDeleteOffersOperation : public DatabaseTypeSpecificOperation<void>
     doSociGenericOperation()
     {
         std::string sql = "DELETE FROM offers WHERE offerid = :id";
-        auto prep = mDB.getPreparedStatement(sql);
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(mOfferIDs));
         st.define_and_bind();
@@ -509,7 +593,7 @@ class BulkDeleteOffersOperation : public DatabaseTypeSpecificOperation<void>
                           ") "
                           "DELETE FROM offers WHERE "
                           "offerid IN (SELECT * FROM r)";
-        auto prep = mDB.getPreparedStatement(sql);
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(strOfferIDs));
         st.define_and_bind();
@@ -527,26 +611,30 @@ class BulkDeleteOffersOperation : public DatabaseTypeSpecificOperation<void>
 };
 
 void
-LedgerTxnRoot::Impl::bulkUpsertOffers(std::vector<EntryIterator> const& entries)
+LedgerTxnRoot::Impl::bulkUpsertOffers(
+    std::vector<EntryIterator> const& entries, soci::session& session)
 {
-    BulkUpsertOffersOperation op(mDatabase, entries);
-    mDatabase.doDatabaseTypeSpecificOperation(op);
+    BulkUpsertOffersOperation op(mDatabase, session, entries);
+    mDatabase.doDatabaseTypeSpecificOperation(op, session);
 }
 
 void
-LedgerTxnRoot::Impl::bulkDeleteOffers(std::vector<EntryIterator> const& entries,
-                                      LedgerTxnConsistency cons)
+LedgerTxnRoot::Impl::bulkDeleteOffers(
+    std::vector<EntryIterator> const& entries, LedgerTxnConsistency cons,
+    soci::session& session)
 {
-    BulkDeleteOffersOperation op(mDatabase, cons, entries);
-    mDatabase.doDatabaseTypeSpecificOperation(op);
+    BulkDeleteOffersOperation op(mDatabase, session, cons, entries);
+    mDatabase.doDatabaseTypeSpecificOperation(op, session);
 }
 
 void
 LedgerTxnRoot::Impl::dropOffers()
 {
     throwIfChild();
+    waitForFlush(0);
+    retireFlushedDeltas();
     mEntryCache.clear();
-    mBestOffersCache.clear();
+    clearOrderBooks();
 
     mDatabase.getSession() << "DROP TABLE IF EXISTS offers;";
     mDatabase.getSession()
@@ -568,6 +656,41 @@ LedgerTxnRoot::Impl::dropOffers()
                               "(sellingasset,buyingasset,price);";
 }
 
+void
+LedgerTxnRoot::Impl::upgradeOffersToBinaryKeys(Database& db)
+{
+    auto& session = db.getSession();
+    auto binary = db.getBinaryType();
+
+    std::string sql =
+        "CREATE TABLE offersbinary"
+        "("
+        "sellerid         " + binary + "            NOT NULL,"
+        "offerid          BIGINT           NOT NULL CHECK (offerid >= 0),"
+        "sellingasset     " + binary + "            NOT NULL,"
+        "buyingasset      " + binary + "            NOT NULL,"
+        "amount           BIGINT           NOT NULL CHECK (amount >= 0),"
+        "pricen           INT              NOT NULL,"
+        "priced           INT              NOT NULL,"
+        "price            DOUBLE PRECISION NOT NULL,"
+        "flags            INT              NOT NULL,"
+        "lastmodified     INT              NOT NULL,"
+        "PRIMARY KEY      (offerid)"
+        ");";
+    session << sql;
+    session << "INSERT INTO offersbinary (sellerid, offerid, sellingasset, "
+               "buyingasset, amount, pricen, priced, price, flags, "
+               "lastmodified) "
+               "SELECT rawkey, offerid, decode(sellingasset, 'base64'), "
+               "decode(buyingasset, 'base64'), amount, pricen, priced, price, "
+               "flags, lastmodified "
+               "FROM offers JOIN strkeys ON sellerid = strkey";
+    session << "DROP TABLE offers";
+    session << "ALTER TABLE offersbinary RENAME TO offers";
+    session << "CREATE INDEX bestofferindex ON offers "
+               "(sellingasset,buyingasset,price);";
+}
+
 class BulkLoadOffersOperation
     : public DatabaseTypeSpecificOperation<std::vector<LedgerEntry>>
 {
@@ -602,7 +725,7 @@ class BulkLoadOffersOperation
         std::vector<LedgerEntry> res;
         while (st.got_data())
         {
-            auto pubKey = KeyUtils::fromStrKey<PublicKey>(sellerID);
+            auto pubKey = publicKeyFromBinaryColumn(sellerID);
 
             // Exclude offers where sellerID in LedgerKey doesn't match sellerID
             // in LedgerEntry
@@ -651,7 +774,8 @@ class BulkLoadOffersOperation
     doSqliteSpecificOperation(soci::sqlite3_session_backend* sq) override
     {
         std::string sql =
-            "SELECT sellerid, offerid, sellingasset, buyingasset, "
+            "SELECT encode(sellerid, 'hex'), offerid, "
+            "encode(sellingasset, 'hex'), encode(buyingasset, 'hex'), "
             "amount, pricen, priced, flags, lastmodified "
             "FROM offers WHERE offerid IN carray(?, ?, 'int64')";
 
@@ -680,7 +804,8 @@ class BulkLoadOffersOperation
 
         std::string sql =
             "WITH r AS (SELECT unnest(:v1::BIGINT[])) "
-            "SELECT sellerid, offerid, sellingasset, buyingasset, "
+            "SELECT encode(sellerid, 'hex'), offerid, "
+            "encode(sellingasset, 'hex'), encode(buyingasset, 'hex'), "
             "amount, pricen, priced, flags, lastmodified "
             "FROM offers WHERE offerid IN (SELECT * FROM r)";
         auto prep = mDb.getPreparedStatement(sql);
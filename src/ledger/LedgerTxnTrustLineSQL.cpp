@@ -6,6 +6,7 @@
 #include "crypto/SecretKey.h"
 #include "database/Database.h"
 #include "database/DatabaseTypeSpecificOperation.h"
+#include "database/PostgresBinaryCopy.h"
 #include "ledger/LedgerTxnImpl.h"
 #include "util/XDROperators.h"
 #include "util/types.h"
@@ -27,16 +28,16 @@ getTrustLineStrings(AccountID const& accountID, Asset const& asset,
         throw std::runtime_error("TrustLine accountID is issuer");
     }
 
-    accountIDStr = KeyUtils::toStrKey(accountID);
+    accountIDStr = toBinaryColumn(accountID);
     if (asset.type() == ASSET_TYPE_CREDIT_ALPHANUM4)
     {
         assetCodeToStr(asset.alphaNum4().assetCode, assetCodeStr);
-        issuerStr = KeyUtils::toStrKey(asset.alphaNum4().issuer);
+        issuerStr = toBinaryColumn(asset.alphaNum4().issuer);
     }
     else if (asset.type() == ASSET_TYPE_CREDIT_ALPHANUM12)
     {
         assetCodeToStr(asset.alphaNum12().assetCode, assetCodeStr);
-        issuerStr = KeyUtils::toStrKey(asset.alphaNum12().issuer);
+        issuerStr = toBinaryColumn(asset.alphaNum12().issuer);
     }
     else
     {
@@ -61,7 +62,8 @@ LedgerTxnRoot::Impl::loadTrustLine(LedgerKey const& key) const
     auto prep = mDatabase.getPreparedStatement(
         "SELECT tlimit, balance, flags, lastmodified, buyingliabilities, "
         "sellingliabilities FROM trustlines "
-        "WHERE accountid= :id AND issuer= :issuer AND assetcode= :asset");
+        "WHERE accountid = decode(:id, 'hex') "
+        "AND issuer = decode(:issuer, 'hex') AND assetcode = :asset");
     auto& st = prep.statement();
     st.exchange(soci::into(tl.limit));
     st.exchange(soci::into(tl.balance));
@@ -98,6 +100,7 @@ LedgerTxnRoot::Impl::loadTrustLine(LedgerKey const& key) const
 class BulkUpsertTrustLinesOperation : public DatabaseTypeSpecificOperation<void>
 {
     Database& mDB;
+    soci::session& mSession;
     std::vector<std::string> mAccountIDs;
     std::vector<int32_t> mAssetTypes;
     std::vector<std::string> mIssuers;
@@ -111,9 +114,9 @@ class BulkUpsertTrustLinesOperation : public DatabaseTypeSpecificOperation<void>
     std::vector<soci::indicator> mLiabilitiesInds;
 
   public:
-    BulkUpsertTrustLinesOperation(Database& DB,
+    BulkUpsertTrustLinesOperation(Database& DB, soci::session& session,
                                   std::vector<EntryIterator> const& entries)
-        : mDB(DB)
+        : mDB(DB), mSession(session)
     {
         mAccountIDs.reserve(entries.size());
         mAssetTypes.reserve(entries.size());
@@ -172,7 +175,8 @@ class BulkUpsertTrustLinesOperation : public DatabaseTypeSpecificOperation<void>
             "tlimit, balance, flags, lastmodified, "
             "buyingliabilities, sellingliabilities "
             ") VALUES ( "
-            ":id, :v1, :v2, :v3, :v4, :v5, :v6, :v7, :v8, :v9 "
+            "decode(:id, 'hex'), :v1, decode(:v2, 'hex'), :v3, :v4, :v5, :v6, "
+            ":v7, :v8, :v9 "
             ") ON CONFLICT (accountid, issuer, assetcode) DO UPDATE SET "
             "assettype = excluded.assettype, "
             "tlimit = excluded.tlimit, "
@@ -181,7 +185,7 @@ class BulkUpsertTrustLinesOperation : public DatabaseTypeSpecificOperation<void>
             "lastmodified = excluded.lastmodified, "
             "buyingliabilities = excluded.buyingliabilities, "
             "sellingliabilities = excluded.sellingliabilities ";
-        auto prep = mDB.getPreparedStatement(sql);
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(mAccountIDs));
         st.exchange(soci::use(mAssetTypes));
@@ -211,9 +215,68 @@ class BulkUpsertTrustLinesOperation : public DatabaseTypeSpecificOperation<void>
     }
 
 #ifdef USE_POSTGRES
+    void
+    doPostgresCopyOperation(soci::postgresql_session_backend* pg)
+    {
+        std::string columns = "accountid, assettype, issuer, assetcode, "
+                              "tlimit, balance, flags, lastmodified, "
+                              "buyingliabilities, sellingliabilities";
+
+        PostgresBinaryCopy copy(10);
+        for (size_t i = 0; i < mAccountIDs.size(); ++i)
+        {
+            copy.startRow();
+            copy.appendHex(mAccountIDs[i]);
+            copy.append(mAssetTypes[i]);
+            copy.appendHex(mIssuers[i]);
+            copy.append(mAssetCodes[i]);
+            copy.append(mTlimits[i]);
+            copy.append(mBalances[i]);
+            copy.append(mFlags[i]);
+            copy.append(mLastModifieds[i]);
+            copy.append(mBuyingLiabilities[i], mLiabilitiesInds[i]);
+            copy.append(mSellingLiabilities[i], mLiabilitiesInds[i]);
+        }
+
+        std::string sql =
+            "INSERT INTO trustlines ( " + columns + " ) SELECT " + columns +
+            " FROM tmptrustlines "
+            "ON CONFLICT (accountid, issuer, assetcode) DO UPDATE SET "
+            "assettype = excluded.assettype, "
+            "tlimit = excluded.tlimit, "
+            "balance = excluded.balance, "
+            "flags = excluded.flags, "
+            "lastmodified = excluded.lastmodified, "
+            "buyingliabilities = excluded.buyingliabilities, "
+            "sellingliabilities = excluded.sellingliabilities ";
+        // The statement is prepared as soon as it is created, so the
+        // temporary table it reads from has to exist by then
+        mSession << "CREATE TEMP TABLE IF NOT EXISTS tmptrustlines "
+                    "(LIKE trustlines)";
+        auto prep = mDB.getPreparedStatement(sql, mSession);
+        soci::statement& st = prep.statement();
+        st.define_and_bind();
+        {
+            auto timer = mDB.getUpsertTimer("trustline");
+            mSession << "TRUNCATE tmptrustlines";
+            copy.copyInto(pg->conn_, "tmptrustlines", columns);
+            st.execute(true);
+        }
+        if (static_cast<size_t>(st.get_affected_rows()) != mAccountIDs.size())
+        {
+            throw std::runtime_error("Could not update data in SQL");
+        }
+    }
+
     void
     doPostgresSpecificOperation(soci::postgresql_session_backend* pg) override
     {
+        if (mAccountIDs.size() >= mDB.getBulkUpsertCopyThreshold())
+        {
+            doPostgresCopyOperation(pg);
+            return;
+        }
+
         PGconn* conn = pg->conn_;
 
         std::string strAccountIDs, strAssetTypes, strIssuers, strAssetCodes,
@@ -235,9 +298,9 @@ class BulkUpsertTrustLinesOperation : public DatabaseTypeSpecificOperation<void>
 
         std::string sql =
             "WITH r AS (SELECT "
-            "unnest(:ids::TEXT[]), "
+            "decode(unnest(:ids::TEXT[]), 'hex'), "
             "unnest(:v1::INT[]), "
-            "unnest(:v2::TEXT[]), "
+            "decode(unnest(:v2::TEXT[]), 'hex'), "
             "unnest(:v3::TEXT[]), "
             "unnest(:v4::BIGINT[]), "
             "unnest(:v5::BIGINT[]), "
@@ -259,7 +322,7 @@ class BulkUpsertTrustLinesOperation : public DatabaseTypeSpecificOperation<void>
             "lastmodified = excluded.lastmodified, "
             "buyingliabilities = excluded.buyingliabilities, "
             "sellingliabilities = excluded.sellingliabilities ";
-        auto prep = mDB.getPreparedStatement(sql);
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(strAccountIDs));
         st.exchange(soci::use(strAssetTypes));
@@ -287,15 +350,17 @@ class BulkUpsertTrustLinesOperation : public DatabaseTypeSpecificOperation<void>
 class BulkDeleteTrustLinesOperation : public DatabaseTypeSpecificOperation<void>
 {
     Database& mDB;
+    soci::session& mSession;
     LedgerTxnConsistency mCons;
     std::vector<std::string> mAccountIDs;
     std::vector<std::string> mIssuers;
     std::vector<std::string> mAssetCodes;
 
   public:
-    BulkDeleteTrustLinesOperation(Database& DB, LedgerTxnConsistency cons,
+    BulkDeleteTrustLinesOperation(Database& DB, soci::session& session,
+                                  LedgerTxnConsistency cons,
                                   std::vector<EntryIterator> const& entries)
-        : mDB(DB), mCons(cons)
+        : mDB(DB), mSession(session), mCons(cons)
     {
         mAccountIDs.reserve(entries.size());
         mIssuers.reserve(entries.size());
@@ -317,9 +382,10 @@ class BulkDeleteTrustLinesOperation : public DatabaseTypeSpecificOperation<void>
     void
     doSociGenericOperation()
     {
-        std::string sql = "DELETE FROM trustlines WHERE accountid = :id "
-                          "AND issuer = :v1 AND assetcode = :v2";
-        auto prep = mDB.getPreparedStatement(sql);
+        std::string sql = "DELETE FROM trustlines "
+                          "WHERE accountid = decode(:id, 'hex') "
+                          "AND issuer = decode(:v1, 'hex') AND assetcode = :v2";
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(mAccountIDs));
         st.exchange(soci::use(mIssuers));
@@ -352,13 +418,13 @@ class BulkDeleteTrustLinesOperation : public DatabaseTypeSpecificOperation<void>
         marshalToPGArray(conn, strIssuers, mIssuers);
         marshalToPGArray(conn, strAssetCodes, mAssetCodes);
         std::string sql = "WITH r AS (SELECT "
-                          "unnest(:ids::TEXT[]), "
-                          "unnest(:v1::TEXT[]), "
+                          "decode(unnest(:ids::TEXT[]), 'hex'), "
+                          "decode(unnest(:v1::TEXT[]), 'hex'), "
                           "unnest(:v2::TEXT[]) "
                           ") "
                           "DELETE FROM trustlines WHERE "
                           "(accountid, issuer, assetcode) IN (SELECT * FROM r)";
-        auto prep = mDB.getPreparedStatement(sql);
+        auto prep = mDB.getPreparedStatement(sql, mSession);
         soci::statement& st = prep.statement();
         st.exchange(soci::use(strAccountIDs));
         st.exchange(soci::use(strIssuers));
@@ -379,26 +445,29 @@ class BulkDeleteTrustLinesOperation : public DatabaseTypeSpecificOperation<void>
 
 void
 LedgerTxnRoot::Impl::bulkUpsertTrustLines(
-    std::vector<EntryIterator> const& entries)
+    std::vector<EntryIterator> const& entries, soci::session& session)
 {
-    BulkUpsertTrustLinesOperation op(mDatabase, entries);
-    mDatabase.doDatabaseTypeSpecificOperation(op);
+    BulkUpsertTrustLinesOperation op(mDatabase, session, entries);
+    mDatabase.doDatabaseTypeSpecificOperation(op, session);
 }
 
 void
 LedgerTxnRoot::Impl::bulkDeleteTrustLines(
-    std::vector<EntryIterator> const& entries, LedgerTxnConsistency cons)
+    std::vector<EntryIterator> const& entries, LedgerTxnConsistency cons,
+    soci::session& session)
 {
-    BulkDeleteTrustLinesOperation op(mDatabase, cons, entries);
-    mDatabase.doDatabaseTypeSpecificOperation(op);
+    BulkDeleteTrustLinesOperation op(mDatabase, session, cons, entries);
+    mDatabase.doDatabaseTypeSpecificOperation(op, session);
 }
 
 void
 LedgerTxnRoot::Impl::dropTrustLines()
 {
     throwIfChild();
+    waitForFlush(0);
+    retireFlushedDeltas();
     mEntryCache.clear();
-    mBestOffersCache.clear();
+    clearOrderBooks();
 
     mDatabase.getSession() << "DROP TABLE IF EXISTS trustlines;";
     mDatabase.getSession()
@@ -418,6 +487,40 @@ LedgerTxnRoot::Impl::dropTrustLines()
            ");";
 }
 
+void
+LedgerTxnRoot::Impl::upgradeTrustLinesToBinaryKeys(Database& db)
+{
+    auto& session = db.getSession();
+    auto binary = db.getBinaryType();
+
+    std::string sql =
+        "CREATE TABLE trustlinesbinary"
+        "("
+        "accountid    " + binary + "           NOT NULL,"
+        "assettype    INT             NOT NULL,"
+        "issuer       " + binary + "           NOT NULL,"
+        "assetcode    VARCHAR(12)     NOT NULL,"
+        "tlimit       BIGINT          NOT NULL CHECK (tlimit > 0),"
+        "balance      BIGINT          NOT NULL CHECK (balance >= 0),"
+        "buyingliabilities BIGINT CHECK (buyingliabilities >= 0),"
+        "sellingliabilities BIGINT CHECK (sellingliabilities >= 0),"
+        "flags        INT             NOT NULL,"
+        "lastmodified INT             NOT NULL,"
+        "PRIMARY KEY  (accountid, issuer, assetcode)"
+        ");";
+    session << sql;
+    session << "INSERT INTO trustlinesbinary (accountid, assettype, issuer, "
+               "assetcode, tlimit, balance, buyingliabilities, "
+               "sellingliabilities, flags, lastmodified) "
+               "SELECT a.rawkey, assettype, i.rawkey, assetcode, tlimit, "
+               "balance, buyingliabilities, sellingliabilities, flags, "
+               "lastmodified "
+               "FROM trustlines JOIN strkeys a ON accountid = a.strkey "
+               "JOIN strkeys i ON issuer = i.strkey";
+    session << "DROP TABLE trustlines";
+    session << "ALTER TABLE trustlinesbinary RENAME TO trustlines";
+}
+
 class BulkLoadTrustLinesOperation
     : public DatabaseTypeSpecificOperation<std::vector<LedgerEntry>>
 {
@@ -459,20 +562,19 @@ class BulkLoadTrustLinesOperation
             le.data.type(TRUSTLINE);
             auto& tl = le.data.trustLine();
 
-            tl.accountID = KeyUtils::fromStrKey<PublicKey>(accountID);
+            tl.accountID = publicKeyFromBinaryColumn(accountID);
 
             assert(assetType != ASSET_TYPE_NATIVE);
             tl.asset.type(static_cast<AssetType>(assetType));
             if (assetType == ASSET_TYPE_CREDIT_ALPHANUM4)
             {
-                tl.asset.alphaNum4().issuer =
-                    KeyUtils::fromStrKey<PublicKey>(issuer);
+                tl.asset.alphaNum4().issuer = publicKeyFromBinaryColumn(issuer);
                 strToAssetCode(tl.asset.alphaNum4().assetCode, assetCode);
             }
             else
             {
                 tl.asset.alphaNum12().issuer =
-                    KeyUtils::fromStrKey<PublicKey>(issuer);
+                    publicKeyFromBinaryColumn(issuer);
                 strToAssetCode(tl.asset.alphaNum12().assetCode, assetCode);
             }
 
@@ -504,8 +606,7 @@ class BulkLoadTrustLinesOperation
         for (auto const& k : keys)
         {
             assert(k.type() == TRUSTLINE);
-            mAccountIDs.emplace_back(
-                KeyUtils::toStrKey(k.trustLine().accountID));
+            mAccountIDs.emplace_back(toBinaryColumn(k.trustLine().accountID));
 
             auto const& asset = k.trustLine().asset;
             assert(asset.type() != ASSET_TYPE_NATIVE);
@@ -513,15 +614,14 @@ class BulkLoadTrustLinesOperation
             if (asset.type() == ASSET_TYPE_CREDIT_ALPHANUM4)
             {
                 assetCodeToStr(asset.alphaNum4().assetCode, mAssetCodes.back());
-                mIssuers.emplace_back(
-                    KeyUtils::toStrKey(asset.alphaNum4().issuer));
+                mIssuers.emplace_back(toBinaryColumn(asset.alphaNum4().issuer));
             }
             else if (asset.type() == ASSET_TYPE_CREDIT_ALPHANUM12)
             {
                 assetCodeToStr(asset.alphaNum12().assetCode,
                                mAssetCodes.back());
                 mIssuers.emplace_back(
-                    KeyUtils::toStrKey(asset.alphaNum12().issuer));
+                    toBinaryColumn(asset.alphaNum12().issuer));
             }
         }
     }
@@ -546,7 +646,8 @@ class BulkLoadTrustLinesOperation
         }
 
         std::string sqlJoin =
-            "SELECT x.value, y.value, z.value FROM "
+            "SELECT decode(x.value, 'hex'), decode(y.value, 'hex'), z.value "
+            "FROM "
             "(SELECT rowid, value FROM carray(?, ?, 'char*') ORDER BY rowid) "
             "AS x "
             "INNER JOIN (SELECT rowid, value FROM carray(?, ?, 'char*') ORDER "
@@ -555,9 +656,9 @@ class BulkLoadTrustLinesOperation
             "BY rowid) AS z ON x.rowid = z.rowid";
         std::string sql =
             "WITH r AS (" + sqlJoin +
-            ") SELECT accountid, assettype, assetcode, issuer, tlimit, "
-            "balance, flags, lastmodified, buyingliabilities, "
-            "sellingliabilities "
+            ") SELECT encode(accountid, 'hex'), assettype, assetcode, "
+            "encode(issuer, 'hex'), tlimit, balance, flags, lastmodified, "
+            "buyingliabilities, sellingliabilities "
             "FROM trustlines WHERE (accountid, issuer, assetcode) IN r";
 
         auto prep = mDb.getPreparedStatement(sql);
@@ -595,10 +696,11 @@ class BulkLoadTrustLinesOperation
         marshalToPGArray(pg->conn_, strAssetCodes, mAssetCodes);
 
         auto prep = mDb.getPreparedStatement(
-            "WITH r AS (SELECT unnest(:v1::TEXT[]), unnest(:v2::TEXT[]), "
-            "unnest(:v3::TEXT[])) SELECT accountid, assettype, assetcode, "
-            "issuer, tlimit, balance, flags, lastmodified, buyingliabilities, "
-            "sellingliabilities FROM trustlines "
+            "WITH r AS (SELECT decode(unnest(:v1::TEXT[]), 'hex'), "
+            "decode(unnest(:v2::TEXT[]), 'hex'), unnest(:v3::TEXT[])) "
+            "SELECT encode(accountid, 'hex'), assettype, assetcode, "
+            "encode(issuer, 'hex'), tlimit, balance, flags, lastmodified, "
+            "buyingliabilities, sellingliabilities FROM trustlines "
             "WHERE (accountid, issuer, assetcode) IN (SELECT * FROM r)");
         auto& st = prep.statement();
         st.exchange(soci::use(strAccountIDs));
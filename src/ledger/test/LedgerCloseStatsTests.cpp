@@ -0,0 +1,103 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "crypto/SHA.h"
+#include "ledger/LedgerCloseStats.h"
+#include "lib/catch.hpp"
+#include "lib/json/json.h"
+
+using namespace stellar;
+
+namespace
+{
+LedgerCloseStats::Transaction
+makeTransaction(int ms)
+{
+    return {sha256(std::to_string(ms)), 1, txSUCCESS,
+            std::chrono::milliseconds(ms)};
+}
+
+void
+closeLedger(LedgerCloseStats& stats, uint32_t ledgerSeq,
+            std::vector<int> const& txMs)
+{
+    stats.beginLedger(ledgerSeq);
+    for (auto ms : txMs)
+    {
+        stats.addTransaction(makeTransaction(ms));
+    }
+    LedgerCloseStats::PhaseTimes phases{};
+    phases[LedgerCloseStats::APPLY] = std::chrono::milliseconds(ledgerSeq);
+    stats.endLedger(std::chrono::milliseconds(ledgerSeq), phases);
+}
+
+std::vector<int>
+getDurations(std::vector<LedgerCloseStats::Transaction> const& txs)
+{
+    std::vector<int> res;
+    for (auto const& tx : txs)
+    {
+        res.emplace_back(static_cast<int>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(tx.duration)
+                .count()));
+    }
+    return res;
+}
+}
+
+TEST_CASE("ledger close stats", "[ledger][closestats]")
+{
+    LedgerCloseStats stats(3, 2);
+
+    SECTION("only the slowest transactions are kept")
+    {
+        closeLedger(stats, 1, {5, 1, 7, 3, 6});
+        REQUIRE(stats.getLedgers().size() == 1);
+        REQUIRE(getDurations(stats.getLedgers().front().slowest) ==
+                std::vector<int>{7, 6});
+    }
+
+    SECTION("only the last ledgers are kept")
+    {
+        for (uint32_t ledgerSeq = 1; ledgerSeq <= 5; ++ledgerSeq)
+        {
+            closeLedger(stats, ledgerSeq, {});
+        }
+        auto const& ledgers = stats.getLedgers();
+        REQUIRE(ledgers.size() == 3);
+        REQUIRE(ledgers[0].ledgerSeq == 5);
+        REQUIRE(ledgers[2].ledgerSeq == 3);
+    }
+
+    SECTION("a ledger that is begun again is forgotten")
+    {
+        stats.beginLedger(1);
+        stats.addTransaction(makeTransaction(9));
+        closeLedger(stats, 1, {2});
+        REQUIRE(getDurations(stats.getLedgers().front().slowest) ==
+                std::vector<int>{2});
+    }
+
+    SECTION("json reports the slowest transactions of the last ledgers")
+    {
+        closeLedger(stats, 1, {9, 8});
+        closeLedger(stats, 2, {4, 1});
+        closeLedger(stats, 3, {5, 2});
+
+        auto root = stats.getJson(2, 3);
+        REQUIRE(root["ledgers"].size() == 2);
+        REQUIRE(root["ledgers"][0]["ledger"].asUInt() == 3);
+        REQUIRE(root["ledgers"][0]["phases_ms"]["apply"].asDouble() == 3);
+
+        auto const& slowest = root["slowest_transactions"];
+        REQUIRE(slowest.size() == 3);
+        REQUIRE(slowest[0]["ledger"].asUInt() == 3);
+        REQUIRE(slowest[0]["ms"].asDouble() == 5);
+        REQUIRE(slowest[1]["ledger"].asUInt() == 2);
+        REQUIRE(slowest[2]["ms"].asDouble() == 2);
+        REQUIRE(slowest[0]["result"].asString() == "txSUCCESS");
+
+        REQUIRE(stats.getJson(10, 10)["slowest_transactions"].size() == 6);
+    }
+}
@@ -0,0 +1,164 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "crypto/SecretKey.h"
+#include "ledger/LedgerHashUtils.h"
+#include "lib/catch.hpp"
+#include "test/TxTests.h"
+#include "util/FlatHashMap.h"
+#include "util/Logging.h"
+#include "util/Math.h"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace stellar;
+
+namespace
+{
+// generateKeys returns distinct keys distributed roughly like those of the
+// ledger: every account has a few trustlines to popular assets, whose codes
+// often share a prefix and whose issuers are few, along with some offers and
+// data entries.
+std::vector<LedgerKey>
+generateKeys(size_t nAccounts)
+{
+    std::vector<SecretKey> issuers;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        issuers.emplace_back(SecretKey::pseudoRandomForTesting());
+    }
+    std::vector<Asset> assets;
+    for (auto const& issuer : issuers)
+    {
+        for (auto const& code :
+             {"USD", "USDC", "USDT", "EUR", "EURT", "BTC", "ETH", "XLM"})
+        {
+            assets.emplace_back(txtest::makeAsset(issuer, code));
+        }
+        for (auto const& code : {"USDCOIN", "USDTOKEN"})
+        {
+            Asset asset(ASSET_TYPE_CREDIT_ALPHANUM12);
+            strToAssetCode(asset.alphaNum12().assetCode, code);
+            asset.alphaNum12().issuer = issuer.getPublicKey();
+            assets.emplace_back(asset);
+        }
+    }
+
+    std::vector<LedgerKey> keys;
+    int64_t offerID = 0;
+    for (size_t i = 0; i < nAccounts; ++i)
+    {
+        auto accountID = SecretKey::pseudoRandomForTesting().getPublicKey();
+
+        LedgerKey account(ACCOUNT);
+        account.account().accountID = accountID;
+        keys.emplace_back(account);
+
+        for (size_t j = 0; j < 4; ++j)
+        {
+            LedgerKey trustLine(TRUSTLINE);
+            trustLine.trustLine().accountID = accountID;
+            trustLine.trustLine().asset = assets[(i + j * 7) % assets.size()];
+            keys.emplace_back(trustLine);
+        }
+
+        for (size_t j = 0; j < 2; ++j)
+        {
+            LedgerKey offer(OFFER);
+            offer.offer().sellerID = accountID;
+            offer.offer().offerID = ++offerID;
+            keys.emplace_back(offer);
+        }
+
+        if (i % 4 == 0)
+        {
+            for (auto const& name : {"config", "config1", "config2"})
+            {
+                LedgerKey data(DATA);
+                data.data().accountID = accountID;
+                data.data().dataName = name;
+                keys.emplace_back(data);
+            }
+        }
+    }
+    return keys;
+}
+}
+
+TEST_CASE("LedgerKey hash distinguishes keys sharing a prefix", "[ledgerhash]")
+{
+    auto keys = generateKeys(2000);
+    std::hash<LedgerKey> hasher;
+    std::unordered_set<size_t> hashes;
+    for (auto const& key : keys)
+    {
+        REQUIRE(hasher(key) == hasher(LedgerKey(key)));
+        hashes.insert(hasher(key));
+    }
+    REQUIRE(hashes.size() == keys.size());
+
+    SECTION("data names that differ by trailing zero bytes")
+    {
+        LedgerKey key1(DATA);
+        key1.data().dataName = "name";
+        LedgerKey key2 = key1;
+        key2.data().dataName.push_back('\0');
+        REQUIRE(hasher(key1) != hasher(key2));
+    }
+}
+
+TEST_CASE("LedgerKey hash and lookup benchmark", "[!hide][ledgerhashbench]")
+{
+    size_t const nLookups = 10000000;
+    auto keys = generateKeys(100000);
+    auto missing = generateKeys(10000);
+
+    std::vector<size_t> order;
+    for (size_t i = 0; i < nLookups; ++i)
+    {
+        order.emplace_back(rand_uniform<size_t>(0, keys.size() - 1));
+    }
+
+    std::unordered_map<LedgerKey, size_t> nodeMap;
+    FlatHashMap<LedgerKey, size_t> flatMap;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        nodeMap.emplace(keys[i], i);
+        flatMap.emplace(keys[i], i);
+    }
+
+    size_t largestBucket = 0;
+    for (size_t i = 0; i < nodeMap.bucket_count(); ++i)
+    {
+        largestBucket = std::max(largestBucket, nodeMap.bucket_size(i));
+    }
+    CLOG(INFO, "Ledger") << keys.size() << " keys, largest unordered_map "
+                         << "bucket holds " << largestBucket << " keys";
+
+    auto bench = [&](std::string const& name, auto const& map) {
+        auto start = std::chrono::steady_clock::now();
+        size_t found = 0;
+        for (auto i : order)
+        {
+            found += map.find(keys[i])->second == i ? 1 : 0;
+        }
+        for (size_t i = 0; i < nLookups / 10; ++i)
+        {
+            auto const& key = missing[i % missing.size()];
+            found += map.find(key) == map.end() ? 0 : 1;
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start);
+        REQUIRE(found == nLookups);
+        CLOG(INFO, "Ledger")
+            << name << ": "
+            << elapsed.count() / (nLookups + nLookups / 10) << " ns/lookup";
+    };
+    bench("std::unordered_map", nodeMap);
+    bench("FlatHashMap", flatMap);
+}
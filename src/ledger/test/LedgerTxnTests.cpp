@@ -2,24 +2,38 @@
 // under the Apache License, Version 2.0. See the COPYING file at the root
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
+#include "crypto/KeyUtils.h"
+#include "crypto/SHA.h"
+#include "ledger/InMemoryLedgerTxnRoot.h"
+#include "ledger/LedgerManager.h"
+#include "ledger/LedgerRange.h"
 #include "ledger/LedgerTxn.h"
 #include "ledger/LedgerTxnEntry.h"
 #include "ledger/LedgerTxnHeader.h"
 #include "ledger/test/LedgerTestUtils.h"
 #include "lib/catch.hpp"
 #include "main/Application.h"
+#include "main/PersistentState.h"
+#include "test/TestAccount.h"
 #include "test/TestUtils.h"
+#include "test/TxTests.h"
 #include "test/test.h"
+#include "transactions/TransactionFrame.h"
+#include "transactions/TransactionHistoryBatch.h"
 #include "transactions/TransactionUtils.h"
+#include "util/Decoder.h"
 #include "util/Math.h"
 #include "util/XDROperators.h"
+#include "util/types.h"
 #include <algorithm>
 #include <functional>
+#include <limits>
 #include <map>
 #include <memory>
 #include <queue>
 #include <set>
 #include <xdrpp/autocheck.h>
+#include <xdrpp/marshal.h>
 
 using namespace stellar;
 
@@ -1125,6 +1139,123 @@ TEST_CASE("LedgerTxn queryInflationWinners", "[ledgerstate]")
     }
 }
 
+TEST_CASE("inflation votes are maintained across commits", "[ledgerstate]")
+{
+    int64_t const QUERY_VOTE_MINIMUM = 1000000000;
+
+    VirtualClock clock;
+    auto app = createTestApplication(clock, getTestConfig());
+    app->start();
+    auto& sqlRoot = app->getLedgerTxnRoot();
+    InMemoryLedgerTxnRoot memRoot(app->getDatabase());
+    {
+        LedgerTxn ltx(memRoot);
+        ltx.loadHeader().current() = sqlRoot.getHeader();
+        ltx.commit();
+    }
+    std::vector<AbstractLedgerTxnParent*> roots{&sqlRoot, &memRoot};
+
+    std::vector<AccountID> voters, destinations;
+    for (size_t i = 0; i < 12; ++i)
+    {
+        voters.emplace_back(
+            LedgerTestUtils::generateValidAccountEntry().accountID);
+    }
+    for (size_t i = 0; i < 4; ++i)
+    {
+        destinations.emplace_back(
+            LedgerTestUtils::generateValidAccountEntry().accountID);
+    }
+
+    // Votes are only tallied by LedgerTxnRoot once they have been queried, so
+    // query before the first commit and then check that every commit is
+    // applied to the tally
+    for (auto root : roots)
+    {
+        LedgerTxn ltx(*root);
+        REQUIRE(ltx.queryInflationWinners(10, 0).empty());
+    }
+
+    std::map<AccountID, std::pair<AccountID, int64_t>> state;
+    std::uniform_int_distribution<size_t> voterDist(0, voters.size() - 1);
+    std::uniform_int_distribution<size_t> destDist(0, destinations.size() - 1);
+    std::uniform_int_distribution<int64_t> balanceDist(-2, 2);
+    for (size_t round = 0; round < 50; ++round)
+    {
+        // Balances are close to the minimum, so that some accounts do not
+        // vote and some destinations are tied. A zero balance erases the
+        // account.
+        std::map<AccountID, std::pair<AccountID, int64_t>> updates;
+        for (size_t i = 0; i < 3; ++i)
+        {
+            auto const& voter = voters[voterDist(gRandomEngine)];
+            int64_t balance = QUERY_VOTE_MINIMUM + balanceDist(gRandomEngine);
+            bool exists = state.find(voter) != state.end();
+            if (exists && balance < QUERY_VOTE_MINIMUM)
+            {
+                balance = 0;
+            }
+            updates[voter] = {destinations[destDist(gRandomEngine)], balance};
+        }
+        for (auto root : roots)
+        {
+            LedgerTxn ltx(*root);
+            applyLedgerTxnUpdates(ltx, updates);
+            ltx.commit();
+        }
+        for (auto const& kv : updates)
+        {
+            if (kv.second.second > 0)
+            {
+                state[kv.first] = kv.second;
+            }
+            else
+            {
+                state.erase(kv.first);
+            }
+        }
+
+        std::map<AccountID, int64_t> votes;
+        for (auto const& kv : state)
+        {
+            if (kv.second.second >= QUERY_VOTE_MINIMUM)
+            {
+                votes[kv.second.first] += kv.second.second;
+            }
+        }
+        std::vector<std::tuple<AccountID, int64_t>> expected;
+        for (auto const& kv : votes)
+        {
+            expected.emplace_back(kv.first, kv.second);
+        }
+        std::sort(expected.begin(), expected.end(),
+                  [](auto const& lhs, auto const& rhs) {
+                      if (std::get<1>(lhs) == std::get<1>(rhs))
+                      {
+                          return KeyUtils::toStrKey(std::get<0>(lhs)) >
+                                 KeyUtils::toStrKey(std::get<0>(rhs));
+                      }
+                      return std::get<1>(lhs) > std::get<1>(rhs);
+                  });
+        if (expected.size() > 3)
+        {
+            expected.resize(3);
+        }
+
+        for (auto root : roots)
+        {
+            LedgerTxn ltx(*root);
+            auto winners = ltx.queryInflationWinners(3, QUERY_VOTE_MINIMUM);
+            REQUIRE(winners.size() == expected.size());
+            for (size_t i = 0; i < winners.size(); ++i)
+            {
+                REQUIRE(expected[i] == std::make_tuple(winners[i].accountID,
+                                                       winners[i].votes));
+            }
+        }
+    }
+}
+
 TEST_CASE("LedgerTxn loadHeader", "[ledgerstate]")
 {
     VirtualClock clock;
@@ -1279,6 +1410,104 @@ TEST_CASE("LedgerTxn loadWithoutRecord", "[ledgerstate]")
     }
 }
 
+TEST_CASE("LedgerTxn copies entries on write", "[ledgerstate]")
+{
+    VirtualClock clock;
+    auto app = createTestApplication(clock, getTestConfig());
+    app->start();
+
+    LedgerEntry le = LedgerTestUtils::generateValidLedgerEntry();
+    le.lastModifiedLedgerSeq = 1;
+    LedgerKey key = LedgerEntryKey(le);
+
+    LedgerTxn ltx1(app->getLedgerTxnRoot());
+    REQUIRE(ltx1.create(le));
+    auto parentEntry = ltx1.getNewestVersion(key);
+
+    SECTION("load shares the entry of the parent")
+    {
+        LedgerTxn ltx2(ltx1, false);
+        {
+            auto const ltxe = ltx2.load(key);
+            REQUIRE(&ltxe.current() == parentEntry.get());
+        }
+        REQUIRE(ltx2.getNewestVersion(key) == parentEntry);
+        validate(ltx2, {{key, {parentEntry, parentEntry}}});
+    }
+
+    SECTION("loadWithoutRecord shares the entry of the parent")
+    {
+        LedgerTxn ltx2(ltx1, false);
+        auto ltxe = ltx2.loadWithoutRecord(key);
+        REQUIRE(&ltxe.current() == parentEntry.get());
+    }
+
+    SECTION("modifying an entry copies it once")
+    {
+        LedgerTxn ltx2(ltx1, false);
+        {
+            auto ltxe = ltx2.load(key);
+            ltxe.current().lastModifiedLedgerSeq = 2;
+            auto copy = &ltxe.current();
+            REQUIRE(copy != parentEntry.get());
+            ltxe.current().lastModifiedLedgerSeq = 3;
+            REQUIRE(&ltxe.current() == copy);
+        }
+        {
+            auto ltxe = ltx2.load(key);
+            ltxe.current().lastModifiedLedgerSeq = 4;
+        }
+        REQUIRE(parentEntry->lastModifiedLedgerSeq == 1);
+        REQUIRE(ltx2.getNewestVersion(key)->lastModifiedLedgerSeq == 4);
+
+        ltx2.commit();
+        REQUIRE(ltx1.getNewestVersion(key)->lastModifiedLedgerSeq == 4);
+    }
+
+    SECTION("commit shares the entries that were not modified")
+    {
+        LedgerTxn ltx2(ltx1, false);
+        {
+            LedgerTxn ltx3(ltx2, false);
+            REQUIRE(ltx3.load(key));
+            ltx3.commit();
+        }
+        REQUIRE(ltx2.getNewestVersion(key) == parentEntry);
+        ltx2.commit();
+        REQUIRE(ltx1.getNewestVersion(key) == parentEntry);
+    }
+
+    SECTION("commit moves the entries that were modified")
+    {
+        LedgerTxn ltx2(ltx1, false);
+        std::shared_ptr<LedgerEntry const> modified;
+        {
+            LedgerTxn ltx3(ltx2, false);
+            ltx3.load(key).current().lastModifiedLedgerSeq = 2;
+            modified = ltx3.getNewestVersion(key);
+            ltx3.commit();
+        }
+        REQUIRE(ltx2.getNewestVersion(key) == modified);
+
+        // The entry of the child is not modified in place by the parent
+        ltx2.load(key).current().lastModifiedLedgerSeq = 3;
+        REQUIRE(modified->lastModifiedLedgerSeq == 2);
+        ltx2.commit();
+        REQUIRE(ltx1.getNewestVersion(key)->lastModifiedLedgerSeq == 3);
+    }
+
+    SECTION("updating last modified does not modify the parent")
+    {
+        LedgerTxn ltx2(ltx1);
+        ltx2.loadHeader().current().ledgerSeq = 5;
+        REQUIRE(ltx2.load(key));
+        auto delta = ltx2.getDelta();
+        REQUIRE(delta.entry[key].current->lastModifiedLedgerSeq == 5);
+        REQUIRE(delta.entry[key].previous == parentEntry);
+        REQUIRE(parentEntry->lastModifiedLedgerSeq == 1);
+    }
+}
+
 static void
 applyLedgerTxnUpdates(
     AbstractLedgerTxn& ltx,
@@ -1671,6 +1900,125 @@ testBestOffer(
     }
 }
 
+TEST_CASE("LedgerTxn loadOffersBySellerRange", "[ledgerstate]")
+{
+    VirtualClock clock;
+    auto app = createTestApplication(clock, getTestConfig());
+    app->start();
+    auto& sqlRoot = app->getLedgerTxnRoot();
+    InMemoryLedgerTxnRoot memRoot(app->getDatabase());
+    {
+        LedgerTxn ltx(memRoot);
+        ltx.loadHeader().current() = sqlRoot.getHeader();
+        ltx.commit();
+    }
+
+    std::vector<AccountID> sellers;
+    for (size_t i = 0; i < 20; ++i)
+    {
+        sellers.emplace_back(
+            LedgerTestUtils::generateValidAccountEntry().accountID);
+    }
+
+    // Sellers hold between 1 and 20 offers, so that batches end both within
+    // and at the boundary of the offers of a seller
+    std::vector<LedgerEntry> offers;
+    int64_t offerID = 0;
+    for (size_t i = 0; i < sellers.size(); ++i)
+    {
+        for (size_t j = 0; j <= i; ++j)
+        {
+            LedgerEntry le;
+            le.data.type(OFFER);
+            le.data.offer() = LedgerTestUtils::generateValidOfferEntry();
+            le.data.offer().sellerID = sellers[i];
+            le.data.offer().offerID = ++offerID;
+            offers.emplace_back(le);
+        }
+    }
+
+    auto check = [&](AbstractLedgerTxn& ltx, size_t maxOffers) {
+        auto allOffers = ltx.getAllOffers();
+
+        std::unordered_map<LedgerKey, LedgerEntry> visited;
+        xdr::pointer<AccountID> lastSeller;
+        do
+        {
+            auto afterSeller = lastSeller;
+            auto batch = ltx.getOffersBySellerRange(afterSeller.get(),
+                                                    maxOffers);
+            for (auto const& kv : batch.offers)
+            {
+                auto const& sellerID = kv.first.offer().sellerID;
+                REQUIRE((!afterSeller || *afterSeller < sellerID));
+                REQUIRE((!batch.lastSeller || !(*batch.lastSeller < sellerID)));
+                REQUIRE(visited.emplace(kv).second);
+            }
+            lastSeller = batch.lastSeller;
+        } while (lastSeller);
+        REQUIRE(visited == allOffers);
+
+        // Loading visits the same offers, grouped by seller
+        size_t loaded = 0;
+        {
+            LedgerTxn ltxLoad(ltx);
+            lastSeller.reset();
+            do
+            {
+                auto afterSeller = lastSeller;
+                auto offersByAccount = ltxLoad.loadOffersBySellerRange(
+                    afterSeller.get(), maxOffers, lastSeller);
+                for (auto const& kv : offersByAccount)
+                {
+                    for (auto const& ltxe : kv.second)
+                    {
+                        auto const& le = ltxe.current();
+                        REQUIRE(le.data.offer().sellerID == kv.first);
+                        REQUIRE(allOffers.at(LedgerEntryKey(le)) == le);
+                        ++loaded;
+                    }
+                }
+            } while (lastSeller);
+        }
+        REQUIRE(loaded == allOffers.size());
+    };
+
+    for (auto root : std::vector<AbstractLedgerTxnParent*>{&sqlRoot, &memRoot})
+    {
+        {
+            LedgerTxn ltx(*root);
+            for (auto const& le : offers)
+            {
+                ltx.create(le);
+            }
+            ltx.commit();
+        }
+
+        LedgerTxn ltx(*root);
+        for (size_t maxOffers : {1, 7, 20, 1000})
+        {
+            check(ltx, maxOffers);
+        }
+
+        // Uncommitted changes are merged into the batches
+        ltx.erase(LedgerEntryKey(offers[3]));
+        ltx.erase(LedgerEntryKey(offers[50]));
+        {
+            auto ltxe = ltx.load(LedgerEntryKey(offers[100]));
+            ltxe.current().data.offer().amount += 1;
+        }
+        LedgerEntry le = offers.back();
+        le.data.offer().sellerID =
+            LedgerTestUtils::generateValidAccountEntry().accountID;
+        le.data.offer().offerID = ++offerID;
+        ltx.create(le);
+        for (size_t maxOffers : {1, 7, 20, 1000})
+        {
+            check(ltx, maxOffers);
+        }
+    }
+}
+
 TEST_CASE("LedgerTxn loadBestOffer", "[ledgerstate]")
 {
     auto a1 = LedgerTestUtils::generateValidAccountEntry().accountID;
@@ -1822,6 +2170,89 @@ TEST_CASE("LedgerTxn loadBestOffer", "[ledgerstate]")
     }
 }
 
+TEST_CASE("LedgerTxnRoot order book updated by commit", "[ledgerstate]")
+{
+    auto a1 = LedgerTestUtils::generateValidAccountEntry().accountID;
+
+    Asset buying = LedgerTestUtils::generateValidOfferEntry().buying;
+    Asset selling = LedgerTestUtils::generateValidOfferEntry().selling;
+    REQUIRE(!(buying == selling));
+
+    VirtualClock clock;
+    auto app = createTestApplication(clock, getTestConfig());
+    app->start();
+    auto& root = app->getLedgerTxnRoot();
+
+    auto commitUpdates =
+        [&](std::map<std::pair<AccountID, int64_t>,
+                     std::tuple<Asset, Asset, Price, int64_t>> const& updates) {
+            LedgerTxn ltx(root);
+            applyLedgerTxnUpdates(ltx, updates);
+            ltx.commit();
+        };
+
+    auto checkBestOffer = [&](Asset const& b, Asset const& s,
+                              int64_t expectedOfferID) {
+        std::unordered_set<LedgerKey> exclude;
+        auto best = root.getBestOffer(b, s, exclude);
+        if (expectedOfferID == 0)
+        {
+            REQUIRE(!best);
+        }
+        else
+        {
+            REQUIRE(best);
+            REQUIRE(best->data.offer().offerID == expectedOfferID);
+        }
+    };
+
+    // Load both order books before any offers exist, so that every following
+    // change has to be applied to resident order books
+    checkBestOffer(buying, selling, 0);
+    checkBestOffer(selling, buying, 0);
+
+    commitUpdates({{{a1, 1}, {buying, selling, Price{2, 1}, 1}},
+                   {{a1, 2}, {buying, selling, Price{3, 1}, 1}}});
+    checkBestOffer(buying, selling, 1);
+
+    SECTION("better offer created")
+    {
+        commitUpdates({{{a1, 3}, {buying, selling, Price{1, 1}, 1}}});
+        checkBestOffer(buying, selling, 3);
+    }
+
+    SECTION("best offer price modified")
+    {
+        commitUpdates({{{a1, 1}, {buying, selling, Price{4, 1}, 1}}});
+        checkBestOffer(buying, selling, 2);
+    }
+
+    SECTION("best offer erased")
+    {
+        commitUpdates({{{a1, 1}, {buying, selling, Price{2, 1}, 0}}});
+        checkBestOffer(buying, selling, 2);
+        commitUpdates({{{a1, 2}, {buying, selling, Price{3, 1}, 0}}});
+        checkBestOffer(buying, selling, 0);
+    }
+
+    SECTION("best offer assets modified")
+    {
+        commitUpdates({{{a1, 1}, {selling, buying, Price{2, 1}, 1}}});
+        checkBestOffer(buying, selling, 2);
+        checkBestOffer(selling, buying, 1);
+    }
+
+    SECTION("rolled back changes are ignored")
+    {
+        {
+            LedgerTxn ltx(root);
+            applyLedgerTxnUpdates(
+                ltx, {{{a1, 3}, {buying, selling, Price{1, 1}, 1}}});
+        }
+        checkBestOffer(buying, selling, 1);
+    }
+}
+
 static void
 testOffersByAccountAndAsset(
     AbstractLedgerTxnParent& ltxParent, AccountID const& accountID,
@@ -2205,72 +2636,762 @@ TEST_CASE("LedgerTxnRoot prefetch", "[ledgerstate]")
     }
 }
 
-TEST_CASE("Create performance benchmark", "[!hide][createbench]")
+TEST_CASE("LedgerTxnRoot entry cache follows commits", "[ledgerstate]")
 {
-    auto runTest = [&](Config::TestDbMode mode, bool loading) {
-        VirtualClock clock;
-        Config cfg(getTestConfig(0, mode));
-        Application::pointer app = createTestApplication(clock, cfg);
-        app->start();
-        size_t n = 0xffff, batch = 0xfff;
-
-        std::vector<LedgerEntry> entries;
-        for (auto i = 0; i < 10; ++i)
-        {
-            // First add some bulking entries so we're not using a
-            // totally empty database.
-            entries = LedgerTestUtils::generateValidLedgerEntries(n);
-            LedgerTxn ltx(app->getLedgerTxnRoot());
-            for (auto e : entries)
-            {
-                ltx.createOrUpdateWithoutLoading(e);
-            }
-            ltx.commit();
-        }
-
-        // Then do some precise timed creates.
-        entries = LedgerTestUtils::generateValidLedgerEntries(n);
-        auto& m =
-            app->getMetrics().NewMeter({"ledger", "create", "commit"}, "entry");
-        while (!entries.empty())
-        {
-            LedgerTxn ltx(app->getLedgerTxnRoot());
-            for (size_t i = 0; !entries.empty() && i < batch; ++i)
-            {
-                if (loading)
-                {
-                    ltx.create(entries.back());
-                }
-                else
-                {
-                    ltx.createOrUpdateWithoutLoading(entries.back());
-                }
-                entries.pop_back();
-            }
-            ltx.commit();
-            m.Mark(batch);
-            CLOG(INFO, "Ledger")
-                << "benchmark create rate: " << m.mean_rate() << " entries/sec "
-                << (loading ? "(loading)" : "(non-loading)");
-        }
-    };
+    VirtualClock clock;
+    auto cfg = getTestConfig();
+    cfg.ENTRY_CACHE_SIZE = 1000;
+    auto app = createTestApplication(clock, cfg);
+    app->start();
+    auto& root = app->getLedgerTxnRoot();
 
-    SECTION("sqlite")
+    LedgerEntry le;
+    le.data.type(ACCOUNT);
+    le.data.account() = LedgerTestUtils::generateValidAccountEntry();
+    le.data.account().balance = 100;
+    auto key = LedgerEntryKey(le);
     {
-        runTest(Config::TESTDB_ON_DISK_SQLITE, true);
-        runTest(Config::TESTDB_ON_DISK_SQLITE, false);
+        LedgerTxn ltx(root);
+        ltx.createOrUpdateWithoutLoading(le);
+        ltx.commit();
     }
 
-#ifdef USE_POSTGRES
-    SECTION("postgresql")
+    // The first load misses and caches the entry
     {
-        runTest(Config::TESTDB_POSTGRESQL, true);
-        runTest(Config::TESTDB_POSTGRESQL, false);
+        LedgerTxn ltx(root);
+        auto entry = ltx.loadWithoutRecord(key);
+        REQUIRE(entry.current().data.account().balance == 100);
     }
-#endif
-}
 
-TEST_CASE("Erase performance benchmark", "[!hide][erasebench]")
+    // Committing a cached entry replaces the cached version, so the next
+    // load hits and sees the committed version
+    le.data.account().balance = 200;
+    {
+        LedgerTxn ltx(root);
+        ltx.load(key).current() = le;
+        ltx.commit();
+    }
+    {
+        LedgerTxn ltx(root);
+        auto entry = ltx.loadWithoutRecord(key);
+        REQUIRE(entry.current().data.account().balance == 200);
+    }
+    REQUIRE(root.getEntryCacheHitRate(ACCOUNT) > 0);
+
+    {
+        LedgerTxn ltx(root);
+        ltx.erase(key);
+        ltx.commit();
+    }
+    {
+        LedgerTxn ltx(root);
+        REQUIRE(!ltx.loadWithoutRecord(key));
+    }
+}
+
+TEST_CASE("LedgerTxnRoot writes deferred transaction history with commits",
+          "[ledgerstate]")
+{
+    VirtualClock clock;
+    auto app = createTestApplication(clock, getTestConfig());
+    app->start();
+    auto& root = app->getLedgerTxnRoot();
+    auto& db = app->getDatabase();
+    uint32_t const ledgerSeq = 1000;
+
+    auto history = std::make_shared<TransactionHistoryBatch>(ledgerSeq);
+    std::vector<LedgerEntryChanges> expectedChanges;
+    TransactionResultSet expectedResults;
+    for (int i = 1; i <= 10; ++i)
+    {
+        LedgerEntry le;
+        le.data.type(ACCOUNT);
+        le.data.account() = LedgerTestUtils::generateValidAccountEntry();
+        expectedChanges.emplace_back();
+        expectedChanges.back().emplace_back(LEDGER_ENTRY_STATE);
+        expectedChanges.back().back().state() = le;
+
+        TransactionEnvelope envelope;
+        envelope.tx.sourceAccount = le.data.account().accountID;
+        envelope.tx.seqNum = i;
+        auto txID = sha256(std::to_string(i));
+        expectedResults.results.emplace_back();
+        expectedResults.results.back().transactionHash = txID;
+
+        history->addTransactionFee(txID, expectedChanges.back(), i);
+        history->addTransaction(txID, envelope, expectedResults.results.back(),
+                                TransactionMeta(1), i);
+    }
+    auto write = [history, &db](soci::session& session) {
+        history->store(db, session);
+    };
+
+    SECTION("rollback discards the write")
+    {
+        {
+            LedgerTxn ltx(root);
+            root.deferWrite(write);
+        }
+        {
+            LedgerTxn ltx(root);
+            ltx.commit();
+        }
+        root.waitForDeferredWrites();
+        REQUIRE(TransactionFrame::getTransactionFeeMeta(db, ledgerSeq).empty());
+        REQUIRE(TransactionFrame::getTransactionHistoryResults(db, ledgerSeq)
+                    .results.empty());
+    }
+
+    SECTION("commit writes the batch")
+    {
+        {
+            LedgerTxn ltx(root);
+            root.deferWrite(write);
+            ltx.commit();
+        }
+        root.waitForDeferredWrites();
+        REQUIRE(TransactionFrame::getTransactionFeeMeta(db, ledgerSeq) ==
+                expectedChanges);
+        REQUIRE(TransactionFrame::getTransactionHistoryResults(
+                    db, ledgerSeq) == expectedResults);
+    }
+}
+
+#ifdef USE_POSTGRES
+TEST_CASE("LedgerTxnRoot asynchronous commit", "[ledgerstate]")
+{
+    VirtualClock clock;
+    auto cfg = getTestConfig(0, Config::TESTDB_POSTGRESQL);
+    cfg.ASYNC_LEDGER_COMMIT = true;
+    auto app = createTestApplication(clock, cfg);
+    app->start();
+    auto& root = app->getLedgerTxnRoot();
+
+    std::vector<LedgerEntry> entries;
+    {
+        std::unordered_set<LedgerKey> keys;
+        for (auto const& e : LedgerTestUtils::generateValidLedgerEntries(1000))
+        {
+            if (keys.emplace(LedgerEntryKey(e)).second)
+            {
+                entries.emplace_back(e);
+            }
+        }
+    }
+    {
+        LedgerTxn ltx(root);
+        for (auto const& e : entries)
+        {
+            ltx.createOrUpdateWithoutLoading(e);
+        }
+        ltx.commit();
+    }
+
+    // Erase every other entry in the next ledger, while the first delta is
+    // possibly still being written
+    std::unordered_set<LedgerKey> erased;
+    std::map<LedgerEntryType, uint64_t> expectedCounts;
+    size_t expectedOffers = 0;
+    {
+        LedgerTxn ltx(root);
+        ++ltx.loadHeader().current().ledgerSeq;
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            auto key = LedgerEntryKey(entries[i]);
+            if (i % 2 == 0)
+            {
+                ltx.erase(key);
+                erased.emplace(key);
+            }
+            else
+            {
+                ++expectedCounts[key.type()];
+                expectedOffers += (key.type() == OFFER) ? 1 : 0;
+            }
+        }
+        ltx.commit();
+    }
+
+    {
+        LedgerTxn ltx(root);
+        for (auto const& e : entries)
+        {
+            auto key = LedgerEntryKey(e);
+            bool exists = (bool)ltx.loadWithoutRecord(key);
+            REQUIRE(exists == (erased.find(key) == erased.end()));
+        }
+    }
+    REQUIRE(root.getAllOffers().size() == expectedOffers);
+
+    // countObjects waits for every delta to be written
+    for (auto let : {ACCOUNT, DATA, OFFER, TRUSTLINE})
+    {
+        REQUIRE(root.countObjects(let) == expectedCounts[let]);
+    }
+    REQUIRE(app->getPersistentState().getState(
+                PersistentState::kLastFlushedLedger) ==
+            std::to_string(root.getHeader().ledgerSeq));
+}
+
+TEST_CASE("LedgerTxnRoot asynchronous commit recovers from crash during flush",
+          "[ledgerstate]")
+{
+    auto cfg = getTestConfig(0, Config::TESTDB_POSTGRESQL);
+    cfg.ASYNC_LEDGER_COMMIT = true;
+    auto a1 = txtest::getAccount("A");
+    uint32_t lcl;
+    {
+        VirtualClock clock;
+        auto app = createTestApplication(clock, cfg);
+        app->start();
+
+        auto root = TestAccount::createRoot(*app);
+        auto tx = root.tx({txtest::createAccount(
+            a1.getPublicKey(), app->getLedgerManager().getLastMinBalance(0))});
+        txtest::closeLedgerOn(*app, 2, 1, 1, 2016, {tx});
+        lcl = app->getLedgerManager().getLastClosedLedgerNum();
+
+        // The node dies after the ledger commits, with the creation of the
+        // account not written yet
+        {
+            LedgerTxn ltx(app->getLedgerTxnRoot());
+            ltx.erase(accountKey(a1.getPublicKey()));
+            ltx.commit();
+        }
+        // countObjects waits for the flush
+        app->getLedgerTxnRoot().countObjects(ACCOUNT);
+        app->getPersistentState().setState(
+            PersistentState::kLastFlushedLedger, std::to_string(lcl - 1));
+        REQUIRE(!txtest::doesAccountExist(*app, a1.getPublicKey()));
+    }
+
+    VirtualClock clock;
+    auto app = createTestApplication(clock, cfg, false);
+    app->start();
+    REQUIRE(app->getLedgerManager().getLastClosedLedgerNum() == lcl);
+    REQUIRE(txtest::doesAccountExist(*app, a1.getPublicKey()));
+    REQUIRE(app->getLedgerTxnRoot().countObjects(ACCOUNT) == 2);
+    REQUIRE(app->getPersistentState().getState(
+                PersistentState::kLastFlushedLedger) == std::to_string(lcl));
+}
+
+TEST_CASE("LedgerTxnRoot asynchronous commit recovers from crash before the "
+          "first flush after a restart",
+          "[ledgerstate]")
+{
+    auto cfg = getTestConfig(0, Config::TESTDB_POSTGRESQL);
+    cfg.ASYNC_LEDGER_COMMIT = true;
+    auto a1 = txtest::getAccount("A");
+    {
+        VirtualClock clock;
+        auto app = createTestApplication(clock, cfg);
+        app->start();
+    }
+
+    uint32_t lcl;
+    {
+        VirtualClock clock;
+        auto app = createTestApplication(clock, cfg, false);
+        app->start();
+
+        // The marker holds the LCL from the start, before anything is flushed
+        auto& ps = app->getPersistentState();
+        auto startMarker = ps.getState(PersistentState::kLastFlushedLedger);
+        REQUIRE(startMarker ==
+                std::to_string(
+                    app->getLedgerManager().getLastClosedLedgerNum()));
+
+        auto root = TestAccount::createRoot(*app);
+        auto tx = root.tx({txtest::createAccount(
+            a1.getPublicKey(), app->getLedgerManager().getLastMinBalance(0))});
+        txtest::closeLedgerOn(*app, 2, 1, 1, 2016, {tx});
+        lcl = app->getLedgerManager().getLastClosedLedgerNum();
+
+        // The node dies after the ledger commits, before the first flush
+        // since it started
+        {
+            LedgerTxn ltx(app->getLedgerTxnRoot());
+            ltx.erase(accountKey(a1.getPublicKey()));
+            ltx.commit();
+        }
+        // countObjects waits for the flush
+        app->getLedgerTxnRoot().countObjects(ACCOUNT);
+        ps.setState(PersistentState::kLastFlushedLedger, startMarker);
+        REQUIRE(!txtest::doesAccountExist(*app, a1.getPublicKey()));
+    }
+
+    VirtualClock clock;
+    auto app = createTestApplication(clock, cfg, false);
+    app->start();
+    REQUIRE(app->getLedgerManager().getLastClosedLedgerNum() == lcl);
+    REQUIRE(txtest::doesAccountExist(*app, a1.getPublicKey()));
+    REQUIRE(app->getPersistentState().getState(
+                PersistentState::kLastFlushedLedger) == std::to_string(lcl));
+}
+#endif
+
+TEST_CASE("InMemoryLedgerTxnRoot matches LedgerTxnRoot", "[ledgerstate]")
+{
+    VirtualClock clock;
+    auto app = createTestApplication(clock, getTestConfig());
+    app->start();
+    auto& sqlRoot = app->getLedgerTxnRoot();
+    InMemoryLedgerTxnRoot memRoot(app->getDatabase());
+    {
+        LedgerTxn ltx(memRoot);
+        ltx.loadHeader().current() = sqlRoot.getHeader();
+        ltx.commit();
+    }
+
+    auto buying = txtest::makeAsset(txtest::getAccount("issuer"), "USD");
+    auto selling = txtest::makeNativeAsset();
+
+    std::vector<LedgerEntry> entries;
+    {
+        std::unordered_set<LedgerKey> keys;
+        for (auto e : LedgerTestUtils::generateValidLedgerEntries(500))
+        {
+            // Put every offer in the same order book, so that best offers
+            // are compared across many offers
+            if (e.data.type() == OFFER)
+            {
+                e.data.offer().buying = buying;
+                e.data.offer().selling = selling;
+            }
+            if (keys.emplace(LedgerEntryKey(e)).second)
+            {
+                entries.emplace_back(e);
+            }
+        }
+    }
+
+    auto apply = [&](std::function<void(AbstractLedgerTxn&)> f) {
+        std::vector<AbstractLedgerTxnParent*> roots{&sqlRoot, &memRoot};
+        for (auto root : roots)
+        {
+            LedgerTxn ltx(*root);
+            f(ltx);
+            ltx.commit();
+        }
+    };
+
+    auto check = [&]() {
+        for (auto const& e : entries)
+        {
+            auto key = LedgerEntryKey(e);
+            auto sqlEntry = sqlRoot.getNewestVersion(key);
+            auto memEntry = memRoot.getNewestVersion(key);
+            REQUIRE((bool)sqlEntry == (bool)memEntry);
+            if (sqlEntry)
+            {
+                REQUIRE(*sqlEntry == *memEntry);
+            }
+        }
+        for (auto let : {ACCOUNT, DATA, OFFER, TRUSTLINE})
+        {
+            REQUIRE(sqlRoot.countObjects(let) == memRoot.countObjects(let));
+        }
+        REQUIRE(sqlRoot.getAllOffers() == memRoot.getAllOffers());
+
+        std::unordered_set<LedgerKey> sqlExclude, memExclude;
+        for (size_t i = 0; i < 10; ++i)
+        {
+            auto sqlBest = sqlRoot.getBestOffer(buying, selling, sqlExclude);
+            auto memBest = memRoot.getBestOffer(buying, selling, memExclude);
+            REQUIRE((bool)sqlBest == (bool)memBest);
+            if (!sqlBest)
+            {
+                break;
+            }
+            REQUIRE(*sqlBest == *memBest);
+            sqlExclude.emplace(LedgerEntryKey(*sqlBest));
+            memExclude.emplace(LedgerEntryKey(*memBest));
+        }
+
+        auto sqlWinners = sqlRoot.getInflationWinners(50, 0);
+        auto memWinners = memRoot.getInflationWinners(50, 0);
+        REQUIRE(sqlWinners.size() == memWinners.size());
+        for (size_t i = 0; i < sqlWinners.size(); ++i)
+        {
+            REQUIRE(sqlWinners[i].accountID == memWinners[i].accountID);
+            REQUIRE(sqlWinners[i].votes == memWinners[i].votes);
+        }
+    };
+
+    apply([&](AbstractLedgerTxn& ltx) {
+        for (auto const& e : entries)
+        {
+            ltx.createOrUpdateWithoutLoading(e);
+        }
+    });
+    check();
+
+    SECTION("erase")
+    {
+        apply([&](AbstractLedgerTxn& ltx) {
+            for (size_t i = 0; i < entries.size(); i += 2)
+            {
+                ltx.erase(LedgerEntryKey(entries[i]));
+            }
+        });
+        check();
+    }
+
+    SECTION("delete objects modified on or after ledger")
+    {
+        apply([&](AbstractLedgerTxn& ltx) {
+            ++ltx.loadHeader().current().ledgerSeq;
+            for (size_t i = 0; i < entries.size(); i += 3)
+            {
+                ltx.load(LedgerEntryKey(entries[i]));
+            }
+        });
+        auto ledgerSeq = sqlRoot.getHeader().ledgerSeq;
+        LedgerRange range(ledgerSeq, ledgerSeq);
+        REQUIRE(sqlRoot.countObjects(ACCOUNT, range) ==
+                memRoot.countObjects(ACCOUNT, range));
+        sqlRoot.deleteObjectsModifiedOnOrAfterLedger(ledgerSeq);
+        memRoot.deleteObjectsModifiedOnOrAfterLedger(ledgerSeq);
+        check();
+    }
+}
+
+TEST_CASE("in-memory ledger state is loaded from buckets at startup",
+          "[ledgerstate]")
+{
+    auto cfg = getTestConfig(0, Config::TESTDB_ON_DISK_SQLITE);
+    cfg.MODE_USES_IN_MEMORY_LEDGER = true;
+
+    auto dest = txtest::getAccount("dest");
+    int64_t destBalance = 0;
+    LedgerHeader lcl;
+    {
+        VirtualClock clock;
+        auto app = createTestApplication(clock, cfg);
+        app->start();
+
+        auto root = TestAccount::createRoot(*app);
+        destBalance = app->getLedgerManager().getLastMinBalance(0) + 1000;
+        txtest::closeLedgerOn(
+            *app, 2, 1, 1, 2016,
+            {root.tx({txtest::createAccount(dest.getPublicKey(),
+                                            destBalance)})});
+        for (uint32_t i = 3; i < 10; ++i)
+        {
+            txtest::closeLedgerOn(*app, i, 1, 1, 2016);
+        }
+        lcl = app->getLedgerManager().getLastClosedLedgerHeader().header;
+    }
+
+    VirtualClock clock;
+    auto app = createTestApplication(clock, cfg, /*newDB=*/false);
+    app->start();
+    REQUIRE(app->getLedgerManager().getLastClosedLedgerHeader().header ==
+            lcl);
+    REQUIRE(app->getLedgerTxnRoot().countObjects(ACCOUNT) == 2);
+
+    LedgerTxn ltx(app->getLedgerTxnRoot());
+    auto destAccount = ltx.load(accountKey(dest.getPublicKey()));
+    REQUIRE(destAccount);
+    REQUIRE(destAccount.current().data.account().balance == destBalance);
+}
+
+TEST_CASE("ledger entries are rebuilt after running with in-memory state",
+          "[ledgerstate]")
+{
+    auto cfg = getTestConfig(0, Config::TESTDB_ON_DISK_SQLITE);
+    auto dest = txtest::getAccount("dest");
+    int64_t destBalance = 0;
+    bool createInMemory = false;
+    SECTION("database created without in-memory state")
+    {
+    }
+    SECTION("database created with in-memory state")
+    {
+        // The schema upgrades still apply to the ledger entry tables
+        createInMemory = true;
+    }
+    {
+        auto createCfg = cfg;
+        createCfg.MODE_USES_IN_MEMORY_LEDGER = createInMemory;
+        VirtualClock clock;
+        auto app = createTestApplication(clock, createCfg);
+        app->start();
+    }
+    {
+        auto memCfg = cfg;
+        memCfg.MODE_USES_IN_MEMORY_LEDGER = true;
+        VirtualClock clock;
+        auto app = createTestApplication(clock, memCfg, /*newDB=*/false);
+        app->start();
+        REQUIRE(app->getPersistentState().getState(
+                    PersistentState::kInMemoryLedger) == "true");
+
+        auto root = TestAccount::createRoot(*app);
+        destBalance = app->getLedgerManager().getLastMinBalance(0) + 1000;
+        txtest::closeLedgerOn(
+            *app, 2, 1, 1, 2016,
+            {root.tx({txtest::createAccount(dest.getPublicKey(),
+                                            destBalance)})});
+    }
+
+    VirtualClock clock;
+    auto app = createTestApplication(clock, cfg, /*newDB=*/false);
+    app->start();
+    REQUIRE(app->getPersistentState()
+                .getState(PersistentState::kInMemoryLedger)
+                .empty());
+    REQUIRE(app->getLedgerTxnRoot().countObjects(ACCOUNT) == 2);
+
+    LedgerTxn ltx(app->getLedgerTxnRoot());
+    auto destAccount = ltx.load(accountKey(dest.getPublicKey()));
+    REQUIRE(destAccount);
+    REQUIRE(destAccount.current().data.account().balance == destBalance);
+}
+
+// Inserts entry as it was stored before schema version 11, with StrKeys and
+// base64 XDR.
+static void
+insertPreBinaryKeysEntry(soci::session& session, LedgerEntry const& entry)
+{
+    int32_t lastModified = unsignedToSigned(entry.lastModifiedLedgerSeq);
+    switch (entry.data.type())
+    {
+    case ACCOUNT:
+    {
+        auto const& ae = entry.data.account();
+        std::string accountID = KeyUtils::toStrKey(ae.accountID);
+        std::string inflationDest =
+            ae.inflationDest ? KeyUtils::toStrKey(*ae.inflationDest) : "";
+        soci::indicator inflationDestInd =
+            ae.inflationDest ? soci::i_ok : soci::i_null;
+        std::string homeDomain = decoder::encode_b64(ae.homeDomain);
+        std::string thresholds = decoder::encode_b64(ae.thresholds);
+        std::string signers =
+            decoder::encode_b64(xdr::xdr_to_opaque(ae.signers));
+        soci::indicator signersInd =
+            ae.signers.empty() ? soci::i_null : soci::i_ok;
+        int32_t numSubEntries = unsignedToSigned(ae.numSubEntries);
+        int32_t flags = unsignedToSigned(ae.flags);
+        Liabilities liabilities;
+        soci::indicator liabilitiesInd = soci::i_null;
+        if (ae.ext.v() == 1)
+        {
+            liabilities = ae.ext.v1().liabilities;
+            liabilitiesInd = soci::i_ok;
+        }
+        session << "INSERT INTO accounts (accountid, balance, seqnum, "
+                   "numsubentries, inflationdest, homedomain, thresholds, "
+                   "flags, signers, lastmodified, buyingliabilities, "
+                   "sellingliabilities) VALUES (:v1, :v2, :v3, :v4, :v5, "
+                   ":v6, :v7, :v8, :v9, :v10, :v11, :v12)",
+            soci::use(accountID), soci::use(ae.balance), soci::use(ae.seqNum),
+            soci::use(numSubEntries),
+            soci::use(inflationDest, inflationDestInd), soci::use(homeDomain),
+            soci::use(thresholds), soci::use(flags),
+            soci::use(signers, signersInd), soci::use(lastModified),
+            soci::use(liabilities.buying, liabilitiesInd),
+            soci::use(liabilities.selling, liabilitiesInd);
+        break;
+    }
+    case TRUSTLINE:
+    {
+        auto const& tl = entry.data.trustLine();
+        std::string accountID = KeyUtils::toStrKey(tl.accountID);
+        std::string issuer = KeyUtils::toStrKey(getIssuer(tl.asset));
+        std::string assetCode;
+        if (tl.asset.type() == ASSET_TYPE_CREDIT_ALPHANUM4)
+        {
+            assetCodeToStr(tl.asset.alphaNum4().assetCode, assetCode);
+        }
+        else
+        {
+            assetCodeToStr(tl.asset.alphaNum12().assetCode, assetCode);
+        }
+        int32_t assetType = tl.asset.type();
+        int32_t flags = unsignedToSigned(tl.flags);
+        Liabilities liabilities;
+        soci::indicator liabilitiesInd = soci::i_null;
+        if (tl.ext.v() == 1)
+        {
+            liabilities = tl.ext.v1().liabilities;
+            liabilitiesInd = soci::i_ok;
+        }
+        session << "INSERT INTO trustlines (accountid, assettype, issuer, "
+                   "assetcode, tlimit, balance, flags, lastmodified, "
+                   "buyingliabilities, sellingliabilities) VALUES (:v1, :v2, "
+                   ":v3, :v4, :v5, :v6, :v7, :v8, :v9, :v10)",
+            soci::use(accountID), soci::use(assetType), soci::use(issuer),
+            soci::use(assetCode), soci::use(tl.limit), soci::use(tl.balance),
+            soci::use(flags), soci::use(lastModified),
+            soci::use(liabilities.buying, liabilitiesInd),
+            soci::use(liabilities.selling, liabilitiesInd);
+        break;
+    }
+    case OFFER:
+    {
+        auto const& oe = entry.data.offer();
+        std::string sellerID = KeyUtils::toStrKey(oe.sellerID);
+        std::string selling =
+            decoder::encode_b64(xdr::xdr_to_opaque(oe.selling));
+        std::string buying = decoder::encode_b64(xdr::xdr_to_opaque(oe.buying));
+        double price = double(oe.price.n) / double(oe.price.d);
+        int32_t flags = unsignedToSigned(oe.flags);
+        session << "INSERT INTO offers (sellerid, offerid, sellingasset, "
+                   "buyingasset, amount, pricen, priced, price, flags, "
+                   "lastmodified) VALUES (:v1, :v2, :v3, :v4, :v5, :v6, :v7, "
+                   ":v8, :v9, :v10)",
+            soci::use(sellerID), soci::use(oe.offerID), soci::use(selling),
+            soci::use(buying), soci::use(oe.amount), soci::use(oe.price.n),
+            soci::use(oe.price.d), soci::use(price), soci::use(flags),
+            soci::use(lastModified);
+        break;
+    }
+    case DATA:
+    {
+        auto const& de = entry.data.data();
+        std::string accountID = KeyUtils::toStrKey(de.accountID);
+        std::string dataName = decoder::encode_b64(de.dataName);
+        std::string dataValue = decoder::encode_b64(de.dataValue);
+        session << "INSERT INTO accountdata (accountid, dataname, datavalue, "
+                   "lastmodified) VALUES (:v1, :v2, :v3, :v4)",
+            soci::use(accountID), soci::use(dataName), soci::use(dataValue),
+            soci::use(lastModified);
+        break;
+    }
+    default:
+        throw std::runtime_error("Unknown ledger entry type");
+    }
+}
+
+TEST_CASE("schema upgrade converts ledger entry tables to binary keys",
+          "[ledgerstate]")
+{
+    auto runTest = [](Config::TestDbMode mode) {
+        VirtualClock clock;
+        auto app = createTestApplication(clock, getTestConfig(0, mode));
+        app->start();
+        auto& db = app->getDatabase();
+        auto& root = app->getLedgerTxnRoot();
+
+        // drop* creates the tables as they were before schema version 11
+        root.dropAccounts();
+        root.dropData();
+        root.dropOffers();
+        root.dropTrustLines();
+
+        std::vector<LedgerEntry> entries;
+        {
+            std::unordered_set<LedgerKey> keys;
+            for (auto const& e :
+                 LedgerTestUtils::generateValidLedgerEntries(200))
+            {
+                if (keys.emplace(LedgerEntryKey(e)).second)
+                {
+                    insertPreBinaryKeysEntry(db.getSession(), e);
+                    entries.emplace_back(e);
+                }
+            }
+        }
+
+        {
+            soci::transaction tx(db.getSession());
+            LedgerTxnRoot::upgradeToBinaryKeys(db);
+            tx.commit();
+        }
+        db.clearPreparedStatementCache();
+
+        REQUIRE(root.countObjects(ACCOUNT) + root.countObjects(TRUSTLINE) +
+                    root.countObjects(OFFER) + root.countObjects(DATA) ==
+                entries.size());
+        LedgerTxn ltx(root);
+        for (auto const& e : entries)
+        {
+            auto entry = ltx.load(LedgerEntryKey(e));
+            REQUIRE(entry);
+            REQUIRE(entry.current() == e);
+        }
+    };
+
+    SECTION("sqlite")
+    {
+        runTest(Config::TESTDB_IN_MEMORY_SQLITE);
+    }
+
+#ifdef USE_POSTGRES
+    SECTION("postgresql")
+    {
+        runTest(Config::TESTDB_POSTGRESQL);
+    }
+#endif
+}
+
+TEST_CASE("Create performance benchmark", "[!hide][createbench]")
+{
+    auto runTest = [&](Config::TestDbMode mode, bool loading) {
+        VirtualClock clock;
+        Config cfg(getTestConfig(0, mode));
+        Application::pointer app = createTestApplication(clock, cfg);
+        app->start();
+        size_t n = 0xffff, batch = 0xfff;
+
+        std::vector<LedgerEntry> entries;
+        for (auto i = 0; i < 10; ++i)
+        {
+            // First add some bulking entries so we're not using a
+            // totally empty database.
+            entries = LedgerTestUtils::generateValidLedgerEntries(n);
+            LedgerTxn ltx(app->getLedgerTxnRoot());
+            for (auto e : entries)
+            {
+                ltx.createOrUpdateWithoutLoading(e);
+            }
+            ltx.commit();
+        }
+
+        // Then do some precise timed creates.
+        entries = LedgerTestUtils::generateValidLedgerEntries(n);
+        auto& m =
+            app->getMetrics().NewMeter({"ledger", "create", "commit"}, "entry");
+        while (!entries.empty())
+        {
+            LedgerTxn ltx(app->getLedgerTxnRoot());
+            for (size_t i = 0; !entries.empty() && i < batch; ++i)
+            {
+                if (loading)
+                {
+                    ltx.create(entries.back());
+                }
+                else
+                {
+                    ltx.createOrUpdateWithoutLoading(entries.back());
+                }
+                entries.pop_back();
+            }
+            ltx.commit();
+            m.Mark(batch);
+            CLOG(INFO, "Ledger")
+                << "benchmark create rate: " << m.mean_rate() << " entries/sec "
+                << (loading ? "(loading)" : "(non-loading)");
+        }
+    };
+
+    SECTION("sqlite")
+    {
+        runTest(Config::TESTDB_ON_DISK_SQLITE, true);
+        runTest(Config::TESTDB_ON_DISK_SQLITE, false);
+    }
+
+#ifdef USE_POSTGRES
+    SECTION("postgresql")
+    {
+        runTest(Config::TESTDB_POSTGRESQL, true);
+        runTest(Config::TESTDB_POSTGRESQL, false);
+    }
+#endif
+}
+
+TEST_CASE("Erase performance benchmark", "[!hide][erasebench]")
 {
     auto runTest = [&](Config::TestDbMode mode, bool loading) {
         VirtualClock clock;
@@ -2398,6 +3519,141 @@ TEST_CASE("Bulk load batch size benchmark", "[!hide][bulkbatchsizebench]")
 #endif
 }
 
+#ifdef USE_POSTGRES
+TEST_CASE("Bulk upsert through COPY", "[ledgerstate]")
+{
+    VirtualClock clock;
+    Config cfg(getTestConfig(0, Config::TESTDB_POSTGRESQL));
+    cfg.BULK_UPSERT_COPY_THRESHOLD = 0;
+    auto app = createTestApplication(clock, cfg);
+    app->start();
+    auto& root = app->getLedgerTxnRoot();
+
+    std::unordered_map<LedgerKey, LedgerEntry> entries;
+    for (auto const& e : LedgerTestUtils::generateValidLedgerEntries(500))
+    {
+        entries[LedgerEntryKey(e)] = e;
+    }
+
+    // Read back through a fresh root so that nothing is served from cache
+    auto check = [&]() {
+        LedgerTxnRoot freshRoot(app->getDatabase(), 4096, 64, 1000, false);
+        LedgerTxn ltx(freshRoot);
+        for (auto const& kv : entries)
+        {
+            auto le = ltx.load(kv.first);
+            REQUIRE(le);
+            REQUIRE(le.current() == kv.second);
+        }
+    };
+
+    {
+        LedgerTxn ltx(root, false);
+        for (auto const& kv : entries)
+        {
+            ltx.createOrUpdateWithoutLoading(kv.second);
+        }
+        ltx.commit();
+    }
+    check();
+
+    // Updates of existing rows go through the ON CONFLICT branch
+    for (auto& kv : entries)
+    {
+        kv.second.lastModifiedLedgerSeq += 1;
+    }
+    {
+        LedgerTxn ltx(root, false);
+        for (auto const& kv : entries)
+        {
+            ltx.createOrUpdateWithoutLoading(kv.second);
+        }
+        ltx.commit();
+    }
+    check();
+}
+
+TEST_CASE("Bulk upsert through COPY first in a session", "[ledgerstate]")
+{
+    VirtualClock clock;
+    Config cfg(getTestConfig(0, Config::TESTDB_POSTGRESQL));
+    cfg.BULK_UPSERT_COPY_THRESHOLD = 100;
+    auto app = createTestApplication(clock, cfg);
+    app->start();
+    auto& root = app->getLedgerTxnRoot();
+
+    // The genesis ledger is below the threshold, so the temporary tables of
+    // COPY do not exist yet in the session of the application
+    std::vector<LedgerEntry> entries;
+    std::map<LedgerEntryType, uint64_t> counts;
+    {
+        std::unordered_set<LedgerKey> keys;
+        for (auto const& e : LedgerTestUtils::generateValidLedgerEntries(2000))
+        {
+            if (keys.emplace(LedgerEntryKey(e)).second)
+            {
+                entries.emplace_back(e);
+                ++counts[e.data.type()];
+            }
+        }
+    }
+    for (auto let : {ACCOUNT, OFFER, TRUSTLINE})
+    {
+        REQUIRE(counts[let] >= cfg.BULK_UPSERT_COPY_THRESHOLD);
+    }
+
+    {
+        LedgerTxn ltx(root, false);
+        for (auto const& e : entries)
+        {
+            ltx.createOrUpdateWithoutLoading(e);
+        }
+        REQUIRE_NOTHROW(ltx.commit());
+    }
+    // The root account was created by the genesis ledger
+    REQUIRE(root.countObjects(ACCOUNT) == counts[ACCOUNT] + 1);
+    REQUIRE(root.countObjects(OFFER) == counts[OFFER]);
+    REQUIRE(root.countObjects(TRUSTLINE) == counts[TRUSTLINE]);
+}
+
+TEST_CASE("Bulk upsert COPY threshold benchmark", "[!hide][copyupsertbench]")
+{
+    auto runTest = [&](size_t batchSize, size_t threshold) {
+        VirtualClock clock;
+        Config cfg(getTestConfig(0, Config::TESTDB_POSTGRESQL));
+        cfg.BULK_UPSERT_COPY_THRESHOLD = threshold;
+        auto app = createTestApplication(clock, cfg);
+        app->start();
+        auto& root = app->getLedgerTxnRoot();
+
+        auto entries = LedgerTestUtils::generateValidLedgerEntries(50000);
+        auto& m = app->getMetrics().NewTimer(
+            {"ledger", "copy-upsert", std::to_string(batchSize) + " batch"});
+        for (size_t i = 0; i < entries.size(); i += batchSize)
+        {
+            LedgerTxn ltx(root);
+            auto end = std::min(entries.size(), i + batchSize);
+            for (size_t j = i; j < end; ++j)
+            {
+                ltx.createOrUpdateWithoutLoading(entries[j]);
+            }
+            auto timer = m.TimeScope();
+            ltx.commit();
+        }
+        return m.sum();
+    };
+
+    for (size_t batchSize : {10, 100, 500, 1000, 2500, 5000, 10000})
+    {
+        auto unnest = runTest(batchSize, std::numeric_limits<size_t>::max());
+        auto copy = runTest(batchSize, 0);
+        CLOG(INFO, "Ledger") << "Bulk upsert batch size " << batchSize
+                             << ": unnest took " << unnest
+                             << ", COPY took " << copy;
+    }
+}
+#endif
+
 TEST_CASE("Signers performance benchmark", "[!hide][signersbench]")
 {
     auto getTimeScope = [](Application& app, uint32_t numSigners,
@@ -47,7 +47,7 @@ class CommandHandler;
 class WorkScheduler;
 class BanManager;
 class StatusManager;
-class LedgerTxnRoot;
+class AbstractLedgerTxnParent;
 
 #ifdef BUILD_TESTS
 class LoadGenerator;
@@ -282,7 +282,9 @@ class Application
     // instances
     virtual Hash const& getNetworkID() const = 0;
 
-    virtual LedgerTxnRoot& getLedgerTxnRoot() = 0;
+    // Returns the root of the ledger state, which holds the committed ledger
+    // entries either in SQL or, with MODE_USES_IN_MEMORY_LEDGER, in memory.
+    virtual AbstractLedgerTxnParent& getLedgerTxnRoot() = 0;
 
     // Factory: create a new Application object bound to `clock`, with a local
     // copy made of `cfg`.
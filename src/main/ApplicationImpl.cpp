@@ -18,12 +18,14 @@
 #include "herder/HerderPersistence.h"
 #include "history/HistoryArchiveManager.h"
 #include "history/HistoryManager.h"
+#include "history/HistorySegmentStore.h"
 #include "invariant/AccountSubEntriesCountIsValid.h"
 #include "invariant/BucketListIsConsistentWithDatabase.h"
 #include "invariant/ConservationOfLumens.h"
 #include "invariant/InvariantManager.h"
 #include "invariant/LedgerEntryIsValid.h"
 #include "invariant/LiabilitiesMatchOffers.h"
+#include "ledger/InMemoryLedgerTxnRoot.h"
 #include "ledger/LedgerManager.h"
 #include "ledger/LedgerTxn.h"
 #include "main/CommandHandler.h"
@@ -132,9 +134,27 @@ ApplicationImpl::initialize(bool createNewDB)
     mWorkScheduler = WorkScheduler::create(*this);
     mBanManager = BanManager::create(*this);
     mStatusManager = std::make_unique<StatusManager>();
-    mLedgerTxnRoot = std::make_unique<LedgerTxnRoot>(
-        *mDatabase, mConfig.ENTRY_CACHE_SIZE, mConfig.BEST_OFFERS_CACHE_SIZE,
-        mConfig.PREFETCH_BATCH_SIZE);
+    if (mConfig.MODE_USES_IN_MEMORY_LEDGER)
+    {
+        LOG(INFO) << "Holding ledger state in memory, it will be loaded "
+                     "from buckets at startup";
+        mLedgerTxnRoot = std::make_unique<InMemoryLedgerTxnRoot>(*mDatabase);
+    }
+    else
+    {
+        bool asyncCommit = mConfig.ASYNC_LEDGER_COMMIT;
+        if (asyncCommit && mDatabase->isSqlite())
+        {
+            LOG(WARNING) << "ASYNC_LEDGER_COMMIT is not supported with "
+                            "sqlite, ledger entries will be committed "
+                            "synchronously";
+            asyncCommit = false;
+        }
+        mLedgerTxnRoot = std::make_unique<LedgerTxnRoot>(
+            *mDatabase, mConfig.ENTRY_CACHE_SIZE,
+            mConfig.BEST_OFFERS_CACHE_SIZE, mConfig.PREFETCH_BATCH_SIZE,
+            asyncCommit);
+    }
 
     BucketListIsConsistentWithDatabase::registerInvariant(*this);
     AccountSubEntriesCountIsValid::registerInvariant(*this);
@@ -165,6 +185,10 @@ ApplicationImpl::newDB()
     mDatabase->initialize();
     mDatabase->upgradeToCurrentSchema();
     mBucketManager->dropAll();
+    if (auto segments = mHistoryManager->getSegmentStore())
+    {
+        segments->clear();
+    }
     mLedgerManager->startNewLedger();
 }
 
@@ -329,6 +353,9 @@ ApplicationImpl::~ApplicationImpl()
     reportCfgMetrics();
     shutdownMainIOContext();
     joinAllThreads();
+    // Destroying the LedgerTxnRoot waits until any pending ledger entries are
+    // written to the database, which requires the metrics to still exist
+    mLedgerTxnRoot.reset();
     LOG(INFO) << "Application destroyed";
 }
 
@@ -837,7 +864,7 @@ ApplicationImpl::createLedgerManager()
     return LedgerManager::create(*this);
 }
 
-LedgerTxnRoot&
+AbstractLedgerTxnParent&
 ApplicationImpl::getLedgerTxnRoot()
 {
     // assertThreadIsMain();
@@ -29,7 +29,7 @@ class HistoryManager;
 class ProcessManager;
 class CommandHandler;
 class Database;
-class LedgerTxnRoot;
+class AbstractLedgerTxnParent;
 class LoadGenerator;
 
 class ApplicationImpl : public Application
@@ -112,7 +112,7 @@ class ApplicationImpl : public Application
 
     virtual Hash const& getNetworkID() const override;
 
-    virtual LedgerTxnRoot& getLedgerTxnRoot() override;
+    virtual AbstractLedgerTxnParent& getLedgerTxnRoot() override;
 
   protected:
     std::unique_ptr<LedgerManager>
@@ -152,7 +152,7 @@ class ApplicationImpl : public Application
     std::unique_ptr<PersistentState> mPersistentState;
     std::unique_ptr<BanManager> mBanManager;
     std::unique_ptr<StatusManager> mStatusManager;
-    std::unique_ptr<LedgerTxnRoot> mLedgerTxnRoot;
+    std::unique_ptr<AbstractLedgerTxnParent> mLedgerTxnRoot;
 
 #ifdef BUILD_TESTS
     std::unique_ptr<LoadGenerator> mLoadGenerator;
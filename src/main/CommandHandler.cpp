@@ -6,6 +6,7 @@
 #include "crypto/Hex.h"
 #include "crypto/KeyUtils.h"
 #include "herder/Herder.h"
+#include "ledger/LedgerCloseStats.h"
 #include "ledger/LedgerManager.h"
 #include "ledger/LedgerTxn.h"
 #include "ledger/LedgerTxnEntry.h"
@@ -72,6 +73,7 @@ CommandHandler::CommandHandler(Application& app) : mApp(app)
 
     addRoute("bans", &CommandHandler::bans);
     addRoute("clearmetrics", &CommandHandler::clearMetrics);
+    addRoute("closetimes", &CommandHandler::closeTimes);
     addRoute("connect", &CommandHandler::connect);
     addRoute("dropcursor", &CommandHandler::dropcursor);
     addRoute("droppeer", &CommandHandler::dropPeer);
@@ -490,6 +492,20 @@ CommandHandler::scpInfo(std::string const& params, std::string& retStr)
     retStr = root.toStyledString();
 }
 
+void
+CommandHandler::closeTimes(std::string const& params, std::string& retStr)
+{
+    std::map<std::string, std::string> retMap;
+    http::server::server::parseParams(params, retMap);
+    size_t ledgers = 10;
+    size_t limit = 10;
+    maybeParseParam(retMap, "ledgers", ledgers);
+    maybeParseParam(retMap, "limit", limit);
+
+    auto root = mApp.getLedgerManager().getCloseStats().getJson(ledgers, limit);
+    retStr = root.toStyledString();
+}
+
 // "Must specify a log level: ll?level=<level>&partition=<name>";
 void
 CommandHandler::ll(std::string const& params, std::string& retStr)
@@ -37,6 +37,7 @@ class CommandHandler
 
     void bans(std::string const& params, std::string& retStr);
     void checkdb(std::string const& params, std::string& retStr);
+    void closeTimes(std::string const& params, std::string& retStr);
     void connect(std::string const& params, std::string& retStr);
     void dropcursor(std::string const& params, std::string& retStr);
     void dropPeer(std::string const& params, std::string& retStr);
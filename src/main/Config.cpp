@@ -13,6 +13,7 @@
 #include "main/StellarCoreVersion.h"
 #include "scp/LocalNode.h"
 #include "scp/QuorumSetUtils.h"
+#include "util/BlockCompressedFile.h"
 #include "util/Fs.h"
 #include "util/Logging.h"
 #include "util/XDROperators.h"
@@ -105,6 +106,7 @@ Config::Config() : NODE_SEED(SecretKey::random())
     FAILURE_SAFETY = -1;
     UNSAFE_QUORUM = false;
     DISABLE_BUCKET_GC = false;
+    CHECK_BUCKET_REFERENCES = false;
     DISABLE_XDR_FSYNC = false;
 
     LOG_FILE_PATH = "stellar-core.%datetime{%Y.%M.%d-%H:%m:%s}.log";
@@ -142,6 +144,12 @@ Config::Config() : NODE_SEED(SecretKey::random())
     //
     // Worst case = 10 concurrent merges + 1 quorum intersection calculation.
     WORKER_THREADS = 11;
+    BUCKET_MERGE_THREADS = 4;
+    BUCKET_COMPRESSION_LEVEL = 0;
+    MAX_CONCURRENT_DEEP_MERGES = 2;
+    BUCKET_IO_RATE_LIMIT = 256;
+    BUCKET_APPLY_THREADS = 4;
+    BUCKET_MERGE_CHECKPOINT_SIZE = 256;
     MAX_CONCURRENT_SUBPROCESSES = 16;
     NODE_IS_VALIDATOR = false;
     QUORUM_INTERSECTION_CHECKER = true;
@@ -150,6 +158,11 @@ Config::Config() : NODE_SEED(SecretKey::random())
     ENTRY_CACHE_SIZE = 100000;
     BEST_OFFERS_CACHE_SIZE = 64;
     PREFETCH_BATCH_SIZE = 1000;
+    BULK_UPSERT_COPY_THRESHOLD = 1000;
+    ASYNC_LEDGER_COMMIT = false;
+    MODE_USES_IN_MEMORY_LEDGER = false;
+    HISTORY_SEGMENT_DIR_PATH = "";
+    HISTORY_PARTITION_CHECKPOINTS = 0;
 }
 
 namespace
@@ -667,6 +680,10 @@ Config::processConfig(std::shared_ptr<cpptoml::table> t)
             {
                 UNSAFE_QUORUM = readBool(item);
             }
+            else if (item.first == "CHECK_BUCKET_REFERENCES")
+            {
+                CHECK_BUCKET_REFERENCES = readBool(item);
+            }
             else if (item.first == "DISABLE_XDR_FSYNC")
             {
                 DISABLE_XDR_FSYNC = readBool(item);
@@ -833,6 +850,38 @@ Config::processConfig(std::shared_ptr<cpptoml::table> t)
             {
                 WORKER_THREADS = readInt<int>(item, 1, 1000);
             }
+            else if (item.first == "BUCKET_MERGE_THREADS")
+            {
+                BUCKET_MERGE_THREADS = readInt<uint32_t>(item, 1, 64);
+            }
+            else if (item.first == "MAX_CONCURRENT_DEEP_MERGES")
+            {
+                MAX_CONCURRENT_DEEP_MERGES = readInt<uint32_t>(item, 1, 64);
+            }
+            else if (item.first == "BUCKET_IO_RATE_LIMIT")
+            {
+                BUCKET_IO_RATE_LIMIT = readInt<uint32_t>(item, 0, 1000000);
+            }
+            else if (item.first == "BUCKET_APPLY_THREADS")
+            {
+                BUCKET_APPLY_THREADS = readInt<uint32_t>(item, 1, 64);
+            }
+            else if (item.first == "BUCKET_MERGE_CHECKPOINT_SIZE")
+            {
+                BUCKET_MERGE_CHECKPOINT_SIZE =
+                    readInt<uint32_t>(item, 0, 1000000);
+            }
+            else if (item.first == "BUCKET_COMPRESSION_LEVEL")
+            {
+                BUCKET_COMPRESSION_LEVEL = readInt<int>(item, 0, 19);
+                if (BUCKET_COMPRESSION_LEVEL != 0 &&
+                    !blockcompression::isAvailable())
+                {
+                    throw std::invalid_argument(
+                        "BUCKET_COMPRESSION_LEVEL needs stellar-core to be "
+                        "built with zstd");
+                }
+            }
             else if (item.first == "MAX_CONCURRENT_SUBPROCESSES")
             {
                 MAX_CONCURRENT_SUBPROCESSES = readInt<int>(item, 1);
@@ -916,6 +965,26 @@ Config::processConfig(std::shared_ptr<cpptoml::table> t)
             {
                 PREFETCH_BATCH_SIZE = readInt<uint32_t>(item);
             }
+            else if (item.first == "BULK_UPSERT_COPY_THRESHOLD")
+            {
+                BULK_UPSERT_COPY_THRESHOLD = readInt<uint32_t>(item);
+            }
+            else if (item.first == "ASYNC_LEDGER_COMMIT")
+            {
+                ASYNC_LEDGER_COMMIT = readBool(item);
+            }
+            else if (item.first == "MODE_USES_IN_MEMORY_LEDGER")
+            {
+                MODE_USES_IN_MEMORY_LEDGER = readBool(item);
+            }
+            else if (item.first == "HISTORY_SEGMENT_DIR_PATH")
+            {
+                HISTORY_SEGMENT_DIR_PATH = readString(item);
+            }
+            else if (item.first == "HISTORY_PARTITION_CHECKPOINTS")
+            {
+                HISTORY_PARTITION_CHECKPOINTS = readInt<uint32_t>(item);
+            }
             else if (item.first == "MAXIMUM_LEDGER_CLOSETIME_DRIFT")
             {
                 MAXIMUM_LEDGER_CLOSETIME_DRIFT = readInt<int64_t>(item, 0);
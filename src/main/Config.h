@@ -202,6 +202,12 @@ class Config : public std::enable_shared_from_this<Config>
     // disk usage, but it is useful for recovering of nodes.
     bool DISABLE_BUCKET_GC;
 
+    // If set to true, every bucket GC pass checks the reference counts of
+    // the buckets against a full scan of the bucket list, the last closed
+    // ledger and the publish queue, and throws if they disagree. It is a
+    // debugging aid, too slow for production.
+    bool CHECK_BUCKET_REFERENCES;
+
     // If set to true, writing an XDR file (a bucket or a checkpoint) will not
     // be followed by an fsync on the file. This in turn means that XDR files
     // (which hold the canonical state of the ledger) may be corrupted if the
@@ -273,6 +279,32 @@ class Config : public std::enable_shared_from_this<Config>
     // thread-management config
     int WORKER_THREADS;
 
+    // Maximum number of threads merging a bucket. Merges of large buckets are
+    // split into ranges of keys that are merged in parallel; 1 disables it.
+    uint32_t BUCKET_MERGE_THREADS;
+
+    // zstd level that new bucket files are block-compressed at, 0 to write
+    // them uncompressed. Needs a build with zstd.
+    int BUCKET_COMPRESSION_LEVEL;
+
+    // Maximum number of merges into the deepest levels of the bucket list
+    // running at once (see MergeScheduler).
+    uint32_t MAX_CONCURRENT_DEEP_MERGES;
+
+    // Maximum rate of background bucket I/O, in MB per second, which backs
+    // off during ledger closes (see IOThrottle). 0 does not limit it.
+    uint32_t BUCKET_IO_RATE_LIMIT;
+
+    // Number of threads applying buckets to the database during catchup,
+    // each through a session of its own; 1 applies them on the main thread.
+    // Buckets are always applied on the main thread with SQLite.
+    uint32_t BUCKET_APPLY_THREADS;
+
+    // Size, in MB, of output after which merges of at least that much input
+    // checkpoint their progress (see MergeCheckpoint), so that they resume
+    // where they stopped after a restart. 0 disables it.
+    uint32_t BUCKET_MERGE_CHECKPOINT_SIZE;
+
     // process-management config
     int MAX_CONCURRENT_SUBPROCESSES;
 
@@ -303,9 +335,9 @@ class Config : public std::enable_shared_from_this<Config>
     // Data layer cache configuration
     // - ENTRY_CACHE_SIZE controls the maximum number of LedgerEntry objects
     //   that will be stored in the cache
-    // - BEST_OFFERS_CACHE_SIZE controls the maximum number of Asset pairs that
-    //   will be stored in the cache, although many LedgerEntry objects may be
-    //   associated with a single Asset pair
+    // - BEST_OFFERS_CACHE_SIZE controls the maximum number of Asset pairs for
+    //   which an order book will be kept in memory, although many LedgerEntry
+    //   objects may be associated with a single Asset pair
     size_t ENTRY_CACHE_SIZE;
     size_t BEST_OFFERS_CACHE_SIZE;
 
@@ -315,6 +347,33 @@ class Config : public std::enable_shared_from_this<Config>
     // the entry cache
     size_t PREFETCH_BATCH_SIZE;
 
+    // - BULK_UPSERT_COPY_THRESHOLD is the number of rows from which bulk
+    // upserts of ledger entries on postgresql stream the rows into a
+    // temporary table with COPY instead of binding them as arrays
+    size_t BULK_UPSERT_COPY_THRESHOLD;
+
+    // If ASYNC_LEDGER_COMMIT is true, ledger entries committed by a ledger
+    // close are written to the database by a dedicated thread, overlapping
+    // with the next ledger. Only takes effect with a postgresql database.
+    bool ASYNC_LEDGER_COMMIT;
+
+    // If MODE_USES_IN_MEMORY_LEDGER is true, ledger entries are held in
+    // memory rather than in the database, and are loaded from the bucket list
+    // at startup. The database only holds history and node state.
+    bool MODE_USES_IN_MEMORY_LEDGER;
+
+    // If HISTORY_SEGMENT_DIR_PATH is not empty, the transactions, results
+    // and SCP messages of closed ledgers are appended to one segment per
+    // checkpoint in that directory (see HistorySegmentStore). SCP messages
+    // are then no longer inserted in the database; transactions still are,
+    // along with their meta and fee changes.
+    std::string HISTORY_SEGMENT_DIR_PATH;
+
+    // If HISTORY_PARTITION_CHECKPOINTS is not 0, the history tables are
+    // partitioned by that many checkpoints, so that trimming history drops
+    // partitions rather than deleting rows (see HistoryPartitions).
+    uint32_t HISTORY_PARTITION_CHECKPOINTS;
+
     Config();
 
     void load(std::string const& filename);
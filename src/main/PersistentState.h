@@ -7,6 +7,11 @@
 #include "main/Application.h"
 #include <string>
 
+namespace soci
+{
+class session;
+}
+
 namespace stellar
 {
 
@@ -24,11 +29,21 @@ class PersistentState
         kDatabaseSchema,
         kNetworkPassphrase,
         kLedgerUpgrades,
+        kLastFlushedLedger,
+        kInMemoryLedger,
         kLastEntry,
     };
 
     static void dropAll(Database& db);
 
+    // Variants of getState and setState that run on the provided session
+    // rather than the main session, for use by threads that own a session
+    // borrowed from the connection pool.
+    static std::string getState(Database& db, soci::session& session,
+                                Entry stateName);
+    static void setState(Database& db, soci::session& session,
+                         Entry stateName, std::string const& value);
+
     std::string getState(Entry stateName);
     void setState(Entry stateName, std::string const& value);
 
@@ -42,8 +57,12 @@ class PersistentState
 
     Application& mApp;
 
-    std::string getStoreStateName(Entry n, uint32 subscript = 0);
+    static std::string getStoreStateName(Entry n, uint32 subscript = 0);
     void updateDb(std::string const& entry, std::string const& value);
     std::string getFromDb(std::string const& entry);
+    static void updateDb(Database& db, soci::session& session,
+                         std::string const& entry, std::string const& value);
+    static std::string getFromDb(Database& db, soci::session& session,
+                                 std::string const& entry);
 };
 }
@@ -122,6 +122,7 @@ getTestConfig(int instanceNumber, Config::TestDbMode mode)
         thisConfig.BUCKET_DIR_PATH = rootDir + "bucket";
 
         thisConfig.INVARIANT_CHECKS = {".*"};
+        thisConfig.CHECK_BUCKET_REFERENCES = true;
 
         thisConfig.ALLOW_LOCALHOST_FOR_TESTING = true;
 
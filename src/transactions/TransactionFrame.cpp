@@ -13,12 +13,14 @@
 #include "herder/TxSetFrame.h"
 #include "invariant/InvariantManager.h"
 #include "ledger/LedgerHeaderUtils.h"
+#include "ledger/LedgerManager.h"
 #include "ledger/LedgerTxn.h"
 #include "ledger/LedgerTxnEntry.h"
 #include "ledger/LedgerTxnHeader.h"
 #include "main/Application.h"
 #include "transactions/SignatureChecker.h"
 #include "transactions/SignatureUtils.h"
+#include "transactions/TransactionHistoryBatch.h"
 #include "transactions/TransactionUtils.h"
 #include "util/Algoritm.h"
 #include "util/Decoder.h"
@@ -30,6 +32,7 @@
 
 #include "medida/meter.h"
 #include "medida/metrics_registry.h"
+#include "medida/timer.h"
 
 #include <algorithm>
 #include <numeric>
@@ -618,6 +621,13 @@ TransactionFrame::applyOperations(SignatureChecker& signatureChecker,
         }
         meta.operations.emplace_back(ltxOp.getChanges());
         ltxOp.commit();
+
+        // time every kind of operation by outcome, as failing operations
+        // often take a very different time than successful ones
+        app.getLedgerManager()
+            .getOperationTimer(op->getOperation().body.type(),
+                               op->getResult())
+            .Update(time.Stop());
     }
 
     if (!errorEncountered)
@@ -686,84 +696,21 @@ TransactionFrame::toStellarMessage() const
 }
 
 void
-TransactionFrame::storeTransaction(Database& db, uint32_t ledgerSeq,
-                                   TransactionMeta& tm, int txindex,
+TransactionFrame::storeTransaction(TransactionHistoryBatch& batch,
+                                   TransactionMeta const& tm, int txindex,
                                    TransactionResultSet& resultSet) const
 {
-    auto txBytes(xdr::xdr_to_opaque(mEnvelope));
-
     resultSet.results.emplace_back(getResultPair());
-    auto txResultBytes(xdr::xdr_to_opaque(resultSet.results.back()));
-
-    std::string txBody;
-    txBody = decoder::encode_b64(txBytes);
-
-    std::string txResult;
-    txResult = decoder::encode_b64(txResultBytes);
-
-    xdr::opaque_vec<> txMeta(xdr::xdr_to_opaque(tm));
-
-    std::string meta;
-    meta = decoder::encode_b64(txMeta);
-
-    string txIDString(binToHex(getContentsHash()));
-
-    auto prep = db.getPreparedStatement(
-        "INSERT INTO txhistory "
-        "( txid, ledgerseq, txindex,  txbody, txresult, txmeta) VALUES "
-        "(:id,  :seq,      :txindex, :txb,   :txres,   :meta)");
-
-    auto& st = prep.statement();
-    st.exchange(soci::use(txIDString));
-    st.exchange(soci::use(ledgerSeq));
-    st.exchange(soci::use(txindex));
-    st.exchange(soci::use(txBody));
-    st.exchange(soci::use(txResult));
-    st.exchange(soci::use(meta));
-    st.define_and_bind();
-    {
-        auto timer = db.getInsertTimer("txhistory");
-        st.execute(true);
-    }
-
-    if (st.get_affected_rows() != 1)
-    {
-        throw std::runtime_error("Could not update data in SQL");
-    }
+    batch.addTransaction(getContentsHash(), mEnvelope,
+                         resultSet.results.back(), tm, txindex);
 }
 
 void
-TransactionFrame::storeTransactionFee(Database& db, uint32_t ledgerSeq,
+TransactionFrame::storeTransactionFee(TransactionHistoryBatch& batch,
                                       LedgerEntryChanges const& changes,
                                       int txindex) const
 {
-    xdr::opaque_vec<> txChanges(xdr::xdr_to_opaque(changes));
-
-    std::string txChanges64;
-    txChanges64 = decoder::encode_b64(txChanges);
-
-    string txIDString(binToHex(getContentsHash()));
-
-    auto prep = db.getPreparedStatement(
-        "INSERT INTO txfeehistory "
-        "( txid, ledgerseq, txindex,  txchanges) VALUES "
-        "(:id,  :seq,      :txindex, :txchanges)");
-
-    auto& st = prep.statement();
-    st.exchange(soci::use(txIDString));
-    st.exchange(soci::use(ledgerSeq));
-    st.exchange(soci::use(txindex));
-    st.exchange(soci::use(txChanges64));
-    st.define_and_bind();
-    {
-        auto timer = db.getInsertTimer("txfeehistory");
-        st.execute(true);
-    }
-
-    if (st.get_affected_rows() != 1)
-    {
-        throw std::runtime_error("Could not update data in SQL");
-    }
+    batch.addTransactionFee(getContentsHash(), changes, txindex);
 }
 
 static void
@@ -855,7 +802,7 @@ TransactionFrame::copyTransactionsToStream(Hash const& networkID, Database& db,
                                            XDROutputFileStream& txResultOut)
 {
     auto timer = db.getSelectTimer("txhistory");
-    std::string txBody, txResult, txMeta;
+    std::string txBody, txResult;
     uint32_t begin = ledgerSeq, end = ledgerSeq + ledgerCount;
     size_t n = 0;
 
@@ -959,9 +906,9 @@ void
 TransactionFrame::deleteOldEntries(Database& db, uint32_t ledgerSeq,
                                    uint32_t count)
 {
-    DatabaseUtils::deleteOldEntriesHelper(db.getSession(), ledgerSeq, count,
-                                          "txhistory", "ledgerseq");
-    DatabaseUtils::deleteOldEntriesHelper(db.getSession(), ledgerSeq, count,
-                                          "txfeehistory", "ledgerseq");
+    DatabaseUtils::deleteOldEntriesHelper(db, ledgerSeq, count, "txhistory",
+                                          "ledgerseq");
+    DatabaseUtils::deleteOldEntriesHelper(db, ledgerSeq, count, "txfeehistory",
+                                          "ledgerseq");
 }
 }
@@ -32,6 +32,7 @@ class SecretKey;
 class SignatureChecker;
 class XDROutputFileStream;
 class SHA256;
+class TransactionHistoryBatch;
 
 class TransactionFrame;
 using TransactionFramePtr = std::shared_ptr<TransactionFrame>;
@@ -194,12 +195,14 @@ class TransactionFrame
                                LedgerTxnHeader const& header,
                                AccountID const& accountID);
 
-    // transaction history
-    void storeTransaction(Database& db, uint32_t ledgerSeq, TransactionMeta& tm,
-                          int txindex, TransactionResultSet& resultSet) const;
+    // transaction history, appends the result pair to resultSet and the
+    // transaction to batch, which is written once the ledger is closed
+    void storeTransaction(TransactionHistoryBatch& batch,
+                          TransactionMeta const& tm, int txindex,
+                          TransactionResultSet& resultSet) const;
 
     // fee history
-    void storeTransactionFee(Database& db, uint32_t ledgerSeq,
+    void storeTransactionFee(TransactionHistoryBatch& batch,
                              LedgerEntryChanges const& changes,
                              int txindex) const;
 
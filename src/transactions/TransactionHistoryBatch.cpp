@@ -0,0 +1,200 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "transactions/TransactionHistoryBatch.h"
+#include "crypto/Hex.h"
+#include "database/Database.h"
+#include "database/DatabaseTypeSpecificOperation.h"
+#include "database/HistoryPartitions.h"
+#include "database/PostgresBinaryCopy.h"
+#include "util/Decoder.h"
+#include "util/types.h"
+#include "xdrpp/marshal.h"
+
+namespace stellar
+{
+
+// The XDR values are stored as base64 text, which is part of the documented
+// schema of the history tables (see docs/db-schema.md)
+template <typename T>
+static std::string
+xdrToBase64(T const& value)
+{
+    return decoder::encode_b64(xdr::xdr_to_opaque(value));
+}
+
+class TransactionHistoryBatch::StoreTransactionsOperation
+    : public DatabaseTypeSpecificOperation<void>
+{
+    Database& mDB;
+    soci::session& mSession;
+    TransactionHistoryBatch const& mBatch;
+
+  public:
+    StoreTransactionsOperation(Database& db, soci::session& session,
+                               TransactionHistoryBatch const& batch)
+        : mDB(db), mSession(session), mBatch(batch)
+    {
+    }
+
+    void
+    doSqliteSpecificOperation(soci::sqlite3_session_backend* sq) override
+    {
+        std::vector<int32_t> ledgerSeqs(
+            mBatch.mTxIDs.size(), unsignedToSigned(mBatch.mLedgerSeq));
+        auto table =
+            mDB.getHistoryPartitions().getTable("txhistory", mBatch.mLedgerSeq);
+        auto prep = mDB.getPreparedStatement(
+            "INSERT INTO " + table +
+                " (txid, ledgerseq, txindex, txbody, txresult, txmeta) "
+                "VALUES (:id, :seq, :txindex, :txb, :txres, :meta)",
+            mSession);
+        auto& st = prep.statement();
+        st.exchange(soci::use(mBatch.mTxIDs));
+        st.exchange(soci::use(ledgerSeqs));
+        st.exchange(soci::use(mBatch.mTxIndexes));
+        st.exchange(soci::use(mBatch.mTxBodies));
+        st.exchange(soci::use(mBatch.mTxResults));
+        st.exchange(soci::use(mBatch.mTxMetas));
+        st.define_and_bind();
+        {
+            auto timer = mDB.getInsertTimer("txhistory");
+            st.execute(true);
+        }
+        if (static_cast<size_t>(st.get_affected_rows()) !=
+            mBatch.mTxIDs.size())
+        {
+            throw std::runtime_error("Could not update data in SQL");
+        }
+    }
+
+#ifdef USE_POSTGRES
+    void
+    doPostgresSpecificOperation(soci::postgresql_session_backend* pg) override
+    {
+        PostgresBinaryCopy copy(6);
+        for (size_t i = 0; i < mBatch.mTxIDs.size(); ++i)
+        {
+            copy.startRow();
+            copy.append(mBatch.mTxIDs[i]);
+            copy.append(unsignedToSigned(mBatch.mLedgerSeq));
+            copy.append(mBatch.mTxIndexes[i]);
+            copy.append(mBatch.mTxBodies[i]);
+            copy.append(mBatch.mTxResults[i]);
+            copy.append(mBatch.mTxMetas[i]);
+        }
+        auto timer = mDB.getInsertTimer("txhistory");
+        copy.copyInto(pg->conn_, "txhistory",
+                      "txid, ledgerseq, txindex, txbody, txresult, txmeta");
+    }
+#endif
+};
+
+class TransactionHistoryBatch::StoreTransactionFeesOperation
+    : public DatabaseTypeSpecificOperation<void>
+{
+    Database& mDB;
+    soci::session& mSession;
+    TransactionHistoryBatch const& mBatch;
+
+  public:
+    StoreTransactionFeesOperation(Database& db, soci::session& session,
+                                  TransactionHistoryBatch const& batch)
+        : mDB(db), mSession(session), mBatch(batch)
+    {
+    }
+
+    void
+    doSqliteSpecificOperation(soci::sqlite3_session_backend* sq) override
+    {
+        std::vector<int32_t> ledgerSeqs(
+            mBatch.mFeeTxIDs.size(), unsignedToSigned(mBatch.mLedgerSeq));
+        auto table = mDB.getHistoryPartitions().getTable("txfeehistory",
+                                                         mBatch.mLedgerSeq);
+        auto prep = mDB.getPreparedStatement(
+            "INSERT INTO " + table +
+                " (txid, ledgerseq, txindex, txchanges) VALUES "
+                "(:id, :seq, :txindex, :txchanges)",
+            mSession);
+        auto& st = prep.statement();
+        st.exchange(soci::use(mBatch.mFeeTxIDs));
+        st.exchange(soci::use(ledgerSeqs));
+        st.exchange(soci::use(mBatch.mFeeTxIndexes));
+        st.exchange(soci::use(mBatch.mFeeChanges));
+        st.define_and_bind();
+        {
+            auto timer = mDB.getInsertTimer("txfeehistory");
+            st.execute(true);
+        }
+        if (static_cast<size_t>(st.get_affected_rows()) !=
+            mBatch.mFeeTxIDs.size())
+        {
+            throw std::runtime_error("Could not update data in SQL");
+        }
+    }
+
+#ifdef USE_POSTGRES
+    void
+    doPostgresSpecificOperation(soci::postgresql_session_backend* pg) override
+    {
+        PostgresBinaryCopy copy(4);
+        for (size_t i = 0; i < mBatch.mFeeTxIDs.size(); ++i)
+        {
+            copy.startRow();
+            copy.append(mBatch.mFeeTxIDs[i]);
+            copy.append(unsignedToSigned(mBatch.mLedgerSeq));
+            copy.append(mBatch.mFeeTxIndexes[i]);
+            copy.append(mBatch.mFeeChanges[i]);
+        }
+        auto timer = mDB.getInsertTimer("txfeehistory");
+        copy.copyInto(pg->conn_, "txfeehistory",
+                      "txid, ledgerseq, txindex, txchanges");
+    }
+#endif
+};
+
+TransactionHistoryBatch::TransactionHistoryBatch(uint32_t ledgerSeq)
+    : mLedgerSeq(ledgerSeq)
+{
+}
+
+void
+TransactionHistoryBatch::addTransaction(Hash const& txID,
+                                        TransactionEnvelope const& envelope,
+                                        TransactionResultPair const& result,
+                                        TransactionMeta const& meta,
+                                        int txindex)
+{
+    mTxIDs.emplace_back(binToHex(txID));
+    mTxIndexes.emplace_back(txindex);
+    mTxBodies.emplace_back(xdrToBase64(envelope));
+    mTxResults.emplace_back(xdrToBase64(result));
+    mTxMetas.emplace_back(xdrToBase64(meta));
+}
+
+void
+TransactionHistoryBatch::addTransactionFee(Hash const& txID,
+                                           LedgerEntryChanges const& changes,
+                                           int txindex)
+{
+    mFeeTxIDs.emplace_back(binToHex(txID));
+    mFeeTxIndexes.emplace_back(txindex);
+    mFeeChanges.emplace_back(xdrToBase64(changes));
+}
+
+void
+TransactionHistoryBatch::store(Database& db, soci::session& session) const
+{
+    if (!mTxIDs.empty())
+    {
+        StoreTransactionsOperation op(db, session, *this);
+        db.doDatabaseTypeSpecificOperation(op, session);
+    }
+    if (!mFeeTxIDs.empty())
+    {
+        StoreTransactionFeesOperation op(db, session, *this);
+        db.doDatabaseTypeSpecificOperation(op, session);
+    }
+}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "xdr/Stellar-ledger.h"
+#include <string>
+#include <vector>
+
+namespace soci
+{
+class session;
+}
+
+namespace stellar
+{
+
+class Database;
+
+// TransactionHistoryBatch accumulates the rows of the txhistory and
+// txfeehistory tables for the transactions of one ledger, so that they are
+// written with one statement per table (COPY on postgresql) rather than one
+// statement per transaction. The XDR values are serialized as they are added,
+// so a batch does not reference the transactions it was built from and can be
+// stored by another thread once it is complete.
+class TransactionHistoryBatch
+{
+    uint32_t const mLedgerSeq;
+
+    std::vector<std::string> mTxIDs;
+    std::vector<int32_t> mTxIndexes;
+    std::vector<std::string> mTxBodies;
+    std::vector<std::string> mTxResults;
+    std::vector<std::string> mTxMetas;
+
+    std::vector<std::string> mFeeTxIDs;
+    std::vector<int32_t> mFeeTxIndexes;
+    std::vector<std::string> mFeeChanges;
+
+    class StoreTransactionsOperation;
+    class StoreTransactionFeesOperation;
+
+  public:
+    explicit TransactionHistoryBatch(uint32_t ledgerSeq);
+
+    uint32_t
+    getLedgerSeq() const
+    {
+        return mLedgerSeq;
+    }
+
+    size_t
+    countTransactions() const
+    {
+        return mTxIDs.size();
+    }
+
+    size_t
+    countTransactionFees() const
+    {
+        return mFeeTxIDs.size();
+    }
+
+    void addTransaction(Hash const& txID, TransactionEnvelope const& envelope,
+                        TransactionResultPair const& result,
+                        TransactionMeta const& meta, int txindex);
+
+    void addTransactionFee(Hash const& txID, LedgerEntryChanges const& changes,
+                           int txindex);
+
+    // store inserts every row through session, which must be in a
+    // transaction. Throws if a row cannot be inserted.
+    void store(Database& db, soci::session& session) const;
+};
+}
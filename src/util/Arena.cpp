@@ -0,0 +1,112 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/Arena.h"
+
+#include <cassert>
+#include <cstdint>
+
+namespace stellar
+{
+
+Arena::Arena(std::shared_ptr<Arena> parent)
+    : mParent(std::move(parent))
+    , mRoot(mParent ? mParent->mRoot : this)
+    , mNext(nullptr)
+    , mRemaining(0)
+    , mStart(mRoot->position())
+    , mEnd(mStart)
+    , mBytesAllocated(0)
+{
+}
+
+Arena::~Arena()
+{
+    // Every allocation in [mStart, mEnd) belongs to this Arena or to one of
+    // its children, which are all destroyed by now. The space can be handed
+    // out again if nothing was allocated after it.
+    if (mParent && mStart <= mEnd && mRoot->position() == mEnd)
+    {
+        mRoot->rewind(mStart);
+        for (auto arena = mParent.get(); arena && arena->mEnd == mEnd;
+             arena = arena->mParent.get())
+        {
+            arena->mEnd = mStart;
+        }
+    }
+}
+
+size_t
+Arena::position() const
+{
+    return mBlocks.size() * BLOCK_SIZE - mRemaining;
+}
+
+void
+Arena::rewind(size_t pos)
+{
+    size_t blocks = (pos + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    assert(blocks <= mBlocks.size());
+    while (mBlocks.size() > blocks)
+    {
+        mFreeBlocks.emplace_back(std::move(mBlocks.back()));
+        mBlocks.pop_back();
+    }
+    mRemaining = blocks * BLOCK_SIZE - pos;
+    mNext = mBlocks.empty() ? nullptr
+                            : mBlocks.back().get() + BLOCK_SIZE - mRemaining;
+}
+
+void*
+Arena::carve(size_t bytes, size_t alignment)
+{
+    size_t padding = (alignment - reinterpret_cast<uintptr_t>(mNext) %
+                                      alignment) %
+                     alignment;
+    if (!mNext || padding + bytes > mRemaining)
+    {
+        std::unique_ptr<char[]> block;
+        if (!mFreeBlocks.empty())
+        {
+            block = std::move(mFreeBlocks.back());
+            mFreeBlocks.pop_back();
+        }
+        else
+        {
+            block.reset(new char[BLOCK_SIZE]);
+        }
+        mBlocks.emplace_back(std::move(block));
+        mNext = mBlocks.back().get();
+        mRemaining = BLOCK_SIZE;
+        padding = 0;
+    }
+
+    auto res = mNext + padding;
+    mNext += padding + bytes;
+    mRemaining -= padding + bytes;
+    return res;
+}
+
+void*
+Arena::allocate(size_t bytes, size_t alignment)
+{
+    assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+    mBytesAllocated += bytes;
+
+    if (bytes > BLOCK_SIZE / 4)
+    {
+        // The storage of new[] is suitably aligned for any fundamental type
+        mLargeAllocations.emplace_back(new char[bytes]);
+        return mLargeAllocations.back().get();
+    }
+
+    auto res = mRoot->carve(bytes, alignment);
+    auto end = mRoot->position();
+    for (auto arena = this; arena; arena = arena->mParent.get())
+    {
+        arena->mEnd = end;
+    }
+    return res;
+}
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/NonCopyable.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace stellar
+{
+
+// Arena is a monotonic allocator: memory is carved sequentially out of large
+// blocks and individual deallocations are no-ops, so that a structure with
+// many short-lived nodes costs a pointer bump per allocation and is released
+// in bulk when the Arena is destroyed.
+//
+// Arenas can be nested. An Arena constructed with a parent carves its
+// allocations out of the blocks of the root of its tree, right after the
+// allocations made so far. When it is destroyed, and nothing was allocated
+// after its own allocations (and those of its children), the space it used
+// is handed out again. Otherwise it stays in use until its parent is
+// destroyed. Allocations from a nested Arena therefore remain valid for as
+// long as the Arena itself, and an object can be handed to the parent without
+// being copied by keeping the Arena alive along with it.
+//
+// A parent must not allocate while one of its children still does: the
+// space of a child is assumed to hold nothing but the allocations of the
+// child and of its own children.
+//
+// An Arena is not thread-safe. It is meant to be shared through
+// std::shared_ptr by ArenaAllocator, so that it outlives every object
+// allocated from it. A child holds a reference to its parent, so it is
+// destroyed before its parent.
+class Arena : public NonMovableOrCopyable
+{
+  public:
+    static size_t const BLOCK_SIZE = 64 * 1024;
+
+  private:
+    std::shared_ptr<Arena> const mParent;
+    Arena* const mRoot;
+
+    // Blocks used by the tree of this Arena, and blocks that were released
+    // by it and can be handed out again. Only used by the root.
+    std::vector<std::unique_ptr<char[]>> mBlocks;
+    std::vector<std::unique_ptr<char[]>> mFreeBlocks;
+    char* mNext;
+    size_t mRemaining;
+
+    // Allocations too large to share a block, they are only released when the
+    // Arena is destroyed.
+    std::vector<std::unique_ptr<char[]>> mLargeAllocations;
+
+    // The space used by this Arena and its children, as positions in the
+    // blocks of the root (see position).
+    size_t const mStart;
+    size_t mEnd;
+
+    size_t mBytesAllocated;
+
+    // position is the offset of the next allocation of the root, counting
+    // every block in use as BLOCK_SIZE bytes. rewind releases the space
+    // after pos.
+    size_t position() const;
+    void rewind(size_t pos);
+    void* carve(size_t bytes, size_t alignment);
+
+  public:
+    explicit Arena(std::shared_ptr<Arena> parent = nullptr);
+    ~Arena();
+
+    void* allocate(size_t bytes, size_t alignment);
+
+    // bytesAllocated is the total size of the allocations made from this
+    // Arena, not including its children.
+    size_t
+    bytesAllocated() const
+    {
+        return mBytesAllocated;
+    }
+};
+
+// ArenaAllocator adapts Arena to the Allocator requirements of the standard
+// library. Every copy of an ArenaAllocator holds a reference to its Arena, so
+// an object created through std::allocate_shared keeps its Arena alive for as
+// long as the object itself.
+template <typename T> class ArenaAllocator
+{
+    template <typename U> friend class ArenaAllocator;
+
+    std::shared_ptr<Arena> mArena;
+
+  public:
+    typedef T value_type;
+
+    explicit ArenaAllocator(std::shared_ptr<Arena> arena) noexcept
+        : mArena(std::move(arena))
+    {
+    }
+
+    template <typename U>
+    ArenaAllocator(ArenaAllocator<U> const& other) noexcept
+        : mArena(other.mArena)
+    {
+    }
+
+    T*
+    allocate(size_t n)
+    {
+        return static_cast<T*>(mArena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void
+    deallocate(T* p, size_t n) noexcept
+    {
+    }
+
+    std::shared_ptr<Arena> const&
+    getArena() const
+    {
+        return mArena;
+    }
+
+    template <typename U>
+    bool
+    operator==(ArenaAllocator<U> const& other) const
+    {
+        return mArena == other.mArena;
+    }
+
+    template <typename U>
+    bool
+    operator!=(ArenaAllocator<U> const& other) const
+    {
+        return mArena != other.mArena;
+    }
+};
+}
@@ -0,0 +1,312 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/BlockCompressedFile.h"
+#include "util/XDRStream.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace stellar
+{
+
+namespace
+{
+// size, block size, block count and magic
+size_t const FOOTER_SIZE = 8 + 4 + 4 + 4;
+
+void
+putUint(char* out, uint64_t v, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        out[i] = static_cast<char>((v >> (8 * (bytes - 1 - i))) & 0xff);
+    }
+}
+
+uint64_t
+getUint(char const* in, size_t bytes)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        v = (v << 8) | static_cast<uint8_t>(in[i]);
+    }
+    return v;
+}
+
+void
+checkAvailable()
+{
+    if (!blockcompression::isAvailable())
+    {
+        throw std::runtime_error(
+            "Compressed files need stellar-core to be built with zstd");
+    }
+}
+
+struct Footer
+{
+    uint64_t size;
+    uint32_t blockSize;
+    uint32_t blockCount;
+};
+
+Footer
+readFooter(char const* footer, std::string const& filename)
+{
+    if (std::memcmp(footer + FOOTER_SIZE - 4, blockcompression::MAGIC, 4))
+    {
+        throw std::runtime_error("Invalid compressed file " + filename);
+    }
+    return Footer{getUint(footer, 8),
+                  static_cast<uint32_t>(getUint(footer + 8, 4)),
+                  static_cast<uint32_t>(getUint(footer + 12, 4))};
+}
+}
+
+namespace blockcompression
+{
+char const MAGIC[4] = {'S', 'C', 'B', 'Z'};
+
+bool
+isAvailable()
+{
+#ifdef USE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool
+isCompressed(char const* data, size_t size)
+{
+    return size >= sizeof(MAGIC) && std::memcmp(data, MAGIC, 4) == 0;
+}
+
+bool
+isCompressed(std::string const& filename)
+{
+    char magic[sizeof(MAGIC)];
+    std::ifstream in(filename, std::ifstream::binary);
+    in.read(magic, sizeof(magic));
+    return in && isCompressed(magic, sizeof(magic));
+}
+
+size_t
+getStreamSize(std::string const& filename)
+{
+    char footer[FOOTER_SIZE];
+    std::ifstream in(filename, std::ifstream::binary);
+    in.seekg(-static_cast<std::streamoff>(FOOTER_SIZE), std::ifstream::end);
+    in.read(footer, sizeof(footer));
+    if (!in)
+    {
+        throw std::runtime_error("Unable to read compressed file " + filename);
+    }
+    return readFooter(footer, filename).size;
+}
+
+void
+decompressFile(std::string const& from, std::string const& to)
+{
+    BlockCompressedFile in;
+    in.open(from);
+    in.adviseSequential();
+    XDROutputFileStream out(/*fsyncOnClose=*/false);
+    out.open(to);
+    std::vector<char> block;
+    for (size_t i = 0; i * in.getBlockSize() < in.size(); ++i)
+    {
+        in.readBlock(i, block);
+        out.writeBytes(block.data(), block.size());
+    }
+    out.close();
+}
+}
+
+BlockCompressor::BlockCompressor(XDROutputFileStream& out, int level)
+    : mOut(out), mLevel(level)
+{
+    checkAvailable();
+    mBlock.reserve(blockcompression::BLOCK_SIZE);
+    writeOut(blockcompression::MAGIC, sizeof(blockcompression::MAGIC));
+}
+
+void
+BlockCompressor::writeOut(char const* buf, size_t size)
+{
+    mOut.writeBytes(buf, size);
+    mOutSize += size;
+}
+
+void
+BlockCompressor::compressBlock()
+{
+#ifdef USE_ZSTD
+    mCompressed.resize(ZSTD_compressBound(mBlock.size()));
+    size_t size = ZSTD_compress(mCompressed.data(), mCompressed.size(),
+                                mBlock.data(), mBlock.size(), mLevel);
+    if (ZSTD_isError(size))
+    {
+        throw std::runtime_error(std::string("Unable to compress block: ") +
+                                 ZSTD_getErrorName(size));
+    }
+    mOffsets.emplace_back(mOutSize);
+    writeOut(mCompressed.data(), size);
+    mStreamSize += mBlock.size();
+    mBlock.clear();
+#endif
+}
+
+void
+BlockCompressor::write(char const* buf, size_t size)
+{
+    while (size > 0)
+    {
+        size_t n =
+            std::min(size, blockcompression::BLOCK_SIZE - mBlock.size());
+        mBlock.insert(mBlock.end(), buf, buf + n);
+        buf += n;
+        size -= n;
+        if (mBlock.size() == blockcompression::BLOCK_SIZE)
+        {
+            compressBlock();
+        }
+    }
+}
+
+void
+BlockCompressor::finish()
+{
+    if (!mBlock.empty())
+    {
+        compressBlock();
+    }
+    mOffsets.emplace_back(mOutSize);
+
+    std::vector<char> tail(mOffsets.size() * 8 + FOOTER_SIZE);
+    char* p = tail.data();
+    for (auto offset : mOffsets)
+    {
+        putUint(p, offset, 8);
+        p += 8;
+    }
+    putUint(p, mStreamSize, 8);
+    putUint(p + 8, blockcompression::BLOCK_SIZE, 4);
+    putUint(p + 12, mOffsets.size() - 1, 4);
+    std::memcpy(p + 16, blockcompression::MAGIC, 4);
+    writeOut(tail.data(), tail.size());
+}
+
+void
+BlockCompressedFile::open(std::string const& filename)
+{
+    checkAvailable();
+    mFile.open(filename);
+    char const* data = mFile.data();
+    size_t fileSize = mFile.size();
+    if (!blockcompression::isCompressed(data, fileSize) ||
+        fileSize < sizeof(blockcompression::MAGIC) + FOOTER_SIZE + 8)
+    {
+        mFile.close();
+        throw std::runtime_error("Invalid compressed file " + filename);
+    }
+
+    auto footer = readFooter(data + fileSize - FOOTER_SIZE, filename);
+    size_t tableSize = (size_t(footer.blockCount) + 1) * 8;
+    uint64_t blocks = (footer.size + footer.blockSize - 1) /
+                      std::max<uint64_t>(footer.blockSize, 1);
+    if (footer.blockSize == 0 || blocks != footer.blockCount ||
+        fileSize - sizeof(blockcompression::MAGIC) - FOOTER_SIZE < tableSize)
+    {
+        mFile.close();
+        throw std::runtime_error("Invalid compressed file " + filename);
+    }
+
+    char const* table = data + fileSize - FOOTER_SIZE - tableSize;
+    mOffsets.resize(footer.blockCount + 1);
+    for (size_t i = 0; i < mOffsets.size(); ++i)
+    {
+        mOffsets[i] = getUint(table + 8 * i, 8);
+        if ((i > 0 && mOffsets[i] < mOffsets[i - 1]) ||
+            mOffsets[i] > static_cast<uint64_t>(table - data))
+        {
+            mFile.close();
+            throw std::runtime_error("Invalid compressed file " + filename);
+        }
+    }
+    mSize = footer.size;
+    mBlockSize = footer.blockSize;
+}
+
+void
+BlockCompressedFile::close()
+{
+    mFile.close();
+    mOffsets.clear();
+    mSize = 0;
+    mBlockSize = 0;
+}
+
+void
+BlockCompressedFile::readBlock(size_t i, std::vector<char>& out) const
+{
+    assert(i + 1 < mOffsets.size());
+    out.resize(std::min(mBlockSize, mSize - i * mBlockSize));
+#ifdef USE_ZSTD
+    size_t size = ZSTD_decompress(out.data(), out.size(),
+                                  mFile.data() + mOffsets[i],
+                                  mOffsets[i + 1] - mOffsets[i]);
+    if (ZSTD_isError(size) || size != out.size())
+    {
+        throw std::runtime_error("Corrupt block in compressed file");
+    }
+#endif
+}
+
+void
+BlockCompressedFile::read(size_t pos, size_t size, char* out) const
+{
+    assert(pos + size <= mSize);
+    std::vector<char> block;
+    while (size > 0)
+    {
+        size_t i = pos / mBlockSize;
+        size_t offset = pos % mBlockSize;
+        readBlock(i, block);
+        size_t n = std::min(size, block.size() - offset);
+        std::copy(block.data() + offset, block.data() + offset + n, out);
+        out += n;
+        pos += n;
+        size -= n;
+    }
+}
+
+void
+BlockCompressedFile::adviseSequential()
+{
+    mFile.adviseSequential();
+}
+
+void
+BlockCompressedFile::willNeed(size_t pos, size_t size)
+{
+    if (pos >= mSize || size == 0)
+    {
+        return;
+    }
+    size_t first = pos / mBlockSize;
+    size_t last = std::min(pos + size - 1, mSize - 1) / mBlockSize;
+    mFile.willNeed(mOffsets[first], mOffsets[last + 1] - mOffsets[first]);
+}
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/MappedFile.h"
+#include "util/NonCopyable.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace stellar
+{
+
+class XDROutputFileStream;
+
+// A block-compressed file holds a stream of bytes cut in blocks of
+// BLOCK_SIZE bytes, each compressed on its own with zstd, so that any range
+// of the stream can be read by decompressing only the blocks that hold it.
+//
+// The file starts with MAGIC, which cannot start an XDR stream as the first
+// byte of an XDR record mark has its high bit set, so that compressed and
+// plain files can be told apart. The compressed blocks follow, then the
+// offsets of the blocks in the file and of their end, as big-endian 64 bit
+// integers, and a footer: the size of the stream (64 bits), the block size
+// and the number of blocks (32 bits each) and MAGIC again.
+//
+// Compression needs stellar-core to be built with zstd (see isAvailable).
+namespace blockcompression
+{
+extern char const MAGIC[4];
+size_t const BLOCK_SIZE = 64 * 1024;
+
+bool isAvailable();
+
+// isCompressed returns true if the size bytes of data start like a
+// block-compressed file
+bool isCompressed(char const* data, size_t size);
+bool isCompressed(std::string const& filename);
+
+// getStreamSize returns the size of the stream held by a block-compressed
+// file, reading only its footer
+size_t getStreamSize(std::string const& filename);
+
+// decompressFile writes the stream held by the block-compressed file from
+// to the file to
+void decompressFile(std::string const& from, std::string const& to);
+}
+
+// BlockCompressor compresses the bytes written to it into blocks that it
+// writes to out, which must be open and empty
+class BlockCompressor : public NonMovableOrCopyable
+{
+    XDROutputFileStream& mOut;
+    int const mLevel;
+    std::vector<char> mBlock;
+    std::vector<char> mCompressed;
+    std::vector<uint64_t> mOffsets;
+    uint64_t mOutSize{0};
+    uint64_t mStreamSize{0};
+
+    void writeOut(char const* buf, size_t size);
+    void compressBlock();
+
+  public:
+    // level is a zstd compression level. Throws if compression is not
+    // available.
+    BlockCompressor(XDROutputFileStream& out, int level);
+
+    void write(char const* buf, size_t size);
+
+    // finish writes the last block and the footer. Nothing can be written
+    // after.
+    void finish();
+};
+
+// BlockCompressedFile reads a block-compressed file through a mapping of it
+class BlockCompressedFile : public NonMovableOrCopyable
+{
+    MappedFile mFile;
+    size_t mSize{0};
+    size_t mBlockSize{0};
+    std::vector<uint64_t> mOffsets;
+
+  public:
+    // Will throw if unable to open the file, if it is not a block-compressed
+    // file or if compression is not available
+    void open(std::string const& filename);
+    void close();
+
+    bool
+    isOpen() const
+    {
+        return mFile.isOpen();
+    }
+
+    // The size of the stream held by the file
+    size_t
+    size() const
+    {
+        return mSize;
+    }
+
+    size_t
+    getBlockSize() const
+    {
+        return mBlockSize;
+    }
+
+    // readBlock decompresses the block i, which holds the bytes of the
+    // stream from i * getBlockSize(), to out. Can be called from any thread.
+    void readBlock(size_t i, std::vector<char>& out) const;
+
+    // read copies size bytes of the stream from pos to out. Can be called
+    // from any thread.
+    void read(size_t pos, size_t size, char* out) const;
+
+    // As MappedFile, for the blocks that hold a range of the stream
+    void adviseSequential();
+    void willNeed(size_t pos, size_t size);
+};
+}
@@ -0,0 +1,590 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace stellar
+{
+
+// FlatHashMap is an unordered associative container that uses open addressing
+// with linear probing. Elements are stored inline in a single array of slots,
+// rather than in individually allocated nodes as in std::unordered_map, so a
+// lookup usually touches one or two cache lines. Each slot has a control byte
+// that records whether the slot is occupied along with 7 bits of the hash of
+// its key, so most probes past a different key are rejected without comparing
+// keys. Elements are erased by backward shift deletion, so there are no
+// tombstones and erasing never makes later lookups slower.
+//
+// FlatHashMap implements the subset of the interface of std::unordered_map
+// that is used in this codebase, with the following differences:
+// - the key of an element is not const, but must not be modified through an
+//   iterator
+// - inserting or erasing an element invalidates every iterator, pointer and
+//   reference to elements, so erase does not return an iterator and elements
+//   cannot be erased while iterating.
+//
+// Hash and KeyEqual must not throw. Since the slot of a key is chosen by
+// masking its hash, Hash should mix well into the low bits: std::hash of an
+// integer, which is often the identity, is a poor choice.
+template <typename K, typename V, typename Hash = std::hash<K>,
+          typename KeyEqual = std::equal_to<K>>
+class FlatHashMap
+{
+  public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<K, V> value_type;
+    typedef Hash hasher;
+    typedef KeyEqual key_equal;
+
+  private:
+    static uint8_t const EMPTY = 0;
+    static uint8_t const OCCUPIED = 0x80;
+    static size_t const MIN_CAPACITY = 8;
+
+    // Table owns the slots and their control bytes, and destroys the elements
+    // in occupied slots when it is destroyed. The capacity is zero or a power
+    // of two.
+    struct Table
+    {
+        std::unique_ptr<uint8_t[]> control;
+        value_type* slots{nullptr};
+        size_t capacity{0};
+
+        Table() = default;
+        Table(Table const&) = delete;
+        Table& operator=(Table const&) = delete;
+
+        explicit Table(size_t cap)
+            : control(new uint8_t[cap]()), capacity(cap)
+        {
+            slots = std::allocator<value_type>().allocate(cap);
+        }
+
+        ~Table()
+        {
+            clear();
+            if (slots)
+            {
+                std::allocator<value_type>().deallocate(slots, capacity);
+            }
+        }
+
+        void
+        clear() noexcept
+        {
+            for (size_t i = 0; i < capacity; ++i)
+            {
+                if (control[i] != EMPTY)
+                {
+                    slots[i].~value_type();
+                    control[i] = EMPTY;
+                }
+            }
+        }
+
+        void
+        swap(Table& other) noexcept
+        {
+            std::swap(control, other.control);
+            std::swap(slots, other.slots);
+            std::swap(capacity, other.capacity);
+        }
+    };
+
+    Table mTable;
+    size_t mSize{0};
+    Hash mHash;
+    KeyEqual mEqual;
+
+    static uint8_t
+    controlByte(size_t hash)
+    {
+        // The top bits of the hash, since the low bits select the slot
+        return OCCUPIED |
+               static_cast<uint8_t>(hash >> (sizeof(size_t) * 8 - 7));
+    }
+
+    // findSlot returns the slot of key, or the capacity if key is absent
+    size_t
+    findSlot(K const& key, size_t hash) const
+    {
+        if (mSize == 0)
+        {
+            return mTable.capacity;
+        }
+        uint8_t const tag = controlByte(hash);
+        size_t const mask = mTable.capacity - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            uint8_t c = mTable.control[i];
+            if (c == EMPTY)
+            {
+                return mTable.capacity;
+            }
+            if (c == tag && mEqual(mTable.slots[i].first, key))
+            {
+                return i;
+            }
+        }
+    }
+
+    // findEmptySlot returns the first empty slot on the probe sequence of
+    // hash. The table must not be full.
+    static size_t
+    findEmptySlot(Table const& table, size_t hash)
+    {
+        size_t const mask = table.capacity - 1;
+        size_t i = hash & mask;
+        while (table.control[i] != EMPTY)
+        {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    static bool
+    needsGrowth(size_t size, size_t capacity)
+    {
+        // Linear probing degrades quickly above a load factor of 3/4
+        return size * 4 > capacity * 3;
+    }
+
+    // rehash has the strong exception safety guarantee
+    void
+    rehash(size_t capacity)
+    {
+        Table table(capacity);
+        for (size_t i = 0; i < mTable.capacity; ++i)
+        {
+            if (mTable.control[i] != EMPTY)
+            {
+                auto& slot = mTable.slots[i];
+                size_t j = findEmptySlot(table, mHash(slot.first));
+                ::new (&table.slots[j])
+                    value_type(std::move_if_noexcept(slot));
+                table.control[j] = mTable.control[i];
+            }
+        }
+        mTable.swap(table);
+    }
+
+    template <typename KK, typename M>
+    std::pair<size_t, bool>
+    tryEmplace(KK&& key, M&& value)
+    {
+        size_t hash = mHash(key);
+        size_t i = findSlot(key, hash);
+        if (i != mTable.capacity)
+        {
+            return std::make_pair(i, false);
+        }
+
+        if (needsGrowth(mSize + 1, mTable.capacity))
+        {
+            reserve(mSize + 1);
+        }
+        i = findEmptySlot(mTable, hash);
+        ::new (&mTable.slots[i])
+            value_type(std::forward<KK>(key), std::forward<M>(value));
+        mTable.control[i] = controlByte(hash);
+        ++mSize;
+        return std::make_pair(i, true);
+    }
+
+    // eraseSlot does not throw as long as moving an element does not throw
+    void
+    eraseSlot(size_t i)
+    {
+        size_t const mask = mTable.capacity - 1;
+        mTable.slots[i].~value_type();
+        mTable.control[i] = EMPTY;
+        --mSize;
+
+        // Shift back the elements that follow the new hole on its probe
+        // sequence, unless that would move them before their home slot
+        for (size_t j = (i + 1) & mask; mTable.control[j] != EMPTY;
+             j = (j + 1) & mask)
+        {
+            auto& slot = mTable.slots[j];
+            size_t home = mHash(slot.first) & mask;
+            if (((j - home) & mask) < ((j - i) & mask))
+            {
+                continue;
+            }
+            ::new (&mTable.slots[i]) value_type(std::move(slot));
+            slot.~value_type();
+            mTable.control[i] = mTable.control[j];
+            mTable.control[j] = EMPTY;
+            i = j;
+        }
+    }
+
+    template <bool IsConst> class Iterator
+    {
+        friend class FlatHashMap;
+        template <bool> friend class Iterator;
+
+        typedef typename std::conditional<IsConst, FlatHashMap const,
+                                          FlatHashMap>::type Map;
+
+        Map* mMap;
+        size_t mIndex;
+
+        Iterator(Map* map, size_t index) : mMap(map), mIndex(index)
+        {
+        }
+
+        Iterator&
+        skipEmpty()
+        {
+            auto const& table = mMap->mTable;
+            while (mIndex < table.capacity && table.control[mIndex] == EMPTY)
+            {
+                ++mIndex;
+            }
+            return *this;
+        }
+
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename FlatHashMap::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef typename std::conditional<IsConst, value_type const*,
+                                          value_type*>::type pointer;
+        typedef typename std::conditional<IsConst, value_type const&,
+                                          value_type&>::type reference;
+
+        Iterator() : mMap(nullptr), mIndex(0)
+        {
+        }
+
+        // Allows converting an iterator to a const_iterator
+        template <bool OtherConst,
+                  typename = typename std::enable_if<IsConst &&
+                                                     !OtherConst>::type>
+        Iterator(Iterator<OtherConst> const& other)
+            : mMap(other.mMap), mIndex(other.mIndex)
+        {
+        }
+
+        reference operator*() const
+        {
+            return mMap->mTable.slots[mIndex];
+        }
+
+        pointer operator->() const
+        {
+            return &mMap->mTable.slots[mIndex];
+        }
+
+        Iterator& operator++()
+        {
+            ++mIndex;
+            return skipEmpty();
+        }
+
+        Iterator operator++(int)
+        {
+            Iterator res = *this;
+            ++*this;
+            return res;
+        }
+
+        bool
+        operator==(Iterator const& other) const
+        {
+            return mMap == other.mMap && mIndex == other.mIndex;
+        }
+
+        bool
+        operator!=(Iterator const& other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+  public:
+    typedef Iterator<false> iterator;
+    typedef Iterator<true> const_iterator;
+
+    FlatHashMap() = default;
+
+    explicit FlatHashMap(size_t capacity)
+    {
+        reserve(capacity);
+    }
+
+    // The copy keeps the capacity of other, so every element is copied into
+    // the same slot and no key is hashed
+    FlatHashMap(FlatHashMap const& other)
+        : mHash(other.mHash), mEqual(other.mEqual)
+    {
+        if (other.mSize == 0)
+        {
+            return;
+        }
+        Table table(other.mTable.capacity);
+        for (size_t i = 0; i < table.capacity; ++i)
+        {
+            if (other.mTable.control[i] != EMPTY)
+            {
+                ::new (&table.slots[i]) value_type(other.mTable.slots[i]);
+                table.control[i] = other.mTable.control[i];
+            }
+        }
+        mTable.swap(table);
+        mSize = other.mSize;
+    }
+
+    FlatHashMap(FlatHashMap&& other) noexcept
+        : mHash(std::move(other.mHash)), mEqual(std::move(other.mEqual))
+    {
+        mTable.swap(other.mTable);
+        std::swap(mSize, other.mSize);
+    }
+
+    FlatHashMap&
+    operator=(FlatHashMap const& other)
+    {
+        if (this != &other)
+        {
+            FlatHashMap copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    FlatHashMap&
+    operator=(FlatHashMap&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    void
+    swap(FlatHashMap& other) noexcept
+    {
+        using std::swap;
+        mTable.swap(other.mTable);
+        swap(mSize, other.mSize);
+        swap(mHash, other.mHash);
+        swap(mEqual, other.mEqual);
+    }
+
+    size_t
+    size() const
+    {
+        return mSize;
+    }
+
+    bool
+    empty() const
+    {
+        return mSize == 0;
+    }
+
+    // capacity is the number of slots, zero or a power of two
+    size_t
+    capacity() const
+    {
+        return mTable.capacity;
+    }
+
+    // reserve makes room for size elements without rehashing. It has the
+    // strong exception safety guarantee.
+    void
+    reserve(size_t size)
+    {
+        size_t capacity = MIN_CAPACITY;
+        if (mTable.capacity > capacity)
+        {
+            capacity = mTable.capacity;
+        }
+        while (needsGrowth(size, capacity))
+        {
+            capacity *= 2;
+        }
+        if (capacity != mTable.capacity)
+        {
+            rehash(capacity);
+        }
+    }
+
+    // clear does not throw, and keeps the capacity
+    void
+    clear() noexcept
+    {
+        mTable.clear();
+        mSize = 0;
+    }
+
+    iterator
+    begin()
+    {
+        return iterator(this, 0).skipEmpty();
+    }
+
+    iterator
+    end()
+    {
+        return iterator(this, mTable.capacity);
+    }
+
+    const_iterator
+    begin() const
+    {
+        return cbegin();
+    }
+
+    const_iterator
+    end() const
+    {
+        return cend();
+    }
+
+    const_iterator
+    cbegin() const
+    {
+        return const_iterator(this, 0).skipEmpty();
+    }
+
+    const_iterator
+    cend() const
+    {
+        return const_iterator(this, mTable.capacity);
+    }
+
+    iterator
+    find(K const& key)
+    {
+        return iterator(this, findSlot(key, mHash(key)));
+    }
+
+    const_iterator
+    find(K const& key) const
+    {
+        return const_iterator(this, findSlot(key, mHash(key)));
+    }
+
+    size_t
+    count(K const& key) const
+    {
+        return findSlot(key, mHash(key)) != mTable.capacity ? 1 : 0;
+    }
+
+    V&
+    at(K const& key)
+    {
+        size_t i = findSlot(key, mHash(key));
+        if (i == mTable.capacity)
+        {
+            throw std::out_of_range("FlatHashMap::at: no such key");
+        }
+        return mTable.slots[i].second;
+    }
+
+    V const&
+    at(K const& key) const
+    {
+        size_t i = findSlot(key, mHash(key));
+        if (i == mTable.capacity)
+        {
+            throw std::out_of_range("FlatHashMap::at: no such key");
+        }
+        return mTable.slots[i].second;
+    }
+
+    // Inserting has the strong exception safety guarantee, as long as moving
+    // an element either does not throw or is done by copying
+    V& operator[](K const& key)
+    {
+        size_t i = tryEmplace(key, V()).first;
+        return mTable.slots[i].second;
+    }
+
+    template <typename M>
+    std::pair<iterator, bool>
+    emplace(K const& key, M&& value)
+    {
+        auto res = tryEmplace(key, std::forward<M>(value));
+        return std::make_pair(iterator(this, res.first), res.second);
+    }
+
+    std::pair<iterator, bool>
+    insert(value_type const& value)
+    {
+        return emplace(value.first, value.second);
+    }
+
+    size_t
+    erase(K const& key)
+    {
+        size_t i = findSlot(key, mHash(key));
+        if (i == mTable.capacity)
+        {
+            return 0;
+        }
+        eraseSlot(i);
+        return 1;
+    }
+
+    void
+    erase(const_iterator iter)
+    {
+        eraseSlot(iter.mIndex);
+    }
+
+    // nextOccupied returns an iterator to the element in slot, or in the
+    // first occupied slot after it, wrapping around at the end of the slots.
+    // Combined with a random slot, this picks an element at random in constant
+    // expected time, although elements that follow empty slots are more
+    // likely to be picked. The map must not be empty.
+    iterator
+    nextOccupied(size_t slot)
+    {
+        size_t const mask = mTable.capacity - 1;
+        slot &= mask;
+        while (mTable.control[slot] == EMPTY)
+        {
+            slot = (slot + 1) & mask;
+        }
+        return iterator(this, slot);
+    }
+
+    bool
+    operator==(FlatHashMap const& other) const
+    {
+        if (mSize != other.mSize)
+        {
+            return false;
+        }
+        for (auto const& kv : *this)
+        {
+            auto iter = other.find(kv.first);
+            if (iter == other.end() || !(iter->second == kv.second))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool
+    operator!=(FlatHashMap const& other) const
+    {
+        return !(*this == other);
+    }
+};
+}
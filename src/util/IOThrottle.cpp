@@ -0,0 +1,192 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/IOThrottle.h"
+
+#include "medida/counter.h"
+#include "medida/meter.h"
+#include "medida/metrics_registry.h"
+#include "medida/timer.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace stellar
+{
+
+namespace
+{
+// The part of the current rate left to background I/O during a close
+double const CLOSE_RATE_FRACTION = 1.0 / 8;
+
+// A commit this many times slower than the average halves the rate, which
+// does not go below MIN_RATE_FRACTION of the maximum. Commits faster than
+// MIN_SLOW_COMMIT_SECONDS are never slow.
+double const SLOW_COMMIT_FACTOR = 2.0;
+double const MIN_RATE_FRACTION = 1.0 / 16;
+double const MIN_SLOW_COMMIT_SECONDS = 0.01;
+
+// Every close that commits as fast as usual grows the rate by this part of
+// the maximum
+double const RATE_STEP_FRACTION = 1.0 / 8;
+
+// Weight of the last commit in the average commit time
+double const COMMIT_TIME_WEIGHT = 0.1;
+
+// Waiting threads wake up at least this often to see rate changes
+std::chrono::milliseconds const MAX_WAIT(50);
+}
+
+IOThrottle::IOThrottle(medida::MetricsRegistry& metrics,
+                       uint64_t maxBytesPerSecond)
+    : mMaxRate(static_cast<double>(maxBytesPerSecond))
+    , mRate(mMaxRate)
+    , mTokens(mMaxRate)
+    , mLastRefill(Clock::now())
+    , mBytes(metrics.NewMeter({"bucket", "io-throttle", "bytes"}, "byte"))
+    , mThrottledTime(metrics.NewTimer({"bucket", "io-throttle", "throttled"}))
+    , mRateMetric(metrics.NewCounter({"bucket", "io-throttle", "rate"}))
+{
+    setRate(mMaxRate);
+}
+
+double
+IOThrottle::getRate() const
+{
+    return mClosing ? mRate * CLOSE_RATE_FRACTION : mRate;
+}
+
+void
+IOThrottle::refill()
+{
+    auto now = Clock::now();
+    std::chrono::duration<double> elapsed = now - mLastRefill;
+    mLastRefill = now;
+    mTokens = std::min(mTokens + elapsed.count() * getRate(), mMaxRate);
+}
+
+void
+IOThrottle::setRate(double rate)
+{
+    mRate = rate;
+    // in KB per second
+    mRateMetric.set_count(static_cast<int64_t>(rate / 1024));
+}
+
+void
+IOThrottle::acquire(size_t bytes)
+{
+    mBytes.Mark(bytes);
+    if (mMaxRate == 0)
+    {
+        return;
+    }
+
+    std::chrono::nanoseconds throttled{0};
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true)
+    {
+        refill();
+        if (mUrgent > 0)
+        {
+            break;
+        }
+        // Tokens can go below 0, so that acquiring more bytes than the
+        // bucket holds waits for them afterwards
+        if (mTokens > 0)
+        {
+            mTokens -= static_cast<double>(bytes);
+            break;
+        }
+        std::chrono::duration<double> missing(-mTokens / getRate());
+        auto wait = std::min<std::chrono::nanoseconds>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(missing) +
+                std::chrono::nanoseconds(1),
+            MAX_WAIT);
+        lock.unlock();
+        auto start = Clock::now();
+        std::this_thread::sleep_for(wait);
+        throttled += Clock::now() - start;
+        lock.lock();
+    }
+    if (throttled.count() > 0)
+    {
+        mThrottledTime.Update(throttled);
+    }
+}
+
+double
+IOThrottle::getCurrentRate()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return getRate();
+}
+
+void
+IOThrottle::ledgerCloseStarted()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    refill();
+    mClosing = true;
+    mTokens = std::min(mTokens, 0.0);
+}
+
+void
+IOThrottle::ledgerCloseFinished(std::chrono::nanoseconds commitTime)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    refill();
+    mClosing = false;
+    if (mMaxRate == 0 || commitTime.count() == 0)
+    {
+        return;
+    }
+
+    std::chrono::duration<double> commit = commitTime;
+    if (mCommitTime == 0)
+    {
+        mCommitTime = commit.count();
+    }
+    if (commit.count() > SLOW_COMMIT_FACTOR * mCommitTime &&
+        commit.count() > MIN_SLOW_COMMIT_SECONDS)
+    {
+        setRate(std::max(mRate / 2, mMaxRate * MIN_RATE_FRACTION));
+    }
+    else
+    {
+        setRate(std::min(mRate + mMaxRate * RATE_STEP_FRACTION, mMaxRate));
+    }
+    mCommitTime = (1 - COMMIT_TIME_WEIGHT) * mCommitTime +
+                  COMMIT_TIME_WEIGHT * commit.count();
+}
+
+IOThrottle::LedgerClose::LedgerClose(IOThrottle& throttle)
+    : mThrottle(throttle)
+{
+    mThrottle.ledgerCloseStarted();
+}
+
+IOThrottle::LedgerClose::~LedgerClose()
+{
+    mThrottle.ledgerCloseFinished(mCommitTime);
+}
+
+void
+IOThrottle::LedgerClose::setCommitTime(std::chrono::nanoseconds commitTime)
+{
+    mCommitTime = commitTime;
+}
+
+IOThrottle::Urgent::Urgent(IOThrottle& throttle) : mThrottle(throttle)
+{
+    std::lock_guard<std::mutex> lock(mThrottle.mMutex);
+    ++mThrottle.mUrgent;
+}
+
+IOThrottle::Urgent::~Urgent()
+{
+    std::lock_guard<std::mutex> lock(mThrottle.mMutex);
+    --mThrottle.mUrgent;
+}
+}
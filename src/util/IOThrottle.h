@@ -0,0 +1,102 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/NonCopyable.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace medida
+{
+class Counter;
+class Meter;
+class MetricsRegistry;
+class Timer;
+}
+
+namespace stellar
+{
+
+// IOThrottle limits the rate of background I/O, such as bucket merges, so
+// that it does not slow down the I/O of ledger closes on the same disk. It is
+// a token bucket: threads acquire the bytes they are about to read or write,
+// and wait while the bucket is empty.
+//
+// The rate adapts to ledger closes. While a ledger is closing it is cut to a
+// fraction of the current rate, and the tokens saved before the close are
+// dropped. When the commit of a ledger is much slower than usual, the rate is
+// halved, down to a floor; otherwise it grows back to the maximum, and tokens
+// accumulate between closes up to a second of I/O at the maximum rate, so
+// that background work catches up.
+class IOThrottle : public NonMovableOrCopyable
+{
+    using Clock = std::chrono::steady_clock;
+
+    double const mMaxRate;
+
+    std::mutex mMutex;
+    double mRate;
+    double mTokens;
+    Clock::time_point mLastRefill;
+    bool mClosing{false};
+    int mUrgent{0};
+    // Average commit time of the last ledgers, in seconds
+    double mCommitTime{0};
+
+    medida::Meter& mBytes;
+    medida::Timer& mThrottledTime;
+    medida::Counter& mRateMetric;
+
+    double getRate() const;
+    void refill();
+    void setRate(double rate);
+    void ledgerCloseStarted();
+    void ledgerCloseFinished(std::chrono::nanoseconds commitTime);
+
+  public:
+    // The maximum rate is in bytes per second; 0 does not limit I/O
+    IOThrottle(medida::MetricsRegistry& metrics, uint64_t maxBytesPerSecond);
+
+    // acquire waits until bytes of I/O can be done
+    void acquire(size_t bytes);
+
+    double
+    getMaxRate() const
+    {
+        return mMaxRate;
+    }
+
+    // The current rate, in bytes per second
+    double getCurrentRate();
+
+    // LedgerClose marks a ledger close, from its construction to its
+    // destruction. setCommitTime records the time the close took to commit to
+    // the database; a close that does not set it does not change the rate.
+    class LedgerClose : public NonMovableOrCopyable
+    {
+        IOThrottle& mThrottle;
+        std::chrono::nanoseconds mCommitTime{0};
+
+      public:
+        explicit LedgerClose(IOThrottle& throttle);
+        ~LedgerClose();
+        void setCommitTime(std::chrono::nanoseconds commitTime);
+    };
+
+    // Nothing is throttled while an Urgent exists, such as while a ledger
+    // close waits for background I/O
+    class Urgent : public NonMovableOrCopyable
+    {
+        IOThrottle& mThrottle;
+
+      public:
+        explicit Urgent(IOThrottle& throttle);
+        ~Urgent();
+    };
+};
+}
@@ -0,0 +1,183 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/MappedFile.h"
+#include "util/FileSystemException.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace stellar
+{
+
+MappedFile::~MappedFile()
+{
+    if (isOpen())
+    {
+        close();
+    }
+}
+
+#ifdef _WIN32
+
+void
+MappedFile::open(std::string const& filename)
+{
+    if (isOpen())
+    {
+        FileSystemException::failWith(
+            "MappedFile::open() on already-open file");
+    }
+    HANDLE file = ::CreateFile(filename.c_str(), GENERIC_READ,
+                               FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        FileSystemException::failWithGetLastError(
+            "MappedFile::open(\"" + filename + "\") failed");
+    }
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx(file, &size))
+    {
+        ::CloseHandle(file);
+        FileSystemException::failWithGetLastError(
+            "MappedFile::open() failed on GetFileSizeEx()");
+    }
+    if (size.QuadPart == 0)
+    {
+        // Empty files cannot be mapped, and need not be
+        ::CloseHandle(file);
+        return;
+    }
+    HANDLE mapping =
+        ::CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    ::CloseHandle(file);
+    if (mapping == NULL)
+    {
+        FileSystemException::failWithGetLastError(
+            "MappedFile::open() failed on CreateFileMapping()");
+    }
+    // The view keeps the mapping alive
+    void* data = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    ::CloseHandle(mapping);
+    if (data == NULL)
+    {
+        FileSystemException::failWithGetLastError(
+            "MappedFile::open() failed on MapViewOfFile()");
+    }
+    mData = static_cast<char const*>(data);
+    mSize = static_cast<size_t>(size.QuadPart);
+}
+
+void
+MappedFile::close()
+{
+    if (mData && !::UnmapViewOfFile(mData))
+    {
+        FileSystemException::failWithGetLastError(
+            "MappedFile::close() failed on UnmapViewOfFile()");
+    }
+    mData = nullptr;
+    mSize = 0;
+}
+
+void
+MappedFile::adviseSequential()
+{
+    // FILE_FLAG_SEQUENTIAL_SCAN was given when opening the file
+}
+
+void
+MappedFile::willNeed(size_t offset, size_t size)
+{
+}
+
+#else
+
+void
+MappedFile::open(std::string const& filename)
+{
+    if (isOpen())
+    {
+        FileSystemException::failWith(
+            "MappedFile::open() on already-open file");
+    }
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        FileSystemException::failWithErrno(
+            std::string("MappedFile::open(\"") + filename + "\") failed: ");
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        FileSystemException::failWithErrno(
+            "MappedFile::open() failed on fstat(): ");
+    }
+    if (st.st_size == 0)
+    {
+        // Empty files cannot be mapped, and need not be
+        ::close(fd);
+        return;
+    }
+    // The mapping outlives the file descriptor
+    void* data = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                        MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        FileSystemException::failWithErrno(
+            "MappedFile::open() failed on mmap(): ");
+    }
+    mData = static_cast<char const*>(data);
+    mSize = static_cast<size_t>(st.st_size);
+}
+
+void
+MappedFile::close()
+{
+    if (mData && ::munmap(const_cast<char*>(mData), mSize) != 0)
+    {
+        FileSystemException::failWithErrno(
+            "MappedFile::close() failed on munmap(): ");
+    }
+    mData = nullptr;
+    mSize = 0;
+}
+
+void
+MappedFile::adviseSequential()
+{
+    if (mData)
+    {
+        // Advice is only a hint, so failures are ignored
+        ::madvise(const_cast<char*>(mData), mSize, MADV_SEQUENTIAL);
+    }
+}
+
+void
+MappedFile::willNeed(size_t offset, size_t size)
+{
+    if (!mData || offset >= mSize)
+    {
+        return;
+    }
+    // madvise needs an address aligned on a page, which the mapping is
+    static size_t const pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t start = offset / pageSize * pageSize;
+    size_t end = std::min(offset + size, mSize);
+    ::madvise(const_cast<char*>(mData) + start, end - start, MADV_WILLNEED);
+}
+
+#endif
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/NonCopyable.h"
+
+#include <cstddef>
+#include <string>
+
+namespace stellar
+{
+
+// MappedFile maps a whole file in memory, read only, so that it can be read
+// without copying it. The file must not change while it is mapped.
+class MappedFile : public NonMovableOrCopyable
+{
+    char const* mData{nullptr};
+    size_t mSize{0};
+
+  public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    // Will throw if unable to open or map the file
+    void open(std::string const& filename);
+    void close();
+
+    // Empty files are not mapped, and read as empty without being open
+    bool
+    isOpen() const
+    {
+        return mData != nullptr;
+    }
+
+    char const*
+    data() const
+    {
+        return mData;
+    }
+
+    size_t
+    size() const
+    {
+        return mSize;
+    }
+
+    // adviseSequential tells the kernel that the file is read in order, so
+    // that it reads ahead more aggressively and drops pages once read
+    void adviseSequential();
+
+    // willNeed starts reading size bytes from offset in the background
+    void willNeed(size_t offset, size_t size);
+};
+}
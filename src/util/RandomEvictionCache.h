@@ -3,11 +3,13 @@
 // under the Apache License, Version 2.0. See the COPYING file at the root
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
+#include "util/FlatHashMap.h"
 #include "util/Math.h"
 #include "util/NonCopyable.h"
 
+#include <functional>
 #include <random>
-#include <unordered_map>
+#include <vector>
 
 namespace stellar
 {
@@ -42,15 +44,10 @@ class RandomEvictionCache : public NonMovableOrCopyable
         V mValue;
     };
 
-    // Cache itself is stored in a hashmap.
-    std::unordered_map<K, CacheValue> mValueMap;
-    using MapValueType = typename std::unordered_map<K, CacheValue>::value_type;
-
-    // Pointers to hashmap elements are stored redundantly here just so we can
-    // randomly pick some to evict; unordered_map has no random-access iterators
-    // (most hashtables don't). Pointers to elements of unordered_map are stable
-    // even across rehashing or deletion of other elements, by design.
-    std::vector<MapValueType*> mValuePtrs;
+    // Cache itself is stored in a flat hashmap, whose elements are stored in
+    // an array of slots, so some can be picked at random for eviction by
+    // picking random slots.
+    FlatHashMap<K, CacheValue> mValueMap;
 
     // Each cache keeps some counters just to monitor its performance.
     Counters mCounters;
@@ -59,18 +56,16 @@ class RandomEvictionCache : public NonMovableOrCopyable
     void
     evictOne()
     {
-        size_t sz = mValuePtrs.size();
-        if (sz == 0)
+        if (mValueMap.empty())
         {
             return;
         }
-        MapValueType*& vp1 = mValuePtrs.at(rand_uniform<size_t>(0, sz - 1));
-        MapValueType*& vp2 = mValuePtrs.at(rand_uniform<size_t>(0, sz - 1));
-        MapValueType*& victim =
-            (vp1->second.mLastAccess < vp2->second.mLastAccess ? vp1 : vp2);
-        mValueMap.erase(victim->first);
-        std::swap(victim, mValuePtrs.back());
-        mValuePtrs.pop_back();
+        size_t cap = mValueMap.capacity();
+        auto i1 = mValueMap.nextOccupied(rand_uniform<size_t>(0, cap - 1));
+        auto i2 = mValueMap.nextOccupied(rand_uniform<size_t>(0, cap - 1));
+        auto victim =
+            (i1->second.mLastAccess < i2->second.mLastAccess ? i1 : i2);
+        mValueMap.erase(victim);
         ++mCounters.mEvicts;
     }
 
@@ -78,7 +73,6 @@ class RandomEvictionCache : public NonMovableOrCopyable
     explicit RandomEvictionCache(size_t maxSize) : mMaxSize(maxSize)
     {
         mValueMap.reserve(maxSize + 1);
-        mValuePtrs.reserve(maxSize + 1);
     }
 
     size_t
@@ -107,18 +101,12 @@ class RandomEvictionCache : public NonMovableOrCopyable
     {
         ++mGeneration;
         CacheValue newValue{mGeneration, v};
-        auto pair = mValueMap.insert(std::make_pair(k, newValue));
+        auto pair = mValueMap.emplace(k, newValue);
         if (pair.second)
         {
-            // An insertion occurred: save a pointer to the pair inserted.
-            // Note that it's okay to do so, as the C++14 standard
-            // guarantees that rehashing does not invalidate pointers or
-            // references to elements (26.2.7)
-            MapValueType& inserted = *pair.first;
-            mValuePtrs.push_back(&inserted);
             ++mCounters.mInserts;
             // We may have just grown over the size limit. Fix that.
-            if (mValuePtrs.size() > mMaxSize)
+            if (mValueMap.size() > mMaxSize)
             {
                 evictOne();
             }
@@ -154,7 +142,6 @@ class RandomEvictionCache : public NonMovableOrCopyable
     void
     clear()
     {
-        mValuePtrs.clear();
         mValueMap.clear();
     }
 
@@ -163,24 +150,24 @@ class RandomEvictionCache : public NonMovableOrCopyable
     void
     erase_if(std::function<bool(V const&)> const& f)
     {
-        for (size_t i = 0; i < mValuePtrs.size(); ++i)
+        // Erasing from mValueMap moves other elements, so the keys to erase
+        // are collected first
+        std::vector<K> erased;
+        for (auto const& kv : mValueMap)
         {
-            MapValueType*& vp = mValuePtrs.at(i);
-            while (mValuePtrs.size() != i && f(vp->second.mValue))
+            if (f(kv.second.mValue))
             {
-                // - `erase(k)` does not throw an exception unless that
-                // exception is thrown by the container’s Hash or Pred object
-                // (if any)
-                // - `std::swap` does not throw
-                // - `std::unordered_map::pop_back` does not throw
-                mValueMap.erase(vp->first);
-                std::swap(vp, mValuePtrs.back());
-                mValuePtrs.pop_back();
+                erased.emplace_back(kv.first);
             }
         }
+        for (auto const& k : erased)
+        {
+            mValueMap.erase(k);
+        }
     }
 
-    // `get` offers strong exception safety guarantee.
+    // `get` offers strong exception safety guarantee. The returned reference
+    // is invalidated by the next call to `put`, `erase_if` or `clear`.
     V&
     get(K const& k)
     {
@@ -0,0 +1,404 @@
+#pragma once
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/FlatHashMap.h"
+#include "util/NonCopyable.h"
+
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <vector>
+
+namespace stellar
+{
+
+// FrequencySketch estimates how many times each key was accessed recently, in
+// a fixed amount of memory, with a count-min sketch: four rows of saturating
+// 4-bit counters, each row indexed by a different hash of the key. Collisions
+// can only make an estimate too high, and taking the minimum over the rows
+// keeps that unlikely. Every time the number of increments reaches ten times
+// the width of the sketch, every counter is halved, so that old accesses are
+// forgotten and the sketch follows changes in popularity.
+class FrequencySketch
+{
+    static uint8_t const MAX_COUNT = 15;
+    static size_t const ROWS = 4;
+
+    std::vector<uint8_t> mCounters;
+    size_t mMask;
+    size_t mSampleSize;
+    size_t mIncrements{0};
+
+    size_t
+    index(uint64_t hash, size_t row) const
+    {
+        uint64_t x = (hash ^ (row * 0x9E3779B97F4A7C15ULL)) *
+                     0xBF58476D1CE4E5B9ULL;
+        return row * (mMask + 1) + ((x ^ (x >> 31)) & mMask);
+    }
+
+    void
+    halve()
+    {
+        for (auto& c : mCounters)
+        {
+            c >>= 1;
+        }
+        mIncrements /= 2;
+    }
+
+  public:
+    // The width is the smallest power of two that is at least expectedKeys
+    explicit FrequencySketch(size_t expectedKeys)
+    {
+        size_t width = 16;
+        while (width < expectedKeys)
+        {
+            width *= 2;
+        }
+        mCounters.resize(ROWS * width);
+        mMask = width - 1;
+        mSampleSize = 10 * width;
+    }
+
+    void
+    increment(uint64_t hash)
+    {
+        for (size_t row = 0; row < ROWS; ++row)
+        {
+            auto& c = mCounters[index(hash, row)];
+            if (c < MAX_COUNT)
+            {
+                ++c;
+            }
+        }
+        if (++mIncrements >= mSampleSize)
+        {
+            halve();
+        }
+    }
+
+    uint8_t
+    estimate(uint64_t hash) const
+    {
+        uint8_t res = MAX_COUNT;
+        for (size_t row = 0; row < ROWS; ++row)
+        {
+            uint8_t c = mCounters[index(hash, row)];
+            res = c < res ? c : res;
+        }
+        return res;
+    }
+};
+
+// Implements a fixed-size cache with W-TinyLFU admission and segmented LRU
+// eviction:
+// - new entries go to a small LRU window, so that entries that are accessed
+//   in a quick burst get a chance to be hit
+// - an entry that leaves the window is only admitted to the main cache if the
+//   FrequencySketch estimates that it was accessed more often than the entry
+//   it would evict, so a stream of keys that are each accessed once cannot
+//   flush entries that are accessed often
+// - the main cache is a segmented LRU: admitted entries start in the
+//   probation segment and move to the protected segment when they are hit
+//   again, so only entries that were never hit since admission are evicted
+//   until the protected segment fills up.
+//
+// Accesses are recorded in the sketch by maybeGet, whether they hit or not.
+// The sketch is not reset by clear, so the cache remembers which keys are
+// popular across invalidations.
+template <typename K, typename V, typename Hash = std::hash<K>>
+class TinyLFUCache : public NonMovableOrCopyable
+{
+  public:
+    struct Counters
+    {
+        uint64_t mHits{0};
+        uint64_t mMisses{0};
+        uint64_t mInserts{0};
+        uint64_t mUpdates{0};
+        uint64_t mEvicts{0};
+        // Entries that were evicted when leaving the window, because they
+        // were not accessed more often than the main cache victim
+        uint64_t mRejects{0};
+    };
+
+  private:
+    enum class Segment
+    {
+        WINDOW,
+        PROBATION,
+        PROTECTED
+    };
+
+    struct Node
+    {
+        K mKey;
+        V mValue;
+        Segment mSegment;
+    };
+
+    typedef std::list<Node> List;
+    typedef typename List::iterator ListIterator;
+
+    size_t const mMaxSize;
+    size_t const mMaxWindowSize;
+    size_t const mMaxMainSize;
+    size_t const mMaxProtectedSize;
+
+    // The front of each list is its most recently used entry. Iterators to
+    // list elements remain valid when they are spliced from one list to
+    // another, so the index maps every key to its element wherever it is.
+    List mWindow;
+    List mProbation;
+    List mProtected;
+    FlatHashMap<K, ListIterator, Hash> mIndex;
+    FrequencySketch mSketch;
+    Hash mHash;
+    Counters mCounters;
+
+    size_t
+    mainSize() const
+    {
+        return mProbation.size() + mProtected.size();
+    }
+
+    void
+    evict(List& list, ListIterator iter)
+    {
+        mIndex.erase(iter->mKey);
+        list.erase(iter);
+        ++mCounters.mEvicts;
+    }
+
+    // evictFromMain evicts the least recently used entry of the probation
+    // segment, or of the protected segment if the probation segment is empty
+    void
+    evictFromMain()
+    {
+        auto& list = mProbation.empty() ? mProtected : mProbation;
+        evict(list, std::prev(list.end()));
+    }
+
+    // leaveWindow moves the least recently used entry of the window to the
+    // probation segment if it is admitted, and evicts it otherwise
+    void
+    leaveWindow()
+    {
+        auto candidate = std::prev(mWindow.end());
+        if (mainSize() >= mMaxMainSize)
+        {
+            if (mMaxMainSize == 0)
+            {
+                evict(mWindow, candidate);
+                return;
+            }
+            auto& victimList = mProbation.empty() ? mProtected : mProbation;
+            auto victim = std::prev(victimList.end());
+            if (mSketch.estimate(mHash(candidate->mKey)) <=
+                mSketch.estimate(mHash(victim->mKey)))
+            {
+                evict(mWindow, candidate);
+                ++mCounters.mRejects;
+                return;
+            }
+            evict(victimList, victim);
+        }
+        candidate->mSegment = Segment::PROBATION;
+        mProbation.splice(mProbation.begin(), mWindow, candidate);
+    }
+
+    void
+    touch(ListIterator iter)
+    {
+        switch (iter->mSegment)
+        {
+        case Segment::WINDOW:
+            mWindow.splice(mWindow.begin(), mWindow, iter);
+            break;
+        case Segment::PROBATION:
+            iter->mSegment = Segment::PROTECTED;
+            mProtected.splice(mProtected.begin(), mProbation, iter);
+            if (mProtected.size() > mMaxProtectedSize)
+            {
+                auto demoted = std::prev(mProtected.end());
+                demoted->mSegment = Segment::PROBATION;
+                mProbation.splice(mProbation.begin(), mProtected, demoted);
+            }
+            break;
+        case Segment::PROTECTED:
+            mProtected.splice(mProtected.begin(), mProtected, iter);
+            break;
+        }
+    }
+
+    // insert adds a new entry at the front of list. It has the strong
+    // exception safety guarantee.
+    void
+    insert(List& list, Segment segment, K const& k, V const& v)
+    {
+        list.push_front(Node{k, v, segment});
+        try
+        {
+            mIndex.emplace(k, list.begin());
+        }
+        catch (...)
+        {
+            list.pop_front();
+            throw;
+        }
+        ++mCounters.mInserts;
+    }
+
+  public:
+    // The window holds 1% of the entries, and the protected segment 80% of
+    // the rest
+    explicit TinyLFUCache(size_t maxSize)
+        : mMaxSize(maxSize)
+        , mMaxWindowSize(maxSize == 0 ? 0 : (maxSize + 99) / 100)
+        , mMaxMainSize(maxSize - mMaxWindowSize)
+        , mMaxProtectedSize(mMaxMainSize * 4 / 5)
+        , mSketch(maxSize)
+    {
+        mIndex.reserve(maxSize);
+    }
+
+    size_t
+    maxSize() const
+    {
+        return mMaxSize;
+    }
+
+    size_t
+    size() const
+    {
+        return mIndex.size();
+    }
+
+    Counters const&
+    getCounters() const
+    {
+        return mCounters;
+    }
+
+    // `exists` does not record an access and does not throw
+    bool
+    exists(K const& k) const
+    {
+        return mIndex.find(k) != mIndex.end();
+    }
+
+    // `maybeGet` records an access to k, and returns a pointer to its value
+    // if it is in the cache and nullptr otherwise. The pointer is invalidated
+    // by the next call to `put`, `admit`, `erase` or `clear`. It does not
+    // throw.
+    V*
+    maybeGet(K const& k)
+    {
+        mSketch.increment(mHash(k));
+        auto iter = mIndex.find(k);
+        if (iter == mIndex.end())
+        {
+            ++mCounters.mMisses;
+            return nullptr;
+        }
+        ++mCounters.mHits;
+        touch(iter->second);
+        return &iter->second->mValue;
+    }
+
+    // `put` inserts k in the window, or updates its value if it is already in
+    // the cache. It offers basic exception safety guarantee. If it throws an
+    // exception, then k may or may not be in the cache.
+    void
+    put(K const& k, V const& v)
+    {
+        if (update(k, v) || mMaxSize == 0)
+        {
+            return;
+        }
+        insert(mWindow, Segment::WINDOW, k, v);
+        if (mWindow.size() > mMaxWindowSize)
+        {
+            leaveWindow();
+        }
+    }
+
+    // `admit` is like `put` but bypasses the window and the admission filter:
+    // k is inserted in the probation segment, evicting an entry of the main
+    // cache if it is full. It is meant for entries that are known to be
+    // accessed soon. It offers the same guarantee as `put`.
+    void
+    admit(K const& k, V const& v)
+    {
+        if (mMaxMainSize == 0)
+        {
+            put(k, v);
+            return;
+        }
+        if (update(k, v))
+        {
+            return;
+        }
+        if (mainSize() >= mMaxMainSize)
+        {
+            evictFromMain();
+        }
+        insert(mProbation, Segment::PROBATION, k, v);
+    }
+
+    // `update` replaces the value of k and returns true if k is in the cache,
+    // and returns false otherwise. It does not record an access and has the
+    // same exception safety guarantee as the assignment of V.
+    bool
+    update(K const& k, V const& v)
+    {
+        auto iter = mIndex.find(k);
+        if (iter == mIndex.end())
+        {
+            return false;
+        }
+        iter->second->mValue = v;
+        ++mCounters.mUpdates;
+        return true;
+    }
+
+    // `erase` does not throw
+    void
+    erase(K const& k)
+    {
+        auto iter = mIndex.find(k);
+        if (iter == mIndex.end())
+        {
+            return;
+        }
+        auto node = iter->second;
+        mIndex.erase(iter);
+        switch (node->mSegment)
+        {
+        case Segment::WINDOW:
+            mWindow.erase(node);
+            break;
+        case Segment::PROBATION:
+            mProbation.erase(node);
+            break;
+        case Segment::PROTECTED:
+            mProtected.erase(node);
+            break;
+        }
+    }
+
+    // `clear` does not throw
+    void
+    clear()
+    {
+        mIndex.clear();
+        mWindow.clear();
+        mProbation.clear();
+        mProtected.clear();
+    }
+};
+}
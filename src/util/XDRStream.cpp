@@ -0,0 +1,176 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/XDRStream.h"
+
+#include <algorithm>
+
+namespace stellar
+{
+
+XDRAsyncOutputFileStream::XDRAsyncOutputFileStream(bool fsyncOnClose,
+                                                   size_t bufferSize)
+    : mOut(fsyncOnClose), mBufferSize(bufferSize)
+{
+}
+
+XDRAsyncOutputFileStream::~XDRAsyncOutputFileStream()
+{
+    // Errors were already reported if the stream was closed, and are dropped
+    // if it is destroyed while unwinding from another one
+    stopThread();
+}
+
+void
+XDRAsyncOutputFileStream::open(std::string const& filename, SHA256* hasher,
+                               int compressionLevel)
+{
+    mOut.open(filename);
+    if (compressionLevel != 0)
+    {
+        mCompressor = std::make_unique<BlockCompressor>(mOut, compressionLevel);
+    }
+    mHasher = hasher;
+    mFilling.reserve(mBufferSize);
+}
+
+void
+XDRAsyncOutputFileStream::writeBuffer(std::vector<char> const& buf)
+{
+    if (buf.empty())
+    {
+        return;
+    }
+    if (mThrottle)
+    {
+        mThrottle->acquire(buf.size());
+    }
+    if (mCompressor)
+    {
+        mCompressor->write(buf.data(), buf.size());
+    }
+    else
+    {
+        mOut.writeBytes(buf.data(), buf.size());
+    }
+    if (mHasher)
+    {
+        mHasher->add(ByteSlice(buf.data(), buf.size()));
+    }
+}
+
+void
+XDRAsyncOutputFileStream::writeLoop()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (;;)
+    {
+        mCond.wait(lock, [this]() { return mHasWrite || mStopping; });
+        if (!mHasWrite)
+        {
+            return;
+        }
+
+        lock.unlock();
+        try
+        {
+            writeBuffer(mWriting);
+        }
+        catch (...)
+        {
+            lock.lock();
+            mError = std::current_exception();
+            lock.unlock();
+        }
+        lock.lock();
+
+        mWriting.clear();
+        mHasWrite = false;
+        mCond.notify_all();
+    }
+}
+
+void
+XDRAsyncOutputFileStream::handOff()
+{
+    if (!mThread.joinable())
+    {
+        mWriting.reserve(mBufferSize);
+        mThread = std::thread([this]() { writeLoop(); });
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCond.wait(lock, [this]() { return !mHasWrite; });
+    if (mError)
+    {
+        std::rethrow_exception(mError);
+    }
+    std::swap(mFilling, mWriting);
+    mHasWrite = true;
+    mCond.notify_all();
+}
+
+void
+XDRAsyncOutputFileStream::stopThread()
+{
+    if (mThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStopping = true;
+            mCond.notify_all();
+        }
+        mThread.join();
+        mStopping = false;
+    }
+}
+
+char*
+XDRAsyncOutputFileStream::reserve(size_t size)
+{
+    if (!isOpen())
+    {
+        FileSystemException::failWith(
+            "XDRAsyncOutputFileStream: write on non-open FILE*");
+    }
+    if (!mFilling.empty() && mFilling.size() + size > mBufferSize)
+    {
+        handOff();
+    }
+    size_t filled = mFilling.size();
+    mFilling.resize(filled + size);
+    return mFilling.data() + filled;
+}
+
+void
+XDRAsyncOutputFileStream::writeBytes(char const* buf, size_t size)
+{
+    while (size > 0)
+    {
+        size_t n = std::min(size, mBufferSize);
+        std::copy(buf, buf + n, reserve(n));
+        buf += n;
+        size -= n;
+    }
+}
+
+void
+XDRAsyncOutputFileStream::close()
+{
+    // The thread writes the buffers it was handed before stopping
+    stopThread();
+    if (mError)
+    {
+        std::rethrow_exception(mError);
+    }
+    writeBuffer(mFilling);
+    mFilling.clear();
+    if (mCompressor)
+    {
+        mCompressor->finish();
+        mCompressor.reset();
+    }
+    mOut.close();
+}
+}
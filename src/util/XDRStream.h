@@ -6,13 +6,24 @@
 
 #include "crypto/ByteSlice.h"
 #include "crypto/SHA.h"
+#include "util/BlockCompressedFile.h"
 #include "util/FileSystemException.h"
 #include "util/Fs.h"
+#include "util/IOThrottle.h"
 #include "util/Logging.h"
+#include "util/MappedFile.h"
+#include "util/NonCopyable.h"
 #include "xdrpp/marshal.h"
 
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <exception>
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 namespace stellar
@@ -29,6 +40,29 @@ class XDRInputFileStream
     size_t mSizeLimit;
     size_t mSize;
 
+    bool
+    readSize(uint32_t& sz)
+    {
+        char szBuf[4];
+        if (!mIn.read(szBuf, 4))
+        {
+            return false;
+        }
+
+        // Read 4 bytes of size, big-endian, with XDR 'continuation' bit cleared
+        // (high bit of high byte).
+        sz = 0;
+        sz |= static_cast<uint8_t>(szBuf[0] & '\x7f');
+        sz <<= 8;
+        sz |= static_cast<uint8_t>(szBuf[1]);
+        sz <<= 8;
+        sz |= static_cast<uint8_t>(szBuf[2]);
+        sz <<= 8;
+        sz |= static_cast<uint8_t>(szBuf[3]);
+
+        return mSizeLimit == 0 || sz <= mSizeLimit;
+    }
+
   public:
     XDRInputFileStream(unsigned int sizeLimit = 0)
         : mSizeLimit{sizeLimit}, mSize{0}
@@ -77,28 +111,38 @@ class XDRInputFileStream
         return mIn.tellg();
     }
 
-    template <typename T>
+    // seek moves to pos, which must be the start of an object
+    void
+    seek(size_t pos)
+    {
+        mIn.clear();
+        mIn.seekg(pos);
+    }
+
+    // skipOne moves past the next object without decoding it, returning false
+    // at the end of the stream
     bool
-    readOne(T& out)
+    skipOne()
     {
-        char szBuf[4];
-        if (!mIn.read(szBuf, 4))
+        uint32_t sz;
+        if (!readSize(sz))
         {
             return false;
         }
+        // ignore reads through the stream buffer, where seeking would drop it
+        if (!mIn.ignore(sz) || static_cast<uint32_t>(mIn.gcount()) != sz)
+        {
+            throw xdr::xdr_runtime_error("malformed XDR file");
+        }
+        return true;
+    }
 
-        // Read 4 bytes of size, big-endian, with XDR 'continuation' bit cleared
-        // (high bit of high byte).
-        uint32_t sz = 0;
-        sz |= static_cast<uint8_t>(szBuf[0] & '\x7f');
-        sz <<= 8;
-        sz |= static_cast<uint8_t>(szBuf[1]);
-        sz <<= 8;
-        sz |= static_cast<uint8_t>(szBuf[2]);
-        sz <<= 8;
-        sz |= static_cast<uint8_t>(szBuf[3]);
-
-        if (mSizeLimit != 0 && sz > mSizeLimit)
+    template <typename T>
+    bool
+    readOne(T& out)
+    {
+        uint32_t sz;
+        if (!readSize(sz))
         {
             return false;
         }
@@ -116,6 +160,216 @@ class XDRInputFileStream
     }
 };
 
+/**
+ * Helper for reading a sequence of XDR objects from a file mapped in memory.
+ * Objects are decoded from the mapped bytes rather than copied to a buffer
+ * first, and the file is read ahead a window at a time as objects are read.
+ * It reads the same files as XDRInputFileStream, and block-compressed files
+ * holding them (see BlockCompressedFile), which are decompressed a block at a
+ * time. Positions and sizes are those of the uncompressed stream.
+ */
+class XDRInputMappedStream
+{
+    MappedFile mFile;
+    std::unique_ptr<BlockCompressedFile> mCompressed;
+    IOThrottle* mThrottle{nullptr};
+    size_t mPos{0};
+    size_t mReadaheadEnd{0};
+    size_t mSizeLimit;
+
+    // The last block decompressed, and a buffer for objects that span blocks
+    static size_t const NO_BLOCK = static_cast<size_t>(-1);
+    size_t mBlockIndex{NO_BLOCK};
+    std::vector<char> mBlock;
+    std::vector<char> mObject;
+
+    // How far ahead of the objects read the file is read in the background
+    static size_t const READAHEAD_WINDOW = 4 * 1024 * 1024;
+
+    void
+    readAhead()
+    {
+        if (mPos + READAHEAD_WINDOW / 2 >= mReadaheadEnd &&
+            mReadaheadEnd < size())
+        {
+            mReadaheadEnd = std::max(mReadaheadEnd, mPos);
+            if (mThrottle)
+            {
+                mThrottle->acquire(std::min(size() - mReadaheadEnd,
+                                            size_t(READAHEAD_WINDOW)));
+            }
+            if (mCompressed)
+            {
+                mCompressed->willNeed(mReadaheadEnd, READAHEAD_WINDOW);
+            }
+            else
+            {
+                mFile.willNeed(mReadaheadEnd, READAHEAD_WINDOW);
+            }
+            mReadaheadEnd += READAHEAD_WINDOW;
+        }
+    }
+
+    // getBytes returns the len bytes of the stream from pos, which must be in
+    // the stream
+    char const*
+    getBytes(size_t pos, size_t len)
+    {
+        if (!mCompressed)
+        {
+            return mFile.data() + pos;
+        }
+        size_t blockSize = mCompressed->getBlockSize();
+        size_t offset = pos % blockSize;
+        if (offset + len <= blockSize)
+        {
+            if (mBlockIndex != pos / blockSize)
+            {
+                mBlockIndex = pos / blockSize;
+                mCompressed->readBlock(mBlockIndex, mBlock);
+            }
+            return mBlock.data() + offset;
+        }
+        mObject.resize(len);
+        mCompressed->read(pos, len, mObject.data());
+        return mObject.data();
+    }
+
+    bool
+    readSize(uint32_t& sz)
+    {
+        if (size() - mPos < 4)
+        {
+            return false;
+        }
+        // Read 4 bytes of size, big-endian, with XDR 'continuation' bit cleared
+        // (high bit of high byte).
+        auto p = reinterpret_cast<uint8_t const*>(getBytes(mPos, 4));
+        sz = (static_cast<uint32_t>(p[0] & 0x7f) << 24) |
+             (static_cast<uint32_t>(p[1]) << 16) |
+             (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+        if (mSizeLimit != 0 && sz > mSizeLimit)
+        {
+            return false;
+        }
+        if (size() - mPos - 4 < sz)
+        {
+            throw xdr::xdr_runtime_error("malformed XDR file");
+        }
+        return true;
+    }
+
+  public:
+    XDRInputMappedStream(unsigned int sizeLimit = 0) : mSizeLimit{sizeLimit}
+    {
+    }
+
+    // setThrottle makes the stream acquire the bytes it reads ahead from
+    // throttle. It must be called before open.
+    void
+    setThrottle(IOThrottle* throttle)
+    {
+        mThrottle = throttle;
+    }
+
+    void
+    close()
+    {
+        if (mFile.isOpen())
+        {
+            mFile.close();
+        }
+        mCompressed.reset();
+        mBlockIndex = NO_BLOCK;
+        mPos = 0;
+        mReadaheadEnd = 0;
+    }
+
+    void
+    open(std::string const& filename)
+    {
+        mFile.open(filename);
+        if (blockcompression::isCompressed(mFile.data(), mFile.size()))
+        {
+            mFile.close();
+            mCompressed = std::make_unique<BlockCompressedFile>();
+            mCompressed->open(filename);
+            mCompressed->adviseSequential();
+        }
+        else
+        {
+            mFile.adviseSequential();
+        }
+        mBlockIndex = NO_BLOCK;
+        mPos = 0;
+        mReadaheadEnd = 0;
+        readAhead();
+    }
+
+    // true while there are bytes left to read
+    operator bool() const
+    {
+        return mPos < size();
+    }
+
+    size_t
+    size() const
+    {
+        return mCompressed ? mCompressed->size() : mFile.size();
+    }
+
+    size_t
+    pos() const
+    {
+        return mPos;
+    }
+
+    // seek moves to pos, which must be the start of an object
+    void
+    seek(size_t pos)
+    {
+        assert(pos <= size());
+        mPos = pos;
+        mReadaheadEnd = pos;
+        readAhead();
+    }
+
+    // skipOne moves past the next object without decoding it, returning false
+    // at the end of the stream
+    bool
+    skipOne()
+    {
+        uint32_t sz;
+        if (!readSize(sz))
+        {
+            return false;
+        }
+        mPos += 4 + sz;
+        readAhead();
+        return true;
+    }
+
+    template <typename T>
+    bool
+    readOne(T& out)
+    {
+        uint32_t sz;
+        if (!readSize(sz))
+        {
+            return false;
+        }
+        // XDR objects are sized in multiples of 4 bytes, so objects are
+        // aligned as the decoder expects in the page-aligned mapping and in
+        // the blocks
+        char const* start = getBytes(mPos + 4, sz);
+        xdr::xdr_get g(start, start + sz);
+        xdr::xdr_argpack_archive(g, out);
+        mPos += 4 + sz;
+        readAhead();
+        return true;
+    }
+};
+
 // XDROutputStream needs access to a file descriptor to do
 // fsync, so we use cstdio here rather than fstreams.
 class XDROutputFileStream
@@ -179,12 +433,57 @@ class XDROutputFileStream
         }
     }
 
+    // openAt opens filename for writing at offset, creating it if it does not
+    // exist. Records overwrite the bytes after offset, but the file is not
+    // truncated.
+    void
+    openAt(std::string const& filename, uint64_t offset)
+    {
+        if (mOut)
+        {
+            FileSystemException::failWith(
+                "XDROutputFileStream::openAt() on already-open stream");
+        }
+        mOut = fopen(filename.c_str(), "r+b");
+        if (!mOut)
+        {
+            mOut = fopen(filename.c_str(), "w+b");
+        }
+        if (!mOut)
+        {
+            FileSystemException::failWithErrno(
+                std::string("XDROutputFileStream::openAt(\"") + filename +
+                "\") failed: ");
+        }
+        if (fseek(mOut, static_cast<long>(offset), SEEK_SET) != 0)
+        {
+            FileSystemException::failWithErrno(
+                "XDROutputFileStream::openAt() failed on fseek(): ");
+        }
+    }
+
     operator bool() const
     {
         return (mOut && !static_cast<bool>(ferror(mOut)) &&
                 !static_cast<bool>(feof(mOut)));
     }
 
+    // writeBytes writes objects that were already serialized
+    void
+    writeBytes(char const* buf, size_t size)
+    {
+        if (!mOut)
+        {
+            FileSystemException::failWith(
+                "XDROutputFileStream::writeBytes() on non-open FILE*");
+        }
+        if (fwrite(buf, 1, size, mOut) != size)
+        {
+            FileSystemException::failWithErrno(
+                "XDROutputFileStream::writeBytes() failed:");
+        }
+    }
+
     template <typename T>
     void
     writeOne(T const& t, SHA256* hasher = nullptr, size_t* bytesPut = nullptr)
@@ -229,4 +528,96 @@ class XDROutputFileStream
         }
     }
 };
+
+/**
+ * Helper for writing a sequence of XDR objects to a file, pipelined: objects
+ * are serialized into a large buffer on the caller's thread, and full buffers
+ * are hashed and written by a thread of the stream while the caller fills the
+ * next one. The file is fsynced once, on close. Small files, which fit in a
+ * buffer, are written on close without starting the thread.
+ */
+class XDRAsyncOutputFileStream : public NonMovableOrCopyable
+{
+    XDROutputFileStream mOut;
+    std::unique_ptr<BlockCompressor> mCompressor;
+    SHA256* mHasher{nullptr};
+    IOThrottle* mThrottle{nullptr};
+    size_t const mBufferSize;
+
+    // The buffer being filled by the caller, and the one being written
+    std::vector<char> mFilling;
+    std::vector<char> mWriting;
+
+    std::thread mThread;
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    bool mHasWrite{false};
+    bool mStopping{false};
+    std::exception_ptr mError;
+
+    void writeBuffer(std::vector<char> const& buf);
+    void writeLoop();
+    void handOff();
+    void stopThread();
+
+    // reserve returns size bytes at the end of the buffer being filled
+    char* reserve(size_t size);
+
+  public:
+    XDRAsyncOutputFileStream(bool fsyncOnClose,
+                             size_t bufferSize = 1024 * 1024);
+    ~XDRAsyncOutputFileStream();
+
+    // The bytes written are added to hasher, if it is not null, in order. It
+    // can only be finished after close. If compressionLevel is not 0, the
+    // file is block-compressed at that zstd level (see BlockCompressedFile),
+    // on the writer thread; the bytes hashed are still those written.
+    void open(std::string const& filename, SHA256* hasher = nullptr,
+              int compressionLevel = 0);
+
+    // close writes what is left, then flushes and closes the file, and throws
+    // any error that happened while writing
+    void close();
+
+    // setThrottle makes the writer thread acquire the bytes it writes from
+    // throttle. It must be called before open.
+    void
+    setThrottle(IOThrottle* throttle)
+    {
+        mThrottle = throttle;
+    }
+
+    bool
+    isOpen() const
+    {
+        return static_cast<bool>(mOut);
+    }
+
+    // writeBytes writes objects that were already serialized
+    void writeBytes(char const* buf, size_t size);
+
+    template <typename T>
+    void
+    writeOne(T const& t, size_t* bytesPut = nullptr)
+    {
+        uint32_t sz = (uint32_t)xdr::xdr_size(t);
+        assert(sz < 0x80000000);
+
+        // Write 4 bytes of size, big-endian, with XDR 'continuation' bit set on
+        // high bit of high byte.
+        char* buf = reserve(sz + 4);
+        buf[0] = static_cast<char>((sz >> 24) & 0xFF) | '\x80';
+        buf[1] = static_cast<char>((sz >> 16) & 0xFF);
+        buf[2] = static_cast<char>((sz >> 8) & 0xFF);
+        buf[3] = static_cast<char>(sz & 0xFF);
+
+        xdr::xdr_put p(buf + 4, buf + 4 + sz);
+        xdr_argpack_archive(p, t);
+
+        if (bytesPut)
+        {
+            *bytesPut += (sz + 4);
+        }
+    }
+};
 }
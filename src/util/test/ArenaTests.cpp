@@ -0,0 +1,121 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "lib/catch.hpp"
+#include "util/Arena.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace stellar;
+
+TEST_CASE("arena allocations are aligned and disjoint", "[arena]")
+{
+    auto arena = std::make_shared<Arena>();
+    std::vector<std::pair<char*, size_t>> allocations;
+    for (size_t i = 1; i < 2000; ++i)
+    {
+        size_t alignment = size_t(1) << (i % 4);
+        size_t bytes = (i * 7) % 200 + 1;
+        auto p = static_cast<char*>(arena->allocate(bytes, alignment));
+        REQUIRE(reinterpret_cast<uintptr_t>(p) % alignment == 0);
+        std::fill(p, p + bytes, static_cast<char>(i));
+        allocations.emplace_back(p, bytes);
+    }
+    for (size_t i = 0; i < allocations.size(); ++i)
+    {
+        auto const& a = allocations[i];
+        REQUIRE(std::all_of(a.first, a.first + a.second, [&](char c) {
+            return c == static_cast<char>(i + 1);
+        }));
+    }
+
+    SECTION("large allocations")
+    {
+        auto p = static_cast<char*>(arena->allocate(Arena::BLOCK_SIZE * 2, 8));
+        std::fill(p, p + Arena::BLOCK_SIZE * 2, 'x');
+        REQUIRE(arena->bytesAllocated() >= Arena::BLOCK_SIZE * 2);
+    }
+}
+
+TEST_CASE("nested arenas reuse the space of destroyed children", "[arena]")
+{
+    auto parent = std::make_shared<Arena>();
+    char* first = nullptr;
+    {
+        auto child = std::make_shared<Arena>(parent);
+        first = static_cast<char*>(child->allocate(16, 8));
+    }
+    REQUIRE(parent->bytesAllocated() == 0);
+    {
+        // Nothing was allocated after the first child, so its space is handed
+        // out again
+        auto child = std::make_shared<Arena>(parent);
+        REQUIRE(static_cast<char*>(child->allocate(16, 8)) == first);
+    }
+}
+
+TEST_CASE("nested arenas keep the space of children that are alive",
+          "[arena]")
+{
+    auto parent = std::make_shared<Arena>();
+    auto child = std::make_shared<Arena>(parent);
+    auto str = std::allocate_shared<std::string>(
+        ArenaAllocator<std::string>(child), "child");
+    child.reset();
+
+    // str keeps the child alive, so the parent allocates after it
+    auto p = static_cast<char*>(parent->allocate(64, 8));
+    std::fill(p, p + 64, 'x');
+    REQUIRE(*str == "child");
+
+    // The parent allocated after the child, so the space of the child is not
+    // handed out again when it is destroyed
+    str.reset();
+    auto other = std::make_shared<Arena>(parent);
+    auto q = static_cast<char*>(other->allocate(64, 8));
+    REQUIRE((q >= p + 64 || q + 64 <= p));
+}
+
+TEST_CASE("arena allocator works with containers", "[arena]")
+{
+    auto arena = std::make_shared<Arena>();
+    typedef ArenaAllocator<std::pair<int const, std::string>> Alloc;
+    std::unordered_map<int, std::string, std::hash<int>, std::equal_to<int>,
+                       Alloc>
+        map(Alloc{arena});
+    for (int i = 0; i < 10000; ++i)
+    {
+        map[i] = std::to_string(i);
+    }
+    for (int i = 0; i < 10000; i += 2)
+    {
+        map.erase(i);
+    }
+    REQUIRE(map.size() == 5000);
+    REQUIRE(map.at(1) == "1");
+    REQUIRE(arena->bytesAllocated() > 0);
+
+    auto copy = map;
+    REQUIRE(copy.get_allocator() == map.get_allocator());
+    REQUIRE(copy == map);
+}
+
+TEST_CASE("objects from allocate_shared keep their arena alive", "[arena]")
+{
+    std::weak_ptr<Arena> weak;
+    std::shared_ptr<std::string> str;
+    {
+        auto arena = std::make_shared<Arena>();
+        weak = arena;
+        str = std::allocate_shared<std::string>(
+            ArenaAllocator<std::string>(arena), "arena");
+    }
+    REQUIRE(!weak.expired());
+    REQUIRE(*str == "arena");
+    str.reset();
+    REQUIRE(weak.expired());
+}
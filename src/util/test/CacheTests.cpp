@@ -4,9 +4,14 @@
 
 #include "lib/catch.hpp"
 #include "lib/util/lrucache.hpp"
+#include "util/Logging.h"
+#include "util/Math.h"
 #include "util/RandomEvictionCache.h"
+#include "util/TinyLFUCache.h"
+#include <algorithm>
 #include <ctime>
 #include <map>
+#include <vector>
 
 using namespace stellar;
 
@@ -246,3 +251,135 @@ TEMPLATE_TEST_CASE("cache erase_if removes all nodes", "[cache][template]",
     REQUIRE(!c.exists(3));
     REQUIRE(!c.exists(4));
 }
+
+TEST_CASE("tinylfu cache keeps frequent entries through a scan",
+          "[tinylfucache]")
+{
+    size_t sz = 1000;
+    TinyLFUCache<int, int> cache(sz);
+    auto access = [&](int i) {
+        if (!cache.maybeGet(i))
+        {
+            cache.put(i, i);
+        }
+    };
+
+    // Access a hot set a few times, then scan many keys that are only
+    // accessed once
+    for (int round = 0; round < 5; ++round)
+    {
+        for (int i = 0; i < 500; ++i)
+        {
+            access(i);
+        }
+    }
+    for (int i = 0; i < 100000; ++i)
+    {
+        access(1000000 + i);
+    }
+
+    REQUIRE(cache.size() == sz);
+    size_t hot = 0;
+    for (int i = 0; i < 500; ++i)
+    {
+        hot += cache.exists(i) ? 1 : 0;
+    }
+    REQUIRE(hot >= 450);
+    REQUIRE(cache.getCounters().mRejects > 0);
+}
+
+TEST_CASE("tinylfu cache admit, update and erase", "[tinylfucache]")
+{
+    TinyLFUCache<int, int> cache(100);
+    for (int i = 0; i < 1000; ++i)
+    {
+        cache.admit(i, i);
+        REQUIRE(cache.size() <= 100);
+    }
+    // Admitted entries bypass the admission filter
+    REQUIRE(cache.exists(999));
+
+    REQUIRE(cache.update(999, 1));
+    REQUIRE(*cache.maybeGet(999) == 1);
+    REQUIRE(!cache.update(-1, 1));
+    REQUIRE(!cache.exists(-1));
+
+    cache.erase(999);
+    REQUIRE(!cache.exists(999));
+    REQUIRE(cache.maybeGet(999) == nullptr);
+
+    cache.clear();
+    REQUIRE(cache.size() == 0);
+
+    SECTION("empty cache")
+    {
+        TinyLFUCache<int, int> empty(0);
+        empty.put(0, 0);
+        empty.admit(1, 1);
+        REQUIRE(empty.size() == 0);
+    }
+}
+
+// Replays a synthetic trace of ledger key accesses through a
+// RandomEvictionCache and a TinyLFUCache of the same size, and reports their
+// hit ratios. Popular keys (market makers, issuers) follow a Zipf
+// distribution, and bursts of keys that are accessed once (a spam of new
+// accounts) are interleaved with them.
+TEST_CASE("entry cache simulation", "[!hide][cachesimulation]")
+{
+    size_t const sz = 4096;
+    size_t const popular = 100000;
+    size_t const accesses = 2000000;
+
+    std::vector<double> cdf;
+    double sum = 0;
+    for (size_t i = 1; i <= popular; ++i)
+    {
+        sum += 1.0 / i;
+        cdf.emplace_back(sum);
+    }
+
+    std::vector<int> trace;
+    int oneOff = static_cast<int>(popular);
+    while (trace.size() < accesses)
+    {
+        for (size_t i = 0; i < 10000; ++i)
+        {
+            double x = rand_uniform<int>(0, INT32_MAX) * sum / INT32_MAX;
+            trace.emplace_back(static_cast<int>(
+                std::lower_bound(cdf.begin(), cdf.end(), x) - cdf.begin()));
+        }
+        for (size_t i = 0; i < 5000; ++i)
+        {
+            trace.emplace_back(oneOff++);
+        }
+    }
+
+    RandomEvictionCache<int, int> randomCache(sz);
+    TinyLFUCache<int, int> tinyLFUCache(sz);
+    for (auto key : trace)
+    {
+        if (randomCache.exists(key))
+        {
+            randomCache.get(key);
+        }
+        else
+        {
+            randomCache.put(key, key);
+        }
+        if (!tinyLFUCache.maybeGet(key))
+        {
+            tinyLFUCache.put(key, key);
+        }
+    }
+
+    auto const& randomCounters = randomCache.getCounters();
+    auto const& tinyLFUCounters = tinyLFUCache.getCounters();
+    CLOG(INFO, "Perf")
+        << "RandomEvictionCache hit ratio: "
+        << static_cast<double>(randomCounters.mHits) / trace.size();
+    CLOG(INFO, "Perf")
+        << "TinyLFUCache hit ratio: "
+        << static_cast<double>(tinyLFUCounters.mHits) / trace.size();
+    REQUIRE(tinyLFUCounters.mHits > randomCounters.mHits);
+}
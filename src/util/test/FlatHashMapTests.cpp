@@ -0,0 +1,126 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "lib/catch.hpp"
+#include "util/FlatHashMap.h"
+#include "util/Math.h"
+#include <string>
+#include <unordered_map>
+
+using namespace stellar;
+
+namespace
+{
+struct MixingHash
+{
+    size_t
+    operator()(int x) const
+    {
+        uint64_t h = static_cast<uint64_t>(x) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(h ^ (h >> 32));
+    }
+};
+
+// Puts every key in one of a few long runs of slots, so that probe sequences
+// wrap around the end of the slots and erasing shifts many elements
+struct ClusteringHash
+{
+    size_t
+    operator()(int x) const
+    {
+        return static_cast<size_t>(x % 3) * 0x5555555555555555ULL;
+    }
+};
+}
+
+TEMPLATE_TEST_CASE("flat hash map behaves like unordered_map",
+                   "[flathashmap][template]", MixingHash, ClusteringHash)
+{
+    FlatHashMap<int, std::string, TestType> map;
+    std::unordered_map<int, std::string> expected;
+
+    for (int i = 0; i < 50000; ++i)
+    {
+        int key = rand_uniform<int>(0, 999);
+        switch (rand_uniform<int>(0, 2))
+        {
+        case 0:
+            map[key] = std::to_string(i);
+            expected[key] = std::to_string(i);
+            break;
+        case 1:
+            REQUIRE(map.erase(key) == expected.erase(key));
+            break;
+        default:
+        {
+            auto iter = map.find(key);
+            auto expectedIter = expected.find(key);
+            REQUIRE((iter == map.end()) == (expectedIter == expected.end()));
+            if (iter != map.end())
+            {
+                REQUIRE(iter->second == expectedIter->second);
+            }
+        }
+        }
+        REQUIRE(map.size() == expected.size());
+    }
+
+    size_t visited = 0;
+    for (auto const& kv : map)
+    {
+        REQUIRE(expected.at(kv.first) == kv.second);
+        ++visited;
+    }
+    REQUIRE(visited == expected.size());
+}
+
+TEST_CASE("flat hash map copy, swap and reserve", "[flathashmap]")
+{
+    FlatHashMap<int, std::string, MixingHash> map;
+    for (int i = 0; i < 100; ++i)
+    {
+        REQUIRE(map.emplace(i, std::to_string(i)).second);
+    }
+    REQUIRE(!map.emplace(0, "zero").second);
+    REQUIRE(map.at(0) == "0");
+    REQUIRE_THROWS_AS(map.at(100), std::out_of_range);
+
+    auto copy = map;
+    REQUIRE(copy == map);
+    copy.erase(copy.find(7));
+    REQUIRE(copy != map);
+    REQUIRE(copy.count(7) == 0);
+    REQUIRE(map.count(7) == 1);
+
+    FlatHashMap<int, std::string, MixingHash> other;
+    other.swap(copy);
+    REQUIRE(copy.empty());
+    REQUIRE(other.size() == 99);
+
+    size_t capacity = other.capacity();
+    other.reserve(capacity * 4);
+    REQUIRE(other.capacity() > capacity);
+    for (int i = 0; i < 100; ++i)
+    {
+        REQUIRE(other.count(i) == (i == 7 ? 0 : 1));
+    }
+
+    other.clear();
+    REQUIRE(other.empty());
+    REQUIRE(other.begin() == other.end());
+}
+
+TEST_CASE("flat hash map nextOccupied finds an element", "[flathashmap]")
+{
+    FlatHashMap<int, int, MixingHash> map;
+    for (int i = 0; i < 10; ++i)
+    {
+        map[i] = i;
+    }
+    for (size_t slot = 0; slot < map.capacity(); ++slot)
+    {
+        auto iter = map.nextOccupied(slot);
+        REQUIRE(map.at(iter->first) == iter->second);
+    }
+}
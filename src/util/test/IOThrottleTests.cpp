@@ -0,0 +1,96 @@
+// Copyright 2019 Stellar Development Foundation and contributors. Licensed
+// under the Apache License, Version 2.0. See the COPYING file at the root
+// of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
+
+#include "util/IOThrottle.h"
+
+#include "lib/catch.hpp"
+
+#include "medida/metrics_registry.h"
+
+#include <chrono>
+
+using namespace stellar;
+
+namespace
+{
+size_t const MB = 1024 * 1024;
+
+std::chrono::duration<double>
+timeAcquire(IOThrottle& throttle, size_t bytes)
+{
+    auto start = std::chrono::steady_clock::now();
+    throttle.acquire(bytes);
+    return std::chrono::steady_clock::now() - start;
+}
+}
+
+TEST_CASE("IOThrottle limits the rate", "[iothrottle]")
+{
+    medida::MetricsRegistry metrics;
+
+    SECTION("0 does not limit")
+    {
+        IOThrottle throttle(metrics, 0);
+        REQUIRE(timeAcquire(throttle, 1000 * MB).count() < 0.1);
+    }
+
+    SECTION("waits once the bucket is empty")
+    {
+        // The bucket starts with a second of I/O
+        IOThrottle throttle(metrics, 10 * MB);
+        REQUIRE(timeAcquire(throttle, 10 * MB).count() < 0.1);
+        throttle.acquire(2 * MB);
+        REQUIRE(timeAcquire(throttle, 1).count() >= 0.1);
+    }
+
+    SECTION("does not limit while urgent")
+    {
+        IOThrottle throttle(metrics, 10 * MB);
+        throttle.acquire(100 * MB);
+        IOThrottle::Urgent urgent(throttle);
+        REQUIRE(timeAcquire(throttle, 1).count() < 0.1);
+    }
+}
+
+TEST_CASE("IOThrottle adapts to ledger closes", "[iothrottle]")
+{
+    medida::MetricsRegistry metrics;
+    double const max = 64.0 * MB;
+    IOThrottle throttle(metrics, 64 * MB);
+    auto close = [&](std::chrono::milliseconds commit) {
+        IOThrottle::LedgerClose ledgerClose(throttle);
+        REQUIRE(throttle.getCurrentRate() < max);
+        ledgerClose.setCommitTime(commit);
+    };
+
+    REQUIRE(throttle.getCurrentRate() == max);
+    {
+        IOThrottle::LedgerClose ledgerClose(throttle);
+        REQUIRE(throttle.getCurrentRate() == max / 8);
+    }
+    REQUIRE(throttle.getCurrentRate() == max);
+
+    // Commits as fast as usual keep the rate
+    for (int i = 0; i < 10; ++i)
+    {
+        close(std::chrono::milliseconds(100));
+    }
+    REQUIRE(throttle.getCurrentRate() == max);
+
+    // Slow commits halve it, down to the floor
+    close(std::chrono::milliseconds(500));
+    REQUIRE(throttle.getCurrentRate() == max / 2);
+    for (int i = 0; i < 4; ++i)
+    {
+        close(std::chrono::milliseconds(5000));
+    }
+    REQUIRE(throttle.getCurrentRate() == max / 16);
+
+    // Fast commits bring it back up
+    for (int i = 0; i < 10; ++i)
+    {
+        close(std::chrono::milliseconds(1));
+    }
+    REQUIRE(throttle.getCurrentRate() == max);
+}
@@ -3,14 +3,18 @@
 // of this distribution or at http://www.apache.org/licenses/LICENSE-2.0
 
 #include "bucket/Bucket.h"
+#include "crypto/SHA.h"
 #include "ledger/test/LedgerTestUtils.h"
 #include "lib/catch.hpp"
 #include "lib/util/format.h"
 #include "test/test.h"
+#include "util/Fs.h"
 #include "util/Logging.h"
 #include "util/XDRStream.h"
 
 #include <chrono>
+#include <fstream>
+#include <iterator>
 
 using namespace stellar;
 
@@ -43,6 +47,76 @@ TEST_CASE("XDROutputFileStream fail modes", "[xdrstream]")
     }
 }
 
+TEST_CASE("XDRAsyncOutputFileStream", "[xdrstream]")
+{
+    Config const& cfg = getTestConfig(0);
+    fs::mkpath(cfg.BUCKET_DIR_PATH);
+    auto syncName = cfg.BUCKET_DIR_PATH + "/sync.xdr";
+    auto asyncName = cfg.BUCKET_DIR_PATH + "/async.xdr";
+
+    auto ledgerEntries = LedgerTestUtils::generateValidLedgerEntries(1000);
+    auto bucketEntries =
+        Bucket::convertToBucketEntry(false, {}, ledgerEntries, {});
+
+    auto syncHasher = SHA256::create();
+    size_t syncBytes = 0;
+    XDROutputFileStream syncOut(/*doFsync=*/false);
+    syncOut.open(syncName);
+    for (auto const& e : bucketEntries)
+    {
+        syncOut.writeOne(e, syncHasher.get(), &syncBytes);
+    }
+    syncOut.close();
+    auto syncHash = syncHasher->finish();
+
+    auto readFile = [](std::string const& name) {
+        std::ifstream in(name, std::ifstream::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(in),
+                                 std::istreambuf_iterator<char>());
+    };
+    auto syncData = readFile(syncName);
+    REQUIRE(syncData.size() == syncBytes);
+
+    // Buffers from smaller than an entry to larger than the file; every
+    // other entry is written as framed bytes, like the segments of a merge
+    for (size_t bufferSize : {16, 1000, 64 * 1024, 16 * 1024 * 1024})
+    {
+        auto asyncHasher = SHA256::create();
+        size_t asyncBytes = 0;
+        XDRAsyncOutputFileStream asyncOut(/*doFsync=*/true, bufferSize);
+        asyncOut.open(asyncName, asyncHasher.get());
+        for (size_t i = 0; i < bucketEntries.size(); ++i)
+        {
+            if (i % 2 == 0)
+            {
+                asyncOut.writeOne(bucketEntries[i], &asyncBytes);
+            }
+            else
+            {
+                auto bytes = xdr::xdr_to_opaque(bucketEntries[i]);
+                uint32_t sz = static_cast<uint32_t>(bytes.size()) | 0x80000000;
+                char size[4] = {static_cast<char>(sz >> 24),
+                                static_cast<char>(sz >> 16),
+                                static_cast<char>(sz >> 8),
+                                static_cast<char>(sz)};
+                asyncOut.writeBytes(size, 4);
+                asyncOut.writeBytes(
+                    reinterpret_cast<char const*>(bytes.data()),
+                    bytes.size());
+                asyncBytes += bytes.size() + 4;
+            }
+        }
+        asyncOut.close();
+        REQUIRE(!asyncOut.isOpen());
+
+        REQUIRE(asyncBytes == syncBytes);
+        REQUIRE(asyncHasher->finish() == syncHash);
+        REQUIRE(readFile(asyncName) == syncData);
+        std::remove(asyncName.c_str());
+    }
+    std::remove(syncName.c_str());
+}
+
 TEST_CASE("XDROutputFileStream fsync bench", "[!hide][xdrstream][bench]")
 {
     Config const& cfg = getTestConfig(0);
@@ -91,3 +165,213 @@ TEST_CASE("XDROutputFileStream fsync bench", "[!hide][xdrstream][bench]")
                          << elapsed.count() << "ms";
     }
 }
+
+TEST_CASE("XDRInputMappedStream", "[xdrstream]")
+{
+    Config const& cfg = getTestConfig(0);
+    fs::mkpath(cfg.BUCKET_DIR_PATH);
+    auto filename = cfg.BUCKET_DIR_PATH + "/mapped.xdr";
+
+    auto ledgerEntries = LedgerTestUtils::generateValidLedgerEntries(100);
+    auto bucketEntries =
+        Bucket::convertToBucketEntry(false, {}, ledgerEntries, {});
+    std::vector<size_t> offsets;
+    {
+        XDROutputFileStream out(/*doFsync=*/false);
+        out.open(filename);
+        size_t bytes = 0;
+        for (auto const& e : bucketEntries)
+        {
+            offsets.emplace_back(bytes);
+            out.writeOne(e, nullptr, &bytes);
+        }
+        out.close();
+    }
+
+    SECTION("reads what XDRInputFileStream reads")
+    {
+        XDRInputFileStream fileIn;
+        XDRInputMappedStream mappedIn;
+        fileIn.open(filename);
+        mappedIn.open(filename);
+        REQUIRE(mappedIn.size() == fileIn.size());
+
+        BucketEntry fromFile;
+        BucketEntry fromMapping;
+        while (fileIn.readOne(fromFile))
+        {
+            REQUIRE(mappedIn);
+            REQUIRE(mappedIn.readOne(fromMapping));
+            REQUIRE(fromMapping == fromFile);
+            REQUIRE(mappedIn.pos() == fileIn.pos());
+        }
+        REQUIRE(!mappedIn);
+        REQUIRE(!mappedIn.readOne(fromMapping));
+    }
+
+    SECTION("skips and seeks")
+    {
+        XDRInputMappedStream in;
+        in.open(filename);
+        BucketEntry e;
+        REQUIRE(in.skipOne());
+        REQUIRE(in.pos() == offsets[1]);
+        REQUIRE(in.readOne(e));
+        REQUIRE(e == bucketEntries[1]);
+
+        in.seek(offsets[50]);
+        REQUIRE(in.readOne(e));
+        REQUIRE(e == bucketEntries[50]);
+        in.seek(offsets[0]);
+        REQUIRE(in.readOne(e));
+        REQUIRE(e == bucketEntries[0]);
+    }
+
+    SECTION("reads empty files")
+    {
+        std::ofstream(filename, std::ofstream::trunc);
+        XDRInputMappedStream in;
+        in.open(filename);
+        BucketEntry e;
+        REQUIRE(in.size() == 0);
+        REQUIRE(!in);
+        REQUIRE(!in.readOne(e));
+    }
+
+    SECTION("throws on truncated files")
+    {
+        std::vector<char> buf(offsets[1] + 6);
+        std::ifstream(filename, std::ifstream::binary)
+            .read(buf.data(), buf.size());
+        std::ofstream(filename, std::ofstream::binary | std::ofstream::trunc)
+            .write(buf.data(), buf.size());
+        XDRInputMappedStream in;
+        in.open(filename);
+        BucketEntry e;
+        REQUIRE(in.readOne(e));
+        REQUIRE_THROWS_AS(in.readOne(e), xdr::xdr_runtime_error);
+    }
+
+    std::remove(filename.c_str());
+}
+
+TEST_CASE("block-compressed XDR files", "[xdrstream]")
+{
+    if (!blockcompression::isAvailable())
+    {
+        return;
+    }
+    Config const& cfg = getTestConfig(0);
+    fs::mkpath(cfg.BUCKET_DIR_PATH);
+    auto plainName = cfg.BUCKET_DIR_PATH + "/plain.xdr";
+    auto compressedName = cfg.BUCKET_DIR_PATH + "/compressed.xdr";
+    auto decompressedName = cfg.BUCKET_DIR_PATH + "/decompressed.xdr";
+
+    auto ledgerEntries = LedgerTestUtils::generateValidLedgerEntries(1000);
+    auto bucketEntries =
+        Bucket::convertToBucketEntry(false, {}, ledgerEntries, {});
+
+    auto writeEntries = [&](std::string const& name, int level) {
+        auto hasher = SHA256::create();
+        XDRAsyncOutputFileStream out(/*doFsync=*/false);
+        out.open(name, hasher.get(), level);
+        for (auto const& e : bucketEntries)
+        {
+            out.writeOne(e);
+        }
+        out.close();
+        return hasher->finish();
+    };
+    auto plainHash = writeEntries(plainName, 0);
+    auto compressedHash = writeEntries(compressedName, 3);
+
+    // The hash is that of the uncompressed stream
+    REQUIRE(compressedHash == plainHash);
+    REQUIRE(!blockcompression::isCompressed(plainName));
+    REQUIRE(blockcompression::isCompressed(compressedName));
+    REQUIRE(blockcompression::getStreamSize(compressedName) ==
+            fs::size(plainName));
+
+    XDRInputMappedStream plainIn;
+    XDRInputMappedStream compressedIn;
+    plainIn.open(plainName);
+    compressedIn.open(compressedName);
+    REQUIRE(compressedIn.size() == plainIn.size());
+
+    std::vector<size_t> offsets;
+    BucketEntry fromPlain;
+    BucketEntry fromCompressed;
+    for (size_t offset = plainIn.pos(); plainIn.readOne(fromPlain);
+         offset = plainIn.pos())
+    {
+        offsets.emplace_back(offset);
+        REQUIRE(compressedIn.readOne(fromCompressed));
+        REQUIRE(fromCompressed == fromPlain);
+        REQUIRE(compressedIn.pos() == plainIn.pos());
+    }
+    REQUIRE(!compressedIn.readOne(fromCompressed));
+
+    for (size_t i : {size_t(500), size_t(3), size_t(999)})
+    {
+        compressedIn.seek(offsets[i]);
+        REQUIRE(compressedIn.readOne(fromCompressed));
+        REQUIRE(fromCompressed == bucketEntries[i]);
+    }
+
+    blockcompression::decompressFile(compressedName, decompressedName);
+    auto readFile = [](std::string const& name) {
+        std::ifstream in(name, std::ifstream::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(in),
+                                 std::istreambuf_iterator<char>());
+    };
+    REQUIRE(readFile(decompressedName) == readFile(plainName));
+
+    std::remove(plainName.c_str());
+    std::remove(compressedName.c_str());
+    std::remove(decompressedName.c_str());
+}
+
+TEST_CASE("XDRInputMappedStream bench", "[!hide][xdrstream][bucketbench]")
+{
+    Config const& cfg = getTestConfig(0);
+    fs::mkpath(cfg.BUCKET_DIR_PATH);
+    auto filename = cfg.BUCKET_DIR_PATH + "/bench.xdr";
+
+    auto ledgerEntries = LedgerTestUtils::generateValidLedgerEntries(1000000);
+    auto bucketEntries =
+        Bucket::convertToBucketEntry(false, {}, ledgerEntries, {});
+    {
+        XDROutputFileStream out(/*doFsync=*/false);
+        out.open(filename);
+        for (auto const& e : bucketEntries)
+        {
+            out.writeOne(e);
+        }
+        out.close();
+    }
+
+    auto timeReads = [&](auto& in, std::string const& name) {
+        auto start = std::chrono::system_clock::now();
+        in.open(filename);
+        BucketEntry e;
+        size_t n = 0;
+        while (in.readOne(e))
+        {
+            ++n;
+        }
+        in.close();
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now() - start);
+        REQUIRE(n == bucketEntries.size());
+        CLOG(INFO, "Fs") << "read " << n << " entries with " << name << " in "
+                         << elapsed.count() << "ms";
+    };
+    for (int i = 0; i < 5; ++i)
+    {
+        XDRInputFileStream fileIn;
+        XDRInputMappedStream mappedIn;
+        timeReads(fileIn, "XDRInputFileStream");
+        timeReads(mappedIn, "XDRInputMappedStream");
+    }
+    std::remove(filename.c_str());
+}